@@ -559,6 +559,11 @@ const bool Z_MAX_ENDSTOP_INVERTING = true; // set to true to invert the logic of
 #define DEFAULT_ZJERK                 0.4     // (mm/sec)
 #define DEFAULT_EJERK                 5.0    // (mm/sec)
 
+// Cornering by junction deviation (grbl): the distance in mm the path may be
+// thought to deviate from the corner, the entry speed follows from the
+// acceleration. 0 keeps the jerk limits above, M205 J changes it at runtime.
+#define DEFAULT_JUNCTION_DEVIATION    0.0    // (mm)
+
 //===========================================================================
 //=============================Additional Features===========================
 //===========================================================================
@@ -641,6 +646,19 @@ const bool Z_MAX_ENDSTOP_INVERTING = true; // set to true to invert the logic of
 // REMEMBER TO INSTALL LiquidCrystal_I2C.h in your ARUDINO library folder: https://github.com/kiyoshigawa/LiquidCrystal_I2C
 //#define RA_CONTROL_PANEL
 
+// The host simulation build (make sim) has no panel, G-code is replayed
+// through the serial port and, with SIM_SDSUPPORT, read from a simulated card.
+// make bench also builds it without bed leveling to compare planner cost.
+#ifdef SIMULATION
+  #undef REPRAP_DISCOUNT_SMART_CONTROLLER
+  #ifdef SIM_SDSUPPORT
+    #define SDSUPPORT
+  #endif
+  #ifdef SIM_NO_AUTO_BED_LEVELING
+    #undef ENABLE_AUTO_BED_LEVELING
+  #endif
+#endif
+
 //automatic expansion
 #if defined (MAKRPANEL)
  #define DOGLCD
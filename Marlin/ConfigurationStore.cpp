@@ -43,9 +43,9 @@ void _EEPROM_readData(int &pos, uint8_t* value, uint8_t size)
 // wrong data being written to the variables.
 // ALSO:  always make sure the variables in the Store and retrieve sections are in the same order.
 #ifdef DELTA
-#define EEPROM_VERSION "V11"
+#define EEPROM_VERSION "V17"
 #else
-#define EEPROM_VERSION "V10"
+#define EEPROM_VERSION "V16"
 #endif
 
 #ifdef EEPROM_SETTINGS
@@ -66,6 +66,7 @@ void Config_StoreSettings()
   EEPROM_WRITE_VAR(i,max_xy_jerk);
   EEPROM_WRITE_VAR(i,max_z_jerk);
   EEPROM_WRITE_VAR(i,max_e_jerk);
+  EEPROM_WRITE_VAR(i,junction_deviation);
   EEPROM_WRITE_VAR(i,add_homeing);
   #ifdef DELTA
   EEPROM_WRITE_VAR(i,endstop_adj);
@@ -84,16 +85,26 @@ void Config_StoreSettings()
   EEPROM_WRITE_VAR(i,absPreheatHPBTemp);
   EEPROM_WRITE_VAR(i,absPreheatFanSpeed);
   EEPROM_WRITE_VAR(i,zprobe_zoffset);
+  // one P, I and D for each extruder
   #ifdef PIDTEMP
     EEPROM_WRITE_VAR(i,Kp);
     EEPROM_WRITE_VAR(i,Ki);
     EEPROM_WRITE_VAR(i,Kd);
   #else
     dummy = 3000.0f;
-    EEPROM_WRITE_VAR(i,dummy);
+    for(int e = 0; e < EXTRUDERS; e++)
+      EEPROM_WRITE_VAR(i,dummy);
     dummy = 0.0f;
-    EEPROM_WRITE_VAR(i,dummy);
-    EEPROM_WRITE_VAR(i,dummy);
+    for(int e = 0; e < 2 * EXTRUDERS; e++)
+      EEPROM_WRITE_VAR(i,dummy);
+  #endif
+  // the heater model of each extruder, rise, tau and dead time
+  #ifdef HEATER_MODEL
+    EEPROM_WRITE_VAR(i,hotend_model);
+  #else
+    dummy = 0.0f;
+    for(int e = 0; e < 3 * EXTRUDERS; e++)
+      EEPROM_WRITE_VAR(i,dummy);
   #endif
   #ifndef DOGLCD
     int lcd_contrast = 32;
@@ -167,7 +178,7 @@ void Config_PrintSettings()
     SERIAL_ECHOLN("");
 
     SERIAL_ECHO_START;
-    SERIAL_ECHOLNPGM("Advanced variables: S=Min feedrate (mm/s), T=Min travel feedrate (mm/s), B=minimum segment time (ms), X=maximum XY jerk (mm/s),  Z=maximum Z jerk (mm/s),  E=maximum E jerk (mm/s)");
+    SERIAL_ECHOLNPGM("Advanced variables: S=Min feedrate (mm/s), T=Min travel feedrate (mm/s), B=minimum segment time (ms), X=maximum XY jerk (mm/s),  Z=maximum Z jerk (mm/s),  E=maximum E jerk (mm/s), J=junction deviation (mm)");
     SERIAL_ECHO_START;
     SERIAL_ECHOPAIR("  M205 S",minimumfeedrate ); 
     SERIAL_ECHOPAIR(" T" ,mintravelfeedrate ); 
@@ -175,6 +186,7 @@ void Config_PrintSettings()
     SERIAL_ECHOPAIR(" X" ,max_xy_jerk ); 
     SERIAL_ECHOPAIR(" Z" ,max_z_jerk);
     SERIAL_ECHOPAIR(" E" ,max_e_jerk);
+    SERIAL_ECHOPAIR(" J" ,junction_deviation);
     SERIAL_ECHOLN(""); 
 
     SERIAL_ECHO_START;
@@ -218,11 +230,23 @@ void Config_PrintSettings()
 #ifdef PIDTEMP
     SERIAL_ECHO_START;
     SERIAL_ECHOLNPGM("PID settings:");
-    SERIAL_ECHO_START;
-    SERIAL_ECHOPAIR("   M301 P",Kp); 
-    SERIAL_ECHOPAIR(" I" ,unscalePID_i(Ki)); 
-    SERIAL_ECHOPAIR(" D" ,unscalePID_d(Kd));
-    SERIAL_ECHOLN(""); 
+    for(int e = 0; e < EXTRUDERS; e++)
+    {
+      SERIAL_ECHO_START;
+      SERIAL_ECHOPGM("   M301");
+      #if EXTRUDERS > 1
+      SERIAL_ECHOPAIR(" E" ,(unsigned long)e);
+      #endif
+      SERIAL_ECHOPAIR(" P",Kp[e]); 
+      SERIAL_ECHOPAIR(" I" ,unscalePID_i(Ki[e])); 
+      SERIAL_ECHOPAIR(" D" ,unscalePID_d(Kd[e]));
+      #ifdef HEATER_MODEL
+      SERIAL_ECHOPAIR(" K" ,hotend_model[e].rise);
+      SERIAL_ECHOPAIR(" T" ,hotend_model[e].tau);
+      SERIAL_ECHOPAIR(" L" ,hotend_model[e].dead_time);
+      #endif
+      SERIAL_ECHOLN(""); 
+    }
 #endif
 } 
 #endif
@@ -254,6 +278,7 @@ void Config_RetrieveSettings()
         EEPROM_READ_VAR(i,max_xy_jerk);
         EEPROM_READ_VAR(i,max_z_jerk);
         EEPROM_READ_VAR(i,max_e_jerk);
+        EEPROM_READ_VAR(i,junction_deviation);
         EEPROM_READ_VAR(i,add_homeing);
         #ifdef DELTA
 		EEPROM_READ_VAR(i,endstop_adj);
@@ -273,12 +298,16 @@ void Config_RetrieveSettings()
         EEPROM_READ_VAR(i,absPreheatFanSpeed);
         EEPROM_READ_VAR(i,zprobe_zoffset);
         #ifndef PIDTEMP
-        float Kp,Ki,Kd;
+        float Kp[EXTRUDERS],Ki[EXTRUDERS],Kd[EXTRUDERS];
         #endif
         // do not need to scale PID values as the values in EEPROM are already scaled		
         EEPROM_READ_VAR(i,Kp);
         EEPROM_READ_VAR(i,Ki);
         EEPROM_READ_VAR(i,Kd);
+        #ifndef HEATER_MODEL
+        heater_model hotend_model[EXTRUDERS];
+        #endif
+        EEPROM_READ_VAR(i,hotend_model);
         #ifndef DOGLCD
         int lcd_contrast;
         #endif
@@ -347,6 +376,7 @@ void Config_ResetDefault()
     max_xy_jerk=DEFAULT_XYJERK;
     max_z_jerk=DEFAULT_ZJERK;
     max_e_jerk=DEFAULT_EJERK;
+    junction_deviation=DEFAULT_JUNCTION_DEVIATION;
     add_homeing[0] = add_homeing[1] = add_homeing[2] = 0;
 #ifdef DELTA
 	endstop_adj[0] = endstop_adj[1] = endstop_adj[2] = 0;
@@ -370,16 +400,21 @@ void Config_ResetDefault()
     lcd_contrast = DEFAULT_LCD_CONTRAST;
 #endif
 #ifdef PIDTEMP
-    Kp = DEFAULT_Kp;
-    Ki = scalePID_i(DEFAULT_Ki);
-    Kd = scalePID_d(DEFAULT_Kd);
+    for(int e = 0; e < EXTRUDERS; e++)
+    {
+      Kp[e] = DEFAULT_Kp;
+      Ki[e] = scalePID_i(DEFAULT_Ki);
+      Kd[e] = scalePID_d(DEFAULT_Kd);
+#ifdef PID_ADD_EXTRUSION_RATE
+      Kc[e] = DEFAULT_Kc;
+#endif//PID_ADD_EXTRUSION_RATE
+#ifdef HEATER_MODEL
+      hotend_model[e].rise = hotend_model[e].tau = hotend_model[e].dead_time = 0;
+#endif//HEATER_MODEL
+    }
     
     // call updatePID (similar to when we have processed M301)
     updatePID();
-    
-#ifdef PID_ADD_EXTRUSION_RATE
-    Kc = DEFAULT_Kc;
-#endif//PID_ADD_EXTRUSION_RATE
 #endif//PIDTEMP
 
 #if EXTRUDERS > 1
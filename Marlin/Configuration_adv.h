@@ -28,6 +28,16 @@
 //#define WATCH_TEMP_PERIOD 40000 //40 seconds
 //#define WATCH_TEMP_INCREASE 10  //Heat up at least 10 degree in 20 seconds
 
+//// Thermal runaway protection:
+// A heater that has reached its target has to stay within HYSTERESIS degrees below it, one that is still
+// heating has to get HYSTERESIS degrees warmer every PERIOD seconds. A heater that does neither for PERIOD
+// seconds, a thermistor that came off the block or a dead heater, switches all heaters off and halts the printer.
+// Comment out THERMAL_RUNAWAY_PROTECTION_BED_PERIOD to leave the bed unchecked.
+#define THERMAL_RUNAWAY_PROTECTION_PERIOD 40         // seconds
+#define THERMAL_RUNAWAY_PROTECTION_HYSTERESIS 4      // degrees
+#define THERMAL_RUNAWAY_PROTECTION_BED_PERIOD 90     // seconds
+#define THERMAL_RUNAWAY_PROTECTION_BED_HYSTERESIS 3  // degrees
+
 #ifdef PIDTEMP
   // this adds an experimental additional term to the heatingpower, proportional to the extrusion speed.
   // if Kc is choosen well, the additional required power due to increased melting should be compensated.
@@ -37,6 +47,18 @@
   #endif
 #endif
 
+// Feed-forward from a first-order thermal model of each PID heater: its rise above ambient at full
+// power, time constant and dead time, identified by M303 F1 and set by M301/M304 K<rise> T<s> L<s>.
+// The heater then gets the power that holds the target plus a PID trim, and the PID acts on the
+// temperature expected once the dead time has passed, so a warm-up leaves full power in time instead
+// of overshooting. Heaters without a model (K0, the default) run the plain PID.
+#define HEATER_MODEL
+#define HEATER_MODEL_AMBIENT 25 // degrees a cold heater is at
+
+#ifndef PIDTEMP
+  #undef HEATER_MODEL
+#endif
+
 
 //automatic temperature: The hot end target temperature is calculated by all the buffered lines of gcode.
 //The maximum buffered steps/sec of the extruder motor are called "se".
@@ -316,6 +338,37 @@
 // using:
 //#define MENU_ADDAUTOSTART
 
+// SD printing reads the file a block at a time into a buffer of its own (512 bytes of RAM) and
+// keeps the card streaming the blocks that follow (multiple block read) instead of fetching
+// every byte through the file system and every block with a new read command.
+#define SD_READAHEAD
+
+// The LCD SD menu lists a folder from an index of where its entries sit, built once when the
+// folder is entered, instead of reading the folder from the start for every line it draws.
+// Indexes up to this many entries (2 bytes of RAM each), entries past them are counted on from the last.
+#define SD_DIR_INDEX_SIZE 64
+
+// Files saved with M28 are gathered a block at a time (in the SD_READAHEAD buffer, or 512 bytes of
+// RAM without it) and streamed to the card in one pre-erased multiple block write per run of
+// SD_UPLOAD_CLUSTERS clusters allocated together, instead of one write command per block.
+#define SD_FAST_UPLOAD
+#define SD_UPLOAD_CLUSTERS 8
+
+// Power-loss recovery of SD prints: at every POWER_LOSS_LAYERS'th layer change the file, the position
+// in it and what the commands up to there left the printer at (position, feedrate, temperatures, fan)
+// are checkpointed to EEPROM, each time into the next of POWER_LOSS_SLOTS slots to spread the wear.
+// loop() writes the bytes one at a time whenever the EEPROM is ready, nothing waits for them.
+// M1000 reports the checkpoint of an interrupted print, M1000 S1 resumes it: heat up, lift Z by
+// POWER_LOSS_Z_LIFT mm, home X and Y, go back and print on from the checkpoint.
+#define POWER_LOSS_RECOVERY
+#define POWER_LOSS_LAYERS 1
+#define POWER_LOSS_SLOTS 16
+#define POWER_LOSS_Z_LIFT 2
+
+#ifndef SDSUPPORT
+  #undef POWER_LOSS_RECOVERY
+#endif
+
 // The hardware watchdog should reset the Microcontroller disabling all outputs, in case the firmware gets stuck and doesn't do temperature regulation.
 //#define USE_WATCHDOG
 
@@ -368,6 +421,22 @@
 
 #endif // ADVANCE
 
+// S-curve acceleration: the step rate follows a quintic (smoothstep) curve from the entry rate
+// to the cruise rate and back down, so the acceleration starts and ends at zero instead of
+// jumping to the set value. Ramps take as long and travel as far as the linear ones, the peak
+// acceleration in the middle of a ramp is 15/8 of the set value.
+//#define S_CURVE_ACCELERATION
+
+// Adaptive step smoothing: below the double stepping rate the stepper interrupt runs the
+// bresenham tracer at up to 2^ADAPTIVE_STEP_SMOOTHING times the step rate of a block, so the
+// minor axes step at evenly spaced times instead of on the major axis steps only. The interrupt
+// never runs faster than the 10kHz it already reaches before stepping twice per interrupt.
+#define ADAPTIVE_STEP_SMOOTHING 3
+
+#if defined(ADAPTIVE_STEP_SMOOTHING) && defined(ADVANCE)
+  #error ADAPTIVE_STEP_SMOOTHING not implemented for ADVANCE yet.
+#endif
+
 // Arc interpretation settings:
 #define MM_PER_ARC_SEGMENT 1
 #define N_ARC_CORRECTION 25
@@ -409,16 +478,46 @@ const unsigned int dropsegments=5; //everything with less than this number of st
 
 // The number of linear motions that can be in the plan at any give time.  
 // THE BLOCK_BUFFER_SIZE NEEDS TO BE A POWER OF 2, i.g. 8,16,32 because shifts and ors are used to do the ringbuffering.
+// Each block takes 59 bytes of SRAM (block_t + block_plan_t, without ADVANCE, BARICUDA or
+// S_CURVE_ACCELERATION), the startup message prints the total as PlannerBufferBytes. 16 blocks
+// take 944 bytes, 32 take 1888; 16 blocks of the old 77 byte layout took 1232. SD builds stay
+// at 16: SD_READAHEAD, SD_DIR_INDEX and POWER_LOSS_RECOVERY take more than the smaller blocks
+// give back, and 32 has not been measured against the free SRAM of an ATmega2560 with an LCD.
+// Use 16 on a MCU with 4k of SRAM.
+#ifndef BLOCK_BUFFER_SIZE // can be given on the command line, see make bench
 #if defined SDSUPPORT
   #define BLOCK_BUFFER_SIZE 16   // SD,LCD,Buttons take more memory, block buffer needs to be smaller
 #else
-  #define BLOCK_BUFFER_SIZE 16 // maximize block buffer
+  #define BLOCK_BUFFER_SIZE 32 // maximize block buffer
+#endif
 #endif
 
 
 //The ASCII buffer for recieving from the serial:
 #define MAX_CMD_SIZE 96
-#define BUFSIZE 4
+// Bytes of the command queue. Commands are packed: a line of n characters takes n + 2 bytes,
+// 4 more with ADVANCED_OK and 4 more for a line of the SD print with POWER_LOSS_RECOVERY. So
+// this holds 14 G1 lines of 25 characters, 12 with one of the options and 11 with both, in
+// the RAM that used to take 4 x MAX_CMD_SIZE.
+#define CMDBUFFER_SIZE 384
+
+// "ok N<line> P<free planner blocks> B<free command queue bytes>" instead of a bare "ok", so
+// a host can keep several lines in flight. N is the line of the command acknowledged, B is
+// in bytes because the queue is packed: a line of n characters from the host takes n + 6 of them.
+//#define ADVANCED_OK
+
+// M155 S<seconds> makes the firmware send temperatures, and on request the position, SD progress
+// or the M613 status line, by itself, so the host does not need to poll M105/M613.
+#define AUTO_REPORT
+
+// Transmit ring of the serial port. It is drained by the data register empty interrupt, so
+// printing only waits on the line when the ring is full. Power of 2 up to 256; 0 writes every
+// byte straight to the data register and waits for it, as older versions did.
+#define TX_BUFFER_SIZE 32
+
+// Binary G-code frames with a CRC16 instead of text lines, once the host sent M620 S1.
+// A move takes about half the bytes of a numbered and checksummed line. See get_command().
+#define BINARY_TRANSPORT
 
 
 // Firmware based and LCD controled retract
@@ -77,6 +77,20 @@ void Hysteresis::calcSteps()
 }
 
 
+//===========================================================================
+void hysteresis_report_mcode()
+{
+  hysteresis.ReportToSerial();
+}
+
+void hysteresis_set_mcode()
+{
+  if(code_seen('X')) hysteresis.SetAxis( X_AXIS, code_value() );
+  if(code_seen('Y')) hysteresis.SetAxis( Y_AXIS, code_value() );
+  if(code_seen('Z')) hysteresis.SetAxis( Z_AXIS, code_value() );
+  if(code_seen('E')) hysteresis.SetAxis( E_AXIS, code_value() );
+}
+
 //===========================================================================
 void Hysteresis::ReportToSerial()
 {
@@ -19,20 +19,10 @@
 
 #include "Configuration.h"
 
+// command_table entries for the report (no arguments) and set (X Y Z E) codes
 #define DECLARE_HYSTERESIS_MCODES(REPORT_CODE, SET_CODE)                \
-   case REPORT_CODE:                                                    \
-    {                                                                   \
-      hysteresis.ReportToSerial();                                      \
-    }                                                                   \
-    break;                                                              \
-   case SET_CODE:                                                       \
-    {                                                                   \
-      if(code_seen('X')) hysteresis.SetAxis( X_AXIS, code_value() );    \
-      if(code_seen('Y')) hysteresis.SetAxis( Y_AXIS, code_value() );    \
-      if(code_seen('Z')) hysteresis.SetAxis( Z_AXIS, code_value() );    \
-      if(code_seen('E')) hysteresis.SetAxis( E_AXIS, code_value() );    \
-    }                                                                   \
-    break;
+  { COMMAND_KEY('M', REPORT_CODE), hysteresis_report_mcode },          \
+  { COMMAND_KEY('M', SET_CODE), hysteresis_set_mcode },
 
 //===========================================================================
 
@@ -57,4 +47,7 @@ private:
 //===========================================================================
 
 extern Hysteresis hysteresis;
+
+void hysteresis_report_mcode();
+void hysteresis_set_mcode();
 extern long position[4]; // defined in planner.cpp
\ No newline at end of file
@@ -102,6 +102,21 @@ FORCE_INLINE void serialprintPGM(const char *str)
 void get_command();
 void process_commands();
 
+// process_commands() finds the handler of a G or M code by binary search in
+// a table sorted by COMMAND_KEY; feature modules add entries through macros
+// such as DECLARE_HYSTERESIS_MCODES.
+typedef void (*command_handler_t)();
+struct command_entry {
+  unsigned int key;
+  command_handler_t handler;
+};
+#define COMMAND_NUMBER_MAX 2047
+#define COMMAND_KEY(letter, number) ((unsigned int)((letter) - 'A') << 11 | (number))
+
+bool code_seen(char code);
+float code_value();
+long code_value_long();
+
 void manage_inactivity();
 
 #if defined(DUAL_X_CARRIAGE) && defined(X_ENABLE_PIN) && X_ENABLE_PIN > -1 \
@@ -58,6 +58,30 @@ FORCE_INLINE void store_char(unsigned char c)
   }
 #endif
 
+#if TX_BUFFER_SIZE > 0
+  tx_ring_buffer tx_buffer = { { 0 }, 0, 0 };
+
+  // Moves the oldest queued byte to the data register and switches the
+  // interrupt off once the ring has run empty.
+  FORCE_INLINE void tx_udr_empty()
+  {
+    unsigned char t = tx_buffer.tail;
+    if (tx_buffer.head != t) {
+      M_UDRx = tx_buffer.buffer[t];
+      tx_buffer.tail = t = (t + 1) & (TX_BUFFER_SIZE - 1);
+    }
+    if (tx_buffer.head == t)
+      cbi(M_UCSRxB, M_UDRIEx);
+  }
+
+  #if defined(M_USARTx_UDRE_vect)
+  SIGNAL(M_USARTx_UDRE_vect)
+  {
+    tx_udr_empty();
+  }
+  #endif
+#endif
+
 // Constructors ////////////////////////////////////////////////////////////////
 
 MarlinSerial::MarlinSerial()
@@ -103,6 +127,41 @@ void MarlinSerial::end()
   cbi(M_UCSRxB, M_RXENx);
   cbi(M_UCSRxB, M_TXENx);
   cbi(M_UCSRxB, M_RXCIEx);  
+  cbi(M_UCSRxB, M_UDRIEx);
+}
+
+#if TX_BUFFER_SIZE > 0
+void MarlinSerial::write(uint8_t c)
+{
+  // nothing queued and the data register free: no need for the ring
+  if (tx_buffer.head == tx_buffer.tail && (M_UCSRxA & (1 << M_UDREx))) {
+    M_UDRx = c;
+    return;
+  }
+
+  unsigned char i = (tx_buffer.head + 1) & (TX_BUFFER_SIZE - 1);
+  while (i == tx_buffer.tail) {
+    // The ring is full. With interrupts off (called from an ISR or after
+    // cli()) nothing else is going to drain it, so do it here.
+    if ((M_UCSRxA & (1 << M_UDREx)) && !(SREG & (1 << SREG_I)))
+      tx_udr_empty();
+  }
+  tx_buffer.buffer[tx_buffer.head] = c;
+  tx_buffer.head = i;
+  sbi(M_UCSRxB, M_UDRIEx);
+}
+#endif
+
+// Waits until everything written has been handed to the UART, for callers
+// that are about to stop the interrupts for good.
+void MarlinSerial::flushTX(void)
+{
+#if TX_BUFFER_SIZE > 0
+  while (tx_buffer.head != tx_buffer.tail) {
+    if ((M_UCSRxA & (1 << M_UDREx)) && !(SREG & (1 << SREG_I)))
+      tx_udr_empty();
+  }
+#endif
 }
 
 
@@ -49,11 +49,13 @@
 #define M_TXENx SERIAL_REGNAME(TXEN,SERIAL_PORT,)    
 #define M_RXCIEx SERIAL_REGNAME(RXCIE,SERIAL_PORT,)    
 #define M_UDREx SERIAL_REGNAME(UDRE,SERIAL_PORT,)    
+#define M_UDRIEx SERIAL_REGNAME(UDRIE,SERIAL_PORT,)    
 #define M_UDRx SERIAL_REGNAME(UDR,SERIAL_PORT,)  
 #define M_UBRRxH SERIAL_REGNAME(UBRR,SERIAL_PORT,H)
 #define M_UBRRxL SERIAL_REGNAME(UBRR,SERIAL_PORT,L)
 #define M_RXCx SERIAL_REGNAME(RXC,SERIAL_PORT,)
 #define M_USARTx_RX_vect SERIAL_REGNAME(USART,SERIAL_PORT,_RX_vect)
+#define M_USARTx_UDRE_vect SERIAL_REGNAME(USART,SERIAL_PORT,_UDRE_vect)
 #define M_U2Xx SERIAL_REGNAME(U2X,SERIAL_PORT,)
 
 
@@ -84,6 +86,25 @@ struct ring_buffer
   extern ring_buffer rx_buffer;
 #endif
 
+#if TX_BUFFER_SIZE > 0
+#if (TX_BUFFER_SIZE & (TX_BUFFER_SIZE - 1)) != 0 || TX_BUFFER_SIZE > 256
+  #error TX_BUFFER_SIZE has to be a power of 2 and at most 256.
+#endif
+
+// Outgoing bytes wait here for the data register empty interrupt. head is
+// only moved by write(), tail only by the interrupt.
+struct tx_ring_buffer
+{
+  unsigned char buffer[TX_BUFFER_SIZE];
+  volatile unsigned char head;
+  volatile unsigned char tail;
+};
+
+#if UART_PRESENT(SERIAL_PORT)
+  extern tx_ring_buffer tx_buffer;
+#endif
+#endif
+
 class MarlinSerial //: public Stream
 {
 
@@ -94,12 +115,16 @@ class MarlinSerial //: public Stream
     int peek(void);
     int read(void);
     void flush(void);
+    void flushTX(void);
     
     FORCE_INLINE int available(void)
     {
       return (unsigned int)(RX_BUFFER_SIZE + rx_buffer.head - rx_buffer.tail) % RX_BUFFER_SIZE;
     }
     
+    #if TX_BUFFER_SIZE > 0
+    void write(uint8_t c);
+    #else
     FORCE_INLINE void write(uint8_t c)
     {
       while (!((M_UCSRxA) & (1 << M_UDREx)))
@@ -107,6 +132,7 @@ class MarlinSerial //: public Stream
 
       M_UDRx = c;
     }
+    #endif
     
     
     FORCE_INLINE void checkRx(void)
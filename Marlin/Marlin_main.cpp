@@ -50,6 +50,7 @@
 #include "Hysteresis.h"
 #include "math.h"
 #include "lifetime_stats.h"
+#include "power_loss.h"
 
 #ifdef BLINKM
 #include "BlinkM.h"
@@ -134,6 +135,7 @@
 // M129 - EtoP Closed (BariCUDA EtoP = electricity to air pressure transducer by jmil)
 // M140 - Set bed target temp
 // M150 - Set BlinkM Color Output R: Red<0-255> U(!): Green<0-255> B: Blue<0-255> over i2c, G for green does not work.
+// M155 - S<seconds> report without polling: T1 temperatures (M105), P1 position (M114), D1 SD progress (M27), I1 M613 status. S0 stops.
 // M190 - Sxxx Wait for bed current temp to reach target temp. Waits only when heating
 //        Rxxx Wait for bed current temp to reach target temp. Waits when heating and cooling
 // M200 D<millimeters>- set filament diameter and set E axis units to cubic millimeters (use S0 to set back to millimeters).
@@ -141,7 +143,7 @@
 // M202 - Set max acceleration in units/s^2 for travel moves (M202 X1000 Y1000) Unused in Marlin!!
 // M203 - Set maximum feedrate that your machine can sustain (M203 X200 Y200 Z300 E10000) in mm/sec
 // M204 - Set default acceleration: S normal moves T filament only moves (M204 S3000 T7000) in mm/sec^2  also sets minimum segment time in ms (B20000) to prevent buffer under-runs and M20 minimum feedrate
-// M205 -  advanced settings:  minimum travel speed S=while printing T=travel only,  B=minimum segment time X= maximum xy jerk, Z=maximum Z jerk, E=maximum E jerk
+// M205 -  advanced settings:  minimum travel speed S=while printing T=travel only,  B=minimum segment time X= maximum xy jerk, Z=maximum Z jerk, E=maximum E jerk, J=junction deviation (0 = use jerk)
 // M206 - set additional homing offset
 // M207 - set retract length S[positive mm] F[feedrate mm/min] Z[additional zlift/hop], stays in mm regardless of M200 setting
 // M208 - set recover=unretract length S[positive mm surplus to the M207 S*] F[feedrate mm/sec]
@@ -154,10 +156,12 @@
 // M250 - Set LCD contrast C<contrast value> (value 0..63)
 // M280 - set servo position absolute. P: servo index, S: angle or microseconds
 // M300 - Play beep sound S<frequency Hz> P<duration ms>
-// M301 - Set PID parameters P I and D
+// M301 - Set PID parameters P I and D of extruder E (default 0), and the heater model K<rise> T<tau> L<dead time>
 // M302 - Allow cold extrudes, or set the maximum extrude S<temperature>
 // M303 - PID relay autotune S<temperature> sets the target temperature. (default target temperature = 150C)
-// M304 - Set bed PID parameters P I and D
+//        E<extruder> (-1 for the bed), C<cycles>, U1 applies the result to the heater tuned
+//        F1 measures the heater model instead, heating from cold up to S
+// M304 - Set bed PID parameters P I and D, and the bed model K<rise> T<tau> L<dead time>
 // M400 - Finish all moves
 // M401 - Lower z-probe if present
 // M402 - Raise z-probe if present
@@ -168,6 +172,7 @@
 // M540 - Use S[0|1] to enable or disable the stop SD card print on endstop hit (requires ABORT_ON_ENDSTOP_HIT_FEATURE_ENABLED)
 // M600 - Pause for filament change X[pos] Y[pos] Z[relative lift] E[initial retract] L[later retract distance for removal]
 // M613 - Return status information immediatly
+// M620 - S1 takes binary G-code frames from the host, S0 text lines (requires BINARY_TRANSPORT). Frames can carry the bytes of a file saved with M28.
 // M665 - set delta configurations
 // M666 - set delta endstop adjustment
 // M605 - Set dual x-carriage movement mode: S<mode> [ X<duplication x-offset> R<duplication temp offset> ]
@@ -316,16 +321,48 @@ static long gcode_N, gcode_LastN, Stopped_gcode_LastN = 0;
 
 static bool relative_mode = false;  //Determines Absolute or Relative Coordinates
 
-static char cmdbuffer[BUFSIZE][MAX_CMD_SIZE];
-static bool fromsd[BUFSIZE];
-static int bufindr = 0;
-static int bufindw = 0;
-static int buflen = 0;
+// The command queue packs commands back to back: a source byte, the text and
+// its terminating 0. A command never wraps around the end of cmdbuffer, one
+// that does not fit there is moved to the start and CMD_WRAP left behind.
+// With ADVANCED_OK the line number of the command follows the source byte.
+// With POWER_LOSS_RECOVERY a CMD_FROM_SD command is followed by the position
+// in the SD file after it (0 if it is not from the SD print), serial commands
+// do not pay for it. The bytes of a BINARY_TRANSPORT file frame are queued as
+// CMD_FILE_DATA, a length byte instead of the text and no terminating 0.
+#define CMD_FROM_SERIAL 0
+#define CMD_FROM_SD 1     // no "ok" for these
+#define CMD_WRAP 2
+#define CMD_FILE_DATA 3   // from the host, for the file M28 is saving
+#ifdef ADVANCED_OK
+  #define CMD_HEADER 5    // source byte, int32_t line number
+#else
+  #define CMD_HEADER 1
+#endif
+#ifdef POWER_LOSS_RECOVERY
+  #define CMD_SD_TRAILER 4  // uint32_t file position
+#else
+  #define CMD_SD_TRAILER 0
+#endif
+
+#if CMDBUFFER_SIZE < MAX_CMD_SIZE + CMD_HEADER + CMD_SD_TRAILER + 1
+  #error CMDBUFFER_SIZE has to hold at least one command of MAX_CMD_SIZE.
+#endif
+static char cmdbuffer[CMDBUFFER_SIZE];
+static int bufindr = 0;   // start of the oldest queued command
+static int bufindw = 0;   // start of the command being received
+static int buflen = 0;    // number of queued commands
 //static int i = 0;
 static char serial_char;
 static int serial_count = 0;
 static boolean comment_mode = false;
 static char *strchr_pointer; // just a pointer to find chars in the command string like X, Y, Z, E, etc
+// Index of the first 'A'..'Z' in the command being processed, NO_LETTER if
+// absent. Filled once per command by scan_command() for code_seen().
+#define NO_LETTER 0xff
+static unsigned char letter_index[26];
+
+FORCE_INLINE char *current_command() { return &cmdbuffer[bufindr + CMD_HEADER]; }
+FORCE_INLINE char *received_command() { return &cmdbuffer[bufindw + CMD_HEADER]; }
 
 const int sensitive_pins[] = SENSITIVE_PINS; // Sensitive pin list for M42
 
@@ -364,6 +401,9 @@ boolean chdkActive = false;
 
 void get_arc_coordinates();
 bool setTargetedHotend(int code);
+#ifdef BINARY_TRANSPORT
+static void write_file_frame();
+#endif
 
 void serial_echopair_P(const char *s_P, float v)
     { serialprintPGM(s_P); SERIAL_ECHO(v); }
@@ -389,48 +429,224 @@ extern "C"{
   }
 }
 
+// Index just past the queued command that starts at ind.
+static int command_end(int ind)
+{
+  if (cmdbuffer[ind] == CMD_FILE_DATA)
+    return ind + CMD_HEADER + 1 + (unsigned char)cmdbuffer[ind + CMD_HEADER];
+  int end = ind + CMD_HEADER + strlen(&cmdbuffer[ind + CMD_HEADER]) + 1;
+  if (cmdbuffer[ind] == CMD_FROM_SD)
+    end += CMD_SD_TRAILER;
+  return end;
+}
+
 //Clear all the commands in the ASCII command buffer, to make sure we have room for abort commands.
 void clear_command_queue()
 {
     if (buflen > 0)
     {
-        bufindw = (bufindr + 1)%BUFSIZE;
+        bufindw = command_end(bufindr);
+        if (bufindw + CMD_HEADER >= CMDBUFFER_SIZE)
+          bufindw = 0;
         buflen = 1;
     }
 }
 
+// Makes sure a command of len characters fits at bufindw, moving what has
+// been received of it to the start of cmdbuffer when it would run past the
+// end. False while the queue is too full for it. CMD_FROM_SD commands ask
+// for CMD_SD_TRAILER more.
+static bool command_room(int len)
+{
+  len += CMD_HEADER + 1;
+  if (buflen > 0 && bufindr >= bufindw)
+    return bufindw + len <= bufindr;
+  if (bufindw + len <= CMDBUFFER_SIZE)
+    return true;
+  if (buflen > 0) {
+    if (len > bufindr)
+      return false;
+    cmdbuffer[bufindw] = CMD_WRAP;
+  }
+  memmove(&cmdbuffer[CMD_HEADER], received_command(), serial_count);
+  bufindw = 0;
+  if (buflen == 0)
+    bufindr = 0;
+  return true;
+}
+
+// Adds the command received at bufindw, its source byte set, to the queue.
+// With POWER_LOSS_RECOVERY file_pos is where the SD print goes on after a
+// CMD_FROM_SD command. When that leaves no room for the header of another
+// command before the end of cmdbuffer, the next one starts over at 0, so the
+// received command is always inside it.
+#ifdef POWER_LOSS_RECOVERY
+static void queue_received_command(uint32_t file_pos = 0)
+#else
+static void queue_received_command()
+#endif
+{
+  #ifdef ADVANCED_OK
+    int32_t line = gcode_LastN;
+    memcpy(&cmdbuffer[bufindw + 1], &line, sizeof(line));
+  #endif
+  int end = command_end(bufindw);
+  #ifdef POWER_LOSS_RECOVERY
+    if (cmdbuffer[bufindw] == CMD_FROM_SD)
+      memcpy(&cmdbuffer[end - CMD_SD_TRAILER], &file_pos, sizeof(file_pos));
+  #endif
+  bufindw = end;
+  if (bufindw + CMD_HEADER >= CMDBUFFER_SIZE)
+    bufindw = 0;
+  buflen += 1;
+}
+
+// Drops the command at bufindr from the queue.
+static void next_command()
+{
+  buflen -= 1;
+  if (buflen == 0) {
+    bufindr = bufindw;
+    return;
+  }
+  bufindr = command_end(bufindr);
+  if (bufindr + CMD_HEADER >= CMDBUFFER_SIZE || cmdbuffer[bufindr] == CMD_WRAP)
+    bufindr = 0;
+}
+
+#ifdef ADVANCED_OK
+// "ok" for the command from line number line, with the line and what is free
+// in the planner and in the command queue, less the line being received, so
+// a host can keep more than one line in flight.
+static void send_ok(long line)
+{
+  int queue_free = CMDBUFFER_SIZE - serial_count;
+  if (buflen > 0)
+    queue_free -= bufindr >= bufindw ? CMDBUFFER_SIZE - (bufindr - bufindw) : bufindw - bufindr;
+  SERIAL_PROTOCOLPGM(MSG_OK);
+  SERIAL_PROTOCOLPGM(" N");
+  SERIAL_PROTOCOL(line);
+  SERIAL_PROTOCOLPGM(" P");
+  SERIAL_PROTOCOL(int(BLOCK_BUFFER_SIZE - 1 - movesplanned()));
+  SERIAL_PROTOCOLPGM(" B");
+  SERIAL_PROTOCOLLN(queue_free);
+}
+
+// The line number of the command at bufindr, the last one received when
+// the queue is empty.
+static long current_line()
+{
+  if (buflen == 0)
+    return gcode_LastN;
+  int32_t line;
+  memcpy(&line, &cmdbuffer[bufindr + 1], sizeof(line));
+  return line;
+}
+#else
+// A plain "ok", the line number is not evaluated
+#define send_ok(line) SERIAL_PROTOCOLLNPGM(MSG_OK)
+#endif
+
+#ifdef POWER_LOSS_RECOVERY
+// The position in the SD file after the command at bufindr, 0 if it is not
+// from the SD print.
+static uint32_t current_file_pos()
+{
+  if (cmdbuffer[bufindr] != CMD_FROM_SD)
+    return 0;
+  uint32_t file_pos;
+  memcpy(&file_pos, &cmdbuffer[command_end(bufindr) - CMD_SD_TRAILER], sizeof(file_pos));
+  return file_pos;
+}
+#endif
+
+// The numbers slicers and hosts write: blanks, a sign, then up to 9 digits
+// with an optional point. The digits go to mantissa and scale is the power
+// of 10 to divide by, both exact as integers and as floats while mantissa
+// stays within the 24 bits of a float mantissa, so one division gives the
+// same correctly rounded result as strtod(). False for anything else
+// (exponents, hex, inf/nan, no digits, too many digits), which is left to
+// strtod()/strtol() so the results never differ. sim/parse_test.cpp checks
+// parse_float() and parse_long() against the C library.
+static bool scan_number(const char *p, bool &negative, unsigned long &mantissa, unsigned long &scale)
+{
+  while(*p == ' ' || (*p >= '\t' && *p <= '\r'))
+    p++;
+  negative = (*p == '-');
+  if(*p == '-' || *p == '+')
+    p++;
+  mantissa = 0;
+  scale = 1;
+  unsigned char digits = 0;
+  bool point = false;
+  for(;; p++) {
+    if(*p >= '0' && *p <= '9') {
+      if(++digits > 9)
+        return false;
+      mantissa = mantissa * 10 + (*p - '0');
+      if(point)
+        scale *= 10;
+    }
+    else if(*p == '.' && !point)
+      point = true;
+    else
+      break;
+  }
+  if(digits == 0 || mantissa > (1UL << 24))
+    return false;
+  return *p != 'e' && *p != 'E' && *p != 'x' && *p != 'X';
+}
+
+float parse_float(const char *p)
+{
+  bool negative;
+  unsigned long mantissa, scale;
+  if(!scan_number(p, negative, mantissa, scale))
+    return strtod(p, NULL);
+  float value = scale == 1 ? (float)mantissa : (float)mantissa / (float)scale;
+  return negative ? -value : value;
+}
+
+long parse_long(const char *p)
+{
+  bool negative;
+  unsigned long mantissa, scale;
+  if(!scan_number(p, negative, mantissa, scale))
+    return strtol(p, NULL, 10);
+  long value = mantissa / scale;
+  return negative ? -value : value;
+}
+
 //adds an command to the main command buffer
 //thats really done in a non-safe way.
 //needs overworking someday
 void enquecommand(const char *cmd)
 {
-  if(buflen < BUFSIZE)
+  if(command_room(strlen(cmd) + CMD_SD_TRAILER))
   {
     //this is dangerous if a mixing of serial and this happens
-    strcpy(&(cmdbuffer[bufindw][0]),cmd);
+    strcpy(received_command(),cmd);
     SERIAL_ECHO_START;
     SERIAL_ECHOPGM("enqueing \"");
-    SERIAL_ECHO(cmdbuffer[bufindw]);
+    SERIAL_ECHO(received_command());
     SERIAL_ECHOLNPGM("\"");
-    fromsd[bufindw] = true;
-    bufindw= (bufindw + 1)%BUFSIZE;
-    buflen += 1;
+    cmdbuffer[bufindw] = CMD_FROM_SD;
+    queue_received_command();
   }
 }
 
 void enquecommand_P(const char *cmd)
 {
-  if(buflen < BUFSIZE)
+  if(command_room(strlen_P(cmd) + CMD_SD_TRAILER))
   {
     //this is dangerous if a mixing of serial and this happens
-    strcpy_P(&(cmdbuffer[bufindw][0]),cmd);
+    strcpy_P(received_command(),cmd);
     SERIAL_ECHO_START;
     SERIAL_ECHOPGM("enqueing \"");
-    SERIAL_ECHO(cmdbuffer[bufindw]);
+    SERIAL_ECHO(received_command());
     SERIAL_ECHOLNPGM("\"");
-    fromsd[bufindw] = true;
-    bufindw= (bufindw + 1)%BUFSIZE;
-    buflen += 1;
+    cmdbuffer[bufindw] = CMD_FROM_SD;
+    queue_received_command();
   }
 }
 
@@ -542,11 +758,7 @@ void setup()
   SERIAL_ECHOPGM(MSG_FREE_MEMORY);
   SERIAL_ECHO(freeMemory());
   SERIAL_ECHOPGM(MSG_PLANNER_BUFFER_BYTES);
-  SERIAL_ECHOLN((int)sizeof(block_t)*BLOCK_BUFFER_SIZE);
-  for(int8_t i = 0; i < BUFSIZE; i++)
-  {
-    fromsd[i] = false;
-  }
+  SERIAL_ECHOLN((int)(sizeof(block_t)+sizeof(block_plan_t))*BLOCK_BUFFER_SIZE);
 
   // loads data from EEPROM if available else uses defaults (and resets step acceleration rate)
   Config_RetrieveSettings();
@@ -575,6 +787,9 @@ void setup()
   #endif
 
   lifetime_stats_init();
+  #ifdef POWER_LOSS_RECOVERY
+  power_loss_init();
+  #endif
   
   #ifdef USE_FILAMENT_DETECTION
   SET_INPUT(FIL_DETECT_PIN);
@@ -612,7 +827,9 @@ void sendM613Status( bool ok )
 
    if (IS_SD_PRINTING) {
       SERIAL_ECHOPGM(";");
+#ifdef SDSUPPORT
       SERIAL_ECHO(itostr3(card.percentDone()));
+#endif
    } else {
       SERIAL_ECHOPGM(";-1");
    }
@@ -645,28 +862,186 @@ void sendM613Click( bool request )
       SERIAL_ECHOLNPGM(";C:0");
 }
 
+// The temperatures and heater powers M105 prints after its "ok", with the
+// power of extruder e.
+static void print_heaterstates(uint8_t e)
+{
+  #if defined(TEMP_0_PIN) && TEMP_0_PIN > -1
+    SERIAL_PROTOCOLPGM(" T:");
+    SERIAL_PROTOCOL_F(degHotend(e),1);
+    SERIAL_PROTOCOLPGM(" /");
+    SERIAL_PROTOCOL_F(degTargetHotend(e),1);
+    #if defined(TEMP_BED_PIN) && TEMP_BED_PIN > -1
+      SERIAL_PROTOCOLPGM(" B:");
+      SERIAL_PROTOCOL_F(degBed(),1);
+      SERIAL_PROTOCOLPGM(" /");
+      SERIAL_PROTOCOL_F(degTargetBed(),1);
+    #endif //TEMP_BED_PIN
+    for (int8_t cur_extruder = 0; cur_extruder < EXTRUDERS; ++cur_extruder) {
+      SERIAL_PROTOCOLPGM(" T");
+      SERIAL_PROTOCOL(cur_extruder);
+      SERIAL_PROTOCOLPGM(":");
+      SERIAL_PROTOCOL_F(degHotend(cur_extruder),1);
+      SERIAL_PROTOCOLPGM(" /");
+      SERIAL_PROTOCOL_F(degTargetHotend(cur_extruder),1);
+    }
+  #else
+    SERIAL_ERROR_START;
+    SERIAL_ERRORLNPGM(MSG_ERR_NO_THERMISTORS);
+  #endif
+
+    SERIAL_PROTOCOLPGM(" @:");
+  #ifdef EXTRUDER_WATTS
+    SERIAL_PROTOCOL((EXTRUDER_WATTS * getHeaterPower(e))/127);
+    SERIAL_PROTOCOLPGM("W");
+  #else
+    SERIAL_PROTOCOL(getHeaterPower(e));
+  #endif
+
+    SERIAL_PROTOCOLPGM(" B@:");
+  #ifdef BED_WATTS
+    SERIAL_PROTOCOL((BED_WATTS * getHeaterPower(-1))/127);
+    SERIAL_PROTOCOLPGM("W");
+  #else
+    SERIAL_PROTOCOL(getHeaterPower(-1));
+  #endif
+
+    #ifdef SHOW_TEMP_ADC_VALUES
+      #if defined(TEMP_BED_PIN) && TEMP_BED_PIN > -1
+        SERIAL_PROTOCOLPGM("    ADC B:");
+        SERIAL_PROTOCOL_F(degBed(),1);
+        SERIAL_PROTOCOLPGM("C->");
+        SERIAL_PROTOCOL_F(rawBedTemp()/OVERSAMPLENR,0);
+      #endif
+      for (int8_t cur_extruder = 0; cur_extruder < EXTRUDERS; ++cur_extruder) {
+        SERIAL_PROTOCOLPGM("  T");
+        SERIAL_PROTOCOL(cur_extruder);
+        SERIAL_PROTOCOLPGM(":");
+        SERIAL_PROTOCOL_F(degHotend(cur_extruder),1);
+        SERIAL_PROTOCOLPGM("C->");
+        SERIAL_PROTOCOL_F(rawHotendTemp(cur_extruder)/OVERSAMPLENR,0);
+      }
+    #endif
+
+    SERIAL_PROTOCOLLN("");
+}
+
+// The M114 position report.
+static void print_position()
+{
+  SERIAL_PROTOCOLPGM("X:");
+  SERIAL_PROTOCOL(current_position[X_AXIS]);
+  SERIAL_PROTOCOLPGM(" Y:");
+  SERIAL_PROTOCOL(current_position[Y_AXIS]);
+  SERIAL_PROTOCOLPGM(" Z:");
+  SERIAL_PROTOCOL(current_position[Z_AXIS]);
+  SERIAL_PROTOCOLPGM(" E:");
+  SERIAL_PROTOCOL(current_position[E_AXIS]);
+
+  SERIAL_PROTOCOLPGM(MSG_COUNT_X);
+  SERIAL_PROTOCOL(float(st_get_position(X_AXIS))/axis_steps_per_unit[X_AXIS]);
+  SERIAL_PROTOCOLPGM(" Y:");
+  SERIAL_PROTOCOL(float(st_get_position(Y_AXIS))/axis_steps_per_unit[Y_AXIS]);
+  SERIAL_PROTOCOLPGM(" Z:");
+  SERIAL_PROTOCOL(float(st_get_position(Z_AXIS))/axis_steps_per_unit[Z_AXIS]);
+
+  SERIAL_PROTOCOLLN("");
+}
+
+#ifdef AUTO_REPORT
+// What M155 sends every auto_report_interval seconds, without being asked.
+#define REPORT_TEMPERATURES 1 // as M105
+#define REPORT_POSITION 2     // as M114
+#define REPORT_SD 4           // as M27, while printing from SD
+#define REPORT_STATUS 8       // the M613 status line
+static uint8_t auto_report_interval = 0;
+static uint8_t auto_report_flags = REPORT_TEMPERATURES;
+static unsigned long next_auto_report;
+
+static void auto_report()
+{
+  if(auto_report_interval == 0 || (long)(millis() - next_auto_report) < 0)
+    return;
+  next_auto_report = millis() + auto_report_interval * 1000UL;
+  if(auto_report_flags & REPORT_TEMPERATURES)
+    print_heaterstates(active_extruder);
+  if(auto_report_flags & REPORT_POSITION)
+    print_position();
+  #ifdef SDSUPPORT
+  if((auto_report_flags & REPORT_SD) && IS_SD_PRINTING)
+    card.getStatus();
+  #endif
+  if(auto_report_flags & REPORT_STATUS)
+    sendM613Status( false );
+}
+#endif //AUTO_REPORT
+
+// A G0-G3 at the head of the queue is left there while the planner has no
+// free block, instead of letting plan_buffer_line() spin until it has one.
+// loop() keeps reading and queueing commands in the meantime.
+static bool move_must_wait()
+{
+  #ifdef SDSUPPORT
+  if(card.saving)
+    return false;
+  #endif
+  if(cmdbuffer[bufindr] == CMD_FILE_DATA || current_command()[0] != 'G' || !plan_buffer_full())
+    return false;
+  long code = parse_long(&current_command()[1]);
+  return code >= 0 && code <= 3;
+}
+
+#ifdef POWER_LOSS_RECOVERY
+// After a command: at a layer change of the SD print, what the command left the
+// printer at is checkpointed with the file position the print goes on from.
+static void checkpoint_print(uint32_t file_pos)
+{
+  if(file_pos == 0 || !card.sdprinting || !power_loss_due(current_position[Z_AXIS], current_position[E_AXIS]))
+    return;
+  power_loss_state state;
+  state.file_pos = file_pos;
+  memcpy(state.position, current_position, sizeof(state.position));
+  state.feedrate = feedrate;
+  memcpy(state.target_temperature, target_temperature, sizeof(state.target_temperature));
+  state.target_temperature_bed = target_temperature_bed;
+  state.fan_speed = fanSpeed;
+  state.feedmultiply = feedmultiply;
+  state.active_extruder = active_extruder;
+  state.relative_mode = relative_mode;
+  state.relative_e = axis_relative_modes[E_AXIS];
+  #ifdef ENABLE_AUTO_BED_LEVELING
+  memcpy(state.bed_level, plan_bed_level_matrix.matrix, sizeof(state.bed_level));
+  #endif
+  power_loss_save(state);
+}
+#endif //POWER_LOSS_RECOVERY
+
 void loop()
 {
-  if(buflen < (BUFSIZE-1))
-    get_command();
+  get_command();
   #ifdef SDSUPPORT
   card.checkautostart(false);
   #endif
-  if(buflen)
+  if(buflen && !move_must_wait())
   {
+    #ifdef BINARY_TRANSPORT
+      if(cmdbuffer[bufindr] == CMD_FILE_DATA)
+        write_file_frame();
+      else
+    #endif
     #ifdef SDSUPPORT
       if(card.saving)
       {
-        if(strstr_P(cmdbuffer[bufindr], PSTR("M29")) == NULL)
+        if(strstr_P(current_command(), PSTR("M29")) == NULL)
         {
-          card.write_command(cmdbuffer[bufindr]);
+          card.write_command(current_command());
           if(card.logging)
           {
             process_commands();
           }
           else
           {
-            SERIAL_PROTOCOLLNPGM(MSG_OK);
+            send_ok(current_line());
           }
         }
         else
@@ -678,12 +1053,14 @@ void loop()
       else
       {
         process_commands();
+        #ifdef POWER_LOSS_RECOVERY
+          checkpoint_print(current_file_pos());
+        #endif
       }
     #else
       process_commands();
     #endif //SDSUPPORT
-    buflen = (buflen-1);
-    bufindr = (bufindr + 1)%BUFSIZE;
+    next_command();
   }
   //check heater every n milliseconds
   manage_heater();
@@ -691,25 +1068,225 @@ void loop()
   checkHitEndstops();
   lcd_update();
   lifetime_stats_tick();
+  #ifdef POWER_LOSS_RECOVERY
+  power_loss_tick();
+  #endif
+}
+
+#ifdef BINARY_TRANSPORT
+// After M620 S1 the host sends frames instead of lines:
+//   BINARY_SYNC, sequence, opcode, payload length, payload, CRC16
+// The CRC (CCITT, high byte first) covers sequence to payload. The sequence is
+// the low byte of the line number the frame stands for, so frames are
+// acknowledged and resent like N lines. BINARY_OP_TEXT carries a command as
+// text, without line number or checksum. The moves carry a mask of the axes
+// present (bit 0..4 for X Y Z E F) and a little endian long in 1/1000 mm
+// (mm/min for F) per axis. Each frame becomes a command in the queue, bytes
+// outside of frames are dropped. BINARY_OP_FILE carries bytes of the file M28
+// is saving instead. They are queued as CMD_FILE_DATA, and loop() writes them
+// in order with the commands around them and acknowledges the frame then, so
+// the host can keep as many file frames in flight as the queue has room for
+// (B of ADVANCED_OK).
+#define BINARY_SYNC 0xa5
+#define BINARY_OP_TEXT 0
+#define BINARY_OP_G0 1
+#define BINARY_OP_G1 2
+#define BINARY_OP_G92 3
+#define BINARY_OP_FILE 4
+#define BINARY_HEADER 4 // sync, sequence, opcode, length
+static bool binary_transport = false;
+static unsigned char frame_pos = 0;
+static unsigned char frame_header[BINARY_HEADER];
+static unsigned char frame_data[1 + 5 * 4]; // payload of a move
+static unsigned short frame_crc;
+
+static unsigned short crc16_update(unsigned short crc, unsigned char data)
+{
+  crc ^= (unsigned short)data << 8;
+  for(unsigned char i = 0; i < 8; i++)
+    crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+  return crc;
+}
+
+// Appends " <letter><value / 1000>" to the command being received.
+static void append_fixed(char letter, long value)
+{
+  char *p = received_command() + serial_count;
+  *p++ = ' ';
+  *p++ = letter;
+  unsigned long v = value;
+  if(value < 0) {
+    *p++ = '-';
+    v = -v;
+  }
+  unsigned long whole = v / 1000;
+  unsigned int frac = v - whole * 1000;
+  char digits[7];
+  unsigned char n = 0;
+  do {
+    digits[n++] = '0' + whole % 10;
+    whole /= 10;
+  } while(whole);
+  while(n)
+    *p++ = digits[--n];
+  *p++ = '.';
+  *p++ = '0' + frac / 100;
+  *p++ = '0' + frac / 10 % 10;
+  *p++ = '0' + frac % 10;
+  serial_count = p - received_command();
+}
+
+// A bad frame is answered like a bad line, the host resends from gcode_LastN + 1.
+static bool binary_frame_error(const char *msg_P)
+{
+  SERIAL_ERROR_START;
+  serialprintPGM(msg_P);
+  SERIAL_ERRORLN(gcode_LastN);
+  FlushSerialRequestResend();
+  frame_pos = 0;
+  serial_count = 0;
+  return false;
+}
+
+// Turns the mask and values of a move frame into its command. False if they
+// do not match the payload length.
+static bool binary_frame_move()
+{
+  static const char frame_axes[] = { 'X', 'Y', 'Z', 'E', 'F' };
+  unsigned char op = frame_header[2], mask = frame_data[0];
+  unsigned char *value = &frame_data[1];
+  unsigned char len = 1;
+  for(unsigned char i = 0; i < 5; i++)
+    if(mask & (1 << i))
+      len += 4;
+  if(len != frame_header[3] || mask >= (1 << 5))
+    return false;
+  strcpy_P(received_command(), op == BINARY_OP_G92 ? PSTR("G92") : op == BINARY_OP_G1 ? PSTR("G1") : PSTR("G0"));
+  serial_count = strlen(received_command());
+  for(unsigned char i = 0; i < 5; i++) {
+    if(!(mask & (1 << i)))
+      continue;
+    append_fixed(frame_axes[i], value[0] | (unsigned int)value[1] << 8 | (unsigned long)value[2] << 16 | (unsigned long)value[3] << 24);
+    value += 4;
+  }
+  return true;
+}
+
+// Queues the bytes of a file frame, serial_count of them at received_command(),
+// behind their length.
+static void queue_file_frame()
+{
+  char *data = received_command();
+  memmove(data + 1, data, serial_count);
+  data[0] = serial_count;
+  cmdbuffer[bufindw] = CMD_FILE_DATA;
+  queue_received_command();
+  serial_count = 0;
+}
+
+// Takes the next received byte while frames are on. True once a whole frame
+// checked out and its command, serial_count long, is at received_command().
+static bool binary_frame_byte(unsigned char c)
+{
+  if(frame_pos == 0) {
+    if(c == BINARY_SYNC)
+      frame_header[frame_pos++] = c;
+    frame_crc = 0xffff;
+    return false;
+  }
+  unsigned char len = frame_header[3];
+  if(frame_pos < BINARY_HEADER) {
+    frame_header[frame_pos++] = c;
+    frame_crc = crc16_update(frame_crc, c);
+    if(frame_pos == BINARY_HEADER) {
+      unsigned char op = frame_header[2];
+      len = frame_header[3];
+      bool bytes = op == BINARY_OP_TEXT || op == BINARY_OP_FILE;
+      if(op > BINARY_OP_FILE || len == 0 || len >= (bytes ? MAX_CMD_SIZE : sizeof(frame_data) + 1))
+        return binary_frame_error(PSTR(MSG_ERR_CHECKSUM_MISMATCH));
+    }
+    return false;
+  }
+  if(frame_pos < BINARY_HEADER + len) {
+    if(frame_header[2] == BINARY_OP_TEXT || frame_header[2] == BINARY_OP_FILE)
+      received_command()[serial_count++] = c;
+    else
+      frame_data[frame_pos - BINARY_HEADER] = c;
+    frame_crc = crc16_update(frame_crc, c);
+    frame_pos++;
+    return false;
+  }
+  if(frame_pos == BINARY_HEADER + len) {
+    frame_crc ^= (unsigned short)c << 8;
+    frame_pos++;
+    return false;
+  }
+  frame_crc ^= c;
+  frame_pos = 0;
+  if(frame_crc != 0)
+    return binary_frame_error(PSTR(MSG_ERR_CHECKSUM_MISMATCH));
+  if(frame_header[1] != (unsigned char)(gcode_LastN + 1))
+    return binary_frame_error(PSTR(MSG_ERR_LINE_NO));
+  if(frame_header[2] != BINARY_OP_TEXT && frame_header[2] != BINARY_OP_FILE && !binary_frame_move())
+    return binary_frame_error(PSTR(MSG_ERR_CHECKSUM_MISMATCH));
+  gcode_LastN++;
+  if(frame_header[2] == BINARY_OP_FILE) {
+    queue_file_frame();
+    return false;
+  }
+  return true;
+}
+
+// Writes the file frame at bufindr to the file being saved and acknowledges it.
+static void write_file_frame()
+{
+  #ifdef SDSUPPORT
+  if(card.saving)
+    card.write_data((uint8_t *)current_command() + 1, (unsigned char)current_command()[0]);
+  else
+  #endif
+  {
+    SERIAL_ERROR_START;
+    SERIAL_ERRORLNPGM(MSG_SD_ERR_WRITE_TO_FILE);
+  }
+  send_ok(current_line());
 }
 
+// Room the next received byte needs in the queue: a frame can turn into a
+// command of any length, a file frame takes a length byte instead of the 0.
+FORCE_INLINE int receive_room() { return frame_pos ? MAX_CMD_SIZE - 1 : serial_count + 1; }
+#else
+FORCE_INLINE int receive_room() { return serial_count + 1; }
+#endif //BINARY_TRANSPORT
+
+// Room a line read from SD or memory needs: a line is only started when all of
+// it fits, one cut off by a full queue would look like a serial line being
+// received and never be finished.
+FORCE_INLINE int file_line_room() { return (serial_count ? serial_count + 1 : MAX_CMD_SIZE) + CMD_SD_TRAILER; }
+
 void get_command()
 {
 #ifdef USE_FILAMENT_DETECTION
-  if ( ( forced_M600 == true ) && ( buflen < BUFSIZE ) 
-       && ( forced_M600_inqueue == false ) && ( serial_count == 0 ) ) {
+  if ( ( forced_M600 == true ) && ( forced_M600_inqueue == false )
+       && ( serial_count == 0 ) && command_room(4 + CMD_SD_TRAILER) ) {
     forced_M600_inqueue = true;
-    strcpy( cmdbuffer[bufindw], "M600" );
-    fromsd[bufindw] = true; // No serial response
+    strcpy( received_command(), "M600" );
+    cmdbuffer[bufindw] = CMD_FROM_SD; // No serial response
     SERIAL_ECHO_START;
     SERIAL_ECHOLNPGM("Forced M600 from filament detection");
-    bufindw = (bufindw + 1)%BUFSIZE;
-    buflen += 1;
+    queue_received_command();
     return;
   }
 #endif
-  while( MYSERIAL.available() > 0  && buflen < BUFSIZE) {
+  while( MYSERIAL.available() > 0  && command_room(receive_room())) {
     serial_char = MYSERIAL.read();
+#ifdef BINARY_TRANSPORT
+    if(binary_transport) {
+      if(!binary_frame_byte(serial_char))
+        continue;
+      serial_char = '\n'; // end of the frame's command
+    }
+#endif
     if(serial_char == '\n' ||
        serial_char == '\r' ||
        (serial_char == ':' && comment_mode == false) ||
@@ -719,18 +1296,18 @@ void get_command()
         comment_mode = false; //for new command
         return;
       }
-      cmdbuffer[bufindw][serial_count] = 0; //terminate string
+      received_command()[serial_count] = 0; //terminate string
       //if(!comment_mode){
       {
         comment_mode = false; //for new command
-        fromsd[bufindw] = false;
-        //if(strchr(cmdbuffer[bufindw], 'N') != NULL)
+        cmdbuffer[bufindw] = CMD_FROM_SERIAL;
+        //if(strchr(received_command(), 'N') != NULL)
         //If the line starts with a line number
-        if ( cmdbuffer[bufindw][0] == 'N' ) {
-          strchr_pointer = strchr(cmdbuffer[bufindw], 'N');
-          gcode_N = (strtol(&cmdbuffer[bufindw][strchr_pointer - cmdbuffer[bufindw] + 1], NULL, 10));
+        if ( received_command()[0] == 'N' ) {
+          strchr_pointer = strchr(received_command(), 'N');
+          gcode_N = (parse_long(strchr_pointer + 1));
           // If the line number is incorrect and there isn't a M110 report the error
-          if( (gcode_N != gcode_LastN+1) && ((strstr_P(cmdbuffer[bufindw], PSTR("M110")) == NULL)) ) {
+          if( (gcode_N != gcode_LastN+1) && ((strstr_P(received_command(), PSTR("M110")) == NULL)) ) {
             SERIAL_ERROR_START;
             SERIAL_ERRORPGM(MSG_ERR_LINE_NO);
             SERIAL_ERRORLN(gcode_LastN);
@@ -740,18 +1317,18 @@ void get_command()
           }
 
           // Line number updated with M110
-          if (strstr_P(cmdbuffer[bufindw], PSTR("M110")) != NULL ) {
+          if (strstr_P(received_command(), PSTR("M110")) != NULL ) {
              gcode_LastN = gcode_N;
           } else  {
           // Checksum required with line numbers and line number updated only with M110
-          //if ( ((strstr_P(cmdbuffer[bufindw], PSTR("M110")) == NULL)) && (cmdbuffer[bufindw][0] == 'N') ) {
-            if(strchr(cmdbuffer[bufindw], '*') != NULL) {
+          //if ( ((strstr_P(received_command(), PSTR("M110")) == NULL)) && (received_command()[0] == 'N') ) {
+            if(strchr(received_command(), '*') != NULL) {
               byte checksum = 0;
               byte count = 0;
-              while(cmdbuffer[bufindw][count] != '*') checksum = checksum^cmdbuffer[bufindw][count++];
-              strchr_pointer = strchr(cmdbuffer[bufindw], '*');
+              while(received_command()[count] != '*') checksum = checksum^received_command()[count++];
+              strchr_pointer = strchr(received_command(), '*');
 
-              if( (int)(strtod(&cmdbuffer[bufindw][strchr_pointer - cmdbuffer[bufindw] + 1], NULL)) != checksum) {
+              if( (int)(parse_long(strchr_pointer + 1)) != checksum) {
                 SERIAL_ERROR_START;
                 SERIAL_ERRORPGM(MSG_ERR_CHECKSUM_MISMATCH);
                 SERIAL_ERRORLN(gcode_LastN);
@@ -773,14 +1350,14 @@ void get_command()
           }
 
           //if no errors, drop the line number and continue
-          strchr_pointer=strchr(cmdbuffer[bufindw],' ');
+          strchr_pointer=strchr(received_command(),' ');
           if ( strchr_pointer != NULL ) {
-             strcpy( cmdbuffer[bufindw], strchr_pointer+1 );
+             memmove( received_command(), strchr_pointer+1, strlen(strchr_pointer+1)+1 ); // overlapping, no strcpy
           }
         }
         else  // if we don't receive 'N' but still see '*'
         {
-          if((strchr(cmdbuffer[bufindw], '*') != NULL))
+          if((strchr(received_command(), '*') != NULL))
           {
             SERIAL_ERROR_START;
             SERIAL_ERRORPGM(MSG_ERR_NO_LINENUMBER_WITH_CHECKSUM);
@@ -790,10 +1367,10 @@ void get_command()
           }
         }
         
-        //if(strchr(cmdbuffer[bufindw], 'G') != NULL)
-        if( cmdbuffer[bufindw][0] == 'G' ) {
-          strchr_pointer = strchr(cmdbuffer[bufindw], 'G');
-          switch((int)((strtod(&cmdbuffer[bufindw][strchr_pointer - cmdbuffer[bufindw] + 1], NULL)))){
+        //if(strchr(received_command(), 'G') != NULL)
+        if( received_command()[0] == 'G' ) {
+          strchr_pointer = strchr(received_command(), 'G');
+          switch((int)((parse_float(strchr_pointer + 1)))){
           case 0:
           case 1:
           case 2:
@@ -803,7 +1380,7 @@ void get_command()
               if(card.saving)
                 break;
           #endif //SDSUPPORT
-              SERIAL_PROTOCOLLNPGM(MSG_OK);
+              send_ok(gcode_LastN);
             }
             else {
               SERIAL_ERROR_START;
@@ -830,56 +1407,14 @@ void get_command()
         }
 
         //If command was e-stop process now
-        if(strcmp(cmdbuffer[bufindw], "M112") == 0)
+        if(strcmp(received_command(), "M112") == 0)
           kill();
        
         // Comando diretto lo processa qui e non lo salva
-        if ( strcmp( cmdbuffer[bufindw], "M613" ) == 0 ) {
-           int level;
-
-           SERIAL_ECHO_START;
-           SERIAL_ECHOPGM("M613");
-           SERIAL_ECHO(lcd_getstatus(&level));
-           SERIAL_ECHO(";");
-           SERIAL_ECHO(level);
-#if EXTRUDERS > 0
-           SERIAL_ECHOPGM(";0:");
-           SERIAL_ECHO(int(degHotend(0) + 0.5 ));
-           SERIAL_ECHOPGM("/");
-           SERIAL_ECHO(int(degTargetHotend(0) + 0.5 ));
-#endif
-#if EXTRUDERS > 1
-           SERIAL_ECHOPGM(";1:");
-           SERIAL_ECHO(int(degHotend(1) + 0.5 ));
-           SERIAL_ECHOPGM("/");
-           SERIAL_ECHO(int(degTargetHotend(1) + 0.5 ));
-#endif
-#if TEMP_SENSOR_BED != 0
-           SERIAL_ECHOPGM(";B:");
-           SERIAL_ECHO(int(degBed() + 0.5 ));
-           SERIAL_ECHOPGM("/");
-           SERIAL_ECHO(int(degTargetBed() + 0.5 ));
-#endif
-
-           if (IS_SD_PRINTING) {
-              SERIAL_ECHOPGM(";");
-              SERIAL_ECHO(itostr3(card.percentDone()));
-           } else {
-              SERIAL_ECHOPGM(";-1");
-           }
-
-           SERIAL_ECHOPGM(";");
-           SERIAL_ECHO(ftostr32(current_position[X_AXIS]));
-           SERIAL_ECHOPGM(";");
-           SERIAL_ECHO(ftostr32(current_position[Y_AXIS]));
-           SERIAL_ECHOPGM(";");
-           SERIAL_ECHO(ftostr32(current_position[Z_AXIS]));
-           SERIAL_ECHOPGM(";");
-           SERIAL_ECHOLN(itostr3(feedmultiply));
-           SERIAL_ECHOLNPGM("ok");
+        if ( strcmp( received_command(), "M613" ) == 0 ) {
+           sendM613Status( true );
         } else {
-           bufindw = (bufindw + 1)%BUFSIZE;
-           buflen += 1;
+           queue_received_command();
         }
       }
       serial_count = 0; //clear buffer
@@ -887,7 +1422,7 @@ void get_command()
     else
     {
       if(serial_char == ';') comment_mode = true;
-      if(!comment_mode) cmdbuffer[bufindw][serial_count++] = serial_char;
+      if(!comment_mode) received_command()[serial_count++] = serial_char;
     }
   }
 
@@ -897,7 +1432,7 @@ void get_command()
     
   if( utility.isprinting && serial_count == 0 ) {
         
-    while ( !utility.eof() && buflen < BUFSIZE ) {
+    while ( !utility.eof() && command_room(file_line_room()) ) {
       int16_t n=utility.get();
       serial_char = (char)n;
 
@@ -921,15 +1456,14 @@ void get_command()
           comment_mode = false; //for new command
           return; //if empty line
         }
-        cmdbuffer[bufindw][serial_count] = 0; //terminate string
-        fromsd[bufindw] = true; // No serial response
-        buflen += 1;
-        bufindw = (bufindw + 1)%BUFSIZE;
+        received_command()[serial_count] = 0; //terminate string
+        cmdbuffer[bufindw] = CMD_FROM_SD; // No serial response
+        queue_received_command();
         comment_mode = false;
         serial_count = 0;
       } else {
         if(serial_char == ';') comment_mode = true;
-        if(!comment_mode) cmdbuffer[bufindw][serial_count++] = serial_char;
+        if(!comment_mode) received_command()[serial_count++] = serial_char;
       }
     }
 
@@ -947,7 +1481,7 @@ void get_command()
   static bool stop_buffering=false;
   if(buflen==0) stop_buffering=false;
 
-  while( !card.eof()  && buflen < BUFSIZE && !stop_buffering) {
+  while( !card.eof()  && command_room(file_line_room()) && !stop_buffering) {
     int16_t n=card.get();
     serial_char = (char)n;
     if(serial_char == '\n' ||
@@ -980,11 +1514,15 @@ void get_command()
         comment_mode = false; //for new command
         return; //if empty line
       }
-      cmdbuffer[bufindw][serial_count] = 0; //terminate string
+      received_command()[serial_count] = 0; //terminate string
 //      if(!comment_mode){
-        fromsd[bufindw] = true;
-        buflen += 1;
-        bufindw = (bufindw + 1)%BUFSIZE;
+        cmdbuffer[bufindw] = CMD_FROM_SD;
+      #ifdef POWER_LOSS_RECOVERY
+        // no checkpoint in an M32 procedure, its position is in another file
+        queue_received_command(card.inProcedure() ? 0 : card.getIndex() + 1);
+      #else
+        queue_received_command();
+      #endif
 //      }
       comment_mode = false; //for new command
       serial_count = 0; //clear buffer
@@ -996,7 +1534,7 @@ void get_command()
     else
     {
       if(serial_char == ';') comment_mode = true;
-      if(!comment_mode) cmdbuffer[bufindw][serial_count++] = serial_char;
+      if(!comment_mode) received_command()[serial_count++] = serial_char;
     }
   }
 
@@ -1007,17 +1545,36 @@ void get_command()
 
 float code_value()
 {
-  return (strtod(&cmdbuffer[bufindr][strchr_pointer - cmdbuffer[bufindr] + 1], NULL));
+  return (parse_float(strchr_pointer + 1));
 }
 
 long code_value_long()
 {
-  return (strtol(&cmdbuffer[bufindr][strchr_pointer - cmdbuffer[bufindr] + 1], NULL, 10));
+  return (parse_long(strchr_pointer + 1));
+}
+
+// One pass over the command instead of a strchr() for every code_seen().
+static void scan_command()
+{
+  char *cmd = current_command();
+  memset(letter_index, NO_LETTER, sizeof(letter_index));
+  for(unsigned char i = 0; cmd[i] && i < NO_LETTER; i++) {
+    unsigned char l = cmd[i] - 'A';
+    if(l < 26 && letter_index[l] == NO_LETTER)
+      letter_index[l] = i;
+  }
 }
 
 bool code_seen(char code)
 {
-  strchr_pointer = strchr(cmdbuffer[bufindr], code);
+  unsigned char l = code - 'A';
+  if(l < 26) {
+    if(letter_index[l] == NO_LETTER)
+      return false;
+    strchr_pointer = current_command() + letter_index[l];
+    return true;
+  }
+  strchr_pointer = strchr(current_command(), code);
   return (strchr_pointer != NULL);  //Return True if a character was found
 }
 
@@ -1519,1141 +2076,1320 @@ void refresh_cmd_timeout(void)
   } //retract
 #endif //FWRETRACT
 
-void process_commands()
-{
-  unsigned long codenum; //throw away variable
-#ifdef ENABLE_AUTO_BED_LEVELING
-  float x_tmp, y_tmp, z_tmp, real_z;
-#endif
-  if(code_seen('G') && ( cmdbuffer[bufindr][0] == 'G' ) )
-  {
-    switch((int)code_value())
-    {
-    case 0: // G0 -> G1
-    case 1: // G1
-      if(Stopped == false) {
-        get_coordinates(); // For X Y Z E F
-          #ifdef FWRETRACT
-            if(autoretract_enabled)
-            if( !(code_seen('X') || code_seen('Y') || code_seen('Z')) && code_seen('E')) {
-              float echange=destination[E_AXIS]-current_position[E_AXIS];
-              if((echange<-MIN_RETRACT && !retracted) || (echange>MIN_RETRACT && retracted)) { //move appears to be an attempt to retract or recover
-                  current_position[E_AXIS] = destination[E_AXIS]; //hide the slicer-generated retract/recover from calculations
-                  plan_set_e_position(current_position[E_AXIS]); //AND from the planner
-                  retract(!retracted);
-                  return;
-              }
-            }
-          #endif //FWRETRACT
-        prepare_move();
-        //ClearToSend();
-        return;
-      }
-      break;
-    case 2: // G2  - CW ARC
-      if(Stopped == false) {
-        get_arc_coordinates();
-        prepare_arc_move(true);
-        return;
-      }
-      break;
-    case 3: // G3  - CCW ARC
-      if(Stopped == false) {
-        get_arc_coordinates();
-        prepare_arc_move(false);
-        return;
-      }
-      break;
-    case 4: // G4 dwell
-      LCD_MESSAGEPGM(MSG_DWELL);
-      codenum = 0;
-      if(code_seen('P')) codenum = code_value(); // milliseconds to wait
-      if(code_seen('S')) codenum = code_value() * 1000; // seconds to wait
+// Set by a handler that has answered its command itself (moves are
+// acknowledged when they are queued), so process_commands() sends no "ok".
+static bool command_acked;
 
-      st_synchronize();
-      codenum += millis();  // keep track of when we started waiting
-      previous_millis_cmd = millis();
-      while(millis()  < codenum ){
-        manage_heater();
-        manage_inactivity();
-        lcd_update();
-      }
-      break;
+// G0, G1 - Coordinated Movement X Y Z E
+static void gcode_G0_G1()
+{
+  if(Stopped == false) {
+    get_coordinates(); // For X Y Z E F
       #ifdef FWRETRACT
-      case 10: // G10 retract
-        retract(true);
-      break;
-      case 11: // G11 retract_recover
-        retract(false);
-      break;
+        if(autoretract_enabled)
+        if( !(code_seen('X') || code_seen('Y') || code_seen('Z')) && code_seen('E')) {
+          float echange=destination[E_AXIS]-current_position[E_AXIS];
+          if((echange<-MIN_RETRACT && !retracted) || (echange>MIN_RETRACT && retracted)) { //move appears to be an attempt to retract or recover
+              current_position[E_AXIS] = destination[E_AXIS]; //hide the slicer-generated retract/recover from calculations
+              plan_set_e_position(current_position[E_AXIS]); //AND from the planner
+              retract(!retracted);
+              command_acked = true;
+              return;
+          }
+        }
       #endif //FWRETRACT
-    case 28: //G28 Home all Axis one at a time
+    prepare_move();
+    command_acked = true; // acknowledged when it was queued
+  }
+}
+
+// G2  - CW ARC
+static void gcode_G2()
+{
+  if(Stopped == false) {
+    get_arc_coordinates();
+    prepare_arc_move(true);
+    command_acked = true;
+  }
+}
+
+// G3  - CCW ARC
+static void gcode_G3()
+{
+  if(Stopped == false) {
+    get_arc_coordinates();
+    prepare_arc_move(false);
+    command_acked = true;
+  }
+}
+
+// G4 dwell
+static void gcode_G4()
+{
+  unsigned long codenum;
+  LCD_MESSAGEPGM(MSG_DWELL);
+  codenum = 0;
+  if(code_seen('P')) codenum = code_value(); // milliseconds to wait
+  if(code_seen('S')) codenum = code_value() * 1000; // seconds to wait
+
+  st_synchronize();
+  codenum += millis();  // keep track of when we started waiting
+  previous_millis_cmd = millis();
+  while(millis()  < codenum ){
+    manage_heater();
+    manage_inactivity();
+    lcd_update();
+  }
+}
+
+#ifdef FWRETRACT
+// G10 retract
+static void gcode_G10()
+{
+  retract(true);
+}
+
+// G11 retract_recover
+static void gcode_G11()
+{
+  retract(false);
+}
+
+#endif //FWRETRACT
+
+// G28 Home all Axis one at a time
+static void gcode_G28()
+{
 #ifdef ENABLE_AUTO_BED_LEVELING
-      plan_bed_level_matrix.set_to_identity();  //Reset the plane ("erase" all leveling data)
+  plan_bed_level_matrix.set_to_identity();  //Reset the plane ("erase" all leveling data)
 #endif //ENABLE_AUTO_BED_LEVELING
 
-      st_synchronize();
-      if(Stopped == true) { // No movement if printer stopped
-          return;
-      }
+  st_synchronize();
+  if(Stopped == true) { // No movement if printer stopped
+      command_acked = true;
+      return;
+  }
 
-      saved_feedrate = feedrate;
-      saved_feedmultiply = feedmultiply;
-      feedmultiply = 100;
-      previous_millis_cmd = millis();
+  saved_feedrate = feedrate;
+  saved_feedmultiply = feedmultiply;
+  feedmultiply = 100;
+  previous_millis_cmd = millis();
 
-      enable_endstops(true);
+  enable_endstops(true);
 
-      for(int8_t i=0; i < NUM_AXIS; i++) {
-        destination[i] = current_position[i];
-      }
-      feedrate = 0.0;
+  for(int8_t i=0; i < NUM_AXIS; i++) {
+    destination[i] = current_position[i];
+  }
+  feedrate = 0.0;
 
 #ifdef DELTA
-          // A delta can only safely home all axis at the same time
-          // all axis have to home at the same time
+      // A delta can only safely home all axis at the same time
+      // all axis have to home at the same time
 
-          // Move all carriages up together until the first endstop is hit.
-          current_position[X_AXIS] = 0;
-          current_position[Y_AXIS] = 0;
-          current_position[Z_AXIS] = 0;
-          plan_set_position(current_position[X_AXIS], current_position[Y_AXIS], current_position[Z_AXIS], current_position[E_AXIS]);
+      // Move all carriages up together until the first endstop is hit.
+      current_position[X_AXIS] = 0;
+      current_position[Y_AXIS] = 0;
+      current_position[Z_AXIS] = 0;
+      plan_set_position(current_position[X_AXIS], current_position[Y_AXIS], current_position[Z_AXIS], current_position[E_AXIS]);
 
-          destination[X_AXIS] = 3 * Z_MAX_LENGTH;
-          destination[Y_AXIS] = 3 * Z_MAX_LENGTH;
-          destination[Z_AXIS] = 3 * Z_MAX_LENGTH;
-          feedrate = 1.732 * homing_feedrate[X_AXIS];
-          plan_buffer_line(destination[X_AXIS], destination[Y_AXIS], destination[Z_AXIS], destination[E_AXIS], feedrate/60, active_extruder);
-          st_synchronize();
-          endstops_hit_on_purpose();
+      destination[X_AXIS] = 3 * Z_MAX_LENGTH;
+      destination[Y_AXIS] = 3 * Z_MAX_LENGTH;
+      destination[Z_AXIS] = 3 * Z_MAX_LENGTH;
+      feedrate = 1.732 * homing_feedrate[X_AXIS];
+      plan_buffer_line(destination[X_AXIS], destination[Y_AXIS], destination[Z_AXIS], destination[E_AXIS], feedrate/60, active_extruder);
+      st_synchronize();
+      endstops_hit_on_purpose();
 
-          current_position[X_AXIS] = destination[X_AXIS];
-          current_position[Y_AXIS] = destination[Y_AXIS];
-          current_position[Z_AXIS] = destination[Z_AXIS];
+      current_position[X_AXIS] = destination[X_AXIS];
+      current_position[Y_AXIS] = destination[Y_AXIS];
+      current_position[Z_AXIS] = destination[Z_AXIS];
 
-          // take care of back off and rehome now we are all at the top
-          HOMEAXIS(X);
-          HOMEAXIS(Y);
-          HOMEAXIS(Z);
+      // take care of back off and rehome now we are all at the top
+      HOMEAXIS(X);
+      HOMEAXIS(Y);
+      HOMEAXIS(Z);
 
-          calculate_delta(current_position);
-          plan_set_position(delta[X_AXIS], delta[Y_AXIS], delta[Z_AXIS], current_position[E_AXIS]);
+      calculate_delta(current_position);
+      plan_set_position(delta[X_AXIS], delta[Y_AXIS], delta[Z_AXIS], current_position[E_AXIS]);
 
 #else // NOT DELTA
 
-      home_all_axis = !((code_seen(axis_codes[X_AXIS])) || (code_seen(axis_codes[Y_AXIS])) || (code_seen(axis_codes[Z_AXIS])));
-
-      #if Z_HOME_DIR > 0                      // If homing away from BED do Z first
-      if((home_all_axis) || (code_seen(axis_codes[Z_AXIS]))) {
-        HOMEAXIS(Z);
-      }
-      #endif
+  home_all_axis = !((code_seen(axis_codes[X_AXIS])) || (code_seen(axis_codes[Y_AXIS])) || (code_seen(axis_codes[Z_AXIS])));
 
-      #ifdef QUICK_HOME
-      if((home_all_axis)||( code_seen(axis_codes[X_AXIS]) && code_seen(axis_codes[Y_AXIS])) )  //first diagonal move
-      {
-        current_position[X_AXIS] = 0;current_position[Y_AXIS] = 0;
+  #if Z_HOME_DIR > 0                      // If homing away from BED do Z first
+  if((home_all_axis) || (code_seen(axis_codes[Z_AXIS]))) {
+    HOMEAXIS(Z);
+  }
+  #endif
 
-       #ifndef DUAL_X_CARRIAGE
-        int x_axis_home_dir = home_dir(X_AXIS);
-       #else
-        int x_axis_home_dir = x_home_dir(active_extruder);
-        extruder_duplication_enabled = false;
-       #endif
+  #ifdef QUICK_HOME
+  if((home_all_axis)||( code_seen(axis_codes[X_AXIS]) && code_seen(axis_codes[Y_AXIS])) )  //first diagonal move
+  {
+    current_position[X_AXIS] = 0;current_position[Y_AXIS] = 0;
 
-        plan_set_position(current_position[X_AXIS], current_position[Y_AXIS], current_position[Z_AXIS], current_position[E_AXIS]);
-        destination[X_AXIS] = 1.5 * max_length(X_AXIS) * x_axis_home_dir;destination[Y_AXIS] = 1.5 * max_length(Y_AXIS) * home_dir(Y_AXIS);
-        feedrate = homing_feedrate[X_AXIS];
-        if(homing_feedrate[Y_AXIS]<feedrate)
-          feedrate = homing_feedrate[Y_AXIS];
-        if (max_length(X_AXIS) > max_length(Y_AXIS)) {
-          feedrate *= sqrt(pow(max_length(Y_AXIS) / max_length(X_AXIS), 2) + 1);
-        } else {
-          feedrate *= sqrt(pow(max_length(X_AXIS) / max_length(Y_AXIS), 2) + 1);
-        }
-        plan_buffer_line(destination[X_AXIS], destination[Y_AXIS], destination[Z_AXIS], destination[E_AXIS], feedrate/60, active_extruder);
-        st_synchronize();
+   #ifndef DUAL_X_CARRIAGE
+    int x_axis_home_dir = home_dir(X_AXIS);
+   #else
+    int x_axis_home_dir = x_home_dir(active_extruder);
+    extruder_duplication_enabled = false;
+   #endif
 
-        axis_is_at_home(X_AXIS);
-        axis_is_at_home(Y_AXIS);
-        plan_set_position(current_position[X_AXIS], current_position[Y_AXIS], current_position[Z_AXIS], current_position[E_AXIS]);
-        destination[X_AXIS] = current_position[X_AXIS];
-        destination[Y_AXIS] = current_position[Y_AXIS];
-        plan_buffer_line(destination[X_AXIS], destination[Y_AXIS], destination[Z_AXIS], destination[E_AXIS], feedrate/60, active_extruder);
-        feedrate = 0.0;
-        st_synchronize();
-        endstops_hit_on_purpose();
+    plan_set_position(current_position[X_AXIS], current_position[Y_AXIS], current_position[Z_AXIS], current_position[E_AXIS]);
+    destination[X_AXIS] = 1.5 * max_length(X_AXIS) * x_axis_home_dir;destination[Y_AXIS] = 1.5 * max_length(Y_AXIS) * home_dir(Y_AXIS);
+    feedrate = homing_feedrate[X_AXIS];
+    if(homing_feedrate[Y_AXIS]<feedrate)
+      feedrate = homing_feedrate[Y_AXIS];
+    if (max_length(X_AXIS) > max_length(Y_AXIS)) {
+      feedrate *= sqrt(pow(max_length(Y_AXIS) / max_length(X_AXIS), 2) + 1);
+    } else {
+      feedrate *= sqrt(pow(max_length(X_AXIS) / max_length(Y_AXIS), 2) + 1);
+    }
+    plan_buffer_line(destination[X_AXIS], destination[Y_AXIS], destination[Z_AXIS], destination[E_AXIS], feedrate/60, active_extruder);
+    st_synchronize();
 
-        current_position[X_AXIS] = destination[X_AXIS];
-        current_position[Y_AXIS] = destination[Y_AXIS];
-        //current_position[Z_AXIS] = destination[Z_AXIS];
-      }
-      #endif
+    axis_is_at_home(X_AXIS);
+    axis_is_at_home(Y_AXIS);
+    plan_set_position(current_position[X_AXIS], current_position[Y_AXIS], current_position[Z_AXIS], current_position[E_AXIS]);
+    destination[X_AXIS] = current_position[X_AXIS];
+    destination[Y_AXIS] = current_position[Y_AXIS];
+    plan_buffer_line(destination[X_AXIS], destination[Y_AXIS], destination[Z_AXIS], destination[E_AXIS], feedrate/60, active_extruder);
+    feedrate = 0.0;
+    st_synchronize();
+    endstops_hit_on_purpose();
 
-      if((home_all_axis) || (code_seen(axis_codes[X_AXIS])))
-      {
-      #ifdef DUAL_X_CARRIAGE
-        int tmp_extruder = active_extruder;
-        extruder_duplication_enabled = false;
-        active_extruder = !active_extruder;
-        HOMEAXIS(X);
-        inactive_extruder_x_pos = current_position[X_AXIS];
-        active_extruder = tmp_extruder;
-        HOMEAXIS(X);
-        // reset state used by the different modes
-        memcpy(raised_parked_position, current_position, sizeof(raised_parked_position));
-        delayed_move_time = 0;
-        active_extruder_parked = true;
-      #else
-        HOMEAXIS(X);
-      #endif
-      }
+    current_position[X_AXIS] = destination[X_AXIS];
+    current_position[Y_AXIS] = destination[Y_AXIS];
+    //current_position[Z_AXIS] = destination[Z_AXIS];
+  }
+  #endif
 
-      if((home_all_axis) || (code_seen(axis_codes[Y_AXIS]))) {
-        HOMEAXIS(Y);
-      }
+  if((home_all_axis) || (code_seen(axis_codes[X_AXIS])))
+  {
+  #ifdef DUAL_X_CARRIAGE
+    int tmp_extruder = active_extruder;
+    extruder_duplication_enabled = false;
+    active_extruder = !active_extruder;
+    HOMEAXIS(X);
+    inactive_extruder_x_pos = current_position[X_AXIS];
+    active_extruder = tmp_extruder;
+    HOMEAXIS(X);
+    // reset state used by the different modes
+    memcpy(raised_parked_position, current_position, sizeof(raised_parked_position));
+    delayed_move_time = 0;
+    active_extruder_parked = true;
+  #else
+    HOMEAXIS(X);
+  #endif
+  }
 
-      if(code_seen(axis_codes[X_AXIS]))
-      {
-        if(code_value_long() != 0) {
-          current_position[X_AXIS]=code_value()+add_homeing[0];
-        }
-      }
+  if((home_all_axis) || (code_seen(axis_codes[Y_AXIS]))) {
+    HOMEAXIS(Y);
+  }
 
-      if(code_seen(axis_codes[Y_AXIS])) {
-        if(code_value_long() != 0) {
-          current_position[Y_AXIS]=code_value()+add_homeing[1];
-        }
-      }
+  if(code_seen(axis_codes[X_AXIS]))
+  {
+    if(code_value_long() != 0) {
+      current_position[X_AXIS]=code_value()+add_homeing[0];
+    }
+  }
 
-      #if Z_HOME_DIR < 0                      // If homing towards BED do Z last
-        #ifndef Z_SAFE_HOMING
-          if((home_all_axis) || (code_seen(axis_codes[Z_AXIS]))) {
-            #if defined (Z_RAISE_BEFORE_HOMING) && (Z_RAISE_BEFORE_HOMING > 0)
-              destination[Z_AXIS] = Z_RAISE_BEFORE_HOMING * home_dir(Z_AXIS) * (-1);    // Set destination away from bed
-              feedrate = max_feedrate[Z_AXIS];
-              plan_buffer_line(destination[X_AXIS], destination[Y_AXIS], destination[Z_AXIS], destination[E_AXIS], feedrate, active_extruder);
-              st_synchronize();
-            #endif
-            HOMEAXIS(Z);
-          }
-        #else                      // Z Safe mode activated.
-          if(home_all_axis) {
-            destination[X_AXIS] = round(Z_SAFE_HOMING_X_POINT - X_PROBE_OFFSET_FROM_EXTRUDER);
-            destination[Y_AXIS] = round(Z_SAFE_HOMING_Y_POINT - Y_PROBE_OFFSET_FROM_EXTRUDER);
-            destination[Z_AXIS] = Z_RAISE_BEFORE_HOMING * home_dir(Z_AXIS) * (-1);    // Set destination away from bed
-            feedrate = XY_TRAVEL_SPEED;
-            current_position[Z_AXIS] = 0;
-
-            plan_set_position(current_position[X_AXIS], current_position[Y_AXIS], current_position[Z_AXIS], current_position[E_AXIS]);
-            plan_buffer_line(destination[X_AXIS], destination[Y_AXIS], destination[Z_AXIS], destination[E_AXIS], feedrate, active_extruder);
-            st_synchronize();
-            current_position[X_AXIS] = destination[X_AXIS];
-            current_position[Y_AXIS] = destination[Y_AXIS];
-
-            HOMEAXIS(Z);
-          }
-                                                // Let's see if X and Y are homed and probe is inside bed area.
-          if(code_seen(axis_codes[Z_AXIS])) {
-            if ( (axis_known_position[X_AXIS]) && (axis_known_position[Y_AXIS]) \
-              && (current_position[X_AXIS]+X_PROBE_OFFSET_FROM_EXTRUDER >= X_MIN_POS) \
-              && (current_position[X_AXIS]+X_PROBE_OFFSET_FROM_EXTRUDER <= X_MAX_POS) \
-              && (current_position[Y_AXIS]+Y_PROBE_OFFSET_FROM_EXTRUDER >= Y_MIN_POS) \
-              && (current_position[Y_AXIS]+Y_PROBE_OFFSET_FROM_EXTRUDER <= Y_MAX_POS)) {
-
-              current_position[Z_AXIS] = 0;
-              plan_set_position(current_position[X_AXIS], current_position[Y_AXIS], current_position[Z_AXIS], current_position[E_AXIS]);
-              destination[Z_AXIS] = Z_RAISE_BEFORE_HOMING * home_dir(Z_AXIS) * (-1);    // Set destination away from bed
-              feedrate = max_feedrate[Z_AXIS];
-              plan_buffer_line(destination[X_AXIS], destination[Y_AXIS], destination[Z_AXIS], destination[E_AXIS], feedrate, active_extruder);
-              st_synchronize();
-
-              HOMEAXIS(Z);
-            } else if (!((axis_known_position[X_AXIS]) && (axis_known_position[Y_AXIS]))) {
-                LCD_MESSAGEPGM(MSG_POSITION_UNKNOWN);
-                SERIAL_ECHO_START;
-                SERIAL_ECHOLNPGM(MSG_POSITION_UNKNOWN);
-            } else {
-                LCD_MESSAGEPGM(MSG_ZPROBE_OUT);
-                SERIAL_ECHO_START;
-                SERIAL_ECHOLNPGM(MSG_ZPROBE_OUT);
-            }
-          }
-        #endif
-      #endif
+  if(code_seen(axis_codes[Y_AXIS])) {
+    if(code_value_long() != 0) {
+      current_position[Y_AXIS]=code_value()+add_homeing[1];
+    }
+  }
 
+  #if Z_HOME_DIR < 0                      // If homing towards BED do Z last
+    #ifndef Z_SAFE_HOMING
+      if((home_all_axis) || (code_seen(axis_codes[Z_AXIS]))) {
+        #if defined (Z_RAISE_BEFORE_HOMING) && (Z_RAISE_BEFORE_HOMING > 0)
+          destination[Z_AXIS] = Z_RAISE_BEFORE_HOMING * home_dir(Z_AXIS) * (-1);    // Set destination away from bed
+          feedrate = max_feedrate[Z_AXIS];
+          plan_buffer_line(destination[X_AXIS], destination[Y_AXIS], destination[Z_AXIS], destination[E_AXIS], feedrate, active_extruder);
+          st_synchronize();
+        #endif
+        HOMEAXIS(Z);
+      }
+    #else                      // Z Safe mode activated.
+      if(home_all_axis) {
+        destination[X_AXIS] = round(Z_SAFE_HOMING_X_POINT - X_PROBE_OFFSET_FROM_EXTRUDER);
+        destination[Y_AXIS] = round(Z_SAFE_HOMING_Y_POINT - Y_PROBE_OFFSET_FROM_EXTRUDER);
+        destination[Z_AXIS] = Z_RAISE_BEFORE_HOMING * home_dir(Z_AXIS) * (-1);    // Set destination away from bed
+        feedrate = XY_TRAVEL_SPEED;
+        current_position[Z_AXIS] = 0;
 
+        plan_set_position(current_position[X_AXIS], current_position[Y_AXIS], current_position[Z_AXIS], current_position[E_AXIS]);
+        plan_buffer_line(destination[X_AXIS], destination[Y_AXIS], destination[Z_AXIS], destination[E_AXIS], feedrate, active_extruder);
+        st_synchronize();
+        current_position[X_AXIS] = destination[X_AXIS];
+        current_position[Y_AXIS] = destination[Y_AXIS];
 
+        HOMEAXIS(Z);
+      }
+                                            // Let's see if X and Y are homed and probe is inside bed area.
       if(code_seen(axis_codes[Z_AXIS])) {
-        if(code_value_long() != 0) {
-          current_position[Z_AXIS]=code_value()+add_homeing[2];
+        if ( (axis_known_position[X_AXIS]) && (axis_known_position[Y_AXIS]) \
+          && (current_position[X_AXIS]+X_PROBE_OFFSET_FROM_EXTRUDER >= X_MIN_POS) \
+          && (current_position[X_AXIS]+X_PROBE_OFFSET_FROM_EXTRUDER <= X_MAX_POS) \
+          && (current_position[Y_AXIS]+Y_PROBE_OFFSET_FROM_EXTRUDER >= Y_MIN_POS) \
+          && (current_position[Y_AXIS]+Y_PROBE_OFFSET_FROM_EXTRUDER <= Y_MAX_POS)) {
+
+          current_position[Z_AXIS] = 0;
+          plan_set_position(current_position[X_AXIS], current_position[Y_AXIS], current_position[Z_AXIS], current_position[E_AXIS]);
+          destination[Z_AXIS] = Z_RAISE_BEFORE_HOMING * home_dir(Z_AXIS) * (-1);    // Set destination away from bed
+          feedrate = max_feedrate[Z_AXIS];
+          plan_buffer_line(destination[X_AXIS], destination[Y_AXIS], destination[Z_AXIS], destination[E_AXIS], feedrate, active_extruder);
+          st_synchronize();
+
+          HOMEAXIS(Z);
+        } else if (!((axis_known_position[X_AXIS]) && (axis_known_position[Y_AXIS]))) {
+            LCD_MESSAGEPGM(MSG_POSITION_UNKNOWN);
+            SERIAL_ECHO_START;
+            SERIAL_ECHOLNPGM(MSG_POSITION_UNKNOWN);
+        } else {
+            LCD_MESSAGEPGM(MSG_ZPROBE_OUT);
+            SERIAL_ECHO_START;
+            SERIAL_ECHOLNPGM(MSG_ZPROBE_OUT);
         }
       }
-      #ifdef ENABLE_AUTO_BED_LEVELING
-        if((home_all_axis) || (code_seen(axis_codes[Z_AXIS]))) {
-          current_position[Z_AXIS] += zprobe_zoffset + zprobe_zoffset_delta;  //Add Z_Probe offset (the distance is negative)
-        }
-      #endif
-      plan_set_position(current_position[X_AXIS], current_position[Y_AXIS], current_position[Z_AXIS], current_position[E_AXIS]);
-#endif // else DELTA
-
-      #ifdef ENDSTOPS_ONLY_FOR_HOMING
-        enable_endstops(false);
-      #endif
+    #endif
+  #endif
 
-      feedrate = saved_feedrate;
-      feedmultiply = saved_feedmultiply;
-      previous_millis_cmd = millis();
-      endstops_hit_on_purpose();
-      break;
 
-#ifdef ENABLE_AUTO_BED_LEVELING
-    case 29: // G29 Detailed Z-Probe, probes the bed at 3 or more points.
-      if(Stopped == false) { // No movement if printer stopped
-            #if Z_MIN_PIN == -1
-            #error "You must have a Z_MIN endstop in order to enable Auto Bed Leveling feature!!! Z_MIN_PIN must point to a valid hardware pin."
-            #endif
-
-            // Prevent user from running a G29 without first homing in X and Y
-            if (! (axis_known_position[X_AXIS] && axis_known_position[Y_AXIS]) )
-            {
-                LCD_MESSAGEPGM(MSG_POSITION_UNKNOWN);
-                SERIAL_ECHO_START;
-                SERIAL_ECHOLNPGM(MSG_POSITION_UNKNOWN);
-                break; // abort G29, since we don't know where we are
-            }
 
-            st_synchronize();
-            // make sure the bed_level_rotation_matrix is identity or the planner will get it incorectly
-            //vector_3 corrected_position = plan_get_position_mm();
-            //corrected_position.debug("position before G29");
-            plan_bed_level_matrix.set_to_identity();
-            vector_3 uncorrected_position = plan_get_position();
-            //uncorrected_position.debug("position durring G29");
-            current_position[X_AXIS] = uncorrected_position.x;
-            current_position[Y_AXIS] = uncorrected_position.y;
-            current_position[Z_AXIS] = uncorrected_position.z;
-            plan_set_position(current_position[X_AXIS], current_position[Y_AXIS], current_position[Z_AXIS], current_position[E_AXIS]);
-            setup_for_endstop_move();
-
-            feedrate = homing_feedrate[Z_AXIS];
-#ifdef AUTO_BED_LEVELING_GRID
-            // probe at the points of a lattice grid
-
-            int xGridSpacing = (RIGHT_PROBE_BED_POSITION - LEFT_PROBE_BED_POSITION) / (AUTO_BED_LEVELING_GRID_POINTS-1);
-            int yGridSpacing = (BACK_PROBE_BED_POSITION - FRONT_PROBE_BED_POSITION) / (AUTO_BED_LEVELING_GRID_POINTS-1);
-
-
-            // solve the plane equation ax + by + d = z
-            // A is the matrix with rows [x y 1] for all the probed points
-            // B is the vector of the Z positions
-            // the normal vector to the plane is formed by the coefficients of the plane equation in the standard form, which is Vx*x+Vy*y+Vz*z+d = 0
-            // so Vx = -a Vy = -b Vz = 1 (we want the vector facing towards positive Z
-
-            // "A" matrix of the linear system of equations
-            double eqnAMatrix[AUTO_BED_LEVELING_GRID_POINTS*AUTO_BED_LEVELING_GRID_POINTS*3];
-            // "B" vector of Z points
-            double eqnBVector[AUTO_BED_LEVELING_GRID_POINTS*AUTO_BED_LEVELING_GRID_POINTS];
-
-
-            int probePointCounter = 0;
-            bool zig = true;
-
-            for (int yProbe=FRONT_PROBE_BED_POSITION; yProbe <= BACK_PROBE_BED_POSITION; yProbe += yGridSpacing)
-            {
-              int xProbe, xInc;
-              if (zig)
-              {
-                xProbe = LEFT_PROBE_BED_POSITION;
-                //xEnd = RIGHT_PROBE_BED_POSITION;
-                xInc = xGridSpacing;
-                zig = false;
-              } else // zag
-              {
-                xProbe = RIGHT_PROBE_BED_POSITION;
-                //xEnd = LEFT_PROBE_BED_POSITION;
-                xInc = -xGridSpacing;
-                zig = true;
-              }
+  if(code_seen(axis_codes[Z_AXIS])) {
+    if(code_value_long() != 0) {
+      current_position[Z_AXIS]=code_value()+add_homeing[2];
+    }
+  }
+  #ifdef ENABLE_AUTO_BED_LEVELING
+    if((home_all_axis) || (code_seen(axis_codes[Z_AXIS]))) {
+      current_position[Z_AXIS] += zprobe_zoffset + zprobe_zoffset_delta;  //Add Z_Probe offset (the distance is negative)
+    }
+  #endif
+  plan_set_position(current_position[X_AXIS], current_position[Y_AXIS], current_position[Z_AXIS], current_position[E_AXIS]);
+#endif // else DELTA
 
-              for (int xCount=0; xCount < AUTO_BED_LEVELING_GRID_POINTS; xCount++)
-              {
-                float z_before;
-                if (probePointCounter == 0)
-                {
-                  // raise before probing
-                  z_before = Z_RAISE_BEFORE_PROBING;
-                } else
-                {
-                  // raise extruder
-                  z_before = current_position[Z_AXIS] + Z_RAISE_BETWEEN_PROBINGS;
-                }
-
-                float measured_z = probe_pt(xProbe, yProbe, z_before);
-
-                eqnBVector[probePointCounter] = measured_z;
-
-                eqnAMatrix[probePointCounter + 0*AUTO_BED_LEVELING_GRID_POINTS*AUTO_BED_LEVELING_GRID_POINTS] = xProbe;
-                eqnAMatrix[probePointCounter + 1*AUTO_BED_LEVELING_GRID_POINTS*AUTO_BED_LEVELING_GRID_POINTS] = yProbe;
-                eqnAMatrix[probePointCounter + 2*AUTO_BED_LEVELING_GRID_POINTS*AUTO_BED_LEVELING_GRID_POINTS] = 1;
-                probePointCounter++;
-                xProbe += xInc;
-              }
-            }
-            clean_up_after_endstop_move();
+  #ifdef ENDSTOPS_ONLY_FOR_HOMING
+    enable_endstops(false);
+  #endif
 
-            // solve lsq problem
-            double *plane_equation_coefficients = qr_solve(AUTO_BED_LEVELING_GRID_POINTS*AUTO_BED_LEVELING_GRID_POINTS, 3, eqnAMatrix, eqnBVector);
+  feedrate = saved_feedrate;
+  feedmultiply = saved_feedmultiply;
+  previous_millis_cmd = millis();
+  endstops_hit_on_purpose();
+}
 
-            SERIAL_PROTOCOLPGM("Eqn coefficients: a: ");
-            SERIAL_PROTOCOL(plane_equation_coefficients[0]);
-            SERIAL_PROTOCOLPGM(" b: ");
-            SERIAL_PROTOCOL(plane_equation_coefficients[1]);
-            SERIAL_PROTOCOLPGM(" d: ");
-            SERIAL_PROTOCOLLN(plane_equation_coefficients[2]);
+#ifdef ENABLE_AUTO_BED_LEVELING
+// G29 Detailed Z-Probe, probes the bed at 3 or more points.
+static void gcode_G29()
+{
+  float x_tmp, y_tmp, z_tmp, real_z;
 
+  if(Stopped == false) { // No movement if printer stopped
+    #if Z_MIN_PIN == -1
+    #error "You must have a Z_MIN endstop in order to enable Auto Bed Leveling feature!!! Z_MIN_PIN must point to a valid hardware pin."
+    #endif
 
-            set_bed_level_equation_lsq(plane_equation_coefficients);
+    // Prevent user from running a G29 without first homing in X and Y
+    if (! (axis_known_position[X_AXIS] && axis_known_position[Y_AXIS]) )
+    {
+        LCD_MESSAGEPGM(MSG_POSITION_UNKNOWN);
+        SERIAL_ECHO_START;
+        SERIAL_ECHOLNPGM(MSG_POSITION_UNKNOWN);
+        return; // abort G29, since we don't know where we are
+    }
 
-            free(plane_equation_coefficients);
+    st_synchronize();
+    // make sure the bed_level_rotation_matrix is identity or the planner will get it incorectly
+    //vector_3 corrected_position = plan_get_position_mm();
+    //corrected_position.debug("position before G29");
+    plan_bed_level_matrix.set_to_identity();
+    vector_3 uncorrected_position = plan_get_position();
+    //uncorrected_position.debug("position durring G29");
+    current_position[X_AXIS] = uncorrected_position.x;
+    current_position[Y_AXIS] = uncorrected_position.y;
+    current_position[Z_AXIS] = uncorrected_position.z;
+    plan_set_position(current_position[X_AXIS], current_position[Y_AXIS], current_position[Z_AXIS], current_position[E_AXIS]);
+    setup_for_endstop_move();
 
-#else // AUTO_BED_LEVELING_GRID not defined
+    feedrate = homing_feedrate[Z_AXIS];
+#ifdef AUTO_BED_LEVELING_GRID
+    // probe at the points of a lattice grid
 
-            // Probe at 3 arbitrary points
-            // probe 1
-            float z_at_pt_1 = probe_pt(ABL_PROBE_PT_1_X, ABL_PROBE_PT_1_Y, Z_RAISE_BEFORE_PROBING);
+    int xGridSpacing = (RIGHT_PROBE_BED_POSITION - LEFT_PROBE_BED_POSITION) / (AUTO_BED_LEVELING_GRID_POINTS-1);
+    int yGridSpacing = (BACK_PROBE_BED_POSITION - FRONT_PROBE_BED_POSITION) / (AUTO_BED_LEVELING_GRID_POINTS-1);
 
-            // probe 2
-            float z_at_pt_2 = probe_pt(ABL_PROBE_PT_2_X, ABL_PROBE_PT_2_Y, current_position[Z_AXIS] + Z_RAISE_BETWEEN_PROBINGS);
 
-            // probe 3
-            float z_at_pt_3 = probe_pt(ABL_PROBE_PT_3_X, ABL_PROBE_PT_3_Y, current_position[Z_AXIS] + Z_RAISE_BETWEEN_PROBINGS);
+    // solve the plane equation ax + by + d = z
+    // A is the matrix with rows [x y 1] for all the probed points
+    // B is the vector of the Z positions
+    // the normal vector to the plane is formed by the coefficients of the plane equation in the standard form, which is Vx*x+Vy*y+Vz*z+d = 0
+    // so Vx = -a Vy = -b Vz = 1 (we want the vector facing towards positive Z
 
-            clean_up_after_endstop_move();
+    // "A" matrix of the linear system of equations
+    double eqnAMatrix[AUTO_BED_LEVELING_GRID_POINTS*AUTO_BED_LEVELING_GRID_POINTS*3];
+    // "B" vector of Z points
+    double eqnBVector[AUTO_BED_LEVELING_GRID_POINTS*AUTO_BED_LEVELING_GRID_POINTS];
 
-            set_bed_level_equation_3pts(z_at_pt_1, z_at_pt_2, z_at_pt_3);
 
+    int probePointCounter = 0;
+    bool zig = true;
 
-#endif // AUTO_BED_LEVELING_GRID
-            st_synchronize();
-
-            // The following code correct the Z height difference from z-probe position and hotend tip position.
-            // The Z height on homing is measured by Z-Probe, but the probe is quite far from the hotend.
-            // When the bed is uneven, this height must be corrected.
-            real_z = float(st_get_position(Z_AXIS))/axis_steps_per_unit[Z_AXIS];  //get the real Z (since the auto bed leveling is already correcting the plane)
-            x_tmp = current_position[X_AXIS] + X_PROBE_OFFSET_FROM_EXTRUDER;
-            y_tmp = current_position[Y_AXIS] + Y_PROBE_OFFSET_FROM_EXTRUDER;
-            z_tmp = current_position[Z_AXIS];
-
-            apply_rotation_xyz(plan_bed_level_matrix, x_tmp, y_tmp, z_tmp);         //Apply the correction sending the probe offset
-            current_position[Z_AXIS] = z_tmp - real_z + current_position[Z_AXIS];   //The difference is added to current position and sent to planner.
-            plan_set_position(current_position[X_AXIS], current_position[Y_AXIS], current_position[Z_AXIS], current_position[E_AXIS]);
-        }
-        break;
+    for (int yProbe=FRONT_PROBE_BED_POSITION; yProbe <= BACK_PROBE_BED_POSITION; yProbe += yGridSpacing)
+    {
+      int xProbe, xInc;
+      if (zig)
+      {
+        xProbe = LEFT_PROBE_BED_POSITION;
+        //xEnd = RIGHT_PROBE_BED_POSITION;
+        xInc = xGridSpacing;
+        zig = false;
+      } else // zag
+      {
+        xProbe = RIGHT_PROBE_BED_POSITION;
+        //xEnd = LEFT_PROBE_BED_POSITION;
+        xInc = -xGridSpacing;
+        zig = true;
+      }
 
-    case 30: // G30 Single Z Probe
+      for (int xCount=0; xCount < AUTO_BED_LEVELING_GRID_POINTS; xCount++)
+      {
+        float z_before;
+        if (probePointCounter == 0)
         {
-            engage_z_probe(); // Engage Z Servo endstop if available
-
-            st_synchronize();
-            // TODO: make sure the bed_level_rotation_matrix is identity or the planner will get set incorectly
-            setup_for_endstop_move();
-
-            feedrate = homing_feedrate[Z_AXIS];
+          // raise before probing
+          z_before = Z_RAISE_BEFORE_PROBING;
+        } else
+        {
+          // raise extruder
+          z_before = current_position[Z_AXIS] + Z_RAISE_BETWEEN_PROBINGS;
+        }
 
-            run_z_probe();
-            SERIAL_PROTOCOLPGM(MSG_BED);
-            SERIAL_PROTOCOLPGM(" X: ");
-            SERIAL_PROTOCOL(current_position[X_AXIS]);
-            SERIAL_PROTOCOLPGM(" Y: ");
-            SERIAL_PROTOCOL(current_position[Y_AXIS]);
-            SERIAL_PROTOCOLPGM(" Z: ");
-            SERIAL_PROTOCOL(current_position[Z_AXIS]);
-            SERIAL_PROTOCOLPGM("\n");
+        float measured_z = probe_pt(xProbe, yProbe, z_before);
 
-            clean_up_after_endstop_move();
+        eqnBVector[probePointCounter] = measured_z;
 
-            retract_z_probe(); // Retract Z Servo endstop if available
-        }
-        break;
-#endif // ENABLE_AUTO_BED_LEVELING
-    case 90: // G90
-      relative_mode = false;
-      break;
-    case 91: // G91
-      relative_mode = true;
-      break;
-    case 92: // G92
-      if(!code_seen(axis_codes[E_AXIS]))
-        st_synchronize();
-      for(int8_t i=0; i < NUM_AXIS; i++) {
-        if(code_seen(axis_codes[i])) {
-           if(i == E_AXIS) {
-             float e_pos = code_value();
-             lifetime_stats_update_e(e_pos);
-             current_position[i] = e_pos;
-             plan_set_e_position(current_position[E_AXIS]);
-           }
-           else {
-             current_position[i] = code_value()+add_homeing[i];
-             plan_set_position(current_position[X_AXIS], current_position[Y_AXIS], current_position[Z_AXIS], current_position[E_AXIS]);
-           }
-        }
+        eqnAMatrix[probePointCounter + 0*AUTO_BED_LEVELING_GRID_POINTS*AUTO_BED_LEVELING_GRID_POINTS] = xProbe;
+        eqnAMatrix[probePointCounter + 1*AUTO_BED_LEVELING_GRID_POINTS*AUTO_BED_LEVELING_GRID_POINTS] = yProbe;
+        eqnAMatrix[probePointCounter + 2*AUTO_BED_LEVELING_GRID_POINTS*AUTO_BED_LEVELING_GRID_POINTS] = 1;
+        probePointCounter++;
+        xProbe += xInc;
       }
-      break;
     }
-  }
+    clean_up_after_endstop_move();
 
-  else if(code_seen('M'))
-  {
-    switch( (int)code_value() )
-    {
+    // solve lsq problem
+    double *plane_equation_coefficients = qr_solve(AUTO_BED_LEVELING_GRID_POINTS*AUTO_BED_LEVELING_GRID_POINTS, 3, eqnAMatrix, eqnBVector);
 
+    SERIAL_PROTOCOLPGM("Eqn coefficients: a: ");
+    SERIAL_PROTOCOL(plane_equation_coefficients[0]);
+    SERIAL_PROTOCOLPGM(" b: ");
+    SERIAL_PROTOCOL(plane_equation_coefficients[1]);
+    SERIAL_PROTOCOLPGM(" d: ");
+    SERIAL_PROTOCOLLN(plane_equation_coefficients[2]);
 
-      DECLARE_HYSTERESIS_MCODES(98, 99)
 
-#ifdef ULTIPANEL
-    case 0: // M0 - Unconditional stop - Wait for user button press on LCD
-    case 1: // M1 - Conditional stop - Wait for user button press on LCD
-    {
-      LCD_MESSAGEPGM(MSG_USERWAIT);
-      codenum = 0;
-      if(code_seen('P')) codenum = code_value(); // milliseconds to wait
-      if(code_seen('S')) codenum = code_value() * 1000; // seconds to wait
+    set_bed_level_equation_lsq(plane_equation_coefficients);
 
-      st_synchronize();
-      previous_millis_cmd = millis();
-      if (codenum > 0){
-        codenum += millis();  // keep track of when we started waiting
-        #ifdef USE_EXTERNAL_CLICK
-          sendM613Click( true );
-        #endif
-        while(millis()  < codenum && !lcd_clicked()){
-          manage_heater();
-          manage_inactivity();
-          lcd_update();
-        }
-        #ifdef USE_EXTERNAL_CLICK
-          sendM613Click( false );
-        #endif
-      }else{
-        #ifdef USE_EXTERNAL_CLICK
-          sendM613Click( true );
-        #endif
-        while(!lcd_clicked()){
-          manage_heater();
-          manage_inactivity();
-          lcd_update();
-        }
-        #ifdef USE_EXTERNAL_CLICK
-          sendM613Click( false );
-        #endif
-      }
-      LCD_MESSAGEPGM(MSG_RESUMING);
-    }
-    break;
-#endif
-    case 17:
-        LCD_MESSAGEPGM(MSG_NO_MOVE);
-        enable_x();
-        enable_y();
-        enable_z();
-        enable_e0();
-        enable_e1();
-        enable_e2();
-      break;
+    free(plane_equation_coefficients);
 
-#ifdef SDSUPPORT
-    case 20: // M20 - list SD card
-      SERIAL_PROTOCOLLNPGM(MSG_BEGIN_FILE_LIST);
-      card.ls();
-      SERIAL_PROTOCOLLNPGM(MSG_END_FILE_LIST);
-      break;
-    case 21: // M21 - init SD card
+#else // AUTO_BED_LEVELING_GRID not defined
 
-      card.initsd();
+    // Probe at 3 arbitrary points
+    // probe 1
+    float z_at_pt_1 = probe_pt(ABL_PROBE_PT_1_X, ABL_PROBE_PT_1_Y, Z_RAISE_BEFORE_PROBING);
 
-      break;
-    case 22: //M22 - release SD card
-      card.release();
+    // probe 2
+    float z_at_pt_2 = probe_pt(ABL_PROBE_PT_2_X, ABL_PROBE_PT_2_Y, current_position[Z_AXIS] + Z_RAISE_BETWEEN_PROBINGS);
 
-      break;
-    case 23: //M23 - Select file
-      card.openFile(strchr_pointer + 4,true);
-      break;
-    case 24: //M24 - Start SD print
-      card.startFileprint();
-      starttime=millis();
-      break;
-    case 25: //M25 - Pause SD print
-      card.pauseSDPrint();
-      break;
-    case 26: //M26 - Set SD index
-      if(card.cardOK && code_seen('S')) {
-        card.setIndex(code_value_long());
-      }
-      break;
-    case 27: //M27 - Get SD status
-      card.getStatus();
-      break;
-    case 28: //M28 - Start SD write
-      card.openFile(strchr_pointer+4,false);
-      break;
-    case 29: //M29 - Stop SD write
-      //processed in write to file routine above
-      //card,saving = false;
-      break;
-    case 30: //M30 <filename> Delete File
-      if (card.cardOK){
-        card.closefile();
-        card.removeFile(strchr_pointer + 4);
-      }
-      break;
-    case 32: //M32 - Select file and start SD print
-    {
-      if(card.sdprinting) {
-        st_synchronize();
+    // probe 3
+    float z_at_pt_3 = probe_pt(ABL_PROBE_PT_3_X, ABL_PROBE_PT_3_Y, current_position[Z_AXIS] + Z_RAISE_BETWEEN_PROBINGS);
 
-      }
-      char* namestartpos = (strchr(strchr_pointer + 4,'!'));   //find ! to indicate filename string start.
-      if(namestartpos==NULL)
-      {
-        namestartpos=strchr_pointer + 4; //default name position, 4 letters after the M
-      }
-      else
-        namestartpos++; //to skip the '!'
-      bool call_procedure=(code_seen('P'));
+    clean_up_after_endstop_move();
 
-      if(strchr_pointer>namestartpos)
-        call_procedure=false;  //false alert, 'P' found within filename
+    set_bed_level_equation_3pts(z_at_pt_1, z_at_pt_2, z_at_pt_3);
 
-      if( card.cardOK )
-      {
-        card.openFile(namestartpos,true,!call_procedure);
-        if(code_seen('S'))
-          if(strchr_pointer<namestartpos) //only if "S" is occuring _before_ the filename
-            card.setIndex(code_value_long());
-        card.startFileprint();
-        if(!call_procedure)
-          starttime=millis(); //procedure calls count as normal print time.
-      }
-    } break;
-    case 928: //M928 - Start SD write
-      card.openLogFile(strchr_pointer+5);
-      break;
 
-#endif //SDSUPPORT
+#endif // AUTO_BED_LEVELING_GRID
 
-    case 31: //M31 take time since the start of the SD print or an M109 command
-      {
-      stoptime=millis();
-      char time[30];
-      unsigned long t=(stoptime-starttime)/1000;
-      int sec,min;
-      min=t/60;
-      sec=t%60;
-      sprintf_P(time, PSTR("%i min, %i sec"), min, sec);
-      SERIAL_ECHO_START;
-      SERIAL_ECHOLN(time);
-      lcd_setstatus(time);
-      autotempShutdown();
-      }
-      break;
-    case 42: //M42 -Change pin status via gcode
-      if (code_seen('S'))
-      {
-        int pin_status = code_value();
-        int pin_number = LED_PIN;
-        if (code_seen('P') && pin_status >= 0 && pin_status <= 255)
-          pin_number = code_value();
-        for(int8_t i = 0; i < (int8_t)(sizeof(sensitive_pins)/sizeof(int)); i++)
-        {
-          if (sensitive_pins[i] == pin_number)
-          {
-            pin_number = -1;
-            break;
-          }
-        }
-      #if defined(FAN_PIN) && FAN_PIN > -1
-        if (pin_number == FAN_PIN)
-          fanSpeed = pin_status;
-      #endif
-        if (pin_number > -1)
-        {
-          pinMode(pin_number, OUTPUT);
-          digitalWrite(pin_number, pin_status);
-          analogWrite(pin_number, pin_status);
-        }
-      }
-     break;
-     case 71: //M71
-      {
-        if(code_seen(')')) {
-           *(strchr_pointer)='\0';
-        }
-        if(code_seen('(')) {
-          strchr_pointer += 1;
-          lcd_setstatus(strchr_pointer);
-        }
+    st_synchronize();
 
-        codenum = 0;
-        if(code_seen('P')) codenum = code_value(); // milliseconds to wait
-        if(code_seen('S')) codenum = code_value() * 1000; // seconds to wait
-        lcd_ForceStatusScreen(true);
-        
-        st_synchronize();
-        previous_millis_cmd = millis();
-        if (codenum > 0){
-          codenum += millis();  // keep track of when we started waiting
-          #ifdef USE_EXTERNAL_CLICK
-          sendM613Click( true );
-          #endif
-          while(millis()  < codenum && !lcd_clicked()){
-            manage_heater();
-            manage_inactivity();
-            lcd_update();
-          }
-          #ifdef USE_EXTERNAL_CLICK
-          sendM613Click( false );
-          #endif
-        }else{
-          #ifdef USE_EXTERNAL_CLICK
-          sendM613Click( true );
-          #endif
-          while(!lcd_clicked()){
-            manage_heater();
-            manage_inactivity();
-            lcd_update();
-          }
-          #ifdef USE_EXTERNAL_CLICK
-          sendM613Click( false );
-          #endif
-        }
-        lcd_ForceStatusScreen(false);
+    // The following code correct the Z height difference from z-probe position and hotend tip position.
+    // The Z height on homing is measured by Z-Probe, but the probe is quite far from the hotend.
+    // When the bed is uneven, this height must be corrected.
+    real_z = float(st_get_position(Z_AXIS))/axis_steps_per_unit[Z_AXIS];  //get the real Z (since the auto bed leveling is already correcting the plane)
+    x_tmp = current_position[X_AXIS] + X_PROBE_OFFSET_FROM_EXTRUDER;
+    y_tmp = current_position[Y_AXIS] + Y_PROBE_OFFSET_FROM_EXTRUDER;
+    z_tmp = current_position[Z_AXIS];
 
-      }
-    case 104: // M104
-      if(setTargetedHotend(104)){
-        break;
-      }
-      if (code_seen('S')) {
-        if ( force_temp && ( code_value() != 0 ) ) {
-          setTargetHotend( forced_M104, tmp_extruder);
-        }
-        else {
-          setTargetHotend(code_value(), tmp_extruder);
-        }
-      }
-#ifdef DUAL_X_CARRIAGE
-      if (dual_x_carriage_mode == DXC_DUPLICATION_MODE && tmp_extruder == 0)
-        setTargetHotend1(code_value() == 0.0 ? 0.0 : code_value() + duplicate_extruder_temp_offset);
-#endif
-      setWatch();
-      break;
-    case 112: //  M112 -Emergency Stop
-      kill();
-      break;
-    case 140: // M140 set bed temp
-      if (code_seen('S')) setTargetBed(code_value());
-      break;
-    case 105 : // M105
-      if(setTargetedHotend(105)){
-        break;
-      }
-      #if defined(TEMP_0_PIN) && TEMP_0_PIN > -1
-        SERIAL_PROTOCOLPGM("ok T:");
-        SERIAL_PROTOCOL_F(degHotend(tmp_extruder),1);
-        SERIAL_PROTOCOLPGM(" /");
-        SERIAL_PROTOCOL_F(degTargetHotend(tmp_extruder),1);
-        #if defined(TEMP_BED_PIN) && TEMP_BED_PIN > -1
-          SERIAL_PROTOCOLPGM(" B:");
-          SERIAL_PROTOCOL_F(degBed(),1);
-          SERIAL_PROTOCOLPGM(" /");
-          SERIAL_PROTOCOL_F(degTargetBed(),1);
-        #endif //TEMP_BED_PIN
-        for (int8_t cur_extruder = 0; cur_extruder < EXTRUDERS; ++cur_extruder) {
-          SERIAL_PROTOCOLPGM(" T");
-          SERIAL_PROTOCOL(cur_extruder);
-          SERIAL_PROTOCOLPGM(":");
-          SERIAL_PROTOCOL_F(degHotend(cur_extruder),1);
-          SERIAL_PROTOCOLPGM(" /");
-          SERIAL_PROTOCOL_F(degTargetHotend(cur_extruder),1);
-        }
-      #else
-        SERIAL_ERROR_START;
-        SERIAL_ERRORLNPGM(MSG_ERR_NO_THERMISTORS);
-      #endif
+    apply_rotation_xyz(plan_bed_level_matrix, x_tmp, y_tmp, z_tmp);         //Apply the correction sending the probe offset
+    current_position[Z_AXIS] = z_tmp - real_z + current_position[Z_AXIS];   //The difference is added to current position and sent to planner.
+    plan_set_position(current_position[X_AXIS], current_position[Y_AXIS], current_position[Z_AXIS], current_position[E_AXIS]);
+  }
+}
 
-        SERIAL_PROTOCOLPGM(" @:");
-      #ifdef EXTRUDER_WATTS
-        SERIAL_PROTOCOL((EXTRUDER_WATTS * getHeaterPower(tmp_extruder))/127);
-        SERIAL_PROTOCOLPGM("W");
-      #else
-        SERIAL_PROTOCOL(getHeaterPower(tmp_extruder));
-      #endif
+// G30 Single Z Probe
+static void gcode_G30()
+{
+  engage_z_probe(); // Engage Z Servo endstop if available
 
-        SERIAL_PROTOCOLPGM(" B@:");
-      #ifdef BED_WATTS
-        SERIAL_PROTOCOL((BED_WATTS * getHeaterPower(-1))/127);
-        SERIAL_PROTOCOLPGM("W");
-      #else
-        SERIAL_PROTOCOL(getHeaterPower(-1));
-      #endif
+  st_synchronize();
+  // TODO: make sure the bed_level_rotation_matrix is identity or the planner will get set incorectly
+  setup_for_endstop_move();
 
-        #ifdef SHOW_TEMP_ADC_VALUES
-          #if defined(TEMP_BED_PIN) && TEMP_BED_PIN > -1
-            SERIAL_PROTOCOLPGM("    ADC B:");
-            SERIAL_PROTOCOL_F(degBed(),1);
-            SERIAL_PROTOCOLPGM("C->");
-            SERIAL_PROTOCOL_F(rawBedTemp()/OVERSAMPLENR,0);
-          #endif
-          for (int8_t cur_extruder = 0; cur_extruder < EXTRUDERS; ++cur_extruder) {
-            SERIAL_PROTOCOLPGM("  T");
-            SERIAL_PROTOCOL(cur_extruder);
-            SERIAL_PROTOCOLPGM(":");
-            SERIAL_PROTOCOL_F(degHotend(cur_extruder),1);
-            SERIAL_PROTOCOLPGM("C->");
-            SERIAL_PROTOCOL_F(rawHotendTemp(cur_extruder)/OVERSAMPLENR,0);
-          }
-        #endif
+  feedrate = homing_feedrate[Z_AXIS];
 
-        SERIAL_PROTOCOLLN("");
-      return;
-      break;
-    case 109:
-    {// M109 - Wait for extruder heater to reach target.
-      if(setTargetedHotend(109)){
-        break;
-      }
-      LCD_MESSAGEPGM(MSG_HEATING);
-      #ifdef AUTOTEMP
-        autotemp_enabled=false;
-      #endif
-      if (code_seen('S')) {
-        if ( force_temp && ( code_value() != 0.0 )) {
-          setTargetHotend(forced_M109, tmp_extruder);
-        } else {
-          setTargetHotend(code_value(), tmp_extruder);
-        }
+  run_z_probe();
+  SERIAL_PROTOCOLPGM(MSG_BED);
+  SERIAL_PROTOCOLPGM(" X: ");
+  SERIAL_PROTOCOL(current_position[X_AXIS]);
+  SERIAL_PROTOCOLPGM(" Y: ");
+  SERIAL_PROTOCOL(current_position[Y_AXIS]);
+  SERIAL_PROTOCOLPGM(" Z: ");
+  SERIAL_PROTOCOL(current_position[Z_AXIS]);
+  SERIAL_PROTOCOLPGM("\n");
 
-#ifdef DUAL_X_CARRIAGE
-        if (dual_x_carriage_mode == DXC_DUPLICATION_MODE && tmp_extruder == 0)
-          if ( force_temp && ( code_value() != 0.0 ) ) {
-            setTargetHotend1(forced_M109 == 0.0 ? 0.0 : forced_M109 + duplicate_extruder_temp_offset);
-          } else {
-            setTargetHotend1(code_value() == 0.0 ? 0.0 : code_value() + duplicate_extruder_temp_offset);
-          }
-#endif          
-        CooldownNoWait = true;
-      } else if (code_seen('R')) {
-        if ( force_temp && ( code_value() != 0.0 )) {
-          setTargetHotend(forced_M109, tmp_extruder);
-        } else {
-          setTargetHotend(code_value(), tmp_extruder);
-        }
-#ifdef DUAL_X_CARRIAGE
-        if (dual_x_carriage_mode == DXC_DUPLICATION_MODE && tmp_extruder == 0)
-          if ( force_temp && ( code_value() != 0.0 ) ) {
-            setTargetHotend1(forced_M109 == 0.0 ? 0.0 : code_value() + duplicate_extruder_temp_offset);
-          } else {
-            setTargetHotend1(code_value() == 0.0 ? 0.0 : code_value() + duplicate_extruder_temp_offset);
-          }
-#endif
-        CooldownNoWait = false;
-      }
-      #ifdef AUTOTEMP
-        if (code_seen('S')) {
-          if ( force_temp && ( code_value() != 0.0 ) ) {
-            autotemp_min=forced_M109;
-          } else { 
-            autotemp_min=code_value();
-          }
-        }
-        if (code_seen('B')) autotemp_max=code_value();
-        if (code_seen('F'))
-        {
-          autotemp_factor=code_value();
-          autotemp_enabled=true;
-        }
-      #endif
+  clean_up_after_endstop_move();
 
-      setWatch();
-      codenum = millis();
+  retract_z_probe(); // Retract Z Servo endstop if available
+}
 
-      /* See if we are heating up or cooling down */
-      target_direction = isHeatingHotend(tmp_extruder); // true if heating, false if cooling
+#endif //ENABLE_AUTO_BED_LEVELING
 
-      cancel_heatup = false;
+// G90 - Use Absolute Coordinates
+static void gcode_G90()
+{
+  relative_mode = false;
+}
 
-      #ifdef TEMP_RESIDENCY_TIME
-        long residencyStart;
-        residencyStart = -1;
-        /* continue to loop until we have reached the target temp
-          _and_ until TEMP_RESIDENCY_TIME hasn't passed since we reached it */
-        while((!cancel_heatup)&&((residencyStart == -1) ||
-              (residencyStart >= 0 && (((unsigned int) (millis() - residencyStart)) < (TEMP_RESIDENCY_TIME * 1000UL)))) ) {
-      #else
-        while ( target_direction ? (isHeatingHotend(tmp_extruder)) : (isCoolingHotend(tmp_extruder)&&(CooldownNoWait==false)) ) {
-      #endif //TEMP_RESIDENCY_TIME
-          if( (millis() - codenum) > 1000UL )
-          { //Print Temp Reading and remaining time every 1 second while heating up/cooling down
-            SERIAL_PROTOCOLPGM("T:");
-            SERIAL_PROTOCOL_F(degHotend(tmp_extruder),1);
-            SERIAL_PROTOCOLPGM(" E:");
-            SERIAL_PROTOCOL((int)tmp_extruder);
-            #ifdef TEMP_RESIDENCY_TIME
-              SERIAL_PROTOCOLPGM(" W:");
-              if(residencyStart > -1)
-              {
-                 codenum = ((TEMP_RESIDENCY_TIME * 1000UL) - (millis() - residencyStart)) / 1000UL;
-                 SERIAL_PROTOCOLLN( codenum );
-              }
-              else
-              {
-                 SERIAL_PROTOCOLLN( "?" );
-              }
-            #else
-              SERIAL_PROTOCOLLN("");
-            #endif
-            #ifdef USE_EXTERNAL_CLICK
-            sendM613Status( false );
-            #endif
-            codenum = millis();
-          }
-          manage_heater();
-          manage_inactivity();
-          lcd_update();
+// G91 - Use Relative Coordinates
+static void gcode_G91()
+{
+  relative_mode = true;
+}
+
+// G92 - Set current position to coordinates given
+static void gcode_G92()
+{
+  if(!code_seen(axis_codes[E_AXIS]))
+    st_synchronize();
+  for(int8_t i=0; i < NUM_AXIS; i++) {
+    if(code_seen(axis_codes[i])) {
+       if(i == E_AXIS) {
+         float e_pos = code_value();
+         lifetime_stats_update_e(e_pos);
+         current_position[i] = e_pos;
+         plan_set_e_position(current_position[E_AXIS]);
+       }
+       else {
+         current_position[i] = code_value()+add_homeing[i];
+         plan_set_position(current_position[X_AXIS], current_position[Y_AXIS], current_position[Z_AXIS], current_position[E_AXIS]);
+       }
+    }
+  }
+}
+
+#ifdef ULTIPANEL
+// M0 - Unconditional stop - Wait for user button press on LCD
+// M1 - Conditional stop - Wait for user button press on LCD
+static void gcode_M0_M1()
+{
+  unsigned long codenum;
+  LCD_MESSAGEPGM(MSG_USERWAIT);
+  codenum = 0;
+  if(code_seen('P')) codenum = code_value(); // milliseconds to wait
+  if(code_seen('S')) codenum = code_value() * 1000; // seconds to wait
+
+  st_synchronize();
+  previous_millis_cmd = millis();
+  if (codenum > 0){
+    codenum += millis();  // keep track of when we started waiting
+    #ifdef USE_EXTERNAL_CLICK
+      sendM613Click( true );
+    #endif
+    while(millis()  < codenum && !lcd_clicked()){
+      manage_heater();
+      manage_inactivity();
+      lcd_update();
+    }
+    #ifdef USE_EXTERNAL_CLICK
+      sendM613Click( false );
+    #endif
+  }else{
+    #ifdef USE_EXTERNAL_CLICK
+      sendM613Click( true );
+    #endif
+    while(!lcd_clicked()){
+      manage_heater();
+      manage_inactivity();
+      lcd_update();
+    }
+    #ifdef USE_EXTERNAL_CLICK
+      sendM613Click( false );
+    #endif
+  }
+  LCD_MESSAGEPGM(MSG_RESUMING);
+}
+
+#endif //ULTIPANEL
+
+// M17 - Enable/Power all stepper motors
+static void gcode_M17()
+{
+  LCD_MESSAGEPGM(MSG_NO_MOVE);
+  enable_x();
+  enable_y();
+  enable_z();
+  enable_e0();
+  enable_e1();
+  enable_e2();
+}
+
+#ifdef SDSUPPORT
+// M20 - list SD card
+static void gcode_M20()
+{
+  SERIAL_PROTOCOLLNPGM(MSG_BEGIN_FILE_LIST);
+  card.ls();
+  SERIAL_PROTOCOLLNPGM(MSG_END_FILE_LIST);
+}
+
+// M21 - init SD card
+static void gcode_M21()
+{
+  card.initsd();
+}
+
+// M22 - release SD card
+static void gcode_M22()
+{
+  card.release();
+}
+
+// M23 - Select file
+static void gcode_M23()
+{
+  card.openFile(strchr_pointer + 4,true);
+}
+
+// M24 - Start SD print
+static void gcode_M24()
+{
+  card.startFileprint();
+  starttime=millis();
+}
+
+// M25 - Pause SD print
+static void gcode_M25()
+{
+  card.pauseSDPrint();
+}
+
+// M26 - Set SD index
+static void gcode_M26()
+{
+  if(card.cardOK && code_seen('S')) {
+    card.setIndex(code_value_long());
+  }
+}
+
+// M27 - Get SD status
+static void gcode_M27()
+{
+  card.getStatus();
+}
+
+// M28 - Start SD write
+static void gcode_M28()
+{
+  card.openFile(strchr_pointer+4,false);
+}
+
+// M29 - Stop SD write
+static void gcode_M29()
+{
+  //processed in write to file routine above
+  //card,saving = false;
+}
+
+// M30 <filename> Delete File
+static void gcode_M30()
+{
+  if (card.cardOK){
+    card.closefile();
+    card.removeFile(strchr_pointer + 4);
+  }
+}
+
+// M32 - Select file and start SD print
+static void gcode_M32()
+{
+  if(card.sdprinting) {
+    st_synchronize();
+
+  }
+  char* namestartpos = (strchr(strchr_pointer + 4,'!'));   //find ! to indicate filename string start.
+  if(namestartpos==NULL)
+  {
+    namestartpos=strchr_pointer + 4; //default name position, 4 letters after the M
+  }
+  else
+    namestartpos++; //to skip the '!'
+  bool call_procedure=(code_seen('P'));
+
+  if(strchr_pointer>namestartpos)
+    call_procedure=false;  //false alert, 'P' found within filename
+
+  if( card.cardOK )
+  {
+    card.openFile(namestartpos,true,!call_procedure);
+    if(code_seen('S'))
+      if(strchr_pointer<namestartpos) //only if "S" is occuring _before_ the filename
+        card.setIndex(code_value_long());
+    card.startFileprint();
+    if(!call_procedure)
+      starttime=millis(); //procedure calls count as normal print time.
+  }
+}
+
+// M928 - Start SD write
+static void gcode_M928()
+{
+  card.openLogFile(strchr_pointer+5);
+}
+
+#ifdef POWER_LOSS_RECOVERY
+// M1000 - Report the checkpoint of an interrupted SD print, S1 resumes it.
+// S1 heats up, lifts Z off the print and queues G28 X0 Y0 and M1000 S2,
+// which goes back to the checkpoint and prints on from there. Any other S
+// only reports, and S2 is refused unless it is the one S1 queued: the axes
+// are not homed otherwise.
+static bool resume_homing = false; // M1000 S1 queued G28 X0 Y0 and M1000 S2
+
+static void gcode_M1000()
+{
+  power_loss_state state;
+  const char *path = power_loss_load(state);
+  long step = code_seen('S') ? code_value_long() : 0;
+  if(step == 2 && !resume_homing) {
+    SERIAL_ERROR_START;
+    SERIAL_ERRORLNPGM("M1000 S2 only goes on from M1000 S1");
+    return;
+  }
+  if(step == 2)
+    resume_homing = false;
+  if((step != 1 && step != 2) || path == NULL) {
+    power_loss_report();
+    return;
+  }
+  if(!card.cardOK) {
+    SERIAL_ECHO_START;
+    SERIAL_ECHOLNPGM(MSG_SD_INIT_FAIL);
+    return;
+  }
+  if(step == 1) {
+    LCD_MESSAGEPGM(MSG_HEATING);
+    setTargetBed(state.target_temperature_bed);
+    for(int8_t e = 0; e < EXTRUDERS; e++)
+      setTargetHotend(state.target_temperature[e], e);
+    cancel_heatup = false;
+    for(int8_t e = 0; e < EXTRUDERS; e++)
+      while(!cancel_heatup && (isHeatingHotend(e) || isHeatingBed())) {
+        manage_heater();
+        manage_inactivity();
+        lcd_update();
+      }
+    previous_millis_cmd = millis();
+    // the print is still where the power loss left it, Z too. G28 X0 Y0 homes
+    // without bed leveling, so Z is the height the leveling of the print gave
+    // the checkpoint.
+    float z = state.position[Z_AXIS];
+    #ifdef ENABLE_AUTO_BED_LEVELING
+      plan_bed_level_matrix.set_to_identity();
+      matrix_3x3 bed_level;
+      memcpy(bed_level.matrix, state.bed_level, sizeof(bed_level.matrix));
+      float x = state.position[X_AXIS], y = state.position[Y_AXIS];
+      apply_rotation_xyz(bed_level, x, y, z);
+    #endif
+    current_position[Z_AXIS] = z;
+    plan_set_position(current_position[X_AXIS], current_position[Y_AXIS], current_position[Z_AXIS], current_position[E_AXIS]);
+    current_position[Z_AXIS] = min(z + POWER_LOSS_Z_LIFT, max_pos[Z_AXIS]);
+    plan_buffer_line(current_position[X_AXIS], current_position[Y_AXIS], current_position[Z_AXIS], current_position[E_AXIS], homing_feedrate[Z_AXIS]/60, active_extruder);
+    #if EXTRUDERS > 1
+      if(state.active_extruder != active_extruder) {
+        char cmd[4];
+        sprintf_P(cmd, PSTR("T%d"), state.active_extruder);
+        enquecommand(cmd);
+      }
+    #endif
+    enquecommand_P(PSTR("G28 X0 Y0"));
+    enquecommand_P(PSTR("M1000 S2"));
+    resume_homing = true;
+    return;
+  }
+  // openFile() starts a new job over the one path belongs to
+  char name[POWER_LOSS_PATH_LENGTH];
+  strcpy(name, path);
+  #ifdef ENABLE_AUTO_BED_LEVELING
+    // G28 X0 Y0 has reset the bed leveling, the print goes on with its own
+    st_synchronize();
+    memcpy(plan_bed_level_matrix.matrix, state.bed_level, sizeof(state.bed_level));
+    vector_3 corrected_position = plan_get_position();
+    current_position[X_AXIS] = corrected_position.x;
+    current_position[Y_AXIS] = corrected_position.y;
+    current_position[Z_AXIS] = corrected_position.z;
+    plan_set_position(current_position[X_AXIS], current_position[Y_AXIS], current_position[Z_AXIS], current_position[E_AXIS]);
+  #endif
+  plan_buffer_line(state.position[X_AXIS], state.position[Y_AXIS], current_position[Z_AXIS], current_position[E_AXIS], homing_feedrate[X_AXIS]/60, active_extruder);
+  plan_buffer_line(state.position[X_AXIS], state.position[Y_AXIS], state.position[Z_AXIS], current_position[E_AXIS], homing_feedrate[Z_AXIS]/60, active_extruder);
+  memcpy(current_position, state.position, sizeof(current_position));
+  plan_set_e_position(current_position[E_AXIS]);
+  feedrate = state.feedrate;
+  feedmultiply = state.feedmultiply;
+  fanSpeed = state.fan_speed;
+  relative_mode = state.relative_mode;
+  axis_relative_modes[E_AXIS] = state.relative_e;
+  card.openFile(name, true);
+  if(!card.isFileOpen())
+    return;
+  card.setIndex(state.file_pos);
+  card.startFileprint();
+  starttime = millis();
+}
+#endif //POWER_LOSS_RECOVERY
+
+#endif //SDSUPPORT
+
+// M31 take time since the start of the SD print or an M109 command
+static void gcode_M31()
+{
+  stoptime=millis();
+  char time[30];
+  unsigned long t=(stoptime-starttime)/1000;
+  int sec,min;
+  min=t/60;
+  sec=t%60;
+  sprintf_P(time, PSTR("%i min, %i sec"), min, sec);
+  SERIAL_ECHO_START;
+  SERIAL_ECHOLN(time);
+  lcd_setstatus(time);
+  autotempShutdown();
+}
+
+// M42 -Change pin status via gcode
+static void gcode_M42()
+{
+  if (code_seen('S'))
+  {
+    int pin_status = code_value();
+    int pin_number = LED_PIN;
+    if (code_seen('P') && pin_status >= 0 && pin_status <= 255)
+      pin_number = code_value();
+    for(int8_t i = 0; i < (int8_t)(sizeof(sensitive_pins)/sizeof(int)); i++)
+    {
+      if (sensitive_pins[i] == pin_number)
+      {
+        pin_number = -1;
+        break;
+      }
+    }
+  #if defined(FAN_PIN) && FAN_PIN > -1
+    if (pin_number == FAN_PIN)
+      fanSpeed = pin_status;
+  #endif
+    if (pin_number > -1)
+    {
+      pinMode(pin_number, OUTPUT);
+      digitalWrite(pin_number, pin_status);
+      analogWrite(pin_number, pin_status);
+    }
+  }
+}
+
+// M71 - Wait for user input displaing message (M71 (message))
+static void gcode_M71()
+{
+  unsigned long codenum;
+  if(code_seen(')')) {
+     *(strchr_pointer)='\0';
+     scan_command(); // the letters behind it are gone
+  }
+  if(code_seen('(')) {
+    strchr_pointer += 1;
+    lcd_setstatus(strchr_pointer);
+  }
+
+  codenum = 0;
+  if(code_seen('P')) codenum = code_value(); // milliseconds to wait
+  if(code_seen('S')) codenum = code_value() * 1000; // seconds to wait
+  lcd_ForceStatusScreen(true);
+
+  st_synchronize();
+  previous_millis_cmd = millis();
+  if (codenum > 0){
+    codenum += millis();  // keep track of when we started waiting
+    #ifdef USE_EXTERNAL_CLICK
+    sendM613Click( true );
+    #endif
+    while(millis()  < codenum && !lcd_clicked()){
+      manage_heater();
+      manage_inactivity();
+      lcd_update();
+    }
+    #ifdef USE_EXTERNAL_CLICK
+    sendM613Click( false );
+    #endif
+  }else{
+    #ifdef USE_EXTERNAL_CLICK
+    sendM613Click( true );
+    #endif
+    while(!lcd_clicked()){
+      manage_heater();
+      manage_inactivity();
+      lcd_update();
+    }
+    #ifdef USE_EXTERNAL_CLICK
+    sendM613Click( false );
+    #endif
+  }
+  lcd_ForceStatusScreen(false);
+}
+
+// M104 - Set extruder target temp
+static void gcode_M104()
+{
+  if(setTargetedHotend(104)){
+    return;
+  }
+  if (code_seen('S')) {
+    if ( force_temp && ( code_value() != 0 ) ) {
+      setTargetHotend( forced_M104, tmp_extruder);
+    }
+    else {
+      setTargetHotend(code_value(), tmp_extruder);
+    }
+  }
+#ifdef DUAL_X_CARRIAGE
+  if (dual_x_carriage_mode == DXC_DUPLICATION_MODE && tmp_extruder == 0)
+    setTargetHotend1(code_value() == 0.0 ? 0.0 : code_value() + duplicate_extruder_temp_offset);
+#endif
+
+  setWatch();
+}
+
+// M112 -Emergency Stop
+static void gcode_M112()
+{
+  kill();
+}
+
+// M140 set bed temp
+static void gcode_M140()
+{
+  if (code_seen('S')) setTargetBed(code_value());
+}
+
+// M105 - Read current temp
+static void gcode_M105()
+{
+  if(setTargetedHotend(105)){
+    return;
+  }
+  #if defined(TEMP_0_PIN) && TEMP_0_PIN > -1
+    SERIAL_PROTOCOLPGM(MSG_OK);
+  #endif
+  print_heaterstates(tmp_extruder);
+  command_acked = true;
+}
+
+// M109 - Wait for extruder heater to reach target.
+static void gcode_M109()
+{
+  unsigned long codenum;
+  if(setTargetedHotend(109)){
+    return;
+  }
+  LCD_MESSAGEPGM(MSG_HEATING);
+  #ifdef AUTOTEMP
+    autotemp_enabled=false;
+  #endif
+  if (code_seen('S')) {
+    if ( force_temp && ( code_value() != 0.0 )) {
+      setTargetHotend(forced_M109, tmp_extruder);
+    } else {
+      setTargetHotend(code_value(), tmp_extruder);
+    }
+
+#ifdef DUAL_X_CARRIAGE
+    if (dual_x_carriage_mode == DXC_DUPLICATION_MODE && tmp_extruder == 0)
+      if ( force_temp && ( code_value() != 0.0 ) ) {
+        setTargetHotend1(forced_M109 == 0.0 ? 0.0 : forced_M109 + duplicate_extruder_temp_offset);
+      } else {
+        setTargetHotend1(code_value() == 0.0 ? 0.0 : code_value() + duplicate_extruder_temp_offset);
+      }
+#endif          
+
+    CooldownNoWait = true;
+  } else if (code_seen('R')) {
+    if ( force_temp && ( code_value() != 0.0 )) {
+      setTargetHotend(forced_M109, tmp_extruder);
+    } else {
+      setTargetHotend(code_value(), tmp_extruder);
+    }
+#ifdef DUAL_X_CARRIAGE
+    if (dual_x_carriage_mode == DXC_DUPLICATION_MODE && tmp_extruder == 0)
+      if ( force_temp && ( code_value() != 0.0 ) ) {
+        setTargetHotend1(forced_M109 == 0.0 ? 0.0 : code_value() + duplicate_extruder_temp_offset);
+      } else {
+        setTargetHotend1(code_value() == 0.0 ? 0.0 : code_value() + duplicate_extruder_temp_offset);
+      }
+#endif
+
+    CooldownNoWait = false;
+  }
+  #ifdef AUTOTEMP
+    if (code_seen('S')) {
+      if ( force_temp && ( code_value() != 0.0 ) ) {
+        autotemp_min=forced_M109;
+      } else { 
+        autotemp_min=code_value();
+      }
+    }
+    if (code_seen('B')) autotemp_max=code_value();
+    if (code_seen('F'))
+    {
+      autotemp_factor=code_value();
+      autotemp_enabled=true;
+    }
+  #endif
+
+  setWatch();
+  codenum = millis();
+
+  /* See if we are heating up or cooling down */
+  target_direction = isHeatingHotend(tmp_extruder); // true if heating, false if cooling
+
+  cancel_heatup = false;
+
+  #ifdef TEMP_RESIDENCY_TIME
+    long residencyStart;
+    residencyStart = -1;
+    /* continue to loop until we have reached the target temp
+      _and_ until TEMP_RESIDENCY_TIME hasn't passed since we reached it */
+    while((!cancel_heatup)&&((residencyStart == -1) ||
+          (residencyStart >= 0 && (((unsigned int) (millis() - residencyStart)) < (TEMP_RESIDENCY_TIME * 1000UL)))) ) {
+  #else
+    while ( target_direction ? (isHeatingHotend(tmp_extruder)) : (isCoolingHotend(tmp_extruder)&&(CooldownNoWait==false)) ) {
+  #endif //TEMP_RESIDENCY_TIME
+      if( (millis() - codenum) > 1000UL )
+      { //Print Temp Reading and remaining time every 1 second while heating up/cooling down
+        SERIAL_PROTOCOLPGM("T:");
+        SERIAL_PROTOCOL_F(degHotend(tmp_extruder),1);
+        SERIAL_PROTOCOLPGM(" E:");
+        SERIAL_PROTOCOL((int)tmp_extruder);
         #ifdef TEMP_RESIDENCY_TIME
-            /* start/restart the TEMP_RESIDENCY_TIME timer whenever we reach target temp for the first time
-              or when current temp falls outside the hysteresis after target temp was reached */
-          if ((residencyStart == -1 &&  target_direction && (degHotend(tmp_extruder) >= (degTargetHotend(tmp_extruder)-TEMP_WINDOW))) ||
-              (residencyStart == -1 && !target_direction && (degHotend(tmp_extruder) <= (degTargetHotend(tmp_extruder)+TEMP_WINDOW))) ||
-              (residencyStart > -1 && labs(degHotend(tmp_extruder) - degTargetHotend(tmp_extruder)) > TEMP_HYSTERESIS) )
+          SERIAL_PROTOCOLPGM(" W:");
+          if(residencyStart > -1)
           {
-            residencyStart = millis();
+             codenum = ((TEMP_RESIDENCY_TIME * 1000UL) - (millis() - residencyStart)) / 1000UL;
+             SERIAL_PROTOCOLLN( codenum );
           }
-        #endif //TEMP_RESIDENCY_TIME
-        }
-        LCD_MESSAGEPGM(MSG_HEATING_COMPLETE);
-        starttime=millis();
-        previous_millis_cmd = millis();
-      }
-      break;
-    case 190: // M190 - Wait for bed heater to reach target.
-    #if defined(TEMP_BED_PIN) && TEMP_BED_PIN > -1
-        LCD_MESSAGEPGM(MSG_BED_HEATING);
-        if (code_seen('S')) {
-          if ( force_temp && ( code_value() != 0.0 ) ) {
-            setTargetBed( forced_M190 );
-          } else {
-            setTargetBed(code_value());
-          }
-          CooldownNoWait = true;
-        } else if (code_seen('R')) {
-          if  ( force_temp && ( code_value() != 0.0 ) ) {
-            setTargetBed( forced_M190 );
-          } else {
-            setTargetBed(code_value());
+          else
+          {
+             SERIAL_PROTOCOLLN( "?" );
           }
-          CooldownNoWait = false;
-        }
+        #else
+          SERIAL_PROTOCOLLN("");
+        #endif
+        #ifdef USE_EXTERNAL_CLICK
+        sendM613Status( false );
+        #endif
         codenum = millis();
-        
-        cancel_heatup = false;
-        target_direction = isHeatingBed(); // true if heating, false if cooling
+      }
+      manage_heater();
+      manage_inactivity();
+      lcd_update();
+    #ifdef TEMP_RESIDENCY_TIME
+        /* start/restart the TEMP_RESIDENCY_TIME timer whenever we reach target temp for the first time
+          or when current temp falls outside the hysteresis after target temp was reached */
+      if ((residencyStart == -1 &&  target_direction && (degHotend(tmp_extruder) >= (degTargetHotend(tmp_extruder)-TEMP_WINDOW))) ||
+          (residencyStart == -1 && !target_direction && (degHotend(tmp_extruder) <= (degTargetHotend(tmp_extruder)+TEMP_WINDOW))) ||
+          (residencyStart > -1 && labs(degHotend(tmp_extruder) - degTargetHotend(tmp_extruder)) > TEMP_HYSTERESIS) )
+      {
+        residencyStart = millis();
+      }
+    #endif //TEMP_RESIDENCY_TIME
+    }
+    LCD_MESSAGEPGM(MSG_HEATING_COMPLETE);
+    starttime=millis();
+    previous_millis_cmd = millis();
+}
+
+// M190 - Wait for bed heater to reach target.
+static void gcode_M190()
+{
+  unsigned long codenum;
+    #if defined(TEMP_BED_PIN) && TEMP_BED_PIN > -1
+  LCD_MESSAGEPGM(MSG_BED_HEATING);
+  if (code_seen('S')) {
+    if ( force_temp && ( code_value() != 0.0 ) ) {
+      setTargetBed( forced_M190 );
+    } else {
+      setTargetBed(code_value());
+    }
+    CooldownNoWait = true;
+  } else if (code_seen('R')) {
+    if  ( force_temp && ( code_value() != 0.0 ) ) {
+      setTargetBed( forced_M190 );
+    } else {
+      setTargetBed(code_value());
+    }
+    CooldownNoWait = false;
+  }
+  codenum = millis();
+
+  cancel_heatup = false;
+  target_direction = isHeatingBed(); // true if heating, false if cooling
+
+  while ( (target_direction)&&(!cancel_heatup) ? (isHeatingBed()) : (isCoolingBed()&&(CooldownNoWait==false)) )
+  {
+    if(( millis() - codenum) > 1000 ) //Print Temp Reading every 1 second while heating up.
+    {
+      float tt=degHotend(active_extruder);
+      SERIAL_PROTOCOLPGM("T:");
+      SERIAL_PROTOCOL(tt);
+      SERIAL_PROTOCOLPGM(" E:");
+      SERIAL_PROTOCOL((int)active_extruder);
+      SERIAL_PROTOCOLPGM(" B:");
+      SERIAL_PROTOCOL_F(degBed(),1);
+      SERIAL_PROTOCOLLN("");
+      #ifdef USE_EXTERNAL_CLICK
+      sendM613Status( false );
+      #endif
+      codenum = millis();
+    }
+    manage_heater();
+    manage_inactivity();
+    lcd_update();
+  }
+  LCD_MESSAGEPGM(MSG_BED_DONE);
+  previous_millis_cmd = millis();
+    #endif
+}
+
+#if defined(FAN_PIN) && FAN_PIN > -1
+// M106 Fan On
+static void gcode_M106()
+{
+  if (code_seen('S')){
+     if ( force_temp && ( code_value() != 0 ) ) {
+       fanSpeed=constrain(forced_M106,0,255);
+     } else {
+       fanSpeed=constrain(code_value(),0,255);
+     }
+  }
+  else {
+    fanSpeed=255;
+  }
+}
+
+// M107 Fan Off
+static void gcode_M107()
+{
+  fanSpeed = 0;
+}
+
+#endif
+
+#ifdef BARICUDA
+#if defined(HEATER_1_PIN) && HEATER_1_PIN > -1
+// M126 valve open
+static void gcode_M126()
+{
+  if (code_seen('S')){
+     ValvePressure=constrain(code_value(),0,255);
+  }
+  else {
+    ValvePressure=255;
+  }
+}
+
+// M127 valve closed
+static void gcode_M127()
+{
+  ValvePressure = 0;
+}
+
+#endif
+
+#if defined(HEATER_2_PIN) && HEATER_2_PIN > -1
+// M128 valve open
+static void gcode_M128()
+{
+  if (code_seen('S')){
+     EtoPPressure=constrain(code_value(),0,255);
+  }
+  else {
+    EtoPPressure=255;
+  }
+}
+
+// M129 valve closed
+static void gcode_M129()
+{
+  EtoPPressure = 0;
+}
+
+#endif
+#endif //BARICUDA
+
+#if defined(PS_ON_PIN) && PS_ON_PIN > -1
+// M80 - Turn on Power Supply
+static void gcode_M80()
+{
+  SET_OUTPUT(PS_ON_PIN); //GND
+  WRITE(PS_ON_PIN, PS_ON_AWAKE);
+
+  // If you have a switch on suicide pin, this is useful
+  // if you want to start another print with suicide feature after
+  // a print without suicide...
+  #if defined SUICIDE_PIN && SUICIDE_PIN > -1
+      SET_OUTPUT(SUICIDE_PIN);
+      WRITE(SUICIDE_PIN, HIGH);
+  #endif
 
-        while ( (target_direction)&&(!cancel_heatup) ? (isHeatingBed()) : (isCoolingBed()&&(CooldownNoWait==false)) )
-        {
-          if(( millis() - codenum) > 1000 ) //Print Temp Reading every 1 second while heating up.
-          {
-            float tt=degHotend(active_extruder);
-            SERIAL_PROTOCOLPGM("T:");
-            SERIAL_PROTOCOL(tt);
-            SERIAL_PROTOCOLPGM(" E:");
-            SERIAL_PROTOCOL((int)active_extruder);
-            SERIAL_PROTOCOLPGM(" B:");
-            SERIAL_PROTOCOL_F(degBed(),1);
-            SERIAL_PROTOCOLLN("");
-            #ifdef USE_EXTERNAL_CLICK
-            sendM613Status( false );
-            #endif
-            codenum = millis();
-          }
-          manage_heater();
-          manage_inactivity();
-          lcd_update();
-        }
-        LCD_MESSAGEPGM(MSG_BED_DONE);
-        previous_millis_cmd = millis();
-    #endif
-        break;
+  #ifdef ULTIPANEL
+    powersupply = true;
+    LCD_MESSAGEPGM(WELCOME_MSG);
+    lcd_update();
+  #endif
+}
 
-    #if defined(FAN_PIN) && FAN_PIN > -1
-      case 106: //M106 Fan On
-        if (code_seen('S')){
-           if ( force_temp && ( code_value() != 0 ) ) {
-             fanSpeed=constrain(forced_M106,0,255);
-           } else {
-             fanSpeed=constrain(code_value(),0,255);
-           }
-        }
-        else {
-          fanSpeed=255;
-        }
-        break;
-      case 107: //M107 Fan Off
-        fanSpeed = 0;
-        break;
-    #endif //FAN_PIN
-    #ifdef BARICUDA
-      // PWM for HEATER_1_PIN
-      #if defined(HEATER_1_PIN) && HEATER_1_PIN > -1
-        case 126: //M126 valve open
-          if (code_seen('S')){
-             ValvePressure=constrain(code_value(),0,255);
-          }
-          else {
-            ValvePressure=255;
-          }
-          break;
-        case 127: //M127 valve closed
-          ValvePressure = 0;
-          break;
-      #endif //HEATER_1_PIN
+#endif
 
-      // PWM for HEATER_2_PIN
-      #if defined(HEATER_2_PIN) && HEATER_2_PIN > -1
-        case 128: //M128 valve open
-          if (code_seen('S')){
-             EtoPPressure=constrain(code_value(),0,255);
-          }
-          else {
-            EtoPPressure=255;
-          }
-          break;
-        case 129: //M129 valve closed
-          EtoPPressure = 0;
-          break;
-      #endif //HEATER_2_PIN
-    #endif
+// M81 - Turn off Power Supply
+static void gcode_M81()
+{
+  disable_heater();
+  st_synchronize();
+  disable_e0();
+  disable_e1();
+  disable_e2();
+  finishAndDisableSteppers();
+  fanSpeed = 0;
+  delay(1000); // Wait a little before to switch off
+#if defined(SUICIDE_PIN) && SUICIDE_PIN > -1
+  st_synchronize();
+  suicide();
+#elif defined(PS_ON_PIN) && PS_ON_PIN > -1
+  SET_OUTPUT(PS_ON_PIN);
+  WRITE(PS_ON_PIN, PS_ON_ASLEEP);
+#endif
 
-    #if defined(PS_ON_PIN) && PS_ON_PIN > -1
-      case 80: // M80 - Turn on Power Supply
-        SET_OUTPUT(PS_ON_PIN); //GND
-        WRITE(PS_ON_PIN, PS_ON_AWAKE);
-
-        // If you have a switch on suicide pin, this is useful
-        // if you want to start another print with suicide feature after
-        // a print without suicide...
-        #if defined SUICIDE_PIN && SUICIDE_PIN > -1
-            SET_OUTPUT(SUICIDE_PIN);
-            WRITE(SUICIDE_PIN, HIGH);
-        #endif
+#ifdef ULTIPANEL
+  powersupply = false;
+  LCD_MESSAGEPGM(MACHINE_NAME" "MSG_OFF".");
+  lcd_update();
+#endif
 
-        #ifdef ULTIPANEL
-          powersupply = true;
-          LCD_MESSAGEPGM(WELCOME_MSG);
-          lcd_update();
-        #endif
-        break;
-      #endif
+}
 
-      case 81: // M81 - Turn off Power Supply
-        disable_heater();
-        st_synchronize();
-        disable_e0();
-        disable_e1();
-        disable_e2();
-        finishAndDisableSteppers();
-        fanSpeed = 0;
-        delay(1000); // Wait a little before to switch off
-      #if defined(SUICIDE_PIN) && SUICIDE_PIN > -1
-        st_synchronize();
-        suicide();
-      #elif defined(PS_ON_PIN) && PS_ON_PIN > -1
-        SET_OUTPUT(PS_ON_PIN);
-        WRITE(PS_ON_PIN, PS_ON_ASLEEP);
-      #endif
-      #ifdef ULTIPANEL
-        powersupply = false;
-        LCD_MESSAGEPGM(MACHINE_NAME" "MSG_OFF".");
-        lcd_update();
-      #endif
-	  break;
+// M82 - Set E codes absolute (default)
+static void gcode_M82()
+{
+  axis_relative_modes[3] = false;
+}
 
-    case 82:
-      axis_relative_modes[3] = false;
-      break;
-    case 83:
-      axis_relative_modes[3] = true;
-      break;
-    case 18: //compatibility
-    case 84: // M84
-      if(code_seen('S')){
-        stepper_inactive_time = code_value() * 1000;
-      }
-      else
-      {
-        bool all_axis = !((code_seen(axis_codes[X_AXIS])) || (code_seen(axis_codes[Y_AXIS])) || (code_seen(axis_codes[Z_AXIS]))|| (code_seen(axis_codes[E_AXIS])));
-        if(all_axis)
-        {
-          st_synchronize();
+// M83 - Set E codes relative while in Absolute Coordinates (G90) mode
+static void gcode_M83()
+{
+  axis_relative_modes[3] = true;
+}
+
+// M18, M84 - Disable steppers until next move, or set the inactivity timeout with S<seconds>
+static void gcode_M18_M84()
+{
+  if(code_seen('S')){
+    stepper_inactive_time = code_value() * 1000;
+  }
+  else
+  {
+    bool all_axis = !((code_seen(axis_codes[X_AXIS])) || (code_seen(axis_codes[Y_AXIS])) || (code_seen(axis_codes[Z_AXIS]))|| (code_seen(axis_codes[E_AXIS])));
+    if(all_axis)
+    {
+      st_synchronize();
+      disable_e0();
+      disable_e1();
+      disable_e2();
+      finishAndDisableSteppers();
+    }
+    else
+    {
+      st_synchronize();
+      if(code_seen('X')) disable_x();
+      if(code_seen('Y')) disable_y();
+      if(code_seen('Z')) disable_z();
+      #if ((E0_ENABLE_PIN != X_ENABLE_PIN) && (E1_ENABLE_PIN != Y_ENABLE_PIN)) // Only enable on boards that have seperate ENABLE_PINS
+        if(code_seen('E')) {
           disable_e0();
           disable_e1();
           disable_e2();
-          finishAndDisableSteppers();
         }
-        else
-        {
-          st_synchronize();
-          if(code_seen('X')) disable_x();
-          if(code_seen('Y')) disable_y();
-          if(code_seen('Z')) disable_z();
-          #if ((E0_ENABLE_PIN != X_ENABLE_PIN) && (E1_ENABLE_PIN != Y_ENABLE_PIN)) // Only enable on boards that have seperate ENABLE_PINS
-            if(code_seen('E')) {
-              disable_e0();
-              disable_e1();
-              disable_e2();
-            }
-          #endif
+      #endif
+    }
+  }
+}
+
+// M85 - Set inactivity shutdown timer with parameter S<seconds>. To disable set zero (default)
+static void gcode_M85()
+{
+  if(code_seen('S')) {
+    max_inactive_time = code_value() * 1000;
+  }
+}
+
+// M92 - Set axis_steps_per_unit - same syntax as G92
+static void gcode_M92()
+{
+  for(int8_t i=0; i < NUM_AXIS; i++)
+  {
+    if(code_seen(axis_codes[i]))
+    {
+      if(i == 3) { // E
+        float value = code_value();
+        if(value < 20.0) {
+          float factor = axis_steps_per_unit[i] / value; // increase e constants if M92 E14 is given for netfab.
+          max_e_jerk *= factor;
+          max_feedrate[i] *= factor;
+          axis_steps_per_sqr_second[i] *= factor;
         }
+        axis_steps_per_unit[i] = value;
       }
-      break;
-    case 85: // M85
-      if(code_seen('S')) {
-        max_inactive_time = code_value() * 1000;
-      }
-      break;
-    case 92: // M92
-      for(int8_t i=0; i < NUM_AXIS; i++)
-      {
-        if(code_seen(axis_codes[i]))
-        {
-          if(i == 3) { // E
-            float value = code_value();
-            if(value < 20.0) {
-              float factor = axis_steps_per_unit[i] / value; // increase e constants if M92 E14 is given for netfab.
-              max_e_jerk *= factor;
-              max_feedrate[i] *= factor;
-              axis_steps_per_sqr_second[i] *= factor;
-            }
-            axis_steps_per_unit[i] = value;
-          }
-          else {
-            axis_steps_per_unit[i] = code_value();
-          }
-        }
+      else {
+        axis_steps_per_unit[i] = code_value();
       }
-      break;
-    case 115: // M115
-      SERIAL_PROTOCOLPGM(MSG_M115_REPORT);
-      break;
-    case 117: // M117 display message
-      lcd_setstatus(strchr_pointer + 5);
-      break;
-    case 114: // M114
-      if (code_seen('Q')){
-          SERIAL_ECHO_START;
+    }
+  }
+}
+
+// M115 - Capabilities string
+static void gcode_M115()
+{
+  SERIAL_PROTOCOLPGM(MSG_M115_REPORT);
+}
+
+// M117 display message
+static void gcode_M117()
+{
+  lcd_setstatus(strchr_pointer + 5);
+}
+
+// M114 - Output current position to serial port
+static void gcode_M114()
+{
+  if (code_seen('Q')){
+      SERIAL_ECHO_START;
 	  SERIAL_PROTOCOLPGM("POSITION:");
 	  SERIAL_PROTOCOL(current_position[X_AXIS]);
 	  SERIAL_PROTOCOLPGM("|");
@@ -2671,173 +3407,209 @@ void process_commands()
 	  SERIAL_PROTOCOL(float(st_get_position(Z_AXIS))/axis_steps_per_unit[Z_AXIS]);
 
 	  SERIAL_PROTOCOLLN("");
-      } else {
-	  SERIAL_PROTOCOLPGM("X:");
-	  SERIAL_PROTOCOL(current_position[X_AXIS]);
-	  SERIAL_PROTOCOLPGM(" Y:");
-	  SERIAL_PROTOCOL(current_position[Y_AXIS]);
-	  SERIAL_PROTOCOLPGM(" Z:");
-	  SERIAL_PROTOCOL(current_position[Z_AXIS]);
-	  SERIAL_PROTOCOLPGM(" E:");
-	  SERIAL_PROTOCOL(current_position[E_AXIS]);
+  } else {
+	  print_position();
+  }
+}
 
-	  SERIAL_PROTOCOLPGM(MSG_COUNT_X);
-	  SERIAL_PROTOCOL(float(st_get_position(X_AXIS))/axis_steps_per_unit[X_AXIS]);
-	  SERIAL_PROTOCOLPGM(" Y:");
-	  SERIAL_PROTOCOL(float(st_get_position(Y_AXIS))/axis_steps_per_unit[Y_AXIS]);
-	  SERIAL_PROTOCOLPGM(" Z:");
-	  SERIAL_PROTOCOL(float(st_get_position(Z_AXIS))/axis_steps_per_unit[Z_AXIS]);
+// M120 - Disable endstops
+static void gcode_M120()
+{
+  enable_endstops(false) ;
+}
 
-	  SERIAL_PROTOCOLLN("");
-      }
-      break;
-    case 120: // M120
-      enable_endstops(false) ;
-      break;
-    case 121: // M121
-      enable_endstops(true) ;
-      break;
-    case 119: // M119
-    SERIAL_PROTOCOLLN(MSG_M119_REPORT);
-      #if defined(X_MIN_PIN) && X_MIN_PIN > -1
-        SERIAL_PROTOCOLPGM(MSG_X_MIN);
-        SERIAL_PROTOCOLLN(((READ(X_MIN_PIN)^X_MIN_ENDSTOP_INVERTING)?MSG_ENDSTOP_HIT:MSG_ENDSTOP_OPEN));
-      #endif
-      #if defined(X_MAX_PIN) && X_MAX_PIN > -1
-        SERIAL_PROTOCOLPGM(MSG_X_MAX);
-        SERIAL_PROTOCOLLN(((READ(X_MAX_PIN)^X_MAX_ENDSTOP_INVERTING)?MSG_ENDSTOP_HIT:MSG_ENDSTOP_OPEN));
-      #endif
-      #if defined(Y_MIN_PIN) && Y_MIN_PIN > -1
-        SERIAL_PROTOCOLPGM(MSG_Y_MIN);
-        #if defined(Y2_MIN_PIN) && Y2_MIN_PIN > -1
-          SERIAL_PROTOCOL(((READ(Y_MIN_PIN)^Y_MIN_ENDSTOP_INVERTING)?MSG_ENDSTOP_HIT:MSG_ENDSTOP_OPEN));
-          SERIAL_PROTOCOLPGM(" - ");
-          SERIAL_PROTOCOLLN(((READ(Y2_MIN_PIN)^Y_MIN_ENDSTOP_INVERTING)?MSG_ENDSTOP_HIT:MSG_ENDSTOP_OPEN));
-        #else
-          SERIAL_PROTOCOLLN(((READ(Y_MIN_PIN)^Y_MIN_ENDSTOP_INVERTING)?MSG_ENDSTOP_HIT:MSG_ENDSTOP_OPEN));
-        #endif
+// M121 - Enable endstops
+static void gcode_M121()
+{
+  enable_endstops(true) ;
+}
+
+// M119 - Output Endstop status to serial port
+static void gcode_M119()
+{
+  SERIAL_PROTOCOLLN(MSG_M119_REPORT);
+    #if defined(X_MIN_PIN) && X_MIN_PIN > -1
+      SERIAL_PROTOCOLPGM(MSG_X_MIN);
+      SERIAL_PROTOCOLLN(((READ(X_MIN_PIN)^X_MIN_ENDSTOP_INVERTING)?MSG_ENDSTOP_HIT:MSG_ENDSTOP_OPEN));
+    #endif
+    #if defined(X_MAX_PIN) && X_MAX_PIN > -1
+      SERIAL_PROTOCOLPGM(MSG_X_MAX);
+      SERIAL_PROTOCOLLN(((READ(X_MAX_PIN)^X_MAX_ENDSTOP_INVERTING)?MSG_ENDSTOP_HIT:MSG_ENDSTOP_OPEN));
+    #endif
+    #if defined(Y_MIN_PIN) && Y_MIN_PIN > -1
+      SERIAL_PROTOCOLPGM(MSG_Y_MIN);
+      #if defined(Y2_MIN_PIN) && Y2_MIN_PIN > -1
+        SERIAL_PROTOCOL(((READ(Y_MIN_PIN)^Y_MIN_ENDSTOP_INVERTING)?MSG_ENDSTOP_HIT:MSG_ENDSTOP_OPEN));
+        SERIAL_PROTOCOLPGM(" - ");
+        SERIAL_PROTOCOLLN(((READ(Y2_MIN_PIN)^Y_MIN_ENDSTOP_INVERTING)?MSG_ENDSTOP_HIT:MSG_ENDSTOP_OPEN));
+      #else
+        SERIAL_PROTOCOLLN(((READ(Y_MIN_PIN)^Y_MIN_ENDSTOP_INVERTING)?MSG_ENDSTOP_HIT:MSG_ENDSTOP_OPEN));
       #endif
-      #if defined(Y_MAX_PIN) && Y_MAX_PIN > -1
-        SERIAL_PROTOCOLPGM(MSG_Y_MAX);
-        #if defined(Y2_MAX_PIN) && Y2_MAX_PIN > -1
-          SERIAL_PROTOCOL(((READ(Y_MAX_PIN)^Y_MAX_ENDSTOP_INVERTING)?MSG_ENDSTOP_HIT:MSG_ENDSTOP_OPEN));
-          SERIAL_PROTOCOLPGM(" - ");
-          SERIAL_PROTOCOLLN(((READ(Y2_MAX_PIN)^Y_MAX_ENDSTOP_INVERTING)?MSG_ENDSTOP_HIT:MSG_ENDSTOP_OPEN));
-        #else
-          SERIAL_PROTOCOLLN(((READ(Y_MAX_PIN)^Y_MAX_ENDSTOP_INVERTING)?MSG_ENDSTOP_HIT:MSG_ENDSTOP_OPEN));
-        #endif
+    #endif
+    #if defined(Y_MAX_PIN) && Y_MAX_PIN > -1
+      SERIAL_PROTOCOLPGM(MSG_Y_MAX);
+      #if defined(Y2_MAX_PIN) && Y2_MAX_PIN > -1
+        SERIAL_PROTOCOL(((READ(Y_MAX_PIN)^Y_MAX_ENDSTOP_INVERTING)?MSG_ENDSTOP_HIT:MSG_ENDSTOP_OPEN));
+        SERIAL_PROTOCOLPGM(" - ");
+        SERIAL_PROTOCOLLN(((READ(Y2_MAX_PIN)^Y_MAX_ENDSTOP_INVERTING)?MSG_ENDSTOP_HIT:MSG_ENDSTOP_OPEN));
+      #else
+        SERIAL_PROTOCOLLN(((READ(Y_MAX_PIN)^Y_MAX_ENDSTOP_INVERTING)?MSG_ENDSTOP_HIT:MSG_ENDSTOP_OPEN));
       #endif
-      #if defined(Z_MIN_PIN) && Z_MIN_PIN > -1
-        SERIAL_PROTOCOLPGM(MSG_Z_MIN);
-        #if defined(Z2_MIN_PIN) && Z2_MIN_PIN > -1
-          SERIAL_PROTOCOL(((READ(Z_MIN_PIN)^Z_MIN_ENDSTOP_INVERTING)?MSG_ENDSTOP_HIT:MSG_ENDSTOP_OPEN));
-          SERIAL_PROTOCOLPGM(" - ");
-          SERIAL_PROTOCOLLN(((READ(Z2_MIN_PIN)^Z_MIN_ENDSTOP_INVERTING)?MSG_ENDSTOP_HIT:MSG_ENDSTOP_OPEN));
-        #else
-          SERIAL_PROTOCOLLN(((READ(Z_MIN_PIN)^Z_MIN_ENDSTOP_INVERTING)?MSG_ENDSTOP_HIT:MSG_ENDSTOP_OPEN));
+    #endif
+    #if defined(Z_MIN_PIN) && Z_MIN_PIN > -1
+      SERIAL_PROTOCOLPGM(MSG_Z_MIN);
+      #if defined(Z2_MIN_PIN) && Z2_MIN_PIN > -1
+        SERIAL_PROTOCOL(((READ(Z_MIN_PIN)^Z_MIN_ENDSTOP_INVERTING)?MSG_ENDSTOP_HIT:MSG_ENDSTOP_OPEN));
+        SERIAL_PROTOCOLPGM(" - ");
+        SERIAL_PROTOCOLLN(((READ(Z2_MIN_PIN)^Z_MIN_ENDSTOP_INVERTING)?MSG_ENDSTOP_HIT:MSG_ENDSTOP_OPEN));
+      #else
+        SERIAL_PROTOCOLLN(((READ(Z_MIN_PIN)^Z_MIN_ENDSTOP_INVERTING)?MSG_ENDSTOP_HIT:MSG_ENDSTOP_OPEN));
 	#endif
+    #endif
+    #if defined(Z_MAX_PIN) && Z_MAX_PIN > -1
+      SERIAL_PROTOCOLPGM(MSG_Z_MAX);
+      #if defined(Z2_MAX_PIN) && Z2_MAX_PIN > -1
+        SERIAL_PROTOCOL(((READ(Z_MAX_PIN)^Z_MAX_ENDSTOP_INVERTING)?MSG_ENDSTOP_HIT:MSG_ENDSTOP_OPEN));
+        SERIAL_PROTOCOLPGM(" - ");
+        SERIAL_PROTOCOLLN(((READ(Z2_MAX_PIN)^Z_MAX_ENDSTOP_INVERTING)?MSG_ENDSTOP_HIT:MSG_ENDSTOP_OPEN));
+      #else
+        SERIAL_PROTOCOLLN(((READ(Z_MAX_PIN)^Z_MAX_ENDSTOP_INVERTING)?MSG_ENDSTOP_HIT:MSG_ENDSTOP_OPEN));
       #endif
-      #if defined(Z_MAX_PIN) && Z_MAX_PIN > -1
-        SERIAL_PROTOCOLPGM(MSG_Z_MAX);
-        #if defined(Z2_MAX_PIN) && Z2_MAX_PIN > -1
-          SERIAL_PROTOCOL(((READ(Z_MAX_PIN)^Z_MAX_ENDSTOP_INVERTING)?MSG_ENDSTOP_HIT:MSG_ENDSTOP_OPEN));
-          SERIAL_PROTOCOLPGM(" - ");
-          SERIAL_PROTOCOLLN(((READ(Z2_MAX_PIN)^Z_MAX_ENDSTOP_INVERTING)?MSG_ENDSTOP_HIT:MSG_ENDSTOP_OPEN));
-        #else
-          SERIAL_PROTOCOLLN(((READ(Z_MAX_PIN)^Z_MAX_ENDSTOP_INVERTING)?MSG_ENDSTOP_HIT:MSG_ENDSTOP_OPEN));
-        #endif
-      #endif
-      break;
-      //TODO: update for all axis, use for loop
-    #ifdef BLINKM
-    case 150: // M150
-      {
-        byte red;
-        byte grn;
-        byte blu;
+    #endif
+    //TODO: update for all axis, use for loop
+}
 
-        if(code_seen('R')) red = code_value();
-        if(code_seen('U')) grn = code_value();
-        if(code_seen('B')) blu = code_value();
+#ifdef BLINKM
+// M150 - Set BlinkM Color Output R: Red<0-255> U(!): Green<0-255> B: Blue<0-255> over i2c, G for green does not work.
+static void gcode_M150()
+{
+  byte red;
+  byte grn;
+  byte blu;
 
-        SendColors(red,grn,blu);
-      }
-      break;
-    #endif //BLINKM
-    case 200: // M200 D<millimeters> set filament diameter and set E axis units to cubic millimeters (use S0 to set back to millimeters).
-      {
-        float area = .0;
-        float radius = .0;
-        if(code_seen('D')) {
-          radius = (float)code_value() * .5;
-          if(radius == 0) {
-            area = 1;
-          } else {
-            area = M_PI * pow(radius, 2);
-          }
-        } else {
-          //reserved for setting filament diameter via UFID or filament measuring device
-          break;
-        }
-        tmp_extruder = active_extruder;
-        if(code_seen('T')) {
-          tmp_extruder = code_value();
-          if(tmp_extruder >= EXTRUDERS) {
-            SERIAL_ECHO_START;
-            SERIAL_ECHO(MSG_M200_INVALID_EXTRUDER);
-            break;
-          }
-        }
-        volumetric_multiplier[tmp_extruder] = 1 / area;
-      }
-      break;
-    case 201: // M201
-      for(int8_t i=0; i < NUM_AXIS; i++)
-      {
-        if(code_seen(axis_codes[i]))
-        {
-          max_acceleration_units_per_sq_second[i] = code_value();
-        }
-      }
-      // steps per sq second need to be updated to agree with the units per sq second (as they are what is used in the planner)
-      reset_acceleration_rates();
-      break;
-    #if 0 // Not used for Sprinter/grbl gen6
-    case 202: // M202
-      for(int8_t i=0; i < NUM_AXIS; i++) {
-        if(code_seen(axis_codes[i])) axis_travel_steps_per_sqr_second[i] = code_value() * axis_steps_per_unit[i];
-      }
-      break;
-    #endif
-    case 203: // M203 max feedrate mm/sec
-      for(int8_t i=0; i < NUM_AXIS; i++) {
-        if(code_seen(axis_codes[i])) max_feedrate[i] = code_value();
-      }
-      break;
-    case 204: // M204 acclereration S normal moves T filmanent only moves
-      {
-        if(code_seen('S')) acceleration = code_value() ;
-        if(code_seen('T')) retract_acceleration = code_value() ;
-      }
-      break;
-    case 205: //M205 advanced settings:  minimum travel speed S=while printing T=travel only,  B=minimum segment time X= maximum xy jerk, Z=maximum Z jerk
+  if(code_seen('R')) red = code_value();
+  if(code_seen('U')) grn = code_value();
+  if(code_seen('B')) blu = code_value();
+
+  SendColors(red,grn,blu);
+}
+
+#endif //BLINKM
+
+#ifdef AUTO_REPORT
+// M155 S<seconds> - report every S seconds, S0 stops. T, P, D, I switch the reports on (1) or off (0).
+static void gcode_M155()
+{
+  static const char report_codes[] = { 'T', 'P', 'D', 'I' };
+  for(uint8_t i = 0; i < sizeof(report_codes); i++) {
+    if(code_seen(report_codes[i])) {
+      if(code_value_long())
+        auto_report_flags |= 1 << i;
+      else
+        auto_report_flags &= ~(1 << i);
+    }
+  }
+  if(code_seen('S')) {
+    auto_report_interval = constrain(code_value_long(), 0, 60);
+    next_auto_report = millis();
+  }
+}
+
+#endif //AUTO_REPORT
+
+// M200 D<millimeters> set filament diameter and set E axis units to cubic millimeters (use S0 to set back to millimeters).
+static void gcode_M200()
+{
+  float area = .0;
+  float radius = .0;
+  if(code_seen('D')) {
+    radius = (float)code_value() * .5;
+    if(radius == 0) {
+      area = 1;
+    } else {
+      area = M_PI * pow(radius, 2);
+    }
+  } else {
+    //reserved for setting filament diameter via UFID or filament measuring device
+    return;
+  }
+  tmp_extruder = active_extruder;
+  if(code_seen('T')) {
+    tmp_extruder = code_value();
+    if(tmp_extruder >= EXTRUDERS) {
+      SERIAL_ECHO_START;
+      SERIAL_ECHO(MSG_M200_INVALID_EXTRUDER);
+      return;
+    }
+  }
+  volumetric_multiplier[tmp_extruder] = 1 / area;
+}
+
+// M201 - Set max acceleration in units/s^2 for print moves (M201 X1000 Y1000)
+static void gcode_M201()
+{
+  for(int8_t i=0; i < NUM_AXIS; i++)
+  {
+    if(code_seen(axis_codes[i]))
     {
-      if(code_seen('S')) minimumfeedrate = code_value();
-      if(code_seen('T')) mintravelfeedrate = code_value();
-      if(code_seen('B')) minsegmenttime = code_value() ;
-      if(code_seen('X')) max_xy_jerk = code_value() ;
-      if(code_seen('Z')) max_z_jerk = code_value() ;
-      if(code_seen('E')) max_e_jerk = code_value() ;
+      max_acceleration_units_per_sq_second[i] = code_value();
     }
-    break;
-    case 206: // M206 additional homeing offset
-      for(int8_t i=0; i < 3; i++)
-      {
-        if(code_seen(axis_codes[i])) add_homeing[i] = code_value();
-      }
-      break;
-    #ifdef DELTA
-	case 665: // M665 set delta configurations L<diagonal_rod> R<delta_radius> S<segments_per_sec>
+  }
+  // steps per sq second need to be updated to agree with the units per sq second (as they are what is used in the planner)
+  reset_acceleration_rates();
+}
+
+#if 0 // Not used for Sprinter/grbl gen6
+// M202 - Set max acceleration in units/s^2 for travel moves (M202 X1000 Y1000) Unused in Marlin!!
+static void gcode_M202()
+{
+  for(int8_t i=0; i < NUM_AXIS; i++) {
+    if(code_seen(axis_codes[i])) axis_travel_steps_per_sqr_second[i] = code_value() * axis_steps_per_unit[i];
+  }
+}
+
+#endif
+
+// M203 max feedrate mm/sec
+static void gcode_M203()
+{
+  for(int8_t i=0; i < NUM_AXIS; i++) {
+    if(code_seen(axis_codes[i])) max_feedrate[i] = code_value();
+  }
+}
+
+// M204 acclereration S normal moves T filmanent only moves
+static void gcode_M204()
+{
+  if(code_seen('S')) acceleration = code_value() ;
+  if(code_seen('T')) retract_acceleration = code_value() ;
+}
+
+// M205 advanced settings:  minimum travel speed S=while printing T=travel only,  B=minimum segment time X= maximum xy jerk, Z=maximum Z jerk, J=junction deviation
+static void gcode_M205()
+{
+  if(code_seen('S')) minimumfeedrate = code_value();
+  if(code_seen('T')) mintravelfeedrate = code_value();
+  if(code_seen('B')) minsegmenttime = code_value() ;
+  if(code_seen('X')) max_xy_jerk = code_value() ;
+  if(code_seen('Z')) max_z_jerk = code_value() ;
+  if(code_seen('E')) max_e_jerk = code_value() ;
+  if(code_seen('J')) junction_deviation = max(code_value(), 0.0);
+}
+
+// M206 additional homeing offset
+static void gcode_M206()
+{
+  for(int8_t i=0; i < 3; i++)
+  {
+    if(code_seen(axis_codes[i])) add_homeing[i] = code_value();
+  }
+}
+
+#ifdef DELTA
+// M665 set delta configurations L<diagonal_rod> R<delta_radius> S<segments_per_sec>
+static void gcode_M665()
+{
 		if(code_seen('L')) {
 			delta_diagonal_rod= code_value();
 		}
@@ -2847,442 +3619,530 @@ void process_commands()
 		if(code_seen('S')) {
 			delta_segments_per_second= code_value();
 		}
-		
+
 		recalc_delta_settings(delta_radius, delta_diagonal_rod);
-		break;
-    case 666: // M666 set delta endstop adjustemnt
-      for(int8_t i=0; i < 3; i++)
-      {
-        if(code_seen(axis_codes[i])) endstop_adj[i] = code_value();
-      }
-      break;
-    #endif
-    #ifdef FWRETRACT
-    case 207: //M207 - set retract length S[positive mm] F[feedrate mm/min] Z[additional zlift/hop]
-    {
-      if(code_seen('S'))
-      {
-        retract_length = code_value() ;
-      }
-      if(code_seen('F'))
-      {
-        retract_feedrate = code_value()/60 ;
-      }
-      if(code_seen('Z'))
-      {
-        retract_zlift = code_value() ;
-      }
-    }break;
-    case 208: // M208 - set retract recover length S[positive mm surplus to the M207 S*] F[feedrate mm/min]
-    {
-      if(code_seen('S'))
-      {
-        retract_recover_length = code_value() ;
-      }
-      if(code_seen('F'))
-      {
-        retract_recover_feedrate = code_value()/60 ;
-      }
-    }break;
-    case 209: // M209 - S<1=true/0=false> enable automatic retract detect if the slicer did not support G10/11: every normal extrude-only move will be classified as retract depending on the direction.
-    {
-      if(code_seen('S'))
-      {
-        int t= code_value() ;
-        switch(t)
-        {
-          case 0: autoretract_enabled=false;retracted=false;break;
-          case 1: autoretract_enabled=true;retracted=false;break;
-          default:
-            SERIAL_ECHO_START;
-            SERIAL_ECHOPGM(MSG_UNKNOWN_COMMAND);
-            SERIAL_ECHO(cmdbuffer[bufindr]);
-            SERIAL_ECHOLNPGM("\"");
-        }
-      }
+}
 
-    }break;
-    #endif // FWRETRACT
-    #if EXTRUDERS > 1
-    case 218: // M218 - set hotend offset (in mm), T<extruder_number> X<offset_on_X> Y<offset_on_Y>
+// M666 set delta endstop adjustemnt
+static void gcode_M666()
+{
+  for(int8_t i=0; i < 3; i++)
+  {
+    if(code_seen(axis_codes[i])) endstop_adj[i] = code_value();
+  }
+}
+
+#endif //DELTA
+
+#ifdef FWRETRACT
+// M207 - set retract length S[positive mm] F[feedrate mm/min] Z[additional zlift/hop]
+static void gcode_M207()
+{
+  if(code_seen('S'))
+  {
+    retract_length = code_value() ;
+  }
+  if(code_seen('F'))
+  {
+    retract_feedrate = code_value()/60 ;
+  }
+  if(code_seen('Z'))
+  {
+    retract_zlift = code_value() ;
+  }
+}
+
+// M208 - set retract recover length S[positive mm surplus to the M207 S*] F[feedrate mm/min]
+static void gcode_M208()
+{
+  if(code_seen('S'))
+  {
+    retract_recover_length = code_value() ;
+  }
+  if(code_seen('F'))
+  {
+    retract_recover_feedrate = code_value()/60 ;
+  }
+}
+
+// M209 - S<1=true/0=false> enable automatic retract detect if the slicer did not support G10/11: every normal extrude-only move will be classified as retract depending on the direction.
+static void gcode_M209()
+{
+  if(code_seen('S'))
+  {
+    int t= code_value() ;
+    switch(t)
     {
-      if(setTargetedHotend(218)){
-        break;
-      }
-      if(code_seen('X'))
-      {
-        extruder_offset[X_AXIS][tmp_extruder] = code_value();
-      }
-      if(code_seen('Y'))
-      {
-        extruder_offset[Y_AXIS][tmp_extruder] = code_value();
-      }
-      #ifdef DUAL_X_CARRIAGE
-      if(code_seen('Z'))
-      {
-        extruder_offset[Z_AXIS][tmp_extruder] = code_value();
-      }
-      #endif
-      SERIAL_ECHO_START;
-      SERIAL_ECHOPGM(MSG_HOTEND_OFFSET);
-      for(tmp_extruder = 0; tmp_extruder < EXTRUDERS; tmp_extruder++)
-      {
-         SERIAL_ECHO(" ");
-         SERIAL_ECHO(extruder_offset[X_AXIS][tmp_extruder]);
-         SERIAL_ECHO(",");
-         SERIAL_ECHO(extruder_offset[Y_AXIS][tmp_extruder]);
-      #ifdef DUAL_X_CARRIAGE
-         SERIAL_ECHO(",");
-         SERIAL_ECHO(extruder_offset[Z_AXIS][tmp_extruder]);
-      #endif
-      }
-      SERIAL_ECHOLN("");
-    }break;
-    #endif
-    case 220: // M220 S<factor in percent>- set speed factor override percentage
+      case 0: autoretract_enabled=false;retracted=false;break;
+      case 1: autoretract_enabled=true;retracted=false;break;
+      default:
+        SERIAL_ECHO_START;
+        SERIAL_ECHOPGM(MSG_UNKNOWN_COMMAND);
+        SERIAL_ECHO(current_command());
+        SERIAL_ECHOLNPGM("\"");
+    }
+  }
+}
+
+#endif //FWRETRACT
+
+#if EXTRUDERS > 1
+// M218 - set hotend offset (in mm), T<extruder_number> X<offset_on_X> Y<offset_on_Y>
+static void gcode_M218()
+{
+  if(setTargetedHotend(218)){
+    return;
+  }
+  if(code_seen('X'))
+  {
+    extruder_offset[X_AXIS][tmp_extruder] = code_value();
+  }
+  if(code_seen('Y'))
+  {
+    extruder_offset[Y_AXIS][tmp_extruder] = code_value();
+  }
+  #ifdef DUAL_X_CARRIAGE
+  if(code_seen('Z'))
+  {
+    extruder_offset[Z_AXIS][tmp_extruder] = code_value();
+  }
+  #endif
+  SERIAL_ECHO_START;
+  SERIAL_ECHOPGM(MSG_HOTEND_OFFSET);
+  for(tmp_extruder = 0; tmp_extruder < EXTRUDERS; tmp_extruder++)
+  {
+     SERIAL_ECHO(" ");
+     SERIAL_ECHO(extruder_offset[X_AXIS][tmp_extruder]);
+     SERIAL_ECHO(",");
+     SERIAL_ECHO(extruder_offset[Y_AXIS][tmp_extruder]);
+  #ifdef DUAL_X_CARRIAGE
+     SERIAL_ECHO(",");
+     SERIAL_ECHO(extruder_offset[Z_AXIS][tmp_extruder]);
+  #endif
+  }
+  SERIAL_ECHOLN("");
+}
+
+#endif
+
+// M220 S<factor in percent>- set speed factor override percentage
+static void gcode_M220()
+{
+  if(code_seen('S')) {
+    feedmultiply = code_value() ;
+  }
+}
+
+// M221 S<factor in percent>- set extrude factor override percentage
+static void gcode_M221()
+{
+  if(code_seen('S'))
+  {
+    int tmp_code = code_value();
+    if (code_seen('T'))
     {
-      if(code_seen('S')) {
-        feedmultiply = code_value() ;
+      if(setTargetedHotend(221)){
+        return;
       }
+      extruder_multiply[tmp_extruder] = tmp_code;
     }
-    break;
-    case 221: // M221 S<factor in percent>- set extrude factor override percentage
+    else
     {
-      if(code_seen('S'))
-      {
-        int tmp_code = code_value();
-        if (code_seen('T'))
-        {
-          if(setTargetedHotend(221)){
-            break;
-          }
-          extruder_multiply[tmp_extruder] = tmp_code;
-        }
-        else
-        {
-          extrudemultiply = tmp_code ;
-        }
-      }
+      extrudemultiply = tmp_code ;
     }
-    break;
-	
-   case 226: // M226 P<pin number> S<pin state>- Wait until the specified pin reaches the state required
-   {
-      if(code_seen('P')){
-        int pin_number = code_value(); // pin number
-        int pin_state = -1; // required pin state - default is inverted
+  }
+}
 
-        if(code_seen('S')) pin_state = code_value(); // required pin state
+// M226 P<pin number> S<pin state>- Wait until the specified pin reaches the state required
+static void gcode_M226()
+{
+  if(code_seen('P')){
+    int pin_number = code_value(); // pin number
+    int pin_state = -1; // required pin state - default is inverted
 
-        if(pin_state >= -1 && pin_state <= 1){
+    if(code_seen('S')) pin_state = code_value(); // required pin state
 
-          for(int8_t i = 0; i < (int8_t)(sizeof(sensitive_pins)/sizeof(int)); i++)
-          {
-            if (sensitive_pins[i] == pin_number)
-            {
-              pin_number = -1;
-              break;
-            }
-          }
+    if(pin_state >= -1 && pin_state <= 1){
 
-          if (pin_number > -1)
-          {
-            st_synchronize();
+      for(int8_t i = 0; i < (int8_t)(sizeof(sensitive_pins)/sizeof(int)); i++)
+      {
+        if (sensitive_pins[i] == pin_number)
+        {
+          pin_number = -1;
+          break;
+        }
+      }
 
-            pinMode(pin_number, INPUT);
+      if (pin_number > -1)
+      {
+        st_synchronize();
 
-            int target;
-            switch(pin_state){
-            case 1:
-              target = HIGH;
-              break;
+        pinMode(pin_number, INPUT);
 
-            case 0:
-              target = LOW;
-              break;
+        int target;
+        switch(pin_state){
+        case 1:
+          target = HIGH;
+          break;
 
-            case -1:
-              target = !digitalRead(pin_number);
-              break;
-            }
+        case 0:
+          target = LOW;
+          break;
 
-            while(digitalRead(pin_number) != target){
-              manage_heater();
-              manage_inactivity();
-              lcd_update();
-            }
-          }
+        case -1:
+          target = !digitalRead(pin_number);
+          break;
+        }
+
+        while(digitalRead(pin_number) != target){
+          manage_heater();
+          manage_inactivity();
+          lcd_update();
         }
       }
     }
-    break;
+  }
+}
 
-    #if NUM_SERVOS > 0
-    case 280: // M280 - set servo position absolute. P: servo index, S: angle or microseconds
-      {
-        int servo_index = -1;
-        int servo_position = 0;
-        if (code_seen('P'))
-          servo_index = code_value();
-        if (code_seen('S')) {
-          servo_position = code_value();
-          if ((servo_index >= 0) && (servo_index < NUM_SERVOS)) {
+#if NUM_SERVOS > 0
+// M280 - set servo position absolute. P: servo index, S: angle or microseconds
+static void gcode_M280()
+{
+  int servo_index = -1;
+  int servo_position = 0;
+  if (code_seen('P'))
+    servo_index = code_value();
+  if (code_seen('S')) {
+    servo_position = code_value();
+    if ((servo_index >= 0) && (servo_index < NUM_SERVOS)) {
 #if defined (ENABLE_AUTO_BED_LEVELING) && (PROBE_SERVO_DEACTIVATION_DELAY > 0)
 		      servos[servo_index].attach(0);
 #endif
-            servos[servo_index].write(servo_position);
+
+      servos[servo_index].write(servo_position);
 #if defined (ENABLE_AUTO_BED_LEVELING) && (PROBE_SERVO_DEACTIVATION_DELAY > 0)
-              delay(PROBE_SERVO_DEACTIVATION_DELAY);
-              servos[servo_index].detach();
+        delay(PROBE_SERVO_DEACTIVATION_DELAY);
+        servos[servo_index].detach();
 #endif
-          }
-          else {
-            SERIAL_ECHO_START;
-            SERIAL_ECHO("Servo ");
-            SERIAL_ECHO(servo_index);
-            SERIAL_ECHOLN(" out of range");
-          }
-        }
-        else if (servo_index >= 0) {
-          SERIAL_PROTOCOL(MSG_OK);
-          SERIAL_PROTOCOL(" Servo ");
-          SERIAL_PROTOCOL(servo_index);
-          SERIAL_PROTOCOL(": ");
-          SERIAL_PROTOCOL(servos[servo_index].read());
-          SERIAL_PROTOCOLLN("");
-        }
-      }
-      break;
-    #endif // NUM_SERVOS > 0
 
-    #if (LARGE_FLASH == true && ( BEEPER > 0 || defined(ULTRALCD) || defined(LCD_USE_I2C_BUZZER)))
-    case 300: // M300
-    {
-      int beepS = code_seen('S') ? code_value() : 110;
-      int beepP = code_seen('P') ? code_value() : 1000;
-      if (beepS > 0)
-      {
-        #if BEEPER > 0
-          tone(BEEPER, beepS);
-          delay(beepP);
-          noTone(BEEPER);
-        #elif defined(ULTRALCD)
+    }
+    else {
+      SERIAL_ECHO_START;
+      SERIAL_ECHO("Servo ");
+      SERIAL_ECHO(servo_index);
+      SERIAL_ECHOLN(" out of range");
+    }
+  }
+  else if (servo_index >= 0) {
+    SERIAL_PROTOCOL(MSG_OK);
+    SERIAL_PROTOCOL(" Servo ");
+    SERIAL_PROTOCOL(servo_index);
+    SERIAL_PROTOCOL(": ");
+    SERIAL_PROTOCOL(servos[servo_index].read());
+    SERIAL_PROTOCOLLN("");
+  }
+}
+
+#endif
+
+#if (LARGE_FLASH == true && ( BEEPER > 0 || defined(ULTRALCD) || defined(LCD_USE_I2C_BUZZER)))
+// M300 - Play beep sound S<frequency Hz> P<duration ms>
+static void gcode_M300()
+{
+  int beepS = code_seen('S') ? code_value() : 110;
+  int beepP = code_seen('P') ? code_value() : 1000;
+  if (beepS > 0)
+  {
+    #if BEEPER > 0
+      tone(BEEPER, beepS);
+      delay(beepP);
+      noTone(BEEPER);
+    #elif defined(ULTRALCD)
 		  lcd_buzz(beepS, beepP);
 		#elif defined(LCD_USE_I2C_BUZZER)
 		  lcd_buzz(beepP, beepS);
-        #endif
-      }
-      else
-      {
-        delay(beepP);
-      }
-    }
-    break;
-    #endif // M300
+    #endif
+  }
+  else
+  {
+    delay(beepP);
+  }
+}
 
-    #ifdef PIDTEMP
-    case 301: // M301
-      {
-        if(code_seen('P')) Kp = code_value();
-        if(code_seen('I')) Ki = scalePID_i(code_value());
-        if(code_seen('D')) Kd = scalePID_d(code_value());
+#endif
 
-        #ifdef PID_ADD_EXTRUSION_RATE
-        if(code_seen('C')) Kc = code_value();
-        #endif
+#ifdef PIDTEMP
+// M301 - Set PID parameters P I and D of extruder E (default 0)
+static void gcode_M301()
+{
+  int e = 0;
+  if(code_seen('E')) e = code_value();
+  if(e < 0 || e >= EXTRUDERS) {
+    SERIAL_ECHO_START;
+    SERIAL_ECHO("M301 E");
+    SERIAL_ECHO(e);
+    SERIAL_ECHO(" ");
+    SERIAL_ECHOLN(MSG_INVALID_EXTRUDER);
+    return;
+  }
+  if(code_seen('P')) Kp[e] = code_value();
+  if(code_seen('I')) Ki[e] = scalePID_i(code_value());
+  if(code_seen('D')) Kd[e] = scalePID_d(code_value());
 
-        updatePID();
-        SERIAL_PROTOCOL("echo:");
-        SERIAL_PROTOCOL(MSG_OK);
-        SERIAL_PROTOCOL(" p:");
-        SERIAL_PROTOCOL(Kp);
-        SERIAL_PROTOCOL(" i:");
-        SERIAL_PROTOCOL(unscalePID_i(Ki));
-        SERIAL_PROTOCOL(" d:");
-        SERIAL_PROTOCOL(unscalePID_d(Kd));
-        #ifdef PID_ADD_EXTRUSION_RATE
-        SERIAL_PROTOCOL(" c:");
-        //Kc does not have scaling applied above, or in resetting defaults
-        SERIAL_PROTOCOL(Kc);
-        #endif
-        SERIAL_PROTOCOLLN("");
-      }
-      break;
-    #endif //PIDTEMP
-    #ifdef PIDTEMPBED
-    case 304: // M304
-      {
-        if(code_seen('P')) bedKp = code_value();
-        if(code_seen('I')) bedKi = scalePID_i(code_value());
-        if(code_seen('D')) bedKd = scalePID_d(code_value());
-
-        updatePID();
-        SERIAL_PROTOCOL("echo:");
-        SERIAL_PROTOCOL(MSG_OK);
-        SERIAL_PROTOCOL(" p:");
-        SERIAL_PROTOCOL(bedKp);
-        SERIAL_PROTOCOL(" i:");
-        SERIAL_PROTOCOL(unscalePID_i(bedKi));
-        SERIAL_PROTOCOL(" d:");
-        SERIAL_PROTOCOL(unscalePID_d(bedKd));
-        SERIAL_PROTOCOLLN("");
-      }
-      break;
-    #endif //PIDTEMP
-    case 240: // M240  Triggers a camera by emulating a Canon RC-1 : http://www.doc-diy.net/photo/rc-1_hacked/
-     {
-     	#ifdef CHDK
-       
-         SET_OUTPUT(CHDK);
-         WRITE(CHDK, HIGH);
-         chdkHigh = millis();
-         chdkActive = true;
-       
-       #else
-     	
-      	#if defined(PHOTOGRAPH_PIN) && PHOTOGRAPH_PIN > -1
+  #ifdef PID_ADD_EXTRUSION_RATE
+  if(code_seen('C')) Kc[e] = code_value();
+  #endif
+
+  #ifdef HEATER_MODEL
+  if(code_seen('K')) hotend_model[e].rise = code_value();
+  if(code_seen('T')) hotend_model[e].tau = code_value();
+  if(code_seen('L')) hotend_model[e].dead_time = code_value();
+  #endif
+
+  updatePID();
+  SERIAL_PROTOCOL("echo:");
+  SERIAL_PROTOCOL(MSG_OK);
+  #if EXTRUDERS > 1
+  SERIAL_PROTOCOL(" e:");
+  SERIAL_PROTOCOL(e);
+  #endif
+  SERIAL_PROTOCOL(" p:");
+  SERIAL_PROTOCOL(Kp[e]);
+  SERIAL_PROTOCOL(" i:");
+  SERIAL_PROTOCOL(unscalePID_i(Ki[e]));
+  SERIAL_PROTOCOL(" d:");
+  SERIAL_PROTOCOL(unscalePID_d(Kd[e]));
+  #ifdef PID_ADD_EXTRUSION_RATE
+  SERIAL_PROTOCOL(" c:");
+  //Kc does not have scaling applied above, or in resetting defaults
+  SERIAL_PROTOCOL(Kc[e]);
+  #endif
+  #ifdef HEATER_MODEL
+  SERIAL_PROTOCOL(" k:");
+  SERIAL_PROTOCOL(hotend_model[e].rise);
+  SERIAL_PROTOCOL(" t:");
+  SERIAL_PROTOCOL(hotend_model[e].tau);
+  SERIAL_PROTOCOL(" l:");
+  SERIAL_PROTOCOL(hotend_model[e].dead_time);
+  #endif
+  SERIAL_PROTOCOLLN("");
+}
+
+#endif //PIDTEMP
+
+#ifdef PIDTEMPBED
+// M304 - Set bed PID parameters P I and D
+static void gcode_M304()
+{
+  if(code_seen('P')) bedKp = code_value();
+  if(code_seen('I')) bedKi = scalePID_i(code_value());
+  if(code_seen('D')) bedKd = scalePID_d(code_value());
+
+  #ifdef HEATER_MODEL
+  if(code_seen('K')) bed_model.rise = code_value();
+  if(code_seen('T')) bed_model.tau = code_value();
+  if(code_seen('L')) bed_model.dead_time = code_value();
+  #endif
+
+  updatePID();
+  SERIAL_PROTOCOL("echo:");
+  SERIAL_PROTOCOL(MSG_OK);
+  SERIAL_PROTOCOL(" p:");
+  SERIAL_PROTOCOL(bedKp);
+  SERIAL_PROTOCOL(" i:");
+  SERIAL_PROTOCOL(unscalePID_i(bedKi));
+  SERIAL_PROTOCOL(" d:");
+  SERIAL_PROTOCOL(unscalePID_d(bedKd));
+  #ifdef HEATER_MODEL
+  SERIAL_PROTOCOL(" k:");
+  SERIAL_PROTOCOL(bed_model.rise);
+  SERIAL_PROTOCOL(" t:");
+  SERIAL_PROTOCOL(bed_model.tau);
+  SERIAL_PROTOCOL(" l:");
+  SERIAL_PROTOCOL(bed_model.dead_time);
+  #endif
+  SERIAL_PROTOCOLLN("");
+}
+
+#endif //PIDTEMPBED
+
+// M240  Triggers a camera by emulating a Canon RC-1 : http://www.doc-diy.net/photo/rc-1_hacked/
+static void gcode_M240()
+{
+	#ifdef CHDK
+
+   SET_OUTPUT(CHDK);
+   WRITE(CHDK, HIGH);
+   chdkHigh = millis();
+   chdkActive = true;
+
+ #else
+
+	#if defined(PHOTOGRAPH_PIN) && PHOTOGRAPH_PIN > -1
 	const uint8_t NUM_PULSES=16;
 	const float PULSE_LENGTH=0.01524;
 	for(int i=0; i < NUM_PULSES; i++) {
-        WRITE(PHOTOGRAPH_PIN, HIGH);
-        _delay_ms(PULSE_LENGTH);
-        WRITE(PHOTOGRAPH_PIN, LOW);
-        _delay_ms(PULSE_LENGTH);
-        }
-        delay(7.33);
-        for(int i=0; i < NUM_PULSES; i++) {
-        WRITE(PHOTOGRAPH_PIN, HIGH);
-        _delay_ms(PULSE_LENGTH);
-        WRITE(PHOTOGRAPH_PIN, LOW);
-        _delay_ms(PULSE_LENGTH);
-        }
-      	#endif
-      #endif //chdk end if
-     }
-    break;
+  WRITE(PHOTOGRAPH_PIN, HIGH);
+  _delay_ms(PULSE_LENGTH);
+  WRITE(PHOTOGRAPH_PIN, LOW);
+  _delay_ms(PULSE_LENGTH);
+  }
+  delay(7.33);
+  for(int i=0; i < NUM_PULSES; i++) {
+  WRITE(PHOTOGRAPH_PIN, HIGH);
+  _delay_ms(PULSE_LENGTH);
+  WRITE(PHOTOGRAPH_PIN, LOW);
+  _delay_ms(PULSE_LENGTH);
+  }
+	#endif
+#endif //chdk end if
+
+}
+
 #ifdef DOGLCD
-    case 250: // M250  Set LCD contrast value: C<value> (value 0..63)
-     {
+// M250  Set LCD contrast value: C<value> (value 0..63)
+static void gcode_M250()
+{
 	  if (code_seen('C')) {
 	   lcd_setcontrast( ((int)code_value())&63 );
-          }
-          SERIAL_PROTOCOLPGM("lcd contrast value: ");
-          SERIAL_PROTOCOL(lcd_contrast);
-          SERIAL_PROTOCOLLN("");
-     }
-    break;
-#endif
-    #ifdef PREVENT_DANGEROUS_EXTRUDE
-    case 302: // allow cold extrudes, or set the minimum extrude temperature
-    {
+  }
+  SERIAL_PROTOCOLPGM("lcd contrast value: ");
+  SERIAL_PROTOCOL(lcd_contrast);
+  SERIAL_PROTOCOLLN("");
+}
+
+#endif //DOGLCD
+
+#ifdef PREVENT_DANGEROUS_EXTRUDE
+// M302 - Allow cold extrudes, or set the minimum extrude temperature
+static void gcode_M302()
+{
 	  float temp = .0;
 	  if (code_seen('S')) temp=code_value();
-      set_extrude_min_temp(temp);
-    }
-    break;
-	#endif
-    case 303: // M303 PID autotune
-    {
-      float temp = 150.0;
-      int e=0;
-      int c=5;
-      if (code_seen('E')) e=code_value();
-        if (e<0)
-          temp=70;
-      if (code_seen('S')) temp=code_value();
-      if (code_seen('C')) c=code_value();
-      PID_autotune(temp, e, c);
-    }
-    break;
-    case 400: // M400 finish all moves
-    {
-      st_synchronize();
-    }
-    break;
+  set_extrude_min_temp(temp);
+}
+
+#endif //PREVENT_DANGEROUS_EXTRUDE
+
+// M303 PID autotune
+static void gcode_M303()
+{
+  float temp = 150.0;
+  int e=0;
+  int c=5;
+  if (code_seen('E')) e=code_value();
+    if (e<0)
+      temp=70;
+  if (code_seen('S')) temp=code_value();
+  if (code_seen('C')) c=code_value();
+  bool apply = code_seen('U') && code_value() != 0;
+  #ifdef HEATER_MODEL
+  if (code_seen('F') && code_value() != 0) {
+    model_autotune(temp, e, apply);
+    return;
+  }
+  #endif
+  PID_autotune(temp, e, c, apply);
+}
+
+// M400 finish all moves
+static void gcode_M400()
+{
+  st_synchronize();
+}
+
 #if defined(ENABLE_AUTO_BED_LEVELING) && defined(SERVO_ENDSTOPS)
-    case 401:
-    {
-        engage_z_probe();    // Engage Z Servo endstop if available
-    }
-    break;
+// M401 - Lower z-probe if present
+static void gcode_M401()
+{
+  engage_z_probe();    // Engage Z Servo endstop if available
+}
+
+// M402 - Raise z-probe if present
+static void gcode_M402()
+{
+  retract_z_probe();    // Retract Z Servo endstop if enabled
+}
 
-    case 402:
-    {
-        retract_z_probe();    // Retract Z Servo endstop if enabled
-    }
-    break;
 #endif
-    case 500: // M500 Store settings in EEPROM
-    {
-        Config_StoreSettings();
-    }
-    break;
-    case 501: // M501 Read settings from EEPROM
-    {
-        Config_RetrieveSettings();
-    }
-    break;
-    case 502: // M502 Revert to default settings
-    {
-        Config_ResetDefault();
-    }
-    break;
-    case 503: // M503 print settings currently in memory
-    {
-        Config_PrintSettings();
-    }
-    break;
-    #ifdef ABORT_ON_ENDSTOP_HIT_FEATURE_ENABLED
-    case 540:
+
+// M500 Store settings in EEPROM
+static void gcode_M500()
+{
+  Config_StoreSettings();
+}
+
+// M501 Read settings from EEPROM
+static void gcode_M501()
+{
+  Config_RetrieveSettings();
+}
+
+// M502 Revert to default settings
+static void gcode_M502()
+{
+  Config_ResetDefault();
+}
+
+// M503 print settings currently in memory
+static void gcode_M503()
+{
+  Config_PrintSettings();
+}
+
+#ifdef ABORT_ON_ENDSTOP_HIT_FEATURE_ENABLED
+// M540 - Use S[0|1] to enable or disable the stop SD card print on endstop hit (requires ABORT_ON_ENDSTOP_HIT_FEATURE_ENABLED)
+static void gcode_M540()
+{
+  if(code_seen('S')) abort_on_endstop_hit = code_value() > 0;
+}
+
+#endif //ABORT_ON_ENDSTOP_HIT_FEATURE_ENABLED
+
+#ifdef CUSTOM_M_CODE_SET_Z_PROBE_OFFSET
+// CUSTOM_M_CODE_SET_Z_PROBE_OFFSET Z<offset> - Set the Z probe offset, Q echoes it back
+static void gcode_set_zprobe_offset()
+{
+  float value;
+  if (code_seen('Z'))
+  {
+    value = code_value();
+    if ((Z_PROBE_OFFSET_RANGE_MIN <= value) && (value <= Z_PROBE_OFFSET_RANGE_MAX))
     {
-        if(code_seen('S')) abort_on_endstop_hit = code_value() > 0;
+      zprobe_zoffset = -value; // compare w/ line 278 of ConfigurationStore.cpp
+      if (code_seen('Q')){
+          SERIAL_ECHO_START;
+          SERIAL_ECHOPGM("ZP_OFFSET:SET:");
+          SERIAL_ECHO(-zprobe_zoffset);
+          SERIAL_PROTOCOLLN("");
+      } else {
+          SERIAL_ECHO_START;
+          SERIAL_ECHOLNPGM(MSG_ZPROBE_ZOFFSET " " MSG_OK);
+          SERIAL_PROTOCOLLN("");
+      }
     }
-    break;
-    #endif
-
-    #ifdef CUSTOM_M_CODE_SET_Z_PROBE_OFFSET
-    case CUSTOM_M_CODE_SET_Z_PROBE_OFFSET:
+    else
     {
-      float value;
-      if (code_seen('Z'))
-      {
-        value = code_value();
-        if ((Z_PROBE_OFFSET_RANGE_MIN <= value) && (value <= Z_PROBE_OFFSET_RANGE_MAX))
-        {
-          zprobe_zoffset = -value; // compare w/ line 278 of ConfigurationStore.cpp
-          if (code_seen('Q')){
-              SERIAL_ECHO_START;
-              SERIAL_ECHOPGM("ZP_OFFSET:SET:");
-              SERIAL_ECHO(-zprobe_zoffset);
-              SERIAL_PROTOCOLLN("");
-          } else {
-              SERIAL_ECHO_START;
-              SERIAL_ECHOLNPGM(MSG_ZPROBE_ZOFFSET " " MSG_OK);
-              SERIAL_PROTOCOLLN("");
-          }
-        }
-        else
-        {
-            if (code_seen('Q')){
-                SERIAL_ECHO_START;
-                SERIAL_ECHOPGM("ZP_OFFSET:OUT_OF_RANGE:");
-                SERIAL_ECHO(Z_PROBE_OFFSET_RANGE_MIN);
-                SERIAL_ECHOPGM(":");
-                SERIAL_ECHO(Z_PROBE_OFFSET_RANGE_MAX);
-                SERIAL_PROTOCOLLN("");
-            } else {
-               SERIAL_ECHO_START;
-               SERIAL_ECHOPGM(MSG_ZPROBE_ZOFFSET);
-               SERIAL_ECHOPGM(MSG_Z_MIN);
-               SERIAL_ECHO(Z_PROBE_OFFSET_RANGE_MIN);
-               SERIAL_ECHOPGM(MSG_Z_MAX);
-               SERIAL_ECHO(Z_PROBE_OFFSET_RANGE_MAX);
-               SERIAL_PROTOCOLLN("");
-            }
+        if (code_seen('Q')){
+            SERIAL_ECHO_START;
+            SERIAL_ECHOPGM("ZP_OFFSET:OUT_OF_RANGE:");
+            SERIAL_ECHO(Z_PROBE_OFFSET_RANGE_MIN);
+            SERIAL_ECHOPGM(":");
+            SERIAL_ECHO(Z_PROBE_OFFSET_RANGE_MAX);
+            SERIAL_PROTOCOLLN("");
+        } else {
+           SERIAL_ECHO_START;
+           SERIAL_ECHOPGM(MSG_ZPROBE_ZOFFSET);
+           SERIAL_ECHOPGM(MSG_Z_MIN);
+           SERIAL_ECHO(Z_PROBE_OFFSET_RANGE_MIN);
+           SERIAL_ECHOPGM(MSG_Z_MAX);
+           SERIAL_ECHO(Z_PROBE_OFFSET_RANGE_MAX);
+           SERIAL_PROTOCOLLN("");
         }
-      }
-      else if (code_seen('D'))
-      {
+    }
+  }
+  else if (code_seen('D'))
+  {
 	value = code_value();
 	zprobe_zoffset_delta = -value;
 	if (code_seen('Q')){
@@ -3295,670 +4155,904 @@ void process_commands()
 	  SERIAL_ECHOLNPGM(MSG_ZPROBE_ZOFFSET " (delta) " MSG_OK);
 	  SERIAL_PROTOCOLLN("");
 	}
+  }
+  else
+  {
+      if (code_seen('Q')){
+          SERIAL_ECHO_START;
+          SERIAL_ECHOPGM("ZP_OFFSET:");
+          SERIAL_ECHO(-zprobe_zoffset);
+          SERIAL_ECHOPGM(":");
+          SERIAL_ECHO(-zprobe_zoffset_delta);
+          SERIAL_PROTOCOLLN("");
+      } else {
+          SERIAL_ECHO_START;
+          SERIAL_ECHOLNPGM(MSG_ZPROBE_ZOFFSET " : ");
+          SERIAL_ECHO(-zprobe_zoffset);
+          SERIAL_PROTOCOLLN("");
       }
-      else
-      {
-          if (code_seen('Q')){
-              SERIAL_ECHO_START;
-              SERIAL_ECHOPGM("ZP_OFFSET:");
-              SERIAL_ECHO(-zprobe_zoffset);
-              SERIAL_ECHOPGM(":");
-              SERIAL_ECHO(-zprobe_zoffset_delta);
-              SERIAL_PROTOCOLLN("");
-          } else {
-              SERIAL_ECHO_START;
-              SERIAL_ECHOLNPGM(MSG_ZPROBE_ZOFFSET " : ");
-              SERIAL_ECHO(-zprobe_zoffset);
-              SERIAL_PROTOCOLLN("");
-          }
-      }
-      break;
-    }
-    #endif // CUSTOM_M_CODE_SET_Z_PROBE_OFFSET
+  }
+}
 
-    #ifdef FILAMENTCHANGEENABLE
-    case 600: //Pause for filament change X[pos] Y[pos] Z[relative lift] E[initial retract] L[later retract distance for removal]
-    {
+#endif //CUSTOM_M_CODE_SET_Z_PROBE_OFFSET
+
+#ifdef FILAMENTCHANGEENABLE
+// M600 - Pause for filament change X[pos] Y[pos] Z[relative lift] E[initial retract] L[later retract distance for removal]
+static void gcode_M600()
+{
 	#ifdef USE_FILAMENT_DETECTION
-        bool old_detect_filament = detect_filament;
-        detect_filament = false;
-        if ( forced_M600 == true ) {
-            SERIAL_ECHO_START;
-            SERIAL_ECHOLNPGM("EVENT_FORCED_M600");
-        }
+  bool old_detect_filament = detect_filament;
+  detect_filament = false;
+  if ( forced_M600 == true ) {
+      SERIAL_ECHO_START;
+      SERIAL_ECHOLNPGM("EVENT_FORCED_M600");
+  }
 	#endif
-        float target[4];
-        float lastpos[4];
-        float old_feedrate=feedrate;
-        feedrate=FILAMENTCHANGE_FEEDRATE;
-        target[X_AXIS]=current_position[X_AXIS];
-        target[Y_AXIS]=current_position[Y_AXIS];
-        target[Z_AXIS]=current_position[Z_AXIS];
-        target[E_AXIS]=current_position[E_AXIS];
-        lastpos[X_AXIS]=current_position[X_AXIS];
-        lastpos[Y_AXIS]=current_position[Y_AXIS];
-        lastpos[Z_AXIS]=current_position[Z_AXIS];
-        lastpos[E_AXIS]=current_position[E_AXIS];
-        //retract by E
-        if(code_seen('E'))
-        {
-          target[E_AXIS]+= code_value();
-        }
-        else
-        {
-          #ifdef FILAMENTCHANGE_FIRSTRETRACT
-            target[E_AXIS]+= FILAMENTCHANGE_FIRSTRETRACT ;
-          #endif
-        }
-        plan_buffer_line(target[X_AXIS], target[Y_AXIS], target[Z_AXIS], target[E_AXIS], feedrate/60, active_extruder);
+  float target[4];
+  float lastpos[4];
+  float old_feedrate=feedrate;
+  feedrate=FILAMENTCHANGE_FEEDRATE;
+  target[X_AXIS]=current_position[X_AXIS];
+  target[Y_AXIS]=current_position[Y_AXIS];
+  target[Z_AXIS]=current_position[Z_AXIS];
+  target[E_AXIS]=current_position[E_AXIS];
+  lastpos[X_AXIS]=current_position[X_AXIS];
+  lastpos[Y_AXIS]=current_position[Y_AXIS];
+  lastpos[Z_AXIS]=current_position[Z_AXIS];
+  lastpos[E_AXIS]=current_position[E_AXIS];
+  //retract by E
+  if(code_seen('E'))
+  {
+    target[E_AXIS]+= code_value();
+  }
+  else
+  {
+    #ifdef FILAMENTCHANGE_FIRSTRETRACT
+      target[E_AXIS]+= FILAMENTCHANGE_FIRSTRETRACT ;
+    #endif
+  }
+  plan_buffer_line(target[X_AXIS], target[Y_AXIS], target[Z_AXIS], target[E_AXIS], feedrate/60, active_extruder);
 
-        //lift Z
-        if(code_seen('Z'))
-        {
-          target[Z_AXIS]+= code_value();
-        }
-        else
-        {
-          #ifdef FILAMENTCHANGE_ZADD
-            target[Z_AXIS]+= FILAMENTCHANGE_ZADD ;
-          #endif
-        }
+  //lift Z
+  if(code_seen('Z'))
+  {
+    target[Z_AXIS]+= code_value();
+  }
+  else
+  {
+    #ifdef FILAMENTCHANGE_ZADD
+      target[Z_AXIS]+= FILAMENTCHANGE_ZADD ;
+    #endif
+  }
 
-        if (target[Z_AXIS] > Z_MAX_POS){
-          target[Z_AXIS] = Z_MAX_POS;
+  if (target[Z_AXIS] > Z_MAX_POS){
+    target[Z_AXIS] = Z_MAX_POS;
   #ifdef Z_MAX_MARGIN
-          if (target[Z_AXIS] - current_position[Z_AXIS] > Z_MAX_MARGIN){
-            target[Z_AXIS]-= Z_MAX_MARGIN;
-          }
+    if (target[Z_AXIS] - current_position[Z_AXIS] > Z_MAX_MARGIN){
+      target[Z_AXIS]-= Z_MAX_MARGIN;
+    }
   #endif
-        }
-        plan_buffer_line(target[X_AXIS], target[Y_AXIS], target[Z_AXIS], target[E_AXIS], feedrate/35, active_extruder);
+  }
+  plan_buffer_line(target[X_AXIS], target[Y_AXIS], target[Z_AXIS], target[E_AXIS], feedrate/35, active_extruder);
 
-        //move xy
-        if(code_seen('X'))
-        {
-          target[X_AXIS] = code_value();
-        }
-        else
-        {
-          #ifdef FILAMENTCHANGE_XPOS
-            target[X_AXIS]= FILAMENTCHANGE_XPOS ;
-          #endif
-        }
-        if(code_seen('Y'))
-        {
-          target[Y_AXIS] = code_value();
-        }
-        else
-        {
-          #ifdef FILAMENTCHANGE_YPOS
-            target[Y_AXIS]= FILAMENTCHANGE_YPOS ;
-          #endif
-        }
+  //move xy
+  if(code_seen('X'))
+  {
+    target[X_AXIS] = code_value();
+  }
+  else
+  {
+    #ifdef FILAMENTCHANGE_XPOS
+      target[X_AXIS]= FILAMENTCHANGE_XPOS ;
+    #endif
+  }
+  if(code_seen('Y'))
+  {
+    target[Y_AXIS] = code_value();
+  }
+  else
+  {
+    #ifdef FILAMENTCHANGE_YPOS
+      target[Y_AXIS]= FILAMENTCHANGE_YPOS ;
+    #endif
+  }
 
-        plan_buffer_line(target[X_AXIS], target[Y_AXIS], target[Z_AXIS], target[E_AXIS], feedrate/10, active_extruder); // ex: feedrate/30
+  plan_buffer_line(target[X_AXIS], target[Y_AXIS], target[Z_AXIS], target[E_AXIS], feedrate/10, active_extruder); // ex: feedrate/30
 
-        if(code_seen('L'))
-        {
-          target[E_AXIS]+= code_value();
-        }
-        else
-        {
-          #ifdef FILAMENTCHANGE_FINALRETRACT
-            target[E_AXIS]+= FILAMENTCHANGE_FINALRETRACT ;
-          #endif
-        }
+  if(code_seen('L'))
+  {
+    target[E_AXIS]+= code_value();
+  }
+  else
+  {
+    #ifdef FILAMENTCHANGE_FINALRETRACT
+      target[E_AXIS]+= FILAMENTCHANGE_FINALRETRACT ;
+    #endif
+  }
 
-        plan_buffer_line(target[X_AXIS], target[Y_AXIS], target[Z_AXIS], target[E_AXIS], feedrate, active_extruder);
+  plan_buffer_line(target[X_AXIS], target[Y_AXIS], target[Z_AXIS], target[E_AXIS], feedrate, active_extruder);
 
-        //finish moves
-        st_synchronize();
-        //disable extruder steppers so filament can be removed
-        disable_e0();
-        disable_e1();
-        disable_e2();
-        delay(100);
-        LCD_MESSAGEPGM(MSG_FILAMENTCHANGE);
-        lcd_ForceStatusScreen(true);
-        #ifdef USE_EXTERNAL_CLICK
-        sendM613Click( true );
-        #endif
-        uint8_t cnt=0;
-        while(!lcd_clicked()){
-          cnt++;
-          manage_heater();
-          manage_inactivity();
-          lcd_update();
-          if(cnt==0)
-          {
-          #if BEEPER > 0
-            SET_OUTPUT(BEEPER);
-
-            WRITE(BEEPER,HIGH);
-            delay(3);
-            WRITE(BEEPER,LOW);
-            delay(3);
-          #else
+  //finish moves
+  st_synchronize();
+  //disable extruder steppers so filament can be removed
+  disable_e0();
+  disable_e1();
+  disable_e2();
+  delay(100);
+  LCD_MESSAGEPGM(MSG_FILAMENTCHANGE);
+  lcd_ForceStatusScreen(true);
+  #ifdef USE_EXTERNAL_CLICK
+  sendM613Click( true );
+  #endif
+  uint8_t cnt=0;
+  while(!lcd_clicked()){
+    cnt++;
+    manage_heater();
+    manage_inactivity();
+    lcd_update();
+    if(cnt==0)
+    {
+    #if BEEPER > 0
+      SET_OUTPUT(BEEPER);
+
+      WRITE(BEEPER,HIGH);
+      delay(3);
+      WRITE(BEEPER,LOW);
+      delay(3);
+    #else
 			#if !defined(LCD_FEEDBACK_FREQUENCY_HZ) || !defined(LCD_FEEDBACK_FREQUENCY_DURATION_MS)
-              lcd_buzz(1000/6,100);
+        lcd_buzz(1000/6,100);
 			#else
 			  lcd_buzz(LCD_FEEDBACK_FREQUENCY_DURATION_MS,LCD_FEEDBACK_FREQUENCY_HZ);
 			#endif
-          #endif
-          }
-        }
+    #endif
+    }
+  }
 
-        #ifdef USE_EXTERNAL_CLICK
-        sendM613Click( false );
-        #endif
+  #ifdef USE_EXTERNAL_CLICK
+  sendM613Click( false );
+  #endif
 
-        // Wait until the button is not clicked
-        while(lcd_clicked()){
-          manage_heater();
-          manage_inactivity();
-          lcd_update();
-        }
-       
-        // Prevent unlimited extrusion in case of error
-        unsigned long extrusion_timeout = (unsigned long) FILAMENTCHANGE_EXTRUSION_TIMEOUT * 1000UL;
-        if(code_seen('S'))
-        {
-            extrusion_timeout = (unsigned long) code_value() * 1000UL;
-        }
+  // Wait until the button is not clicked
+  while(lcd_clicked()){
+    manage_heater();
+    manage_inactivity();
+    lcd_update();
+  }
 
-        delay(500); 
-        LCD_MESSAGEPGM(MSG_LOAD_SINGLE);
-        unsigned long extrusion_start = millis();
-        int extrude = 1;
+  // Prevent unlimited extrusion in case of error
+  unsigned long extrusion_timeout = (unsigned long) FILAMENTCHANGE_EXTRUSION_TIMEOUT * 1000UL;
+  if(code_seen('S'))
+  {
+      extrusion_timeout = (unsigned long) code_value() * 1000UL;
+  }
+
+  delay(500); 
+  LCD_MESSAGEPGM(MSG_LOAD_SINGLE);
+  unsigned long extrusion_start = millis();
+  int extrude = 1;
 
 #ifdef USE_EXTERNAL_CLICK
-        sendM613Click( true );
+  sendM613Click( true );
 #endif
-        // Extrude until the button is clicked
-        while(!lcd_clicked()){
-          manage_heater();
-          manage_inactivity();
-          lcd_update();
 
-          // Prevent unlimited extrusion in case of error
-          if (extrude > 0){
-              target[E_AXIS]+=0.5;
-              plan_buffer_line(target[X_AXIS], target[Y_AXIS], target[Z_AXIS], target[E_AXIS], feedrate/100, active_extruder);
-              if (millis() - extrusion_start >= extrusion_timeout){
-                  LCD_MESSAGEPGM("Extrusion stopped");
-          #ifdef USE_EXTERNAL_CLICK
-                  sendM613Click( true );
-          #endif
-                  extrude = 0;
-              }
-          }
+  // Extrude until the button is clicked
+  while(!lcd_clicked()){
+    manage_heater();
+    manage_inactivity();
+    lcd_update();
+
+    // Prevent unlimited extrusion in case of error
+    if (extrude > 0){
+        target[E_AXIS]+=0.5;
+        plan_buffer_line(target[X_AXIS], target[Y_AXIS], target[Z_AXIS], target[E_AXIS], feedrate/100, active_extruder);
+        if (millis() - extrusion_start >= extrusion_timeout){
+            LCD_MESSAGEPGM("Extrusion stopped");
+    #ifdef USE_EXTERNAL_CLICK
+            sendM613Click( true );
+    #endif
+            extrude = 0;
         }
+    }
+  }
 #ifdef USE_EXTERNAL_CLICK
-        sendM613Click( false );
+  sendM613Click( false );
 #endif
-        // E axis is handled directly by the user so reset it to the actual position
-        target[E_AXIS]=lastpos[E_AXIS];
-        current_position[E_AXIS]=target[E_AXIS];
-        plan_set_e_position(current_position[E_AXIS]);
-
-        plan_buffer_line(target[X_AXIS], target[Y_AXIS], target[Z_AXIS], target[E_AXIS], feedrate/100, active_extruder); // should do nothing
-        plan_buffer_line(lastpos[X_AXIS], lastpos[Y_AXIS], target[Z_AXIS], target[E_AXIS], feedrate/10, active_extruder); //move xy back ; ex: feedrate/30
-        plan_buffer_line(lastpos[X_AXIS],  lastpos[Y_AXIS], lastpos[Z_AXIS], target[E_AXIS], feedrate/35, active_extruder); //move z back
-        plan_buffer_line(lastpos[X_AXIS], lastpos[Y_AXIS], lastpos[Z_AXIS], lastpos[E_AXIS], feedrate/60, active_extruder); //final untretract - should do nothing
-        feedrate=old_feedrate;
-        lcd_ForceStatusScreen(false);
-
-        #ifdef USE_FILAMENT_DETECTION
-        if ( forced_M600 == true ) {
-          forced_M600 = false;
-          forced_M600_inqueue = false;
-          LCD_MESSAGEPGM(MSG_RESUMING);
-        }
-        st_synchronize();
-        detect_filament = old_detect_filament;
-        #endif
-    }
-    break;
-    #endif //FILAMENTCHANGEENABLE
-    #ifdef DUAL_X_CARRIAGE
-    case 605: // Set dual x-carriage movement mode:
-              //    M605 S0: Full control mode. The slicer has full control over x-carriage movement
-              //    M605 S1: Auto-park mode. The inactive head will auto park/unpark without slicer involvement
-              //    M605 S2 [Xnnn] [Rmmm]: Duplication mode. The second extruder will duplicate the first with nnn
-              //                         millimeters x-offset and an optional differential hotend temperature of
-              //                         mmm degrees. E.g., with "M605 S2 X100 R2" the second extruder will duplicate
-              //                         the first with a spacing of 100mm in the x direction and 2 degrees hotter.
-              //
-              //    Note: the X axis should be homed after changing dual x-carriage mode.
-    {
-        st_synchronize();
 
-        if (code_seen('S'))
-          dual_x_carriage_mode = code_value();
+  // E axis is handled directly by the user so reset it to the actual position
+  target[E_AXIS]=lastpos[E_AXIS];
+  current_position[E_AXIS]=target[E_AXIS];
+  plan_set_e_position(current_position[E_AXIS]);
 
-        if (dual_x_carriage_mode == DXC_DUPLICATION_MODE)
-        {
-          if (code_seen('X'))
-            duplicate_extruder_x_offset = max(code_value(),X2_MIN_POS - x_home_pos(0));
+  plan_buffer_line(target[X_AXIS], target[Y_AXIS], target[Z_AXIS], target[E_AXIS], feedrate/100, active_extruder); // should do nothing
+  plan_buffer_line(lastpos[X_AXIS], lastpos[Y_AXIS], target[Z_AXIS], target[E_AXIS], feedrate/10, active_extruder); //move xy back ; ex: feedrate/30
+  plan_buffer_line(lastpos[X_AXIS],  lastpos[Y_AXIS], lastpos[Z_AXIS], target[E_AXIS], feedrate/35, active_extruder); //move z back
+  plan_buffer_line(lastpos[X_AXIS], lastpos[Y_AXIS], lastpos[Z_AXIS], lastpos[E_AXIS], feedrate/60, active_extruder); //final untretract - should do nothing
+  feedrate=old_feedrate;
+  lcd_ForceStatusScreen(false);
 
-          if (code_seen('R'))
-            duplicate_extruder_temp_offset = code_value();
+  #ifdef USE_FILAMENT_DETECTION
+  if ( forced_M600 == true ) {
+    forced_M600 = false;
+    forced_M600_inqueue = false;
+    LCD_MESSAGEPGM(MSG_RESUMING);
+  }
+  st_synchronize();
+  detect_filament = old_detect_filament;
+  #endif
+}
 
-          SERIAL_ECHO_START;
-          SERIAL_ECHOPGM(MSG_HOTEND_OFFSET);
-          SERIAL_ECHO(" ");
-          SERIAL_ECHO(extruder_offset[X_AXIS][0]);
-          SERIAL_ECHO(",");
-          SERIAL_ECHO(extruder_offset[Y_AXIS][0]);
-          SERIAL_ECHO(" ");
-          SERIAL_ECHO(duplicate_extruder_x_offset);
-          SERIAL_ECHO(",");
-          SERIAL_ECHOLN(extruder_offset[Y_AXIS][1]);
-        }
-        else if (dual_x_carriage_mode != DXC_FULL_CONTROL_MODE && dual_x_carriage_mode != DXC_AUTO_PARK_MODE)
-        {
-          dual_x_carriage_mode = DEFAULT_DUAL_X_CARRIAGE_MODE;
-        }
+#endif //FILAMENTCHANGEENABLE
+
+#ifdef DUAL_X_CARRIAGE
+// M605 - Set dual x-carriage movement mode
+static void gcode_M605()
+{
+        //    M605 S0: Full control mode. The slicer has full control over x-carriage movement
+        //    M605 S1: Auto-park mode. The inactive head will auto park/unpark without slicer involvement
+        //    M605 S2 [Xnnn] [Rmmm]: Duplication mode. The second extruder will duplicate the first with nnn
+        //                         millimeters x-offset and an optional differential hotend temperature of
+        //                         mmm degrees. E.g., with "M605 S2 X100 R2" the second extruder will duplicate
+        //                         the first with a spacing of 100mm in the x direction and 2 degrees hotter.
+        //
+        //    Note: the X axis should be homed after changing dual x-carriage mode.
+  st_synchronize();
+
+  if (code_seen('S'))
+    dual_x_carriage_mode = code_value();
+
+  if (dual_x_carriage_mode == DXC_DUPLICATION_MODE)
+  {
+    if (code_seen('X'))
+      duplicate_extruder_x_offset = max(code_value(),X2_MIN_POS - x_home_pos(0));
+
+    if (code_seen('R'))
+      duplicate_extruder_temp_offset = code_value();
+
+    SERIAL_ECHO_START;
+    SERIAL_ECHOPGM(MSG_HOTEND_OFFSET);
+    SERIAL_ECHO(" ");
+    SERIAL_ECHO(extruder_offset[X_AXIS][0]);
+    SERIAL_ECHO(",");
+    SERIAL_ECHO(extruder_offset[Y_AXIS][0]);
+    SERIAL_ECHO(" ");
+    SERIAL_ECHO(duplicate_extruder_x_offset);
+    SERIAL_ECHO(",");
+    SERIAL_ECHOLN(extruder_offset[Y_AXIS][1]);
+  }
+  else if (dual_x_carriage_mode != DXC_FULL_CONTROL_MODE && dual_x_carriage_mode != DXC_AUTO_PARK_MODE)
+  {
+    dual_x_carriage_mode = DEFAULT_DUAL_X_CARRIAGE_MODE;
+  }
+
+  active_extruder_parked = false;
+  extruder_duplication_enabled = false;
+  delayed_move_time = 0;
+}
+
+#endif //DUAL_X_CARRIAGE
+
+#ifdef BINARY_TRANSPORT
+// M620 S1 - binary frames from the host, S0 - text lines again
+static void gcode_M620()
+{
+  // the host waits for the "ok" of this command before it switches
+  if(code_seen('S'))
+    binary_transport = code_value_long() != 0;
+  frame_pos = 0;
+}
+
+#endif //BINARY_TRANSPORT
+
+// M907 Set digital trimpot motor current using axis codes.
+static void gcode_M907()
+{
+#if defined(DIGIPOTSS_PIN) && DIGIPOTSS_PIN > -1
+  for(int i=0;i<NUM_AXIS;i++) if(code_seen(axis_codes[i])) digipot_current(i,code_value());
+  if(code_seen('B')) digipot_current(4,code_value());
+  if(code_seen('S')) for(int i=0;i<=4;i++) digipot_current(i,code_value());
+#endif
+
+#ifdef MOTOR_CURRENT_PWM_XY_PIN
+  if(code_seen('X')) digipot_current(0, code_value());
+#endif
+
+#ifdef MOTOR_CURRENT_PWM_Z_PIN
+  if(code_seen('Z')) digipot_current(1, code_value());
+#endif
+
+#ifdef MOTOR_CURRENT_PWM_E_PIN
+  if(code_seen('E')) digipot_current(2, code_value());
+#endif
+
+#ifdef DIGIPOT_I2C
+  // this one uses actual amps in floating point
+  for(int i=0;i<NUM_AXIS;i++) if(code_seen(axis_codes[i])) digipot_i2c_set_current(i, code_value());
+  // for each additional extruder (named B,C,D,E..., channels 4,5,6,7...)
+  for(int i=NUM_AXIS;i<DIGIPOT_I2C_NUM_CHANNELS;i++) if(code_seen('B'+i-NUM_AXIS)) digipot_i2c_set_current(i, code_value());
+#endif
+
+}
+
+// M908 Control digital trimpot directly.
+static void gcode_M908()
+{
+#if defined(DIGIPOTSS_PIN) && DIGIPOTSS_PIN > -1
+  uint8_t channel,current;
+  if(code_seen('P')) channel=code_value();
+  if(code_seen('S')) current=code_value();
+  digitalPotWrite(channel, current);
+#endif
+
+}
+
+// M350 Set microstepping mode. Warning: Steps per unit remains unchanged. S code sets stepping mode for all drivers.
+static void gcode_M350()
+{
+#if defined(X_MS1_PIN) && X_MS1_PIN > -1
+  if(code_seen('S')) for(int i=0;i<=4;i++) microstep_mode(i,code_value());
+  for(int i=0;i<NUM_AXIS;i++) if(code_seen(axis_codes[i])) microstep_mode(i,(uint8_t)code_value());
+  if(code_seen('B')) microstep_mode(4,code_value());
+  microstep_readings();
+#endif
 
-        active_extruder_parked = false;
-        extruder_duplication_enabled = false;
-        delayed_move_time = 0;
-    }
-    break;
-    #endif //DUAL_X_CARRIAGE
+}
 
-    case 907: // M907 Set digital trimpot motor current using axis codes.
-    {
-      #if defined(DIGIPOTSS_PIN) && DIGIPOTSS_PIN > -1
-        for(int i=0;i<NUM_AXIS;i++) if(code_seen(axis_codes[i])) digipot_current(i,code_value());
-        if(code_seen('B')) digipot_current(4,code_value());
-        if(code_seen('S')) for(int i=0;i<=4;i++) digipot_current(i,code_value());
-      #endif
-      #ifdef MOTOR_CURRENT_PWM_XY_PIN
-        if(code_seen('X')) digipot_current(0, code_value());
-      #endif
-      #ifdef MOTOR_CURRENT_PWM_Z_PIN
-        if(code_seen('Z')) digipot_current(1, code_value());
-      #endif
-      #ifdef MOTOR_CURRENT_PWM_E_PIN
-        if(code_seen('E')) digipot_current(2, code_value());
-      #endif
-      #ifdef DIGIPOT_I2C
-        // this one uses actual amps in floating point
-        for(int i=0;i<NUM_AXIS;i++) if(code_seen(axis_codes[i])) digipot_i2c_set_current(i, code_value());
-        // for each additional extruder (named B,C,D,E..., channels 4,5,6,7...)
-        for(int i=NUM_AXIS;i<DIGIPOT_I2C_NUM_CHANNELS;i++) if(code_seen('B'+i-NUM_AXIS)) digipot_i2c_set_current(i, code_value());
-      #endif
-    }
-    break;
-    case 908: // M908 Control digital trimpot directly.
-    {
-      #if defined(DIGIPOTSS_PIN) && DIGIPOTSS_PIN > -1
-        uint8_t channel,current;
-        if(code_seen('P')) channel=code_value();
-        if(code_seen('S')) current=code_value();
-        digitalPotWrite(channel, current);
-      #endif
-    }
-    break;
-    case 350: // M350 Set microstepping mode. Warning: Steps per unit remains unchanged. S code sets stepping mode for all drivers.
-    {
-      #if defined(X_MS1_PIN) && X_MS1_PIN > -1
-        if(code_seen('S')) for(int i=0;i<=4;i++) microstep_mode(i,code_value());
-        for(int i=0;i<NUM_AXIS;i++) if(code_seen(axis_codes[i])) microstep_mode(i,(uint8_t)code_value());
-        if(code_seen('B')) microstep_mode(4,code_value());
-        microstep_readings();
-      #endif
-    }
-    break;
-    case 351: // M351 Toggle MS1 MS2 pins directly, S# determines MS1 or MS2, X# sets the pin high/low.
-    {
-      #if defined(X_MS1_PIN) && X_MS1_PIN > -1
-      if(code_seen('S')) switch((int)code_value())
-      {
-        case 1:
-          for(int i=0;i<NUM_AXIS;i++) if(code_seen(axis_codes[i])) microstep_ms(i,code_value(),-1);
-          if(code_seen('B')) microstep_ms(4,code_value(),-1);
-          break;
-        case 2:
-          for(int i=0;i<NUM_AXIS;i++) if(code_seen(axis_codes[i])) microstep_ms(i,-1,code_value());
-          if(code_seen('B')) microstep_ms(4,-1,code_value());
-          break;
-      }
-      microstep_readings();
-      #endif
-    }
-    break;
+// M351 Toggle MS1 MS2 pins directly, S# determines MS1 or MS2, X# sets the pin high/low.
+static void gcode_M351()
+{
+  #if defined(X_MS1_PIN) && X_MS1_PIN > -1
+  if(code_seen('S')) switch((int)code_value())
+  {
+    case 1:
+      for(int i=0;i<NUM_AXIS;i++) if(code_seen(axis_codes[i])) microstep_ms(i,code_value(),-1);
+      if(code_seen('B')) microstep_ms(4,code_value(),-1);
+      break;
+    case 2:
+      for(int i=0;i<NUM_AXIS;i++) if(code_seen(axis_codes[i])) microstep_ms(i,-1,code_value());
+      if(code_seen('B')) microstep_ms(4,-1,code_value());
+      break;
+  }
+  microstep_readings();
+  #endif
+}
 
-    /*
-    case 997: // Allineamento degli assi Z manda un impulso su ciscun asse finche' non raggiungere i fine corsa
+/*
+// M997 - Allineamento degli assi Z manda un impulso su ciscun asse finche' non raggiungere i fine corsa
+static void gcode_M997()
+{
 #if defined(Z_DUAL_STEPPER_DRIVERS) && defined(Z2_STEP_PIN) && (Z2_STEP_PIN > -1)
-      enable_z();
+  enable_z();
 
-      #if Z_HOME_DIR == 1
-        #define HOME_Z_DUAL_COND ( (READ(Z_MAX_PIN)==1) || (READ(Z2_MAX_PIN)==1) )
-        #define HOME_Z_DUAL_DIR_PIN !INVERT_Z_DIR
-        #define HOME_Z_COND (READ(Z_MAX_PIN))
-        #define HOME_Z2_COND (READ(Z2_MAX_PIN))
-      #else
-        #define HOME_Z_DUAL_COND ( (READ(Z_MIN_PIN)==1) || (READ(Z2_MIN_PIN)==1) )
-        #define HOME_Z_DUAL_DIR_PIN INVERT_Z_DIR
-        #define HOME_Z_COND (READ(Z_MAX_PIN))
-        #define HOME_Z2_COND (READ(Z2_MAX_PIN))
-      #endif
-      while ( HOME_Z_DUAL_COND ) {
-        int i;
-
-        manage_heater();
-        manage_inactivity();
-        lcd_update();
-        if ( HOME_Z_COND==1 ) {
-          WRITE(Z_DIR_PIN,HOME_Z_DUAL_DIR_PIN);
-           for ( i=0; i<400; i++ ) {
-              delay(1);
-              WRITE(Z_STEP_PIN, !INVERT_Z_STEP_PIN);
-              WRITE(Z_STEP_PIN, INVERT_Z_STEP_PIN);
-           }
-        }
+  #if Z_HOME_DIR == 1
+    #define HOME_Z_DUAL_COND ( (READ(Z_MAX_PIN)==1) || (READ(Z2_MAX_PIN)==1) )
+    #define HOME_Z_DUAL_DIR_PIN !INVERT_Z_DIR
+    #define HOME_Z_COND (READ(Z_MAX_PIN))
+    #define HOME_Z2_COND (READ(Z2_MAX_PIN))
+  #else
+    #define HOME_Z_DUAL_COND ( (READ(Z_MIN_PIN)==1) || (READ(Z2_MIN_PIN)==1) )
+    #define HOME_Z_DUAL_DIR_PIN INVERT_Z_DIR
+    #define HOME_Z_COND (READ(Z_MAX_PIN))
+    #define HOME_Z2_COND (READ(Z2_MAX_PIN))
+  #endif
+  while ( HOME_Z_DUAL_COND ) {
+    int i;
+
+    manage_heater();
+    manage_inactivity();
+    lcd_update();
+    if ( HOME_Z_COND==1 ) {
+      WRITE(Z_DIR_PIN,HOME_Z_DUAL_DIR_PIN);
+       for ( i=0; i<400; i++ ) {
+          delay(1);
+          WRITE(Z_STEP_PIN, !INVERT_Z_STEP_PIN);
+          WRITE(Z_STEP_PIN, INVERT_Z_STEP_PIN);
+       }
+    }
 
-        manage_heater();
-        manage_inactivity();
-        lcd_update();
-        if ( HOME_Z2_COND==1 ) {
-          WRITE(Z2_DIR_PIN,HOME_Z_DUAL_DIR_PIN);
-          for ( i=0; i<400; i++) {
-            delay(1);
-            WRITE(Z2_STEP_PIN, !INVERT_Z_STEP_PIN);
-            WRITE(Z2_STEP_PIN, INVERT_Z_STEP_PIN);
-          }
-        }
+    manage_heater();
+    manage_inactivity();
+    lcd_update();
+    if ( HOME_Z2_COND==1 ) {
+      WRITE(Z2_DIR_PIN,HOME_Z_DUAL_DIR_PIN);
+      for ( i=0; i<400; i++) {
+        delay(1);
+        WRITE(Z2_STEP_PIN, !INVERT_Z_STEP_PIN);
+        WRITE(Z2_STEP_PIN, INVERT_Z_STEP_PIN);
       }
+    }
+  }
 #endif
+}
 */
-    break;
-
-    case 2000: // M2000: Print lifetime stats
-      if(code_seen('R')) {
-        reset_triptime();
-      }
-      if (code_seen('Q')){
-	      print_lifetime_stats(1);
-      } else {
-          print_lifetime_stats(0);
-      }
-      break;
-
-    case 990: //Pause movement X[pos] Y[pos] Z[relative lift] E[initial retract]
-    {
-        st_synchronize();
 
-        float target[4];
-        saved_feedrate=feedrate;
-        feedrate=PAUSERESUME_FEEDRATE;
-
-        target[X_AXIS]=current_position[X_AXIS];
-        target[Y_AXIS]=current_position[Y_AXIS];
-        target[Z_AXIS]=current_position[Z_AXIS];
-        target[E_AXIS]=current_position[E_AXIS];
-        resumepos[X_AXIS]=current_position[X_AXIS];
-        resumepos[Y_AXIS]=current_position[Y_AXIS];
-        resumepos[Z_AXIS]=current_position[Z_AXIS];
-        resumepos[E_AXIS]=current_position[E_AXIS];
-
-        //retract by E
-        if(code_seen('E'))
-        {
-          target[E_AXIS]+= code_value();
-        }
-        else
-        {
-          #ifdef PAUSERESUME_RETRACT
-            target[E_AXIS]+= PAUSERESUME_RETRACT ;
-          #endif
-        }
-        plan_buffer_line(target[X_AXIS], target[Y_AXIS], target[Z_AXIS], target[E_AXIS], feedrate/100, active_extruder);
+// M990 - Pause movement X[pos] Y[pos] Z[relative lift] E[initial retract]
+static void gcode_M990()
+{
+  st_synchronize();
+
+  float target[4];
+  saved_feedrate=feedrate;
+  feedrate=PAUSERESUME_FEEDRATE;
+
+  target[X_AXIS]=current_position[X_AXIS];
+  target[Y_AXIS]=current_position[Y_AXIS];
+  target[Z_AXIS]=current_position[Z_AXIS];
+  target[E_AXIS]=current_position[E_AXIS];
+  resumepos[X_AXIS]=current_position[X_AXIS];
+  resumepos[Y_AXIS]=current_position[Y_AXIS];
+  resumepos[Z_AXIS]=current_position[Z_AXIS];
+  resumepos[E_AXIS]=current_position[E_AXIS];
+
+  //retract by E
+  if(code_seen('E'))
+  {
+    target[E_AXIS]+= code_value();
+  }
+  else
+  {
+    #ifdef PAUSERESUME_RETRACT
+      target[E_AXIS]+= PAUSERESUME_RETRACT ;
+    #endif
+  }
+  plan_buffer_line(target[X_AXIS], target[Y_AXIS], target[Z_AXIS], target[E_AXIS], feedrate/100, active_extruder);
 
-        //lift Z
-        if(code_seen('Z'))
-        {
-          target[Z_AXIS]+= code_value();
-        }
-        else
-        {
-          #ifdef PAUSERESUME_ZADD
-            target[Z_AXIS]+= PAUSERESUME_ZADD ;
-          #endif
-        }
+  //lift Z
+  if(code_seen('Z'))
+  {
+    target[Z_AXIS]+= code_value();
+  }
+  else
+  {
+    #ifdef PAUSERESUME_ZADD
+      target[Z_AXIS]+= PAUSERESUME_ZADD ;
+    #endif
+  }
 
-        if (target[Z_AXIS] > Z_MAX_POS){
-          target[Z_AXIS] = Z_MAX_POS;
-          #ifdef Z_MAX_MARGIN
-            target[Z_AXIS]-= Z_MAX_MARGIN;
-          #endif
-        }
-        plan_buffer_line(target[X_AXIS], target[Y_AXIS], target[Z_AXIS], target[E_AXIS], feedrate/35, active_extruder);
+  if (target[Z_AXIS] > Z_MAX_POS){
+    target[Z_AXIS] = Z_MAX_POS;
+    #ifdef Z_MAX_MARGIN
+      target[Z_AXIS]-= Z_MAX_MARGIN;
+    #endif
+  }
+  plan_buffer_line(target[X_AXIS], target[Y_AXIS], target[Z_AXIS], target[E_AXIS], feedrate/35, active_extruder);
 
-        //move xy
-        if(code_seen('X'))
-        {
-          target[X_AXIS] = code_value();
-        }
-        else
-        {
-          #ifdef PAUSERESUME_XPOS
-            target[X_AXIS]= PAUSERESUME_XPOS ;
-          #endif
-        }
-        if(code_seen('Y'))
-        {
-          target[Y_AXIS] = code_value();
-        }
-        else
-        {
-          #ifdef PAUSERESUME_YPOS
-            target[Y_AXIS]= PAUSERESUME_YPOS ;
-          #endif
-        }
+  //move xy
+  if(code_seen('X'))
+  {
+    target[X_AXIS] = code_value();
+  }
+  else
+  {
+    #ifdef PAUSERESUME_XPOS
+      target[X_AXIS]= PAUSERESUME_XPOS ;
+    #endif
+  }
+  if(code_seen('Y'))
+  {
+    target[Y_AXIS] = code_value();
+  }
+  else
+  {
+    #ifdef PAUSERESUME_YPOS
+      target[Y_AXIS]= PAUSERESUME_YPOS ;
+    #endif
+  }
 
-        plan_buffer_line(target[X_AXIS], target[Y_AXIS], target[Z_AXIS], target[E_AXIS], feedrate/10, active_extruder);
+  plan_buffer_line(target[X_AXIS], target[Y_AXIS], target[Z_AXIS], target[E_AXIS], feedrate/10, active_extruder);
 
-        //finish moves
-        st_synchronize();
-        current_position[X_AXIS] = target[X_AXIS];
-        current_position[Y_AXIS] = target[Y_AXIS];
-        current_position[Z_AXIS] = target[Z_AXIS];
-        current_position[E_AXIS] = target[E_AXIS];
+  //finish moves
+  st_synchronize();
+  current_position[X_AXIS] = target[X_AXIS];
+  current_position[Y_AXIS] = target[Y_AXIS];
+  current_position[Z_AXIS] = target[Z_AXIS];
+  current_position[E_AXIS] = target[E_AXIS];
 
-        //feedrate = saved_feedrate;
-    }
-    break;
+  //feedrate = saved_feedrate;
+}
 
-    case 991: //Resume movement after pause (with previously saved values)
-    {
-      st_synchronize();
+// M991 - Resume movement after pause (with previously saved values)
+static void gcode_M991()
+{
+  st_synchronize();
 
-      float lastpos[4];
-      feedrate=PAUSERESUME_FEEDRATE;
-      lastpos[X_AXIS]=current_position[X_AXIS];
-      lastpos[Y_AXIS]=current_position[Y_AXIS];
-      lastpos[Z_AXIS]=current_position[Z_AXIS];
-      lastpos[E_AXIS]=current_position[E_AXIS];
+  float lastpos[4];
+  feedrate=PAUSERESUME_FEEDRATE;
+  lastpos[X_AXIS]=current_position[X_AXIS];
+  lastpos[Y_AXIS]=current_position[Y_AXIS];
+  lastpos[Z_AXIS]=current_position[Z_AXIS];
+  lastpos[E_AXIS]=current_position[E_AXIS];
 
-      plan_buffer_line(lastpos[X_AXIS], lastpos[Y_AXIS], lastpos[Z_AXIS], lastpos[E_AXIS], feedrate/60, active_extruder); // should do nothing
-      plan_buffer_line(resumepos[X_AXIS], resumepos[Y_AXIS], lastpos[Z_AXIS], lastpos[E_AXIS], feedrate/10, active_extruder); //move xy back
-      plan_buffer_line(resumepos[X_AXIS], resumepos[Y_AXIS], resumepos[Z_AXIS], lastpos[E_AXIS], feedrate/35, active_extruder); //move z back
-      plan_buffer_line(resumepos[X_AXIS], resumepos[Y_AXIS], resumepos[Z_AXIS], resumepos[E_AXIS], feedrate/100, active_extruder); //final untretract
+  plan_buffer_line(lastpos[X_AXIS], lastpos[Y_AXIS], lastpos[Z_AXIS], lastpos[E_AXIS], feedrate/60, active_extruder); // should do nothing
+  plan_buffer_line(resumepos[X_AXIS], resumepos[Y_AXIS], lastpos[Z_AXIS], lastpos[E_AXIS], feedrate/10, active_extruder); //move xy back
+  plan_buffer_line(resumepos[X_AXIS], resumepos[Y_AXIS], resumepos[Z_AXIS], lastpos[E_AXIS], feedrate/35, active_extruder); //move z back
+  plan_buffer_line(resumepos[X_AXIS], resumepos[Y_AXIS], resumepos[Z_AXIS], resumepos[E_AXIS], feedrate/100, active_extruder); //final untretract
 
-      //finish moves
-      st_synchronize();
+  //finish moves
+  st_synchronize();
 
-      current_position[X_AXIS] = resumepos[X_AXIS];
-      current_position[Y_AXIS] = resumepos[Y_AXIS];
-      current_position[Z_AXIS] = resumepos[Z_AXIS];
-      current_position[E_AXIS] = resumepos[E_AXIS];
+  current_position[X_AXIS] = resumepos[X_AXIS];
+  current_position[Y_AXIS] = resumepos[Y_AXIS];
+  current_position[Z_AXIS] = resumepos[Z_AXIS];
+  current_position[E_AXIS] = resumepos[E_AXIS];
 
-      feedrate=saved_feedrate;
+  feedrate=saved_feedrate;
+}
 
+// M993 filament detection on/off
+static void gcode_M993()
+{
+    #ifdef USE_FILAMENT_DETECTION
+    if (code_seen('S')){
+  	  detect_filament = !(code_value() == 0);
     }
-    break;
-
-    case 993: // M993 filament detection on/off
-      #ifdef USE_FILAMENT_DETECTION
-      if (code_seen('S')){
-    	  detect_filament = !(code_value() == 0);
-      }
-      if (code_seen('P')){
-    	  float value = code_value();
-          if ((FILAMENT_DETECTION_FACTOR_MIN <= value) && (value <= FILAMENT_DETECTION_FACTOR_MAX))
-          {
-              detect_filament_factor = value;
-          }
-          else
-          {
-            SERIAL_ECHO_START;
-            SERIAL_ECHOPGM("Filament detection factor out of limit. ");
-            SERIAL_ECHOPGM("FDF Min: ");
-            SERIAL_ECHO(FILAMENT_DETECTION_FACTOR_MIN);
-            SERIAL_ECHOPGM(" FDF Max: ");
-            SERIAL_ECHO(FILAMENT_DETECTION_FACTOR_MAX);
-            SERIAL_PROTOCOLLN("");
-          }
-      }
-      SERIAL_ECHO_START;
-      SERIAL_ECHOPGM("Filament detection ");
-      if (detect_filament){
+    if (code_seen('P')){
+  	  float value = code_value();
+        if ((FILAMENT_DETECTION_FACTOR_MIN <= value) && (value <= FILAMENT_DETECTION_FACTOR_MAX))
+        {
+            detect_filament_factor = value;
+        }
+        else
+        {
+          SERIAL_ECHO_START;
+          SERIAL_ECHOPGM("Filament detection factor out of limit. ");
+          SERIAL_ECHOPGM("FDF Min: ");
+          SERIAL_ECHO(FILAMENT_DETECTION_FACTOR_MIN);
+          SERIAL_ECHOPGM(" FDF Max: ");
+          SERIAL_ECHO(FILAMENT_DETECTION_FACTOR_MAX);
+          SERIAL_PROTOCOLLN("");
+        }
+    }
+    SERIAL_ECHO_START;
+    SERIAL_ECHOPGM("Filament detection ");
+    if (detect_filament){
 	  SERIAL_ECHOPGM("ON f:");
-      } else {
+    } else {
 	  SERIAL_ECHOPGM("OFF f:");
-      }
-      SERIAL_ECHOLN(detect_filament_factor);
+    }
+    SERIAL_ECHOLN(detect_filament_factor);
 
-      #endif
-      break;
+    #endif
+}
 
-    case 999: // M999: Restart after being stopped
-      Stopped = false;
-      lcd_reset_alert_level();
-      gcode_LastN = Stopped_gcode_LastN;
-      FlushSerialRequestResend();
-    break;
-    }
-  }
+// M999 - Restart after being stopped
+static void gcode_M999()
+{
+  Stopped = false;
+  lcd_reset_alert_level();
+  gcode_LastN = Stopped_gcode_LastN;
+  FlushSerialRequestResend();
+}
 
-  else if(code_seen('T'))
-  {
-    tmp_extruder = code_value();
-    if(tmp_extruder >= EXTRUDERS) {
-      SERIAL_ECHO_START;
-      SERIAL_ECHO("T");
-      SERIAL_ECHO(tmp_extruder);
-      SERIAL_ECHOLN(MSG_INVALID_EXTRUDER);
+// T<extruder> - select extruder
+static void gcode_T()
+{
+  tmp_extruder = code_value();
+  if(tmp_extruder >= EXTRUDERS) {
+    SERIAL_ECHO_START;
+    SERIAL_ECHO("T");
+    SERIAL_ECHO(tmp_extruder);
+    SERIAL_ECHOLN(MSG_INVALID_EXTRUDER);
+  }
+  else {
+    boolean make_move = false;
+    if(code_seen('F')) {
+      make_move = true;
+      next_feedrate = code_value();
+      if(next_feedrate > 0.0) {
+        feedrate = next_feedrate;
+      }
     }
-    else {
-      boolean make_move = false;
-      if(code_seen('F')) {
-        make_move = true;
-        next_feedrate = code_value();
-        if(next_feedrate > 0.0) {
-          feedrate = next_feedrate;
-        }
+    #if EXTRUDERS > 1
+    if(tmp_extruder != active_extruder) {
+      // Save current position to return to after applying extruder offset
+      memcpy(destination, current_position, sizeof(destination));
+    #ifdef DUAL_X_CARRIAGE
+      if (dual_x_carriage_mode == DXC_AUTO_PARK_MODE && Stopped == false &&
+          (delayed_move_time != 0 || current_position[X_AXIS] != x_home_pos(active_extruder)))
+      {
+        // Park old head: 1) raise 2) move to park position 3) lower
+        plan_buffer_line(current_position[X_AXIS], current_position[Y_AXIS], current_position[Z_AXIS] + TOOLCHANGE_PARK_ZLIFT,
+              current_position[E_AXIS], max_feedrate[Z_AXIS], active_extruder);
+        plan_buffer_line(x_home_pos(active_extruder), current_position[Y_AXIS], current_position[Z_AXIS] + TOOLCHANGE_PARK_ZLIFT,
+              current_position[E_AXIS], max_feedrate[X_AXIS], active_extruder);
+        plan_buffer_line(x_home_pos(active_extruder), current_position[Y_AXIS], current_position[Z_AXIS],
+              current_position[E_AXIS], max_feedrate[Z_AXIS], active_extruder);
+        st_synchronize();
       }
-      #if EXTRUDERS > 1
-      if(tmp_extruder != active_extruder) {
-        // Save current position to return to after applying extruder offset
-        memcpy(destination, current_position, sizeof(destination));
-      #ifdef DUAL_X_CARRIAGE
-        if (dual_x_carriage_mode == DXC_AUTO_PARK_MODE && Stopped == false &&
-            (delayed_move_time != 0 || current_position[X_AXIS] != x_home_pos(active_extruder)))
-        {
-          // Park old head: 1) raise 2) move to park position 3) lower
-          plan_buffer_line(current_position[X_AXIS], current_position[Y_AXIS], current_position[Z_AXIS] + TOOLCHANGE_PARK_ZLIFT,
-                current_position[E_AXIS], max_feedrate[Z_AXIS], active_extruder);
-          plan_buffer_line(x_home_pos(active_extruder), current_position[Y_AXIS], current_position[Z_AXIS] + TOOLCHANGE_PARK_ZLIFT,
-                current_position[E_AXIS], max_feedrate[X_AXIS], active_extruder);
-          plan_buffer_line(x_home_pos(active_extruder), current_position[Y_AXIS], current_position[Z_AXIS],
-                current_position[E_AXIS], max_feedrate[Z_AXIS], active_extruder);
-          st_synchronize();
-        }
 
-        // apply Y & Z extruder offset (x offset is already used in determining home pos)
-        current_position[Y_AXIS] = current_position[Y_AXIS] -
-                     extruder_offset[Y_AXIS][active_extruder] +
-                     extruder_offset[Y_AXIS][tmp_extruder];
-        current_position[Z_AXIS] = current_position[Z_AXIS] -
-                     extruder_offset[Z_AXIS][active_extruder] +
-                     extruder_offset[Z_AXIS][tmp_extruder];
+      // apply Y & Z extruder offset (x offset is already used in determining home pos)
+      current_position[Y_AXIS] = current_position[Y_AXIS] -
+                   extruder_offset[Y_AXIS][active_extruder] +
+                   extruder_offset[Y_AXIS][tmp_extruder];
+      current_position[Z_AXIS] = current_position[Z_AXIS] -
+                   extruder_offset[Z_AXIS][active_extruder] +
+                   extruder_offset[Z_AXIS][tmp_extruder];
 
-        active_extruder = tmp_extruder;
+      active_extruder = tmp_extruder;
 
-        // This function resets the max/min values - the current position may be overwritten below.
-        axis_is_at_home(X_AXIS);
+      // This function resets the max/min values - the current position may be overwritten below.
+      axis_is_at_home(X_AXIS);
 
-        if (dual_x_carriage_mode == DXC_FULL_CONTROL_MODE)
-        {
+      if (dual_x_carriage_mode == DXC_FULL_CONTROL_MODE)
+      {
+        current_position[X_AXIS] = inactive_extruder_x_pos;
+        inactive_extruder_x_pos = destination[X_AXIS];
+      }
+      else if (dual_x_carriage_mode == DXC_DUPLICATION_MODE)
+      {
+        active_extruder_parked = (active_extruder == 0); // this triggers the second extruder to move into the duplication position
+        if (active_extruder == 0 || active_extruder_parked)
           current_position[X_AXIS] = inactive_extruder_x_pos;
-          inactive_extruder_x_pos = destination[X_AXIS];
-        }
-        else if (dual_x_carriage_mode == DXC_DUPLICATION_MODE)
-        {
-          active_extruder_parked = (active_extruder == 0); // this triggers the second extruder to move into the duplication position
-          if (active_extruder == 0 || active_extruder_parked)
-            current_position[X_AXIS] = inactive_extruder_x_pos;
-          else
-            current_position[X_AXIS] = destination[X_AXIS] + duplicate_extruder_x_offset;
-          inactive_extruder_x_pos = destination[X_AXIS];
-          extruder_duplication_enabled = false;
-        }
         else
-        {
-          // record raised toolhead position for use by unpark
-          memcpy(raised_parked_position, current_position, sizeof(raised_parked_position));
-          raised_parked_position[Z_AXIS] += TOOLCHANGE_UNPARK_ZLIFT;
-          active_extruder_parked = true;
-          delayed_move_time = 0;
-        }
-      #else
-        // Offset extruder (only by XY)
-        int i;
-        for(i = 0; i < 2; i++) {
-           current_position[i] = current_position[i] -
-                                 extruder_offset[i][active_extruder] +
-                                 extruder_offset[i][tmp_extruder];
-        }
-        // Set the new active extruder and position
-        active_extruder = tmp_extruder;
-      #endif //else DUAL_X_CARRIAGE
+          current_position[X_AXIS] = destination[X_AXIS] + duplicate_extruder_x_offset;
+        inactive_extruder_x_pos = destination[X_AXIS];
+        extruder_duplication_enabled = false;
+      }
+      else
+      {
+        // record raised toolhead position for use by unpark
+        memcpy(raised_parked_position, current_position, sizeof(raised_parked_position));
+        raised_parked_position[Z_AXIS] += TOOLCHANGE_UNPARK_ZLIFT;
+        active_extruder_parked = true;
+        delayed_move_time = 0;
+      }
+    #else
+      // Offset extruder (only by XY)
+      int i;
+      for(i = 0; i < 2; i++) {
+         current_position[i] = current_position[i] -
+                               extruder_offset[i][active_extruder] +
+                               extruder_offset[i][tmp_extruder];
+      }
+      // Set the new active extruder and position
+      active_extruder = tmp_extruder;
+    #endif //else DUAL_X_CARRIAGE
 #ifdef DELTA 
 
-  calculate_delta(current_position); // change cartesian kinematic  to  delta kinematic;
-   //sent position to plan_set_position();
-  plan_set_position(delta[X_AXIS], delta[Y_AXIS], delta[Z_AXIS],current_position[E_AXIS]);
-            
+calculate_delta(current_position); // change cartesian kinematic  to  delta kinematic;
+ //sent position to plan_set_position();
+plan_set_position(delta[X_AXIS], delta[Y_AXIS], delta[Z_AXIS],current_position[E_AXIS]);
+          
 #else
-        plan_set_position(current_position[X_AXIS], current_position[Y_AXIS], current_position[Z_AXIS], current_position[E_AXIS]);
+      plan_set_position(current_position[X_AXIS], current_position[Y_AXIS], current_position[Z_AXIS], current_position[E_AXIS]);
 
 #endif
-        // Move to the old position if 'F' was in the parameters
-        if(make_move && Stopped == false) {
-           prepare_move();
-        }
+
+      // Move to the old position if 'F' was in the parameters
+      if(make_move && Stopped == false) {
+         prepare_move();
       }
-      #endif
-      SERIAL_ECHO_START;
-      SERIAL_ECHO(MSG_ACTIVE_EXTRUDER);
-      SERIAL_PROTOCOLLN((int)active_extruder);
     }
+    #endif
+    SERIAL_ECHO_START;
+    SERIAL_ECHO(MSG_ACTIVE_EXTRUDER);
+    SERIAL_PROTOCOLLN((int)active_extruder);
+  }
+}
+
+// Every G and M code, sorted by COMMAND_KEY for find_command()
+static const command_entry command_table[] PROGMEM = {
+  { COMMAND_KEY('G', 0), gcode_G0_G1 },
+  { COMMAND_KEY('G', 1), gcode_G0_G1 },
+  { COMMAND_KEY('G', 2), gcode_G2 },
+  { COMMAND_KEY('G', 3), gcode_G3 },
+  { COMMAND_KEY('G', 4), gcode_G4 },
+#ifdef FWRETRACT
+  { COMMAND_KEY('G', 10), gcode_G10 },
+  { COMMAND_KEY('G', 11), gcode_G11 },
+#endif //FWRETRACT
+  { COMMAND_KEY('G', 28), gcode_G28 },
+#ifdef ENABLE_AUTO_BED_LEVELING
+  { COMMAND_KEY('G', 29), gcode_G29 },
+  { COMMAND_KEY('G', 30), gcode_G30 },
+#endif //ENABLE_AUTO_BED_LEVELING
+  { COMMAND_KEY('G', 90), gcode_G90 },
+  { COMMAND_KEY('G', 91), gcode_G91 },
+  { COMMAND_KEY('G', 92), gcode_G92 },
+#ifdef ULTIPANEL
+  { COMMAND_KEY('M', 0), gcode_M0_M1 },
+  { COMMAND_KEY('M', 1), gcode_M0_M1 },
+#endif //ULTIPANEL
+  { COMMAND_KEY('M', 17), gcode_M17 },
+  { COMMAND_KEY('M', 18), gcode_M18_M84 },
+#ifdef SDSUPPORT
+  { COMMAND_KEY('M', 20), gcode_M20 },
+  { COMMAND_KEY('M', 21), gcode_M21 },
+  { COMMAND_KEY('M', 22), gcode_M22 },
+  { COMMAND_KEY('M', 23), gcode_M23 },
+  { COMMAND_KEY('M', 24), gcode_M24 },
+  { COMMAND_KEY('M', 25), gcode_M25 },
+  { COMMAND_KEY('M', 26), gcode_M26 },
+  { COMMAND_KEY('M', 27), gcode_M27 },
+  { COMMAND_KEY('M', 28), gcode_M28 },
+  { COMMAND_KEY('M', 29), gcode_M29 },
+  { COMMAND_KEY('M', 30), gcode_M30 },
+#endif //SDSUPPORT
+  { COMMAND_KEY('M', 31), gcode_M31 },
+#ifdef SDSUPPORT
+  { COMMAND_KEY('M', 32), gcode_M32 },
+#endif //SDSUPPORT
+  { COMMAND_KEY('M', 42), gcode_M42 },
+  { COMMAND_KEY('M', 71), gcode_M71 },
+#if defined(PS_ON_PIN) && PS_ON_PIN > -1
+  { COMMAND_KEY('M', 80), gcode_M80 },
+#endif
+  { COMMAND_KEY('M', 81), gcode_M81 },
+  { COMMAND_KEY('M', 82), gcode_M82 },
+  { COMMAND_KEY('M', 83), gcode_M83 },
+  { COMMAND_KEY('M', 84), gcode_M18_M84 },
+  { COMMAND_KEY('M', 85), gcode_M85 },
+  { COMMAND_KEY('M', 92), gcode_M92 },
+  DECLARE_HYSTERESIS_MCODES(98, 99)
+  { COMMAND_KEY('M', 104), gcode_M104 },
+  { COMMAND_KEY('M', 105), gcode_M105 },
+#if defined(FAN_PIN) && FAN_PIN > -1
+  { COMMAND_KEY('M', 106), gcode_M106 },
+  { COMMAND_KEY('M', 107), gcode_M107 },
+#endif
+  { COMMAND_KEY('M', 109), gcode_M109 },
+  { COMMAND_KEY('M', 112), gcode_M112 },
+  { COMMAND_KEY('M', 114), gcode_M114 },
+  { COMMAND_KEY('M', 115), gcode_M115 },
+  { COMMAND_KEY('M', 117), gcode_M117 },
+  { COMMAND_KEY('M', 119), gcode_M119 },
+  { COMMAND_KEY('M', 120), gcode_M120 },
+  { COMMAND_KEY('M', 121), gcode_M121 },
+#ifdef BARICUDA
+#if defined(HEATER_1_PIN) && HEATER_1_PIN > -1
+  { COMMAND_KEY('M', 126), gcode_M126 },
+  { COMMAND_KEY('M', 127), gcode_M127 },
+#endif
+#if defined(HEATER_2_PIN) && HEATER_2_PIN > -1
+  { COMMAND_KEY('M', 128), gcode_M128 },
+  { COMMAND_KEY('M', 129), gcode_M129 },
+#endif
+#endif //BARICUDA
+  { COMMAND_KEY('M', 140), gcode_M140 },
+#ifdef BLINKM
+  { COMMAND_KEY('M', 150), gcode_M150 },
+#endif //BLINKM
+#ifdef AUTO_REPORT
+  { COMMAND_KEY('M', 155), gcode_M155 },
+#endif //AUTO_REPORT
+  { COMMAND_KEY('M', 190), gcode_M190 },
+  { COMMAND_KEY('M', 200), gcode_M200 },
+  { COMMAND_KEY('M', 201), gcode_M201 },
+#if 0 // Not used for Sprinter/grbl gen6
+  { COMMAND_KEY('M', 202), gcode_M202 },
+#endif
+  { COMMAND_KEY('M', 203), gcode_M203 },
+  { COMMAND_KEY('M', 204), gcode_M204 },
+  { COMMAND_KEY('M', 205), gcode_M205 },
+  { COMMAND_KEY('M', 206), gcode_M206 },
+#ifdef FWRETRACT
+  { COMMAND_KEY('M', 207), gcode_M207 },
+  { COMMAND_KEY('M', 208), gcode_M208 },
+  { COMMAND_KEY('M', 209), gcode_M209 },
+#endif //FWRETRACT
+#if EXTRUDERS > 1
+  { COMMAND_KEY('M', 218), gcode_M218 },
+#endif
+  { COMMAND_KEY('M', 220), gcode_M220 },
+  { COMMAND_KEY('M', 221), gcode_M221 },
+  { COMMAND_KEY('M', 226), gcode_M226 },
+  { COMMAND_KEY('M', 240), gcode_M240 },
+#ifdef DOGLCD
+  { COMMAND_KEY('M', 250), gcode_M250 },
+#endif //DOGLCD
+#if NUM_SERVOS > 0
+  { COMMAND_KEY('M', 280), gcode_M280 },
+#endif
+#if (LARGE_FLASH == true && ( BEEPER > 0 || defined(ULTRALCD) || defined(LCD_USE_I2C_BUZZER)))
+  { COMMAND_KEY('M', 300), gcode_M300 },
+#endif
+#ifdef PIDTEMP
+  { COMMAND_KEY('M', 301), gcode_M301 },
+#endif //PIDTEMP
+#ifdef PREVENT_DANGEROUS_EXTRUDE
+  { COMMAND_KEY('M', 302), gcode_M302 },
+#endif //PREVENT_DANGEROUS_EXTRUDE
+  { COMMAND_KEY('M', 303), gcode_M303 },
+#ifdef PIDTEMPBED
+  { COMMAND_KEY('M', 304), gcode_M304 },
+#endif //PIDTEMPBED
+  { COMMAND_KEY('M', 350), gcode_M350 },
+  { COMMAND_KEY('M', 351), gcode_M351 },
+  { COMMAND_KEY('M', 400), gcode_M400 },
+#if defined(ENABLE_AUTO_BED_LEVELING) && defined(SERVO_ENDSTOPS)
+  { COMMAND_KEY('M', 401), gcode_M401 },
+  { COMMAND_KEY('M', 402), gcode_M402 },
+#endif
+  { COMMAND_KEY('M', 500), gcode_M500 },
+  { COMMAND_KEY('M', 501), gcode_M501 },
+  { COMMAND_KEY('M', 502), gcode_M502 },
+  { COMMAND_KEY('M', 503), gcode_M503 },
+#ifdef ABORT_ON_ENDSTOP_HIT_FEATURE_ENABLED
+  { COMMAND_KEY('M', 540), gcode_M540 },
+#endif //ABORT_ON_ENDSTOP_HIT_FEATURE_ENABLED
+#ifdef FILAMENTCHANGEENABLE
+  { COMMAND_KEY('M', 600), gcode_M600 },
+#endif //FILAMENTCHANGEENABLE
+#ifdef DUAL_X_CARRIAGE
+  { COMMAND_KEY('M', 605), gcode_M605 },
+#endif //DUAL_X_CARRIAGE
+#ifdef BINARY_TRANSPORT
+  { COMMAND_KEY('M', 620), gcode_M620 },
+#endif //BINARY_TRANSPORT
+#ifdef DELTA
+  { COMMAND_KEY('M', 665), gcode_M665 },
+  { COMMAND_KEY('M', 666), gcode_M666 },
+#endif //DELTA
+#ifdef CUSTOM_M_CODE_SET_Z_PROBE_OFFSET
+  { COMMAND_KEY('M', CUSTOM_M_CODE_SET_Z_PROBE_OFFSET), gcode_set_zprobe_offset },
+#endif //CUSTOM_M_CODE_SET_Z_PROBE_OFFSET
+  { COMMAND_KEY('M', 907), gcode_M907 },
+  { COMMAND_KEY('M', 908), gcode_M908 },
+#ifdef SDSUPPORT
+  { COMMAND_KEY('M', 928), gcode_M928 },
+#endif //SDSUPPORT
+  { COMMAND_KEY('M', 990), gcode_M990 },
+  { COMMAND_KEY('M', 991), gcode_M991 },
+  { COMMAND_KEY('M', 993), gcode_M993 },
+  { COMMAND_KEY('M', 999), gcode_M999 },
+#ifdef POWER_LOSS_RECOVERY
+  { COMMAND_KEY('M', 1000), gcode_M1000 },
+#endif //POWER_LOSS_RECOVERY
+  DECLARE_LIFETIME_STATS_MCODES(2000)
+};
+
+#if defined(CUSTOM_M_CODE_SET_Z_PROBE_OFFSET) && (CUSTOM_M_CODE_SET_Z_PROBE_OFFSET <= 666 || CUSTOM_M_CODE_SET_Z_PROBE_OFFSET >= 907)
+  #error "CUSTOM_M_CODE_SET_Z_PROBE_OFFSET must lie between 666 and 907, or command_table has to be reordered"
+#endif
+
+#ifndef pgm_read_ptr
+  #define pgm_read_ptr(addr) ((void *)pgm_read_word(addr))
+#endif
+
+static command_handler_t find_command(char letter, long number)
+{
+  if(number < 0 || number > COMMAND_NUMBER_MAX)
+    return NULL;
+  unsigned int key = COMMAND_KEY(letter, number);
+  uint8_t lo = 0, hi = sizeof(command_table) / sizeof(command_table[0]);
+  while(lo < hi)
+  {
+    uint8_t mid = (lo + hi) / 2;
+    unsigned int mid_key = pgm_read_word(&command_table[mid].key);
+    if(mid_key == key)
+      return (command_handler_t)pgm_read_ptr(&command_table[mid].handler);
+    if(mid_key < key)
+      lo = mid + 1;
+    else
+      hi = mid;
   }
+  return NULL;
+}
 
+void process_commands()
+{
+  command_handler_t handler = NULL;
+  scan_command();
+  command_acked = false;
+  if(code_seen('G') && ( current_command()[0] == 'G' ) )
+    handler = find_command('G', code_value_long());
+  else if(code_seen('M'))
+    handler = find_command('M', code_value_long());
+  else if(code_seen('T'))
+    handler = gcode_T;
   else
   {
     SERIAL_ECHO_START;
     SERIAL_ECHOPGM(MSG_UNKNOWN_COMMAND);
-    SERIAL_ECHO(cmdbuffer[bufindr]);
+    SERIAL_ECHO(current_command());
     SERIAL_ECHOLNPGM("\"");
   }
 
-  ClearToSend();
+  if(handler != NULL)
+    handler();
+  if(!command_acked)
+    ClearToSend();
 }
 
 void FlushSerialRequestResend()
@@ -3974,10 +5068,10 @@ void ClearToSend()
 {
   previous_millis_cmd = millis();
   #ifdef SDSUPPORT
-  if(fromsd[bufindr])
+  if(buflen > 0 && cmdbuffer[bufindr] == CMD_FROM_SD)
     return;
   #endif //SDSUPPORT
-  SERIAL_PROTOCOLLNPGM(MSG_OK);
+  send_ok(current_line());
 }
 
 void get_coordinates()
@@ -4259,8 +5353,10 @@ void handle_status_leds(void) {
 
 void manage_inactivity()
 {
-  if(buflen < (BUFSIZE-1))
-    get_command();
+  get_command();
+  #ifdef AUTO_REPORT
+    auto_report();
+  #endif
 
   if( (millis() - previous_millis_cmd) >  max_inactive_time )
     if(max_inactive_time)
@@ -4348,7 +5444,13 @@ void kill()
   SERIAL_ERROR_START;
   SERIAL_ERRORLNPGM(MSG_ERR_KILLED);
   LCD_ALERTMESSAGEPGM(MSG_KILLED);
+  #ifndef AT90USB
+    MSerial.flushTX(); // interrupts are off, nothing else sends the rest of the message
+  #endif
   suicide();
+#ifdef SIMULATION
+  exit(1);
+#endif
   while(1) { /* Intentionally left empty */ } // Wait for reset
 }
 
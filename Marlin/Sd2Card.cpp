@@ -152,11 +152,21 @@ static void spiSend(uint8_t data) {
 //------------------------------------------------------------------------------
 // send command and return error code.  Return zero for OK
 uint8_t Sd2Card::cardCommand(uint8_t cmd, uint32_t arg) {
+#ifdef SD_READAHEAD
+  // end a multiple block read left open by readSequential()
+  if (sequentialBlock_ && cmd != CMD12) readStop();
+#endif  // SD_READAHEAD
+#ifdef SD_FAST_UPLOAD
+  // end a multiple block write left open by writeSequential()
+  if (sequentialWriteBlock_) writeStop();
+#endif  // SD_FAST_UPLOAD
+
   // select card
   chipSelectLow();
 
-  // wait up to 300 ms if busy
-  waitNotBusy(300);
+  // wait up to 300 ms if busy, but not to stop a multiple block read: the
+  // card is sending the next block then and would only be waited out
+  if (cmd != CMD12) waitNotBusy(300);
 
   // send command
   spiSend(cmd | 0x40);
@@ -285,6 +295,12 @@ bool Sd2Card::eraseSingleBlockEnable() {
  */
 bool Sd2Card::init(uint8_t sckRateID, uint8_t chipSelectPin) {
   errorCode_ = type_ = 0;
+#ifdef SD_READAHEAD
+  sequentialBlock_ = 0;
+#endif  // SD_READAHEAD
+#ifdef SD_FAST_UPLOAD
+  sequentialWriteBlock_ = 0;
+#endif  // SD_FAST_UPLOAD
   chipSelectPin_ = chipSelectPin;
   // 16-bit init start time allows over a minute
   uint16_t t0 = (uint16_t)millis();
@@ -411,6 +427,35 @@ bool Sd2Card::readData(uint8_t *dst) {
   chipSelectLow();
   return readData(dst, 512);
 }
+#ifdef SD_READAHEAD
+//------------------------------------------------------------------------------
+/**
+ * Read a 512 byte block of a sequence.
+ *
+ * A block that follows the one read last is the next block of the multiple
+ * block read still open on the card, any other block starts a new one. The
+ * card is ready with it as soon as it has been sent the previous one, instead
+ * of seeking it for a CMD17. The read stays open until readStop() or any
+ * other command is sent to the card.
+ *
+ * \param[in] blockNumber Logical block to be read.
+ * \param[out] dst Pointer to the location that will receive the data.
+ * \return The value one, true, is returned for success and
+ * the value zero, false, is returned for failure.
+ */
+bool Sd2Card::readSequential(uint32_t blockNumber, uint8_t* dst) {
+  if (blockNumber != sequentialBlock_ || !sequentialBlock_) {
+    if (!readStart(blockNumber)) return false;
+  }
+  if (!readData(dst)) {
+    // leave the sequence and read the block alone, with retries
+    readStop();
+    return readBlock(blockNumber, dst);
+  }
+  sequentialBlock_ = blockNumber + 1;
+  return true;
+}
+#endif  // SD_READAHEAD
 
 //------------------------------------------------------------------------------
 static const uint16_t crctab[] PROGMEM = {
@@ -542,6 +587,9 @@ bool Sd2Card::readStart(uint32_t blockNumber) {
  * the value zero, false, is returned for failure.
  */
 bool Sd2Card::readStop() {
+#ifdef SD_READAHEAD
+  sequentialBlock_ = 0;
+#endif  // SD_READAHEAD
   chipSelectLow();
   if (cardCommand(CMD12, 0)) {
     error(SD_CARD_ERROR_CMD12);
@@ -691,6 +739,40 @@ bool Sd2Card::writeStart(uint32_t blockNumber, uint32_t eraseCount) {
   chipSelectHigh();
   return false;
 }
+#ifdef SD_FAST_UPLOAD
+//------------------------------------------------------------------------------
+/** Write a 512 byte block of a sequence.
+ *
+ * A block that follows the one written last goes to the multiple block
+ * write still open on the card, any other block starts a new one. The card
+ * programs each block while it receives the next one instead of waiting
+ * out a CMD24, and may erase \a eraseCount blocks ahead when the write
+ * starts. The write stays open until writeStop() or any other command is
+ * sent to the card, the blocks are only certain to be on the card after
+ * that.
+ *
+ * \param[in] blockNumber Logical block to be written.
+ * \param[in] src Pointer to the location of the data to be written.
+ * \param[in] eraseCount The number of blocks to be pre-erased if a new
+ * write starts with this block.
+ * \return The value one, true, is returned for success and
+ * the value zero, false, is returned for failure.
+ */
+bool Sd2Card::writeSequential(uint32_t blockNumber, const uint8_t* src,
+                              uint32_t eraseCount) {
+  if (blockNumber != sequentialWriteBlock_ || !sequentialWriteBlock_) {
+    if (sequentialWriteBlock_ && !writeStop()) return false;
+    if (!writeStart(blockNumber, eraseCount)) return false;
+  }
+  if (!writeData(src)) {
+    // leave the sequence and write the block alone
+    writeStop();
+    return writeBlock(blockNumber, src);
+  }
+  sequentialWriteBlock_ = blockNumber + 1;
+  return true;
+}
+#endif  // SD_FAST_UPLOAD
 //------------------------------------------------------------------------------
 /** End a write multiple blocks sequence.
  *
@@ -698,6 +780,9 @@ bool Sd2Card::writeStart(uint32_t blockNumber, uint32_t eraseCount) {
  * the value zero, false, is returned for failure.
  */
 bool Sd2Card::writeStop() {
+#ifdef SD_FAST_UPLOAD
+  sequentialWriteBlock_ = 0;
+#endif  // SD_FAST_UPLOAD
   chipSelectLow();
   if (!waitNotBusy(SD_WRITE_TIMEOUT)) goto fail;
   spiSend(STOP_TRAN_TOKEN);
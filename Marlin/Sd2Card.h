@@ -204,6 +204,9 @@ class Sd2Card {
     return readRegister(CMD9, csd);
   }
   bool readData(uint8_t *dst);
+#ifdef SD_READAHEAD
+  bool readSequential(uint32_t blockNumber, uint8_t* dst);
+#endif  // SD_READAHEAD
   bool readStart(uint32_t blockNumber);
   bool readStop();
   bool setSckRate(uint8_t sckRateID);
@@ -213,6 +216,10 @@ class Sd2Card {
   int type() const {return type_;}
   bool writeBlock(uint32_t blockNumber, const uint8_t* src);
   bool writeData(const uint8_t* src);
+#ifdef SD_FAST_UPLOAD
+  bool writeSequential(uint32_t blockNumber, const uint8_t* src,
+                       uint32_t eraseCount);
+#endif  // SD_FAST_UPLOAD
   bool writeStart(uint32_t blockNumber, uint32_t eraseCount);
   bool writeStop();
  private:
@@ -222,6 +229,14 @@ class Sd2Card {
   uint8_t spiRate_;
   uint8_t status_;
   uint8_t type_;
+#ifdef SD_READAHEAD
+  // next block of the multiple block read readSequential() left open, 0 if none
+  uint32_t sequentialBlock_;
+#endif  // SD_READAHEAD
+#ifdef SD_FAST_UPLOAD
+  // next block of the multiple block write writeSequential() left open, 0 if none
+  uint32_t sequentialWriteBlock_;
+#endif  // SD_FAST_UPLOAD
   // private functions
   uint8_t cardAcmd(uint8_t cmd, uint32_t arg) {
     cardCommand(CMD55, 0);
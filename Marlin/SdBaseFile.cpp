@@ -1097,6 +1097,57 @@ int16_t SdBaseFile::read(void* buf, uint16_t nbyte) {
  fail:
   return -1;
 }
+#ifdef SD_READAHEAD
+//------------------------------------------------------------------------------
+/** Read the whole block that holds the current position of a file.
+ *
+ * For reading a file front to back into a buffer of the caller's: the
+ * blocks are read with Sd2Card::readSequential(), so the card streams them
+ * for as long as the clusters of the file follow each other, and the volume
+ * cache keeps the FAT block it holds.
+ *
+ * \param[out] dst Pointer to 512 bytes that receive the block.
+ *
+ * \return The offset of the current position in the block. The current
+ * position moves to the start of the next block or the end of the file,
+ * the data of the block beyond the end of the file is undefined. At the
+ * end of the file or if an error occurs, streamBlock() returns -1.
+ */
+int16_t SdBaseFile::streamBlock(uint8_t* dst) {
+  uint16_t offset;
+  uint8_t blockOfCluster;
+  uint32_t block;  // raw device block number
+
+  // error if not a file, write only or at the end
+  if (!isFile() || !(flags_ & O_READ) || curPosition_ >= fileSize_) goto fail;
+
+  offset = curPosition_ & 0X1FF;  // offset in block
+  blockOfCluster = vol_->blockOfCluster(curPosition_);
+  if (offset == 0 && blockOfCluster == 0) {
+    // start of new cluster
+    if (curPosition_ == 0) {
+      // use first cluster in file
+      curCluster_ = firstCluster_;
+    } else {
+      // get next cluster from FAT
+      if (!vol_->fatGet(curCluster_, &curCluster_)) goto fail;
+    }
+  }
+  block = vol_->clusterStartBlock(curCluster_) + blockOfCluster;
+  if (block == vol_->cacheBlockNumber()) {
+    // the cache may hold data not yet written to the card
+    memcpy(dst, vol_->cache()->data, 512);
+  } else {
+    if (!vol_->sdCard()->readSequential(block, dst)) goto fail;
+  }
+  curPosition_ += 512 - offset;
+  if (curPosition_ > fileSize_) curPosition_ = fileSize_;
+  return offset;
+
+ fail:
+  return -1;
+}
+#endif  // SD_READAHEAD
 //------------------------------------------------------------------------------
 /** Read the next directory entry from a directory file.
  *
@@ -1816,6 +1867,78 @@ int16_t SdBaseFile::write(const void* buf, uint16_t nbyte) {
   return -1;
 }
 //------------------------------------------------------------------------------
+#ifdef SD_FAST_UPLOAD
+//------------------------------------------------------------------------------
+/** Write a whole block at the end of a file.
+ *
+ * For writing a file front to back from a buffer of the caller's: the
+ * clusters are added \a count at a time, as one contiguous run where the
+ * volume has one, and the blocks are written with Sd2Card::writeSequential(),
+ * so the card takes a run in one pre-erased multiple block write. Clusters
+ * the file does not fill stay allocated until truncate() gives them back.
+ *
+ * \param[in] src Pointer to the 512 bytes to be written.
+ * \param[in] count Number of clusters to add when the file needs one.
+ *
+ * \return The value one, true, is returned for success and
+ * the value zero, false, is returned for failure. Reasons for failure
+ * include the current position not being the end of the file or the start
+ * of a block, a full volume or an I/O error.
+ */
+bool SdBaseFile::streamWriteBlock(const uint8_t* src, uint8_t count) {
+  uint8_t blockOfCluster;
+  uint32_t block;  // raw device block number
+  uint32_t eraseCount;
+
+  // error if not a normal file, read-only or not at the end of a block
+  if (!isFile() || !(flags_ & O_WRITE)) goto fail;
+  if ((curPosition_ & 0X1FF) || curPosition_ != fileSize_) goto fail;
+
+  blockOfCluster = vol_->blockOfCluster(curPosition_);
+  // blocks the card may erase ahead if it starts a new write
+  eraseCount = vol_->blocksPerCluster() - blockOfCluster;
+  if (blockOfCluster == 0) {
+    // start of new cluster
+    uint32_t next = 0;
+    if (curCluster_ == 0) {
+      next = firstCluster_;
+    } else {
+      if (!vol_->fatGet(curCluster_, &next)) goto fail;
+      if (vol_->isEOC(next)) next = 0;
+    }
+    if (next) {
+      curCluster_ = next;
+    } else {
+      // add a run of clusters, or one if there is no room for a run
+      next = curCluster_;
+      if (vol_->allocContiguous(count, &next)) {
+        eraseCount = (uint32_t)count << vol_->clusterSizeShift();
+      } else if (!vol_->allocContiguous(1, &next)) {
+        goto fail;
+      }
+      curCluster_ = next;
+      if (firstCluster_ == 0) firstCluster_ = curCluster_;
+    }
+  }
+  block = vol_->clusterStartBlock(curCluster_) + blockOfCluster;
+  if (vol_->cacheBlockNumber() == block) {
+    // invalidate cache if block is in cache
+    vol_->cacheSetBlockNumber(0XFFFFFFFF, false);
+  }
+  if (!vol_->sdCard()->writeSequential(block, src, eraseCount)) goto fail;
+
+  curPosition_ += 512;
+  // update fileSize and insure sync will update dir entry
+  fileSize_ = curPosition_;
+  flags_ |= F_FILE_DIR_DIRTY;
+  return true;
+
+ fail:
+  writeError = true;
+  return false;
+}
+#endif  // SD_FAST_UPLOAD
+//------------------------------------------------------------------------------
 // suppress cpplint warnings with NOLINT comment
 #if ALLOW_DEPRECATED_FUNCTIONS && !defined(DOXYGEN)
 void (*SdBaseFile::oldDateTime_)(uint16_t& date, uint16_t& time) = 0;  // NOLINT
@@ -284,6 +284,12 @@ class SdBaseFile {
   int16_t read();
   int16_t read(void* buf, uint16_t nbyte);
   int8_t readDir(dir_t* dir, char* longFilename);
+#ifdef SD_READAHEAD
+  int16_t streamBlock(uint8_t* dst);
+#endif  // SD_READAHEAD
+#ifdef SD_FAST_UPLOAD
+  bool streamWriteBlock(const uint8_t* src, uint8_t count);
+#endif  // SD_FAST_UPLOAD
   static bool remove(SdBaseFile* dirFile, const char* path);
   bool remove();
   /** Set the file's current position to zero. */
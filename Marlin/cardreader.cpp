@@ -4,6 +4,7 @@
 #include "stepper.h"
 #include "temperature.h"
 #include "language.h"
+#include "power_loss.h"
 
 #ifdef SDSUPPORT
 
@@ -11,6 +12,12 @@ CardReader::CardReader()
 {
    filesize = 0;
    sdpos = 0;
+#ifdef SD_READAHEAD
+   readaheadPos = readaheadEnd = 0;
+#endif
+#ifdef SD_FAST_UPLOAD
+   writePos = 0;
+#endif
    sdprinting = false;
    printingpaused = false;
    cardOK = false;
@@ -20,6 +27,7 @@ CardReader::CardReader()
    workDirDepth = 0;
    file_subcall_ctr=0;
    memset(workDirParents, 0, sizeof(workDirParents));
+   dropDirIndex();
 
    autostart_stilltocheck=true; //the SD start is delayed, because otherwise the serial cannot answer fast enough to make contact with the host software.
    lastnr=0;
@@ -53,8 +61,12 @@ void  CardReader::lsDive(const char *prepend,SdFile parent)
 {
   dir_t p;
  uint8_t cnt=0;
- 
+#ifdef SD_DIR_INDEX_SIZE
+  uint16_t entry; //the entry readDir() starts at
+  while (entry=parent.curPosition()>>5, parent.readDir(p, longFilename) > 0)
+#else
   while (parent.readDir(p, longFilename) > 0)
+#endif
   {
     if( DIR_IS_SUBDIR(&p) && lsAction!=LS_Count && lsAction!=LS_GetFilename) // hence LS_SerialPrint
     {
@@ -119,6 +131,10 @@ void  CardReader::lsDive(const char *prepend,SdFile parent)
       }
       else if(lsAction==LS_Count)
       {
+#ifdef SD_DIR_INDEX_SIZE
+        if(nrFiles<SD_DIR_INDEX_SIZE)
+          dirIndex[nrFiles]=entry;
+#endif
         nrFiles++;
       } 
       else if(lsAction==LS_GetFilename)
@@ -176,6 +192,7 @@ void CardReader::initsd()
   }
   workDir=root;
   curDir=&root;
+  dropDirIndex();
   /*
   if(!workDir.openRoot(&volume))
   {
@@ -194,6 +211,7 @@ void CardReader::setroot()
   workDir=root;
   
   curDir=&workDir;
+  dropDirIndex();
 }
 void CardReader::release()
 {
@@ -242,10 +260,39 @@ void CardReader::getAbsFilename(char *t)
     t[0]=0;
 }
 
+//the path of name, relative to workDir unless it starts with '/', from the root. False if it needs more than size characters
+bool CardReader::getAbsPath(char *t,const char *name,uint8_t size)
+{
+  uint8_t n=0;
+  if(name[0]!='/')
+  {
+    //workDirParents[workDirDepth-1] is the root, its children down to workDir follow
+    for(int8_t d=workDirDepth-2;d>=-1;d--)
+    {
+      if(n+14>size)
+        return false;
+      t[n++]='/';
+      (d<0 ? workDir : workDirParents[d]).getFilename(t+n);
+      n+=strlen(t+n);
+    }
+    if(n+1>size)
+      return false;
+    t[n++]='/';
+  }
+  if(n+strlen(name)>=size)
+    return false;
+  strcpy(t+n,name);
+  return true;
+}
+
 void CardReader::openFile(char* name,bool read, bool replace_current/*=true*/)
 {
   if(!cardOK)
     return;
+  flushWrite();
+#ifdef SD_READAHEAD
+  readaheadPos = readaheadEnd = 0;
+#endif
   if(file.isOpen())  //replacing current file by new file, or subfile call
   {
     if(!replace_current)
@@ -299,12 +346,12 @@ void CardReader::openFile(char* name,bool read, bool replace_current/*=true*/)
   if(name[0]=='/')
   {
     dirname_start=strchr(name,'/')+1;
-    while(dirname_start>0)
+    while(dirname_start!=NULL)
     {
       dirname_end=strchr(dirname_start,'/');
       //SERIAL_ECHO("start:");SERIAL_ECHOLN((int)(dirname_start-name));
       //SERIAL_ECHO("end  :");SERIAL_ECHOLN((int)(dirname_end-name));
-      if(dirname_end>0 && dirname_end>dirname_start)
+      if(dirname_end!=NULL && dirname_end>dirname_start)
       {
         char subdirname[13];
         strncpy(subdirname, dirname_start, dirname_end-dirname_start);
@@ -352,6 +399,15 @@ void CardReader::openFile(char* name,bool read, bool replace_current/*=true*/)
       
       SERIAL_PROTOCOLLNPGM(MSG_SD_FILE_SELECTED);
       lcd_setstatus(fname);
+#ifdef POWER_LOSS_RECOVERY
+      if(file_subcall_ctr==0) //a new print, not an M32 procedure or the return from one
+      {
+        char path[POWER_LOSS_PATH_LENGTH];
+        if(!getAbsPath(path,name,sizeof(path)))
+          path[0]=0;
+        power_loss_start(path);
+      }
+#endif
     }
     else
     {
@@ -371,6 +427,7 @@ void CardReader::openFile(char* name,bool read, bool replace_current/*=true*/)
     else
     {
       saving = true;
+      dropDirIndex();
       SERIAL_PROTOCOLPGM(MSG_SD_WRITE_TO_FILE);
       SERIAL_PROTOCOLLN(name);
       lcd_setstatus(fname);
@@ -383,7 +440,11 @@ void CardReader::removeFile(char* name)
 {
   if(!cardOK)
     return;
+  flushWrite();
   file.close();
+#ifdef SD_READAHEAD
+  readaheadPos = readaheadEnd = 0;
+#endif
   sdprinting = false;
   
   
@@ -395,12 +456,12 @@ void CardReader::removeFile(char* name)
   if(name[0]=='/')
   {
     dirname_start=strchr(name,'/')+1;
-    while(dirname_start>0)
+    while(dirname_start!=NULL)
     {
       dirname_end=strchr(dirname_start,'/');
       //SERIAL_ECHO("start:");SERIAL_ECHOLN((int)(dirname_start-name));
       //SERIAL_ECHO("end  :");SERIAL_ECHOLN((int)(dirname_end-name));
-      if(dirname_end>0 && dirname_end>dirname_start)
+      if(dirname_end!=NULL && dirname_end>dirname_start)
       {
         char subdirname[13];
         strncpy(subdirname, dirname_start, dirname_end-dirname_start);
@@ -440,6 +501,7 @@ void CardReader::removeFile(char* name)
       SERIAL_PROTOCOLPGM("File deleted:");
       SERIAL_PROTOCOLLN(fname);
       sdpos = 0;
+      dropDirIndex();
     }
     else
     {
@@ -464,20 +526,35 @@ void CardReader::getStatus()
 }
 void CardReader::write_command(char *buf)
 {
-  char* begin = buf;
-  char* npos = 0;
-  char* end = buf + strlen(buf) - 1;
+  //get_command() has taken off the line number and checksum. The next command
+  //of the queue follows right after this one, the line end is written on its own
+  write_data((const uint8_t*)buf, strlen(buf));
+  write_data((const uint8_t*)"\r\n", 2);
+}
 
+//appends to the file being saved
+void CardReader::write_data(const uint8_t *data,uint16_t n)
+{
   file.writeError = false;
-  if((npos = strchr(buf, 'N')) != NULL)
+#ifdef SD_FAST_UPLOAD
+  //whole blocks go to the card as they fill up, see SdBaseFile::streamWriteBlock()
+  while(n)
   {
-    begin = strchr(npos, ' ') + 1;
-    end = strchr(npos, '*') - 1;
+    uint16_t part=min(n,512-writePos);
+    memcpy(blockBuffer+writePos,data,part);
+    writePos+=part;
+    data+=part;
+    n-=part;
+    if(writePos==512)
+    {
+      writePos=0;
+      if(!file.streamWriteBlock(blockBuffer,SD_UPLOAD_CLUSTERS))
+        break;
+    }
   }
-  end[1] = '\r';
-  end[2] = '\n';
-  end[3] = '\0';
-  file.write(begin);
+#else
+  file.write(data,n);
+#endif
   if (file.writeError)
   {
     SERIAL_ECHO_START;
@@ -538,8 +615,16 @@ void CardReader::checkautostart(bool force)
 
 void CardReader::closefile(bool store_location)
 {
+#ifdef POWER_LOSS_RECOVERY
+  if(!saving && !logging)
+    power_loss_clear(); //the print has been stopped
+#endif
+  flushWrite();
   file.sync();
   file.close();
+#ifdef SD_READAHEAD
+  readaheadPos = readaheadEnd = 0;
+#endif
   saving = false; 
   logging = false;
   
@@ -555,9 +640,24 @@ void CardReader::closefile(bool store_location)
 
 void CardReader::getfilename(const uint8_t nr)
 {
+#ifdef SD_DIR_INDEX_SIZE
+  if(dirIndexCount<0)
+    getnrfilenames();
+#endif
   curDir=&workDir;
   lsAction=LS_GetFilename;
   nrFiles=nr;
+#ifdef SD_DIR_INDEX_SIZE
+  if(nr<dirIndexCount)
+  {
+    //start at the nearest indexed entry and count on from there
+    uint8_t i=min(nr,SD_DIR_INDEX_SIZE-1);
+    curDir->seekSet((uint32_t)dirIndex[i]<<5);
+    nrFiles=nr-i;
+    lsDive("",*curDir);
+    return;
+  }
+#endif
   curDir->rewind();
   lsDive("",*curDir);
   
@@ -566,11 +666,18 @@ void CardReader::getfilename(const uint8_t nr)
 uint16_t CardReader::getnrfilenames()
 {
   curDir=&workDir;
+#ifdef SD_DIR_INDEX_SIZE
+  if(dirIndexCount>=0)
+    return dirIndexCount;
+#endif
   lsAction=LS_Count;
   nrFiles=0;
   curDir->rewind();
   lsDive("",*curDir);
   //SERIAL_ECHOLN(nrFiles);
+#ifdef SD_DIR_INDEX_SIZE
+  dirIndexCount=nrFiles;
+#endif
   return nrFiles;
 }
 
@@ -596,6 +703,7 @@ void CardReader::chdir(const char * relpath)
       workDirParents[0]=*parent;
     }
     workDir=newfile;
+    dropDirIndex();
   }
 }
 
@@ -608,18 +716,58 @@ void CardReader::updir()
     int d;
     for (int d = 0; d < workDirDepth; d++)
       workDirParents[d] = workDirParents[d+1];
+    dropDirIndex();
   }
 }
 
 
+#ifdef SD_FAST_UPLOAD
+//writes the rest of the file being saved and gives back the clusters allocated ahead of it
+void CardReader::flushWrite()
+{
+  if(!saving)
+    return;
+  file.writeError = false;
+  if(writePos)
+    file.write(blockBuffer,writePos);
+  writePos=0;
+  if(!file.truncate(file.curPosition()))
+    file.writeError = true;
+  if (file.writeError)
+  {
+    SERIAL_ECHO_START;
+    SERIAL_ECHOLNPGM(MSG_SD_ERR_WRITE_TO_FILE);
+  }
+}
+#endif //SD_FAST_UPLOAD
+
+#ifdef SD_READAHEAD
+//reads the block holding the file position into readahead, the card keeps streaming the blocks that follow
+bool CardReader::fillReadahead()
+{
+  uint32_t pos=file.curPosition();
+  int16_t offset=file.streamBlock(blockBuffer);
+  if(offset<0)
+  {
+    if(pos>=filesize) //end of the file, eof() from now on
+      sdpos=filesize;
+    return false;
+  }
+  readaheadStart=pos-offset;
+  readaheadPos=offset;
+  readaheadEnd=file.curPosition()-readaheadStart;
+  return true;
+}
+#endif //SD_READAHEAD
+
 void CardReader::printingHasFinished()
 {
     st_synchronize();
     if(file_subcall_ctr>0) //heading up to a parent file that called current as a procedure.
     {
-      file.close();
+      //still counted as in the procedure while the parent opens, it goes on as the same print
+      openFile(filenames[file_subcall_ctr-1],true,true);
       file_subcall_ctr--;
-      openFile(filenames[file_subcall_ctr],true,true);
       setIndex(filespos[file_subcall_ctr]);
       startFileprint();
     }
@@ -628,6 +776,9 @@ void CardReader::printingHasFinished()
       quickStop();
       file.close();
       sdprinting = false;
+#ifdef POWER_LOSS_RECOVERY
+      power_loss_clear();
+#endif
       printingpaused = false;
       force_temp = false;
       if(SD_FINISHED_STEPPERRELEASE)
@@ -14,6 +14,7 @@ public:
   
   void initsd();
   void write_command(char *buf);
+  void write_data(const uint8_t *data,uint16_t n);
   //files auto[0-9].g on the sd card are performed in a row
   //this is to delay autostart and hence the initialisaiton of the sd card to some seconds after the normal init, so the device is available quick after a reset
 
@@ -32,6 +33,7 @@ public:
   uint16_t getnrfilenames();
   
   void getAbsFilename(char *t);
+  bool getAbsPath(char *t,const char *name,uint8_t size);
   
 
   void ls();
@@ -41,9 +43,20 @@ public:
 
 
   FORCE_INLINE bool isFileOpen() { return file.isOpen(); }
+  FORCE_INLINE bool inProcedure() { return file_subcall_ctr > 0; }
   FORCE_INLINE bool eof() { return sdpos>=filesize ;};
+#ifdef SD_READAHEAD
+  FORCE_INLINE int16_t get() {
+    if(readaheadPos>=readaheadEnd && !fillReadahead()) return -1;
+    sdpos=readaheadStart+readaheadPos;
+    return blockBuffer[readaheadPos++];
+  };
+  FORCE_INLINE void setIndex(long index) {sdpos = index;file.seekSet(index);readaheadPos=readaheadEnd=0;};
+#else
   FORCE_INLINE int16_t get() {  sdpos = file.curPosition();return (int16_t)file.read();};
   FORCE_INLINE void setIndex(long index) {sdpos = index;file.seekSet(index);};
+#endif //SD_READAHEAD
+  FORCE_INLINE uint32_t getIndex() { return sdpos; }; //of the byte get() returned last
   FORCE_INLINE uint8_t percentDone(){if(!isFileOpen()) return 0; if(filesize) return sdpos/((filesize+99)/100); else return 0;};
   FORCE_INLINE char* getWorkDirName(){workDir.getFilename(filename);return filename;};
 
@@ -72,11 +85,35 @@ private:
   //int16_t n;
   unsigned long autostart_atmillis;
   uint32_t sdpos ;
+#if defined(SD_READAHEAD) || defined(SD_FAST_UPLOAD)
+  //a block of the open file, read ahead while printing or gathered while saving
+  uint8_t blockBuffer[512];
+#endif
+#ifdef SD_READAHEAD
+  //blockBuffer[i] is the byte at readaheadStart+i, readaheadPos the next one get() returns
+  uint16_t readaheadPos,readaheadEnd;
+  uint32_t readaheadStart;
+  bool fillReadahead();
+#endif //SD_READAHEAD
+#ifdef SD_FAST_UPLOAD
+  uint16_t writePos; //bytes of the file being saved waiting in blockBuffer
+  void flushWrite();
+#else
+  FORCE_INLINE void flushWrite() {};
+#endif //SD_FAST_UPLOAD
 
   bool autostart_stilltocheck; //the sd start is delayed, because otherwise the serial cannot answer fast enought to make contact with the hostsoftware.
   
   LsAction lsAction; //stored for recursion.
   int16_t nrFiles; //counter for the files in the current directory and recycled as position counter for getting the nrFiles'th name in the directory.
+#ifdef SD_DIR_INDEX_SIZE
+  //where the listed entries of workDir sit: dirIndex[i] is the directory entry readDir() starts at to return the i'th one
+  uint16_t dirIndex[SD_DIR_INDEX_SIZE];
+  int16_t dirIndexCount; //number of listed entries, -1 while the index has to be built
+  FORCE_INLINE void dropDirIndex() {dirIndexCount=-1;};
+#else
+  FORCE_INLINE void dropDirIndex() {};
+#endif //SD_DIR_INDEX_SIZE
   char* diveDirName;
   void lsDive(const char *prepend,SdFile parent);
 };
@@ -560,6 +560,11 @@ const bool Z_MAX_ENDSTOP_INVERTING = true; // set to true to invert the logic of
 #define DEFAULT_ZJERK                 0.4     // (mm/sec)
 #define DEFAULT_EJERK                 5.0    // (mm/sec)
 
+// Cornering by junction deviation (grbl): the distance in mm the path may be
+// thought to deviate from the corner, the entry speed follows from the
+// acceleration. 0 keeps the jerk limits above, M205 J changes it at runtime.
+#define DEFAULT_JUNCTION_DEVIATION    0.0    // (mm)
+
 //===========================================================================
 //=============================Additional Features===========================
 //===========================================================================
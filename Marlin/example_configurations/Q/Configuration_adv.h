@@ -418,7 +418,9 @@ const unsigned int dropsegments=5; //everything with less than this number of st
 
 //The ASCII buffer for recieving from the serial:
 #define MAX_CMD_SIZE 96
-#define BUFSIZE 4
+// Bytes of the command queue. Commands are packed: a line of n characters takes n + 2 bytes,
+// so this holds 14 G1 lines of 25 characters in the RAM that used to take 4 x MAX_CMD_SIZE.
+#define CMDBUFFER_SIZE 384
 
 
 // Firmware based and LCD controled retract
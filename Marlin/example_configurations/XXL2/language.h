@@ -173,6 +173,7 @@
 	#define MSG_VXY_JERK "Vxy-jerk"
 	#define MSG_VZ_JERK "Vz-jerk"
 	#define MSG_VE_JERK "Ve-jerk"
+	#define MSG_JUNCTION_DEVIATION "Junc-dev"
 	#define MSG_VMAX "Vmax "
 	#define MSG_X "x"
 	#define MSG_Y "y"
@@ -390,6 +391,7 @@
 
 	#define MSG_VZ_JERK "Zryw Vz"
 	#define MSG_VE_JERK "Zryw Ve"
+	#define MSG_JUNCTION_DEVIATION "Junc-dev"
 	#define MSG_VMAX "Vmax"
 	#define MSG_X "x"
 	#define MSG_Y "y"
@@ -615,6 +617,7 @@
 	#define MSG_VXY_JERK "Vxy-jerk"
 	#define MSG_VZ_JERK "Vz-jerk"
 	#define MSG_VE_JERK "Ve-jerk"
+	#define MSG_JUNCTION_DEVIATION "Junc-dev"
 	#define MSG_VMAX " Vmax "
 	#define MSG_X "x:"
 	#define MSG_Y "y:"
@@ -832,6 +835,7 @@
 
 	#define MSG_VZ_JERK          "Vz-jerk"
 	#define MSG_VE_JERK          "Ve-jerk"
+	#define MSG_JUNCTION_DEVIATION "Junc-dev"
 	#define MSG_VMAX             "Vmax "
 	#define MSG_X                "x"
 	#define MSG_Y                "y"
@@ -1058,6 +1062,7 @@
 	#define MSG_VXY_JERK " Vxy-agit: "
 	#define MSG_VZ_JERK "Vz-agit"
 	#define MSG_VE_JERK "Ve-agit"
+	#define MSG_JUNCTION_DEVIATION "Junc-dev"
 	#define MSG_VMAX " Vmax "
 	#define MSG_X "x:"
 	#define MSG_Y "y:"
@@ -1288,6 +1293,7 @@
 	#define MSG_VXY_JERK						"Vxy-jerk: "
 	#define MSG_VZ_JERK                         "Vz-jerk"
 	#define MSG_VE_JERK                         "Ve-jerk"
+	#define MSG_JUNCTION_DEVIATION              "Junc-dev"
 	#define MSG_VMAX							"Vmax "
 	#define MSG_X								"x:"
 	#define MSG_Y								"y:"
@@ -1504,6 +1510,7 @@
 	#define MSG_VXY_JERK             "Vxy-jerk"
 	#define MSG_VZ_JERK              "Vz-jerk"
 	#define MSG_VE_JERK              "Ve-jerk"
+	#define MSG_JUNCTION_DEVIATION   "Junc-dev"
 	#define MSG_VMAX                 "Vmax"
 	#define MSG_X                    "x"
 	#define MSG_Y                    "y"
@@ -1727,6 +1734,7 @@
 	#define MSG_VXY_JERK "Vxy-jerk: "
 	#define MSG_VZ_JERK "Vz-jerk"
 	#define MSG_VE_JERK "Ve-jerk"
+	#define MSG_JUNCTION_DEVIATION "Junc-dev"
 	#define MSG_VMAX " Vmax "
 	#define MSG_X "x:"
 	#define MSG_Y "y:"
@@ -1939,6 +1947,7 @@
 	#define MSG_VXY_JERK "Vxy-jerk"
 	#define MSG_VZ_JERK "Vz-jerk"
 	#define MSG_VE_JERK "Ve-jerk"
+	#define MSG_JUNCTION_DEVIATION "Junc-dev"
 	#define MSG_VMAX "Vmax "
 	#define MSG_X "x"
 	#define MSG_Y "y"
@@ -2147,6 +2156,7 @@
 	#define MSG_VXY_JERK "Vxy-jerk"
 	#define MSG_VZ_JERK "Vz-jerk"
 	#define MSG_VE_JERK "Ves-jerk"
+	#define MSG_JUNCTION_DEVIATION "Junc-dev"
 	#define MSG_VMAX "Vmax"
 	#define MSG_X "x"
 	#define MSG_Y "y"
@@ -2360,6 +2370,7 @@
 	#define MSG_VXY_JERK "Vxy-jerk"
 	#define MSG_VZ_JERK "Vz-jerk"
 	#define MSG_VE_JERK "Ve-jerk"
+	#define MSG_JUNCTION_DEVIATION "Junc-dev"
 	#define MSG_VMAX "Vmax "
 	#define MSG_X "x"
 	#define MSG_Y "y"
@@ -2567,6 +2578,7 @@
 	#define MSG_VXY_JERK "Vxy-jerk"
 	#define MSG_VZ_JERK "Vz-jerk"
 	#define MSG_VE_JERK "Ve-jerk"
+	#define MSG_JUNCTION_DEVIATION "Junc-dev"
 	#define MSG_VMAX "Vmax "
 	#define MSG_X "x"
 	#define MSG_Y "y"
@@ -2773,6 +2785,7 @@
 	#define MSG_VXY_JERK "Vxy-astindua"
 	#define MSG_VZ_JERK "Vz-astindua"
 	#define MSG_VE_JERK "Ve-astindua"
+	#define MSG_JUNCTION_DEVIATION "Junc-dev"
 	#define MSG_VMAX "Vmax "
 	#define MSG_X "x"
 	#define MSG_Y "y"
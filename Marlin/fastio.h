@@ -62,6 +62,18 @@
 
 //  why double up on these macros? see http://gcc.gnu.org/onlinedocs/cpp/Stringification.html
 
+#ifdef SIMULATION
+// The host simulation build routes pin access through sim/sim_main.cpp so
+// that step and direction edges can be traced.
+#define READ(IO)  sim_read_pin(IO)
+#define WRITE(IO, v)  sim_write_pin(IO, v)
+#define TOGGLE(IO)  sim_write_pin(IO, !sim_read_pin(IO))
+#define SET_INPUT(IO)  do {} while (0)
+#define SET_OUTPUT(IO)  do {} while (0)
+#define GET_INPUT(IO)  (false)
+#define GET_OUTPUT(IO)  (true)
+#define GET_TIMER(IO)  (false)
+#else
 /// Read a pin wrapper
 #define READ(IO)  _READ(IO)
 /// Write to a pin wrapper
@@ -82,6 +94,7 @@
 
 /// check if pin is an timer wrapper
 #define GET_TIMER(IO)  _GET_TIMER(IO)
+#endif // SIMULATION
 
 /*
 	ports and functions
@@ -173,6 +173,7 @@
 	#define MSG_VXY_JERK "Vxy-jerk"
 	#define MSG_VZ_JERK "Vz-jerk"
 	#define MSG_VE_JERK "Ve-jerk"
+	#define MSG_JUNCTION_DEVIATION "Junc-dev"
 	#define MSG_VMAX "Vmax "
 	#define MSG_X "x"
 	#define MSG_Y "y"
@@ -389,6 +390,7 @@
 
 	#define MSG_VZ_JERK "Zryw Vz"
 	#define MSG_VE_JERK "Zryw Ve"
+	#define MSG_JUNCTION_DEVIATION "Junc-dev"
 	#define MSG_VMAX "Vmax"
 	#define MSG_X "x"
 	#define MSG_Y "y"
@@ -614,6 +616,7 @@
 	#define MSG_VXY_JERK "Vxy-jerk"
 	#define MSG_VZ_JERK "Vz-jerk"
 	#define MSG_VE_JERK "Ve-jerk"
+	#define MSG_JUNCTION_DEVIATION "Junc-dev"
 	#define MSG_VMAX " Vmax "
 	#define MSG_X "x:"
 	#define MSG_Y "y:"
@@ -831,6 +834,7 @@
 
 	#define MSG_VZ_JERK          "Vz-jerk"
 	#define MSG_VE_JERK          "Ve-jerk"
+	#define MSG_JUNCTION_DEVIATION "Junc-dev"
 	#define MSG_VMAX             "Vmax "
 	#define MSG_X                "x"
 	#define MSG_Y                "y"
@@ -1057,6 +1061,7 @@
 	#define MSG_VXY_JERK " Vxy-agit: "
 	#define MSG_VZ_JERK "Vz-agit"
 	#define MSG_VE_JERK "Ve-agit"
+	#define MSG_JUNCTION_DEVIATION "Junc-dev"
 	#define MSG_VMAX " Vmax "
 	#define MSG_X "x:"
 	#define MSG_Y "y:"
@@ -1287,6 +1292,7 @@
 	#define MSG_VXY_JERK						"Vxy-jerk: "
 	#define MSG_VZ_JERK                         "Vz-jerk"
 	#define MSG_VE_JERK                         "Ve-jerk"
+	#define MSG_JUNCTION_DEVIATION              "Junc-dev"
 	#define MSG_VMAX							"Vmax "
 	#define MSG_X								"x:"
 	#define MSG_Y								"y:"
@@ -1503,6 +1509,7 @@
 	#define MSG_VXY_JERK             "Vxy-jerk"
 	#define MSG_VZ_JERK              "Vz-jerk"
 	#define MSG_VE_JERK              "Ve-jerk"
+	#define MSG_JUNCTION_DEVIATION   "Junc-dev"
 	#define MSG_VMAX                 "Vmax"
 	#define MSG_X                    "x"
 	#define MSG_Y                    "y"
@@ -1725,6 +1732,7 @@
 	#define MSG_VXY_JERK "Vxy-jerk: "
 	#define MSG_VZ_JERK "Vz-jerk"
 	#define MSG_VE_JERK "Ve-jerk"
+	#define MSG_JUNCTION_DEVIATION "Junc-dev"
 	#define MSG_VMAX " Vmax "
 	#define MSG_X "x:"
 	#define MSG_Y "y:"
@@ -1937,6 +1945,7 @@
 	#define MSG_VXY_JERK "Vxy-jerk"
 	#define MSG_VZ_JERK "Vz-jerk"
 	#define MSG_VE_JERK "Ve-jerk"
+	#define MSG_JUNCTION_DEVIATION "Junc-dev"
 	#define MSG_VMAX "Vmax "
 	#define MSG_X "x"
 	#define MSG_Y "y"
@@ -2145,6 +2154,7 @@
 	#define MSG_VXY_JERK "Vxy-jerk"
 	#define MSG_VZ_JERK "Vz-jerk"
 	#define MSG_VE_JERK "Ves-jerk"
+	#define MSG_JUNCTION_DEVIATION "Junc-dev"
 	#define MSG_VMAX "Vmax"
 	#define MSG_X "x"
 	#define MSG_Y "y"
@@ -2358,6 +2368,7 @@
 	#define MSG_VXY_JERK "Vxy-jerk"
 	#define MSG_VZ_JERK "Vz-jerk"
 	#define MSG_VE_JERK "Ve-jerk"
+	#define MSG_JUNCTION_DEVIATION "Junc-dev"
 	#define MSG_VMAX "Vmax "
 	#define MSG_X "x"
 	#define MSG_Y "y"
@@ -2565,6 +2576,7 @@
 	#define MSG_VXY_JERK "Vxy-jerk"
 	#define MSG_VZ_JERK "Vz-jerk"
 	#define MSG_VE_JERK "Ve-jerk"
+	#define MSG_JUNCTION_DEVIATION "Junc-dev"
 	#define MSG_VMAX "Vmax "
 	#define MSG_X "x"
 	#define MSG_Y "y"
@@ -2771,6 +2783,7 @@
 	#define MSG_VXY_JERK "Vxy-astindua"
 	#define MSG_VZ_JERK "Vz-astindua"
 	#define MSG_VE_JERK "Ve-astindua"
+	#define MSG_JUNCTION_DEVIATION "Junc-dev"
 	#define MSG_VMAX "Vmax "
 	#define MSG_X "x"
 	#define MSG_Y "y"
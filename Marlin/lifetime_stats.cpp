@@ -190,3 +190,10 @@ void reset_triptime()
     triptime_print_centimeters = 0;
     save_lifetime_stats();
 }
+
+void lifetime_stats_mcode()
+{
+    if (code_seen('R'))
+        reset_triptime();
+    print_lifetime_stats(code_seen('Q') ? 1 : 0);
+}
@@ -1,6 +1,10 @@
 #ifndef LIFETIME_STATS_H
 #define LIFETIME_STATS_H
 
+// command_table entry for the stats report: Q condensed, R resets the trip time
+#define DECLARE_LIFETIME_STATS_MCODES(REPORT_CODE) \
+  { COMMAND_KEY('M', REPORT_CODE), lifetime_stats_mcode },
+
 extern unsigned long lifetime_minutes;
 extern unsigned long lifetime_print_minutes;
 extern unsigned long lifetime_print_centimeters;
@@ -15,5 +19,6 @@ void lifetime_stats_update_e(float newPos);
 void lifetime_stats_tick();
 void print_lifetime_stats(int condensed);
 void reset_triptime();
+void lifetime_stats_mcode();
 
 #endif//LIFETIME_STATS_H
@@ -0,0 +1,38 @@
+#ifndef PID_FIXED_H
+#define PID_FIXED_H
+
+// Fixed point arithmetic of the heater PID in manage_heater(): temperatures and
+// errors in Q8 (1/256 degree), the terms in Q8 of the heater power, the gains
+// in Q16.16. Kept apart from temperature.cpp so that sim/pid_test.cpp can check
+// it against the float PID on the host.
+
+#if defined(PIDTEMP) || defined(PIDTEMPBED)
+//K1 defined in Configuration.h in the PID settings
+#define K1_Q16 ((int32_t)(K1 * 65536.0 + 0.5))
+#define K2_Q16 (65536L - K1_Q16)
+
+// Q16.16 of a gain, saturated at +-32767
+static int32_t to_q16(float x)
+{
+  x = constrain(x, -32767.0, 32767.0) * 65536.0;
+  return (int32_t)(x < 0 ? x - 0.5 : x + 0.5);
+}
+
+// Q8 of the integral state that drives the integral term to PID_INTEGRAL_DRIVE_MAX
+static int32_t iState_max_q8(float ki)
+{
+  float m = PID_INTEGRAL_DRIVE_MAX * 256.0 / ki;
+  return (ki <= 0 || m > 1e9) ? 1000000000L : (int32_t)m;
+}
+
+// (gain * x) >> 16 for a Q16.16 gain, with 32 bit multiplies only:
+// exact as long as the result fits in 32 bits.
+static int32_t mul_q16(int32_t gain, int32_t x)
+{
+  int16_t xh = x >> 16;
+  uint16_t gl = gain, xl = x;
+  return (gain >> 16) * x + (int32_t)gl * xh + (int32_t)(((uint32_t)gl * xl) >> 16);
+}
+#endif
+
+#endif
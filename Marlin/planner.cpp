@@ -73,6 +73,7 @@ float retract_acceleration; //  mm/s^2   filament pull-pack and push-forward  wh
 float max_xy_jerk; //speed than can be stopped at once, if i understand correctly.
 float max_z_jerk;
 float max_e_jerk;
+float junction_deviation; // mm, 0 uses the jerk limits for cornering
 float mintravelfeedrate;
 unsigned long axis_steps_per_sqr_second[NUM_AXIS];
 
@@ -89,6 +90,8 @@ matrix_3x3 plan_bed_level_matrix = {
 long position[4];   //rescaled from extern when axis_steps_per_unit are changed by gcode
 static float previous_speed[4]; // Speed of previous path line segment
 static float previous_nominal_speed; // Nominal speed of previous path line segment
+static float previous_unit_vec[3]; // Unit vector of previous path line segment
+static bool previous_xyz_move; // Previous path line segment moved X, Y or Z
 
 #ifdef AUTOTEMP
 float autotemp_max=250;
@@ -101,8 +104,10 @@ bool autotemp_enabled=false;
 //=================semi-private variables, used in inline  functions    =====
 //===========================================================================
 block_t block_buffer[BLOCK_BUFFER_SIZE];            // A ring buffer for motion instfructions
+block_plan_t block_plan[BLOCK_BUFFER_SIZE];         // Planner state of the blocks in block_buffer
 volatile unsigned char block_buffer_head;           // Index of the next block to be pushed
 volatile unsigned char block_buffer_tail;           // Index of the block to process now
+static unsigned char block_buffer_planned;          // Index of the last block whose entry speed is final
 
 //===========================================================================
 //=============================private variables ============================
@@ -171,9 +176,24 @@ FORCE_INLINE float intersection_distance(float initial_rate, float final_rate, f
   }
 }
 
+#ifdef S_CURVE_ACCELERATION
+// Stores a ramp duration for s_curve_rate() in stepper.cpp as a shift that brings it to 15-16 bits
+// and 2^31 divided by the shifted duration, so the interrupt needs no division.
+static void s_curve_time(float ticks, signed char &shift, unsigned short &inverse) {
+  if(ticks < 256) ticks = 256;
+  if(ticks > 16777215) ticks = 16777215;
+  unsigned long t = ticks;
+  shift = 0;
+  while(t >= 65536) { t >>= 1; shift++; }
+  while(t < 32768) { t <<= 1; shift--; }
+  unsigned long inv = 2147483648UL / t;
+  inverse = min(inv, 65535UL);
+}
+#endif
+
 // Calculates trapezoid parameters so that the entry- and exit-speed is compensated by the provided factors.
 
-void calculate_trapezoid_for_block(block_t *block, float entry_factor, float exit_factor) {
+void calculate_trapezoid_for_block(block_t *block, block_plan_t *plan, float entry_factor, float exit_factor) {
   unsigned long initial_rate = ceil(block->nominal_rate*entry_factor); // (step/min)
   unsigned long final_rate = ceil(block->nominal_rate*exit_factor); // (step/min)
 
@@ -185,7 +205,7 @@ void calculate_trapezoid_for_block(block_t *block, float entry_factor, float exi
     final_rate=120;  
   }
 
-  long acceleration = block->acceleration_st;
+  long acceleration = plan->acceleration_st;
   int32_t accelerate_steps =
     ceil(estimate_acceleration_distance(initial_rate, block->nominal_rate, acceleration));
   int32_t decelerate_steps =
@@ -204,9 +224,21 @@ void calculate_trapezoid_for_block(block_t *block, float entry_factor, float exi
     plateau_steps = 0;
   }
 
+#ifdef S_CURVE_ACCELERATION
+  // Both ramps meet at the rate reached after accelerate_steps, the linear profile takes
+  // (rate change)/acceleration seconds for each of them
+  float cruise_rate = sqrt((float)initial_rate*initial_rate + 2.0*acceleration*accelerate_steps);
+  if(cruise_rate > block->nominal_rate) cruise_rate = block->nominal_rate;
+  if(cruise_rate < initial_rate) cruise_rate = initial_rate;
+  signed char accel_time_shift, decel_time_shift;
+  unsigned short accel_time_inverse, decel_time_inverse;
+  s_curve_time((cruise_rate-initial_rate)*(F_CPU/8.0)/acceleration, accel_time_shift, accel_time_inverse);
+  s_curve_time((cruise_rate-final_rate)*(F_CPU/8.0)/acceleration, decel_time_shift, decel_time_inverse);
+#endif
+
 #ifdef ADVANCE
-  volatile long initial_advance = block->advance*entry_factor*entry_factor; 
-  volatile long final_advance = block->advance*exit_factor*exit_factor;
+  volatile long initial_advance = plan->advance*entry_factor*entry_factor; 
+  volatile long final_advance = plan->advance*exit_factor*exit_factor;
 #endif // ADVANCE
 
   // block->accelerate_until = accelerate_steps;
@@ -217,6 +249,13 @@ void calculate_trapezoid_for_block(block_t *block, float entry_factor, float exi
     block->decelerate_after = accelerate_steps+plateau_steps;
     block->initial_rate = initial_rate;
     block->final_rate = final_rate;
+#ifdef S_CURVE_ACCELERATION
+    block->cruise_rate = cruise_rate;
+    block->accel_time_shift = accel_time_shift;
+    block->accel_time_inverse = accel_time_inverse;
+    block->decel_time_shift = decel_time_shift;
+    block->decel_time_inverse = decel_time_inverse;
+#endif
 #ifdef ADVANCE
     block->initial_advance = initial_advance;
     block->final_advance = final_advance;
@@ -241,7 +280,7 @@ FORCE_INLINE float max_allowable_speed(float acceleration, float target_velocity
 
 
 // The kernel called by planner_recalculate() when scanning the plan from last to first entry.
-void planner_reverse_pass_kernel(block_t *previous, block_t *current, block_t *next) {
+void planner_reverse_pass_kernel(block_plan_t *previous, block_plan_t *current, block_plan_t *next) {
   if(!current) { 
     return; 
   }
@@ -254,45 +293,36 @@ void planner_reverse_pass_kernel(block_t *previous, block_t *current, block_t *n
 
       // If nominal length true, max junction speed is guaranteed to be reached. Only compute
       // for max allowable speed if block is decelerating and nominal length is false.
-      if ((!current->nominal_length_flag) && (current->max_entry_speed > next->entry_speed)) {
+      if (!(current->flags & BLOCK_FLAG_NOMINAL_LENGTH) && (current->max_entry_speed > next->entry_speed)) {
         current->entry_speed = min( current->max_entry_speed,
         max_allowable_speed(-current->acceleration,next->entry_speed,current->millimeters));
       } 
       else {
         current->entry_speed = current->max_entry_speed;
       }
-      current->recalculate_flag = true;
+      current->flags |= BLOCK_FLAG_RECALCULATE;
 
     }
   } // Skip last block. Already initialized and set for recalculation.
 }
 
 // planner_recalculate() needs to go over the current plan twice. Once in reverse and once forward. This 
-// implements the reverse pass.
-void planner_reverse_pass() {
-  uint8_t block_index = block_buffer_head;
-  
-  //Make a local copy of block_buffer_tail, because the interrupt can alter it
-  CRITICAL_SECTION_START;
-  unsigned char tail = block_buffer_tail;
-  CRITICAL_SECTION_END
-  
-  if(((block_buffer_head-tail + BLOCK_BUFFER_SIZE) & (BLOCK_BUFFER_SIZE - 1)) > 3) {
-    block_index = (block_buffer_head - 3) & (BLOCK_BUFFER_SIZE - 1);
-    block_t *block[3] = { 
-      NULL, NULL, NULL         };
-    while(block_index != tail) { 
-      block_index = prev_block_index(block_index); 
-      block[2]= block[1];
-      block[1]= block[0];
-      block[0] = &block_buffer[block_index];
-      planner_reverse_pass_kernel(block[0], block[1], block[2]);
-    }
+// implements the reverse pass. It starts at the newest block and stops at block_buffer_planned, everything
+// before that is already optimal and cannot gain speed from blocks added later.
+void planner_reverse_pass(uint8_t planned) {
+  uint8_t block_index = prev_block_index(block_buffer_head);
+  block_plan_t *next = NULL;
+
+  while(block_index != planned) {
+    block_plan_t *current = &block_plan[block_index];
+    planner_reverse_pass_kernel(NULL, current, next);
+    next = current;
+    block_index = prev_block_index(block_index);
   }
 }
 
 // The kernel called by planner_recalculate() when scanning the plan from first to last entry.
-void planner_forward_pass_kernel(block_t *previous, block_t *current, block_t *next) {
+void planner_forward_pass_kernel(block_plan_t *previous, block_plan_t *current, block_plan_t *next) {
   if(!previous) { 
     return; 
   }
@@ -301,7 +331,7 @@ void planner_forward_pass_kernel(block_t *previous, block_t *current, block_t *n
   // full speed change within the block, we need to adjust the entry speed accordingly. Entry
   // speeds have already been reset, maximized, and reverse planned by reverse planner.
   // If nominal length is true, max junction speed is guaranteed to be reached. No need to recheck.
-  if (!previous->nominal_length_flag) {
+  if (!(previous->flags & BLOCK_FLAG_NOMINAL_LENGTH)) {
     if (previous->entry_speed < current->entry_speed) {
       double entry_speed = min( current->entry_speed,
       max_allowable_speed(-previous->acceleration,previous->entry_speed,previous->millimeters) );
@@ -309,56 +339,61 @@ void planner_forward_pass_kernel(block_t *previous, block_t *current, block_t *n
       // Check for junction speed change
       if (current->entry_speed != entry_speed) {
         current->entry_speed = entry_speed;
-        current->recalculate_flag = true;
+        current->flags |= BLOCK_FLAG_RECALCULATE;
       }
     }
   }
 }
 
 // planner_recalculate() needs to go over the current plan twice. Once in reverse and once forward. This 
-// implements the forward pass.
-void planner_forward_pass() {
-  uint8_t block_index = block_buffer_tail;
-  block_t *block[3] = { 
-    NULL, NULL, NULL   };
+// implements the forward pass. A block whose entry speed is capped by acceleration from the block before
+// it, or that enters at its maximum junction speed, cannot change any more: block_buffer_planned moves up
+// to it so later calls start there.
+void planner_forward_pass(uint8_t planned) {
+  uint8_t block_index = next_block_index(planned);
+  block_plan_t *previous = &block_plan[planned];
 
   while(block_index != block_buffer_head) {
-    block[0] = block[1];
-    block[1] = block[2];
-    block[2] = &block_buffer[block_index];
-    planner_forward_pass_kernel(block[0],block[1],block[2]);
+    block_plan_t *current = &block_plan[block_index];
+    float entry_speed = current->entry_speed;
+    planner_forward_pass_kernel(previous, current, NULL);
+    if (current->entry_speed != entry_speed || current->entry_speed == current->max_entry_speed) {
+      block_buffer_planned = block_index;
+    }
+    previous = current;
     block_index = next_block_index(block_index);
   }
-  planner_forward_pass_kernel(block[1], block[2], NULL);
 }
 
 // Recalculates the trapezoid speed profiles for all blocks in the plan according to the 
 // entry_factor for each junction. Must be called by planner_recalculate() after 
 // updating the blocks.
-void planner_recalculate_trapezoids() {
-  int8_t block_index = block_buffer_tail;
-  block_t *current;
-  block_t *next = NULL;
+void planner_recalculate_trapezoids(uint8_t planned) {
+  int8_t block_index = planned;
+  int8_t current_index;
+  block_plan_t *current;
+  block_plan_t *next = NULL;
 
   while(block_index != block_buffer_head) {
     current = next;
-    next = &block_buffer[block_index];
+    current_index = prev_block_index(block_index);
+    next = &block_plan[block_index];
     if (current) {
       // Recalculate if current block entry or exit junction speed has changed.
-      if (current->recalculate_flag || next->recalculate_flag) {
+      if ((current->flags | next->flags) & BLOCK_FLAG_RECALCULATE) {
         // NOTE: Entry and exit factors always > 0 by all previous logic operations.
-        calculate_trapezoid_for_block(current, current->entry_speed/current->nominal_speed,
+        calculate_trapezoid_for_block(&block_buffer[current_index], current, current->entry_speed/current->nominal_speed,
         next->entry_speed/current->nominal_speed);
-        current->recalculate_flag = false; // Reset current only to ensure next trapezoid is computed
+        current->flags &= ~BLOCK_FLAG_RECALCULATE; // Reset current only to ensure next trapezoid is computed
       }
     }
     block_index = next_block_index( block_index );
   }
   // Last/newest block in buffer. Exit speed is set with MINIMUM_PLANNER_SPEED. Always recalculated.
   if(next != NULL) {
-    calculate_trapezoid_for_block(next, next->entry_speed/next->nominal_speed,
+    calculate_trapezoid_for_block(&block_buffer[prev_block_index(block_buffer_head)], next, next->entry_speed/next->nominal_speed,
     MINIMUM_PLANNER_SPEED/next->nominal_speed);
-    next->recalculate_flag = false;
+    next->flags &= ~BLOCK_FLAG_RECALCULATE;
   }
 }
 
@@ -378,16 +413,29 @@ void planner_recalculate_trapezoids() {
 // the set limit. Finally it will:
 //
 //   3. Recalculate trapezoids for all blocks.
+//
+// Only the blocks after block_buffer_planned take part, so the cost of adding a block does not grow with
+// BLOCK_BUFFER_SIZE once the plan in front of it is optimal.
 
 void planner_recalculate() {   
-  planner_reverse_pass();
-  planner_forward_pass();
-  planner_recalculate_trapezoids();
+  // The step interrupt may have discarded the planned block, the one it is executing is never replanned.
+  CRITICAL_SECTION_START;
+  unsigned char tail = block_buffer_tail;
+  if (((block_buffer_planned - tail) & (BLOCK_BUFFER_SIZE - 1)) >= ((block_buffer_head - tail) & (BLOCK_BUFFER_SIZE - 1))) {
+    block_buffer_planned = tail;
+  }
+  uint8_t planned = block_buffer_planned;
+  CRITICAL_SECTION_END;
+
+  planner_reverse_pass(planned);
+  planner_forward_pass(planned);
+  planner_recalculate_trapezoids(planned);
 }
 
 void plan_init() {
   block_buffer_head = 0;
   block_buffer_tail = 0;
+  block_buffer_planned = 0;
   memset(position, 0, sizeof(position)); // clear position
   previous_speed[0] = 0.0;
   previous_speed[1] = 0.0;
@@ -417,7 +465,7 @@ void getHighESpeed()
     if((block_buffer[block_index].steps_x != 0) ||
       (block_buffer[block_index].steps_y != 0) ||
       (block_buffer[block_index].steps_z != 0)) {
-      float se=(float(block_buffer[block_index].steps_e)/float(block_buffer[block_index].step_event_count))*block_buffer[block_index].nominal_speed;
+      float se=(float(block_buffer[block_index].steps_e)/float(block_buffer[block_index].step_event_count))*block_plan[block_index].nominal_speed;
       //se; mm/sec;
       if(se>high)
       {
@@ -522,7 +570,6 @@ void check_axes_activity()
 }
 
 
-float junction_deviation = 0.1;
 // Add a new linear movement to the buffer. steps_x, _y and _z is the absolute position in 
 // mm. Microseconds specify how many microseconds the move should take to perform. To aid acceleration
 // calculation the caller must also provide the physical length of the line in millimeters.
@@ -582,6 +629,7 @@ void plan_buffer_line(const float &x, const float &y, const float &z, const floa
 
   // Prepare to set up new block
   block_t *block = &block_buffer[block_buffer_head];
+  block_plan_t *plan = &block_plan[block_buffer_head];
 
   // Mark block as not busy (Not executed by the stepper interrupt)
   block->busy = false;
@@ -589,26 +637,38 @@ void plan_buffer_line(const float &x, const float &y, const float &z, const floa
   // Number of steps for each axis
 #ifndef COREXY
 // default non-h-bot planning
-block->steps_x = labs(target[X_AXIS]-position[X_AXIS]);
-block->steps_y = labs(target[Y_AXIS]-position[Y_AXIS]);
+unsigned long steps_x = labs(target[X_AXIS]-position[X_AXIS]);
+unsigned long steps_y = labs(target[Y_AXIS]-position[Y_AXIS]);
 #else
 // corexy planning
 // these equations follow the form of the dA and dB equations on http://www.corexy.com/theory.html
-block->steps_x = labs((target[X_AXIS]-position[X_AXIS]) + (target[Y_AXIS]-position[Y_AXIS]));
-block->steps_y = labs((target[X_AXIS]-position[X_AXIS]) - (target[Y_AXIS]-position[Y_AXIS]));
+unsigned long steps_x = labs((target[X_AXIS]-position[X_AXIS]) + (target[Y_AXIS]-position[Y_AXIS]));
+unsigned long steps_y = labs((target[X_AXIS]-position[X_AXIS]) - (target[Y_AXIS]-position[Y_AXIS]));
 #endif
-  block->steps_z = labs(target[Z_AXIS]-position[Z_AXIS]);
-  block->steps_e = labs(target[E_AXIS]-position[E_AXIS]);
-  block->steps_e *= volumetric_multiplier[active_extruder];
-  block->steps_e *= extrudemultiply;
-  block->steps_e /= 100;
-  block->step_event_count = max(block->steps_x, max(block->steps_y, max(block->steps_z, block->steps_e)));
+  unsigned long steps_z = labs(target[Z_AXIS]-position[Z_AXIS]);
+  unsigned long steps_e = labs(target[E_AXIS]-position[E_AXIS]);
+  steps_e *= volumetric_multiplier[active_extruder];
+  steps_e *= extrudemultiply;
+  steps_e /= 100;
+  unsigned long step_event_count = max(steps_x, max(steps_y, max(steps_z, steps_e)));
 
   // Bail if this is a zero-length block
-  if (block->step_event_count <= dropsegments)
+  if (step_event_count <= dropsegments)
   { 
     return; 
   }
+  // The block only has 24 bits for the step counts
+  if (step_event_count > BLOCK_MAX_STEPS)
+  {
+    SERIAL_ERROR_START;
+    SERIAL_ERRORLNPGM("Move too long for a block, skipped");
+    return;
+  }
+  block->steps_x = steps_x;
+  block->steps_y = steps_y;
+  block->steps_z = steps_z;
+  block->steps_e = steps_e;
+  block->step_event_count = step_event_count;
 
   block->fan_speed = fanSpeed;
   #ifdef BARICUDA
@@ -704,13 +764,13 @@ block->steps_y = labs((target[X_AXIS]-position[X_AXIS]) - (target[Y_AXIS]-positi
   delta_mm[E_AXIS] = ((target[E_AXIS]-position[E_AXIS])/axis_steps_per_unit[E_AXIS])*volumetric_multiplier[active_extruder]*extrudemultiply/100.0;
   if ( block->steps_x <=dropsegments && block->steps_y <=dropsegments && block->steps_z <=dropsegments )
   {
-    block->millimeters = fabs(delta_mm[E_AXIS]);
+    plan->millimeters = fabs(delta_mm[E_AXIS]);
   } 
   else
   {
-    block->millimeters = sqrt(square(delta_mm[X_AXIS]) + square(delta_mm[Y_AXIS]) + square(delta_mm[Z_AXIS]));
+    plan->millimeters = sqrt(square(delta_mm[X_AXIS]) + square(delta_mm[Y_AXIS]) + square(delta_mm[Z_AXIS]));
   }
-  float inverse_millimeters = 1.0/block->millimeters;  // Inverse millimeters to remove multiple divides 
+  float inverse_millimeters = 1.0/plan->millimeters;  // Inverse millimeters to remove multiple divides 
 
     // Calculate speed in mm/second for each axis. No divide by zero due to previous checks.
   float inverse_second = feed_rate * inverse_millimeters;
@@ -740,8 +800,8 @@ block->steps_y = labs((target[X_AXIS]-position[X_AXIS]) - (target[Y_AXIS]-positi
   //  END OF SLOW DOWN SECTION    
 
 
-  block->nominal_speed = block->millimeters * inverse_second; // (mm/sec) Always > 0
-  block->nominal_rate = ceil(block->step_event_count * inverse_second); // (step/sec) Always > 0
+  plan->nominal_speed = plan->millimeters * inverse_second; // (mm/sec) Always > 0
+  float nominal_rate = ceil(block->step_event_count * inverse_second); // (step/sec) Always > 0
 
   // Calculate and limit speed in mm/sec for each axis
   float current_speed[4];
@@ -795,72 +855,37 @@ block->steps_y = labs((target[X_AXIS]-position[X_AXIS]) - (target[Y_AXIS]-positi
     {
       current_speed[i] *= speed_factor;
     }
-    block->nominal_speed *= speed_factor;
-    block->nominal_rate *= speed_factor;
+    plan->nominal_speed *= speed_factor;
+    nominal_rate *= speed_factor;
   }
 
+  // The stepper interrupt never runs faster than MAX_STEP_FREQUENCY
+  block->nominal_rate = min(nominal_rate, MAX_STEP_FREQUENCY);
+
   // Compute and limit the acceleration rate for the trapezoid generator.  
-  float steps_per_mm = block->step_event_count/block->millimeters;
+  float steps_per_mm = block->step_event_count/plan->millimeters;
+  unsigned long acceleration_st;
   if(block->steps_x == 0 && block->steps_y == 0 && block->steps_z == 0)
   {
-    block->acceleration_st = ceil(retract_acceleration * steps_per_mm); // convert to: acceleration steps/sec^2
+    acceleration_st = ceil(retract_acceleration * steps_per_mm); // convert to: acceleration steps/sec^2
   }
   else
   {
-    block->acceleration_st = ceil(acceleration * steps_per_mm); // convert to: acceleration steps/sec^2
+    acceleration_st = ceil(acceleration * steps_per_mm); // convert to: acceleration steps/sec^2
     // Limit acceleration per axis
-    if(((float)block->acceleration_st * (float)block->steps_x / (float)block->step_event_count) > axis_steps_per_sqr_second[X_AXIS])
-      block->acceleration_st = axis_steps_per_sqr_second[X_AXIS];
-    if(((float)block->acceleration_st * (float)block->steps_y / (float)block->step_event_count) > axis_steps_per_sqr_second[Y_AXIS])
-      block->acceleration_st = axis_steps_per_sqr_second[Y_AXIS];
-    if(((float)block->acceleration_st * (float)block->steps_e / (float)block->step_event_count) > axis_steps_per_sqr_second[E_AXIS])
-      block->acceleration_st = axis_steps_per_sqr_second[E_AXIS];
-    if(((float)block->acceleration_st * (float)block->steps_z / (float)block->step_event_count ) > axis_steps_per_sqr_second[Z_AXIS])
-      block->acceleration_st = axis_steps_per_sqr_second[Z_AXIS];
-  }
-  block->acceleration = block->acceleration_st / steps_per_mm;
-  block->acceleration_rate = (long)((float)block->acceleration_st * (16777216.0 / (F_CPU / 8.0)));
-
-#if 0  // Use old jerk for now
-  // Compute path unit vector
-  double unit_vec[3];
-
-  unit_vec[X_AXIS] = delta_mm[X_AXIS]*inverse_millimeters;
-  unit_vec[Y_AXIS] = delta_mm[Y_AXIS]*inverse_millimeters;
-  unit_vec[Z_AXIS] = delta_mm[Z_AXIS]*inverse_millimeters;
-
-  // Compute maximum allowable entry speed at junction by centripetal acceleration approximation.
-  // Let a circle be tangent to both previous and current path line segments, where the junction
-  // deviation is defined as the distance from the junction to the closest edge of the circle,
-  // colinear with the circle center. The circular segment joining the two paths represents the
-  // path of centripetal acceleration. Solve for max velocity based on max acceleration about the
-  // radius of the circle, defined indirectly by junction deviation. This may be also viewed as
-  // path width or max_jerk in the previous grbl version. This approach does not actually deviate
-  // from path, but used as a robust way to compute cornering speeds, as it takes into account the
-  // nonlinearities of both the junction angle and junction velocity.
-  double vmax_junction = MINIMUM_PLANNER_SPEED; // Set default max junction speed
-
-  // Skip first block or when previous_nominal_speed is used as a flag for homing and offset cycles.
-  if ((block_buffer_head != block_buffer_tail) && (previous_nominal_speed > 0.0)) {
-    // Compute cosine of angle between previous and current path. (prev_unit_vec is negative)
-    // NOTE: Max junction velocity is computed without sin() or acos() by trig half angle identity.
-    double cos_theta = - previous_unit_vec[X_AXIS] * unit_vec[X_AXIS]
-      - previous_unit_vec[Y_AXIS] * unit_vec[Y_AXIS]
-      - previous_unit_vec[Z_AXIS] * unit_vec[Z_AXIS] ;
-
-    // Skip and use default max junction speed for 0 degree acute junction.
-    if (cos_theta < 0.95) {
-      vmax_junction = min(previous_nominal_speed,block->nominal_speed);
-      // Skip and avoid divide by zero for straight junctions at 180 degrees. Limit to min() of nominal speeds.
-      if (cos_theta > -0.95) {
-        // Compute maximum junction velocity based on maximum acceleration and junction deviation
-        double sin_theta_d2 = sqrt(0.5*(1.0-cos_theta)); // Trig half angle identity. Always positive.
-        vmax_junction = min(vmax_junction,
-        sqrt(block->acceleration * junction_deviation * sin_theta_d2/(1.0-sin_theta_d2)) );
-      }
-    }
+    if(((float)acceleration_st * (float)block->steps_x / (float)block->step_event_count) > axis_steps_per_sqr_second[X_AXIS])
+      acceleration_st = axis_steps_per_sqr_second[X_AXIS];
+    if(((float)acceleration_st * (float)block->steps_y / (float)block->step_event_count) > axis_steps_per_sqr_second[Y_AXIS])
+      acceleration_st = axis_steps_per_sqr_second[Y_AXIS];
+    if(((float)acceleration_st * (float)block->steps_e / (float)block->step_event_count) > axis_steps_per_sqr_second[E_AXIS])
+      acceleration_st = axis_steps_per_sqr_second[E_AXIS];
+    if(((float)acceleration_st * (float)block->steps_z / (float)block->step_event_count ) > axis_steps_per_sqr_second[Z_AXIS])
+      acceleration_st = axis_steps_per_sqr_second[Z_AXIS];
   }
-#endif
+  plan->acceleration_st = acceleration_st;
+  plan->acceleration = acceleration_st / steps_per_mm;
+  block->acceleration_rate = (long)((float)acceleration_st * (16777216.0 / (F_CPU / 8.0)));
+
   // Start with a safe speed
   float vmax_junction = max_xy_jerk/2; 
   float vmax_junction_factor = 1.0; 
@@ -868,30 +893,74 @@ block->steps_y = labs((target[X_AXIS]-position[X_AXIS]) - (target[Y_AXIS]-positi
     vmax_junction = min(vmax_junction, max_z_jerk/2);
   if(fabs(current_speed[E_AXIS]) > max_e_jerk/2) 
     vmax_junction = min(vmax_junction, max_e_jerk/2);
-  vmax_junction = min(vmax_junction, block->nominal_speed);
+  vmax_junction = min(vmax_junction, plan->nominal_speed);
   float safe_speed = vmax_junction;
 
+  // Compute path unit vector, extruder only moves have none
+  float unit_vec[3] = { 0.0, 0.0, 0.0 };
+  bool xyz_move = !(block->steps_x <= dropsegments && block->steps_y <= dropsegments && block->steps_z <= dropsegments);
+  if (xyz_move) {
+    unit_vec[X_AXIS] = delta_mm[X_AXIS]*inverse_millimeters;
+    unit_vec[Y_AXIS] = delta_mm[Y_AXIS]*inverse_millimeters;
+    unit_vec[Z_AXIS] = delta_mm[Z_AXIS]*inverse_millimeters;
+  }
+
   if ((moves_queued > 1) && (previous_nominal_speed > 0.0001)) {
-    float jerk = sqrt(pow((current_speed[X_AXIS]-previous_speed[X_AXIS]), 2)+pow((current_speed[Y_AXIS]-previous_speed[Y_AXIS]), 2));
-    //    if((fabs(previous_speed[X_AXIS]) > 0.0001) || (fabs(previous_speed[Y_AXIS]) > 0.0001)) {
-    vmax_junction = block->nominal_speed;
-    //    }
-    if (jerk > max_xy_jerk) {
-      vmax_junction_factor = (max_xy_jerk/jerk);
-    } 
-    if(fabs(current_speed[Z_AXIS] - previous_speed[Z_AXIS]) > max_z_jerk) {
-      vmax_junction_factor= min(vmax_junction_factor, (max_z_jerk/fabs(current_speed[Z_AXIS] - previous_speed[Z_AXIS])));
-    } 
-    if(fabs(current_speed[E_AXIS] - previous_speed[E_AXIS]) > max_e_jerk) {
-      vmax_junction_factor = min(vmax_junction_factor, (max_e_jerk/fabs(current_speed[E_AXIS] - previous_speed[E_AXIS])));
-    } 
-    vmax_junction = min(previous_nominal_speed, vmax_junction * vmax_junction_factor); // Limit speed to max previous speed
+    if (junction_deviation > 0.0 && xyz_move && previous_xyz_move) {
+      // Compute maximum allowable entry speed at junction by centripetal acceleration approximation.
+      // Let a circle be tangent to both previous and current path line segments, where the junction
+      // deviation is defined as the distance from the junction to the closest edge of the circle,
+      // colinear with the circle center. The circular segment joining the two paths represents the
+      // path of centripetal acceleration. Solve for max velocity based on max acceleration about the
+      // radius of the circle, defined indirectly by junction deviation. This may be also viewed as
+      // path width or max_jerk in the previous grbl version. This approach does not actually deviate
+      // from path, but used as a robust way to compute cornering speeds, as it takes into account the
+      // nonlinearities of both the junction angle and junction velocity.
+      // Compute cosine of angle between previous and current path. (prev_unit_vec is negative)
+      // NOTE: Max junction velocity is computed without sin() or acos() by trig half angle identity.
+      float cos_theta = - previous_unit_vec[X_AXIS] * unit_vec[X_AXIS]
+        - previous_unit_vec[Y_AXIS] * unit_vec[Y_AXIS]
+        - previous_unit_vec[Z_AXIS] * unit_vec[Z_AXIS] ;
+
+      // Keep the safe speed for a (nearly) reversing junction.
+      if (cos_theta < 0.95) {
+        vmax_junction = min(previous_nominal_speed, plan->nominal_speed);
+        // Skip and avoid divide by zero for straight junctions at 180 degrees. Limit to min() of nominal speeds.
+        if (cos_theta > -0.95) {
+          // Compute maximum junction velocity based on maximum acceleration and junction deviation
+          float sin_theta_d2 = sqrt(0.5*(1.0-cos_theta)); // Trig half angle identity. Always positive.
+          vmax_junction = min(vmax_junction,
+            sqrt(plan->acceleration * junction_deviation * sin_theta_d2/(1.0-sin_theta_d2)) );
+        }
+        // The extruder still has to follow the change of its own speed
+        if(fabs(current_speed[E_AXIS] - previous_speed[E_AXIS]) > max_e_jerk) {
+          vmax_junction_factor = max_e_jerk/fabs(current_speed[E_AXIS] - previous_speed[E_AXIS]);
+        }
+        vmax_junction = max(min(safe_speed, vmax_junction), vmax_junction * vmax_junction_factor);
+      }
+    }
+    else {
+      float jerk = sqrt(pow((current_speed[X_AXIS]-previous_speed[X_AXIS]), 2)+pow((current_speed[Y_AXIS]-previous_speed[Y_AXIS]), 2));
+      //    if((fabs(previous_speed[X_AXIS]) > 0.0001) || (fabs(previous_speed[Y_AXIS]) > 0.0001)) {
+      vmax_junction = plan->nominal_speed;
+      //    }
+      if (jerk > max_xy_jerk) {
+        vmax_junction_factor = (max_xy_jerk/jerk);
+      } 
+      if(fabs(current_speed[Z_AXIS] - previous_speed[Z_AXIS]) > max_z_jerk) {
+        vmax_junction_factor= min(vmax_junction_factor, (max_z_jerk/fabs(current_speed[Z_AXIS] - previous_speed[Z_AXIS])));
+      } 
+      if(fabs(current_speed[E_AXIS] - previous_speed[E_AXIS]) > max_e_jerk) {
+        vmax_junction_factor = min(vmax_junction_factor, (max_e_jerk/fabs(current_speed[E_AXIS] - previous_speed[E_AXIS])));
+      } 
+      vmax_junction = min(previous_nominal_speed, vmax_junction * vmax_junction_factor); // Limit speed to max previous speed
+    }
   }
-  block->max_entry_speed = vmax_junction;
+  plan->max_entry_speed = vmax_junction;
 
   // Initialize block entry speed. Compute based on deceleration to user-defined MINIMUM_PLANNER_SPEED.
-  double v_allowable = max_allowable_speed(-block->acceleration,MINIMUM_PLANNER_SPEED,block->millimeters);
-  block->entry_speed = min(vmax_junction, v_allowable);
+  double v_allowable = max_allowable_speed(-plan->acceleration,MINIMUM_PLANNER_SPEED,plan->millimeters);
+  plan->entry_speed = min(vmax_junction, v_allowable);
 
   // Initialize planner efficiency flags
   // Set flag if block will always reach maximum junction speed regardless of entry/exit speeds.
@@ -901,30 +970,29 @@ block->steps_y = labs((target[X_AXIS]-position[X_AXIS]) - (target[Y_AXIS]-positi
   // block nominal speed limits both the current and next maximum junction speeds. Hence, in both
   // the reverse and forward planners, the corresponding block junction speed will always be at the
   // the maximum junction speed and may always be ignored for any speed reduction checks.
-  if (block->nominal_speed <= v_allowable) { 
-    block->nominal_length_flag = true; 
-  }
-  else { 
-    block->nominal_length_flag = false; 
+  plan->flags = BLOCK_FLAG_RECALCULATE; // Always calculate trapezoid for new block
+  if (plan->nominal_speed <= v_allowable) { 
+    plan->flags |= BLOCK_FLAG_NOMINAL_LENGTH; 
   }
-  block->recalculate_flag = true; // Always calculate trapezoid for new block
 
   // Update previous path unit_vector and nominal speed
   memcpy(previous_speed, current_speed, sizeof(previous_speed)); // previous_speed[] = current_speed[]
-  previous_nominal_speed = block->nominal_speed;
+  memcpy(previous_unit_vec, unit_vec, sizeof(previous_unit_vec)); // previous_unit_vec[] = unit_vec[]
+  previous_xyz_move = xyz_move;
+  previous_nominal_speed = plan->nominal_speed;
 
 
 #ifdef ADVANCE
   // Calculate advance rate
   if((block->steps_e == 0) || (block->steps_x == 0 && block->steps_y == 0 && block->steps_z == 0)) {
     block->advance_rate = 0;
-    block->advance = 0;
+    plan->advance = 0;
   }
   else {
-    long acc_dist = estimate_acceleration_distance(0, block->nominal_rate, block->acceleration_st);
+    long acc_dist = estimate_acceleration_distance(0, block->nominal_rate, acceleration_st);
     float advance = (STEPS_PER_CUBIC_MM_E * EXTRUDER_ADVANCE_K) * 
       (current_speed[E_AXIS] * current_speed[E_AXIS] * EXTRUTION_AREA * EXTRUTION_AREA)*256;
-    block->advance = advance;
+    plan->advance = advance;
     if(acc_dist == 0) {
       block->advance_rate = 0;
     } 
@@ -935,14 +1003,14 @@ block->steps_y = labs((target[X_AXIS]-position[X_AXIS]) - (target[Y_AXIS]-positi
   /*
     SERIAL_ECHO_START;
    SERIAL_ECHOPGM("advance :");
-   SERIAL_ECHO(block->advance/256.0);
+   SERIAL_ECHO(plan->advance/256.0);
    SERIAL_ECHOPGM("advance rate :");
    SERIAL_ECHOLN(block->advance_rate/256.0);
    */
 #endif // ADVANCE
 
-  calculate_trapezoid_for_block(block, block->entry_speed/block->nominal_speed,
-  safe_speed/block->nominal_speed);
+  calculate_trapezoid_for_block(block, plan, plan->entry_speed/plan->nominal_speed,
+  safe_speed/plan->nominal_speed);
 
   // Move buffer head
   block_buffer_head = next_buffer_head;
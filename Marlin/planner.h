@@ -30,46 +30,64 @@
 #include "vector_3.h"
 #endif // ENABLE_AUTO_BED_LEVELING
 
-// This struct is used when buffering the setup for each linear movement "nominal" values are as specified in 
-// the source g-code and may never actually be reached if acceleration management is active.
+// This struct is used when buffering the setup for each linear movement. It only holds what the stepper
+// interrupt reads to trace the line, the planner's own bookkeeping is kept apart in block_plan_t. Step rates
+// are limited to MAX_STEP_FREQUENCY and fit in 16 bits, the same width the interrupt computes them in. Step
+// counts take 24 bits, plan_buffer_line() refuses a move of more than BLOCK_MAX_STEPS. The struct is packed
+// so the host build lays it out like the AVR does.
+#define BLOCK_MAX_STEPS 0xFFFFFFUL
 typedef struct {
   // Fields used by the bresenham algorithm for tracing the line
-  long steps_x, steps_y, steps_z, steps_e;  // Step count along each axis
-  unsigned long step_event_count;           // The number of step events required to complete this block
-  long accelerate_until;                    // The index of the step event on which to stop acceleration
-  long decelerate_after;                    // The index of the step event on which to start decelerating
-  long acceleration_rate;                   // The acceleration rate used for acceleration calculation
+  unsigned long steps_x : 24, steps_y : 24, steps_z : 24, steps_e : 24;  // Step count along each axis
+  unsigned long step_event_count : 24;      // The number of step events required to complete this block
+  unsigned long accelerate_until : 24;      // The index of the step event on which to stop acceleration
+  unsigned long decelerate_after : 24;      // The index of the step event on which to start decelerating
+  unsigned long acceleration_rate : 24;     // The acceleration rate used for acceleration calculation, the interrupt only multiplies 24 bits of it
   unsigned char direction_bits;             // The direction bit set for this block (refers to *_DIRECTION_BIT in config.h)
   unsigned char active_extruder;            // Selects the active extruder
   #ifdef ADVANCE
     long advance_rate;
     volatile long initial_advance;
     volatile long final_advance;
-    float advance;
   #endif
 
-  // Fields used by the motion planner to manage acceleration
-//  float speed_x, speed_y, speed_z, speed_e;        // Nominal mm/sec for each axis
+  // Settings for the trapezoid generator
+  unsigned short nominal_rate;                       // The nominal step rate for this block in step_events/sec 
+  unsigned short initial_rate;                       // The jerk-adjusted step rate at start of block  
+  unsigned short final_rate;                         // The minimal rate at exit
+  #ifdef S_CURVE_ACCELERATION
+    unsigned short cruise_rate;                      // The rate reached at the end of acceleration
+    signed char accel_time_shift;                    // Ramp durations in timer ticks, see s_curve_rate()
+    unsigned short accel_time_inverse;
+    signed char decel_time_shift;
+    unsigned short decel_time_inverse;
+  #endif
+  unsigned char fan_speed;
+  #ifdef BARICUDA
+  unsigned char valve_pressure;
+  unsigned char e_to_p_pressure;
+  #endif
+  volatile char busy;
+} __attribute__((packed)) block_t;
+
+// Planner flags, block_plan_t.flags
+#define BLOCK_FLAG_RECALCULATE     1  // Recalculate the trapezoid, the entry junction speed changed
+#define BLOCK_FLAG_NOMINAL_LENGTH  2  // Nominal speed is always reached
+
+// Fields used by the motion planner to manage acceleration, one per block_buffer[] entry. "nominal" values
+// are as specified in the source g-code and may never actually be reached if acceleration management is active.
+typedef struct {
   float nominal_speed;                               // The nominal speed for this block in mm/sec 
   float entry_speed;                                 // Entry speed at previous-current junction in mm/sec
   float max_entry_speed;                             // Maximum allowable junction entry speed in mm/sec
   float millimeters;                                 // The total travel of this block in mm
   float acceleration;                                // acceleration mm/sec^2
-  unsigned char recalculate_flag;                    // Planner flag to recalculate trapezoids on entry junction
-  unsigned char nominal_length_flag;                 // Planner flag for nominal speed always reached
-
-  // Settings for the trapezoid generator
-  unsigned long nominal_rate;                        // The nominal step rate for this block in step_events/sec 
-  unsigned long initial_rate;                        // The jerk-adjusted step rate at start of block  
-  unsigned long final_rate;                          // The minimal rate at exit
-  unsigned long acceleration_st;                     // acceleration steps/sec^2
-  unsigned long fan_speed;
-  #ifdef BARICUDA
-  unsigned long valve_pressure;
-  unsigned long e_to_p_pressure;
+  uint32_t acceleration_st;                          // acceleration steps/sec^2
+  #ifdef ADVANCE
+    float advance;
   #endif
-  volatile char busy;
-} block_t;
+  unsigned char flags;                               // BLOCK_FLAG_*
+} __attribute__((packed)) block_plan_t;
 
 #ifdef ENABLE_AUTO_BED_LEVELING
 // this holds the required transform to compensate for bed level
@@ -115,6 +133,7 @@ extern float retract_acceleration; //  mm/s^2   filament pull-pack and push-forw
 extern float max_xy_jerk; //speed than can be stopped at once, if i understand correctly.
 extern float max_z_jerk;
 extern float max_e_jerk;
+extern float junction_deviation;
 extern float mintravelfeedrate;
 extern unsigned long axis_steps_per_sqr_second[NUM_AXIS];
 
@@ -129,6 +148,7 @@ extern unsigned long axis_steps_per_sqr_second[NUM_AXIS];
 
 
 extern block_t block_buffer[BLOCK_BUFFER_SIZE];            // A ring buffer for motion instfructions
+extern block_plan_t block_plan[BLOCK_BUFFER_SIZE];         // Planner state of the blocks in block_buffer
 extern volatile unsigned char block_buffer_head;           // Index of the next block to be pushed
 extern volatile unsigned char block_buffer_tail; 
 // Called when the current block is no longer needed. Discards the block and makes the memory
@@ -140,6 +160,12 @@ FORCE_INLINE void plan_discard_current_block()
   }
 }
 
+// Returns true if plan_buffer_line() would have to wait for the stepper to free a block
+FORCE_INLINE bool plan_buffer_full()
+{
+  return block_buffer_tail == ((block_buffer_head + 1) & (BLOCK_BUFFER_SIZE - 1));
+}
+
 // Gets the current block. Returns NULL if buffer empty
 FORCE_INLINE block_t *plan_get_current_block() 
 {
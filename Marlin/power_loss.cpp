@@ -0,0 +1,240 @@
+#include <avr/eeprom.h>
+#include <stddef.h>
+#include "Marlin.h"
+#include "planner.h"
+
+#include "power_loss.h"
+
+#ifdef POWER_LOSS_RECOVERY
+
+//ConfigurationStore.cpp stores at offsets 50 and 100, lifetime_stats.cpp at 0x700 to 0x7ff.
+//The job header and the checkpoint slots start at 0xA00, 16 slots take a little over 700 bytes, about
+//1300 with the bed leveling matrix of ENABLE_AUTO_BED_LEVELING.
+#define POWER_LOSS_EEPROM_OFFSET 0xA00
+
+//Not more than one checkpoint in this many milliseconds, a spiral (vase) print that rises with every move
+//would otherwise write one per move.
+#define CHECKPOINT_MIN_MILLIS 10000UL
+
+//The print a checkpoint belongs to: job changes with every file selected for printing.
+//An empty path means there is nothing to resume.
+struct job_header
+{
+  uint16_t job;
+  char path[POWER_LOSS_PATH_LENGTH];
+  uint8_t crc;
+};
+
+//A checkpoint. The valid slot with the highest seq is the last one written, the next one goes to the slot after it.
+struct checkpoint_slot
+{
+  uint32_t seq;
+  uint16_t job;
+  power_loss_state state;
+  uint8_t crc;
+};
+
+#define HEADER_ADDR ((uint8_t*)POWER_LOSS_EEPROM_OFFSET)
+#define SLOT_ADDR(i) ((uint8_t*)(POWER_LOSS_EEPROM_OFFSET + sizeof(job_header) + (i) * sizeof(checkpoint_slot)))
+
+static job_header header;       //as stored, or as being written
+static checkpoint_slot slot;    //the last checkpoint, or the one being written
+static bool have_checkpoint;    //slot is a checkpoint of the job in header
+static uint8_t next_slot;
+static uint8_t *slot_addr;
+//bytes at the end of header and slot that still have to be written
+static uint8_t header_left;
+static uint8_t slot_left;
+//slot is waiting for the steppers to run the moves planned up to it, a power
+//loss before that would leave them out of the print
+static bool slot_pending;
+static unsigned char slot_head;   //block_buffer_head when slot was taken
+
+static float layer_z;            //height of the last extruding move
+static float last_e;
+static uint8_t layers;
+static unsigned long checkpoint_millis;
+
+//CRC-8 (polynomial 0x07), starting from 0xff so erased and cleared EEPROM does not check out
+static uint8_t crc8(const void *data, uint8_t n)
+{
+    const uint8_t *p = (const uint8_t*)data;
+    uint8_t crc = 0xff;
+    while(n--)
+    {
+        crc ^= *p++;
+        for(uint8_t i = 0; i < 8; i++)
+            crc = (crc & 0x80) ? (crc << 1) ^ 0x07 : crc << 1;
+    }
+    return crc;
+}
+
+static void read_eeprom(void *dst, const uint8_t *addr, uint8_t n)
+{
+    uint8_t *p = (uint8_t*)dst;
+    while(n--)
+        *p++ = eeprom_read_byte(addr++);
+}
+
+static void write_header()
+{
+    header.crc = crc8(&header, offsetof(job_header, crc));
+    header_left = sizeof(header);
+}
+
+void power_loss_init()
+{
+    header_left = slot_left = 0;
+    slot_pending = false;
+    read_eeprom(&header, HEADER_ADDR, sizeof(header));
+    if (header.crc != crc8(&header, offsetof(job_header, crc)))
+        memset(&header, 0, sizeof(header));
+
+    bool found = false;
+    checkpoint_slot s;
+    memset(&slot, 0, sizeof(slot));
+    next_slot = 0;
+    for(uint8_t i = 0; i < POWER_LOSS_SLOTS; i++)
+    {
+        read_eeprom(&s, SLOT_ADDR(i), sizeof(s));
+        if (s.crc != crc8(&s, offsetof(checkpoint_slot, crc)) || (found && s.seq <= slot.seq))
+            continue;
+        slot = s;
+        found = true;
+        next_slot = (i + 1) % POWER_LOSS_SLOTS;
+    }
+    have_checkpoint = found && header.path[0] && slot.job == header.job;
+    if (have_checkpoint)
+        power_loss_report();
+}
+
+//A file has been opened for printing, its checkpoints replace the ones of the last job.
+void power_loss_start(const char *path)
+{
+    header.job++;
+    strncpy(header.path, path, POWER_LOSS_PATH_LENGTH);
+    if (header.path[POWER_LOSS_PATH_LENGTH - 1])
+        header.path[0] = 0; //too long to be resumed
+    write_header();
+    have_checkpoint = false;
+    slot_left = 0;
+    slot_pending = false;
+    layer_z = 0;
+    last_e = current_position[E_AXIS];
+    layers = 0;
+    checkpoint_millis = millis() - CHECKPOINT_MIN_MILLIS;
+}
+
+//A command of the print has left the head at height z with the extruder at e.
+//True if it extruded at a new height, the POWER_LOSS_LAYERS'th since the last
+//checkpoint, and a new checkpoint can be written. Travel moves, Z hops and
+//homing do not extrude and do not count.
+bool power_loss_due(float z, float e)
+{
+    bool extruded = e > last_e;
+    last_e = e;
+    if (!extruded || z == layer_z || slot_left || slot_pending || !header.path[0])
+        return false;
+    layer_z = z;
+    if (++layers < POWER_LOSS_LAYERS || millis() - checkpoint_millis < CHECKPOINT_MIN_MILLIS)
+        return false;
+    layers = 0;
+    checkpoint_millis = millis();
+    return true;
+}
+
+void power_loss_save(const power_loss_state &state)
+{
+    slot.seq++;
+    slot.job = header.job;
+    slot.state = state;
+    slot.crc = crc8(&slot, offsetof(checkpoint_slot, crc));
+    slot_addr = SLOT_ADDR(next_slot);
+    next_slot = (next_slot + 1) % POWER_LOSS_SLOTS;
+    slot_head = block_buffer_head;
+    slot_pending = true;
+}
+
+//True once the block planned last before slot was taken has left the planner.
+//The stepper interrupt moves the tail up to slot_head, then past it, but never past the head.
+static bool slot_moves_done()
+{
+    unsigned char tail = block_buffer_tail;
+    unsigned char left = (slot_head - tail) & (BLOCK_BUFFER_SIZE - 1);
+    return left == 0 || left > ((block_buffer_head - tail) & (BLOCK_BUFFER_SIZE - 1));
+}
+
+//The print is over or has been stopped, there is nothing to resume.
+void power_loss_clear()
+{
+    if (!header.path[0])
+        return;
+    header.path[0] = 0;
+    write_header();
+    have_checkpoint = false;
+    slot_left = 0;
+    slot_pending = false;
+}
+
+//The file of the last checkpoint, and the state it stores. NULL if there is none.
+const char *power_loss_load(power_loss_state &state)
+{
+    if (!have_checkpoint)
+        return NULL;
+    state = slot.state;
+    return header.path;
+}
+
+void power_loss_report()
+{
+    SERIAL_ECHO_START;
+    if (!have_checkpoint)
+    {
+        SERIAL_ECHOLNPGM("No print to resume");
+        return;
+    }
+    SERIAL_ECHOPGM("Print of ");
+    SERIAL_ECHO(header.path);
+    SERIAL_ECHOPAIR(" checkpointed at byte ", (unsigned long)slot.state.file_pos);
+    SERIAL_ECHOPAIR(" Z:", slot.state.position[Z_AXIS]);
+    SERIAL_ECHOLNPGM(", M1000 S1 resumes it");
+}
+
+//Writes the next byte of the header, then of the checkpoint. Never waits for
+//the EEPROM: nothing happens while it is busy with the last byte, and bytes
+//that already hold their value are skipped without a write.
+void power_loss_tick()
+{
+    if (slot_pending && slot_moves_done())
+    {
+        slot_pending = false;
+        slot_left = sizeof(slot);
+        have_checkpoint = true;
+    }
+    while (eeprom_is_ready())
+    {
+        uint8_t *addr;
+        uint8_t value;
+        if (header_left)
+        {
+            uint8_t i = sizeof(header) - header_left--;
+            addr = HEADER_ADDR + i;
+            value = ((uint8_t*)&header)[i];
+        }
+        else if (slot_left)
+        {
+            uint8_t i = sizeof(slot) - slot_left--;
+            addr = slot_addr + i;
+            value = ((uint8_t*)&slot)[i];
+        }
+        else
+            return;
+        if (eeprom_read_byte(addr) != value)
+        {
+            eeprom_write_byte(addr, value);
+            return;
+        }
+    }
+}
+
+#endif //POWER_LOSS_RECOVERY
@@ -0,0 +1,39 @@
+#ifndef POWER_LOSS_H
+#define POWER_LOSS_H
+
+#ifdef POWER_LOSS_RECOVERY
+
+// longest path of a file that can be resumed, the terminating 0 included
+#define POWER_LOSS_PATH_LENGTH 48
+
+// Where the commands of an SD print up to a layer change leave the printer,
+// enough to go on from file_pos after a power loss.
+struct power_loss_state
+{
+  uint32_t file_pos;            // position in the file after the last executed command
+  float position[NUM_AXIS];
+  float feedrate;               // mm/min
+  int target_temperature[EXTRUDERS];
+  int target_temperature_bed;
+  int fan_speed;
+  int feedmultiply;
+  uint8_t active_extruder;
+  bool relative_mode;
+  bool relative_e;
+  #ifdef ENABLE_AUTO_BED_LEVELING
+  float bed_level[9];           // plan_bed_level_matrix, the G28 of the resume resets it
+  #endif
+};
+
+void power_loss_init();
+void power_loss_start(const char *path);
+bool power_loss_due(float z, float e);
+void power_loss_save(const power_loss_state &state);
+void power_loss_clear();
+const char *power_loss_load(power_loss_state &state);
+void power_loss_report();
+void power_loss_tick();
+
+#endif //POWER_LOSS_RECOVERY
+
+#endif//POWER_LOSS_H
@@ -0,0 +1,17 @@
+/*
+  Print.h - the part of the Arduino Print class SdFile derives from
+*/
+
+#ifndef sim_Print_h
+#define sim_Print_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+class Print
+{
+  public:
+    virtual size_t write(uint8_t) = 0;
+};
+
+#endif
@@ -0,0 +1 @@
+// SPI is not simulated
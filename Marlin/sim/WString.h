@@ -0,0 +1,21 @@
+/*
+  WString.h - minimal String for the simulated sources, which only ever print it
+*/
+
+#ifndef sim_WString_h
+#define sim_WString_h
+
+#include <string.h>
+
+class String
+{
+  public:
+    String(const char *s = "") : str(s) {}
+    unsigned int length(void) const { return strlen(str); }
+    char operator[](unsigned int index) const { return str[index]; }
+
+  private:
+    const char *str;
+};
+
+#endif
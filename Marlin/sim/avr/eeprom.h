@@ -0,0 +1,14 @@
+#ifndef sim_avr_eeprom_h
+#define sim_avr_eeprom_h
+
+#include <stdint.h>
+
+// 4k of erased EEPROM, lost when the simulator exits unless it is kept with -e.
+// Writes take as long as on the chip: eeprom_is_ready() is false meanwhile.
+bool eeprom_is_ready();
+uint8_t eeprom_read_byte(const uint8_t *addr);
+void eeprom_write_byte(uint8_t *addr, uint8_t value);
+uint32_t eeprom_read_dword(const uint32_t *addr);
+void eeprom_write_dword(uint32_t *addr, uint32_t value);
+
+#endif
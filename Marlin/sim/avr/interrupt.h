@@ -0,0 +1,12 @@
+#ifndef sim_avr_interrupt_h
+#define sim_avr_interrupt_h
+
+#include "io.h"
+
+#define ISR(vect) extern "C" void vect(void)
+#define SIGNAL(vect) ISR(vect)
+// SREG_I is honoured: the simulator does not run ISRs while it is clear
+#define cli() do { SREG &= ~(1<<SREG_I); } while (0)
+#define sei() do { SREG |= (1<<SREG_I); } while (0)
+
+#endif
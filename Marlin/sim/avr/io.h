@@ -0,0 +1,130 @@
+/*
+  avr/io.h - register stand-ins for the host simulation build
+  Only the registers the simulated sources touch are declared. They are plain
+  variables; the ones with side effects (UDR0, SPDR) are small wrapper types.
+*/
+
+#ifndef sim_avr_io_h
+#define sim_avr_io_h
+
+#include <stdint.h>
+#include "../sim.h"
+
+#define _BV(bit) (1 << (bit))
+#define _SFR_BYTE(sfr) (sfr)
+
+extern volatile uint8_t SREG, MCUSR;
+#define SREG_I 7
+
+// timers
+extern volatile uint8_t TCCR0A, TCCR0B, TIMSK0, OCR0A, OCR0B;
+extern volatile uint8_t TCCR1A, TCCR1B, TCCR1C, TIMSK1, TIFR1;
+extern volatile uint16_t OCR1A, OCR1B, TCNT1;
+extern volatile uint8_t TCCR2A, TCCR2B, TCCR3A, TCCR3B, TCCR4A, TCCR4B, TCCR5A, TCCR5B;
+
+#define CS00 0
+#define CS01 1
+#define CS02 2
+#define WGM00 0
+#define WGM01 1
+#define WGM02 3
+#define OCIE0A 1
+#define OCIE0B 2
+#define CS10 0
+#define CS11 1
+#define CS12 2
+#define WGM10 0
+#define WGM11 1
+#define WGM12 3
+#define WGM13 4
+#define COM1A0 6
+#define COM1A1 7
+#define COM1B0 4
+#define COM1B1 5
+#define OCIE1A 1
+#define CS20 0
+#define CS21 1
+#define CS22 2
+#define CS30 0
+#define CS31 1
+#define CS32 2
+#define CS40 0
+#define CS41 1
+#define CS42 2
+#define CS50 0
+#define CS51 1
+#define CS52 2
+
+// USART0, the only port MarlinSerial is built for in the simulation
+#define RXC0 7
+#define UDRE0 5
+#define U2X0 1
+#define RXEN0 4
+#define TXEN0 3
+#define RXCIE0 7
+#define UDRIE0 5
+
+struct sim_udr_t
+{
+  sim_udr_t &operator=(uint8_t c) { sim_serial_write(c); return *this; }
+  operator uint8_t() const { return 0; }
+};
+extern sim_udr_t UDR0;
+// UDRE follows the simulated line, received bytes are put in rx_buffer directly
+struct sim_ucsra_t
+{
+  uint8_t value;
+  sim_ucsra_t &operator=(uint8_t v) { value = v; return *this; }
+  operator uint8_t() const { return value | (sim_serial_ready() ? (1<<UDRE0) : 0); }
+};
+extern sim_ucsra_t UCSR0A;
+extern volatile uint8_t UCSR0B, UBRR0H, UBRR0L;
+
+// MarlinSerial.h tests for these with defined()
+#define UBRR0H UBRR0H
+#define UDR0 UDR0
+
+// SPI, every byte written to SPDR is exchanged with the SD card model in
+// sim_sd.cpp and the transfer is complete when the write returns
+#define SPR0 0
+#define SPR1 1
+#define CPHA 2
+#define CPOL 3
+#define MSTR 4
+#define DORD 5
+#define SPE 6
+#define SPIE 7
+#define SPI2X 0
+#define WCOL 6
+#define SPIF 7
+
+struct sim_spdr_t
+{
+  uint8_t value;
+  sim_spdr_t &operator=(uint8_t c) { value = sim_spi_transfer(c); return *this; }
+  operator uint8_t() const { return value; }
+};
+extern sim_spdr_t SPDR;
+struct sim_spsr_t
+{
+  uint8_t value;
+  sim_spsr_t &operator=(uint8_t v) { value = v; return *this; }
+  operator uint8_t() const { return value | (1<<SPIF); }
+};
+extern sim_spsr_t SPSR;
+extern volatile uint8_t SPCR;
+
+// ports, only Sd2PinMap.h takes their addresses
+extern volatile uint8_t DDRA, PINA, PORTA, DDRB, PINB, PORTB, DDRC, PINC, PORTC;
+extern volatile uint8_t DDRD, PIND, PORTD, DDRE, PINE, PORTE, DDRF, PINF, PORTF;
+extern volatile uint8_t DDRG, PING, PORTG, DDRH, PINH, PORTH, DDRJ, PINJ, PORTJ;
+extern volatile uint8_t DDRK, PINK, PORTK, DDRL, PINL, PORTL;
+
+// interrupt vectors are plain functions the simulator calls
+#define TIMER0_COMPA_vect sim_vect_TIMER0_COMPA
+#define TIMER0_COMPB_vect sim_vect_TIMER0_COMPB
+#define TIMER1_COMPA_vect sim_vect_TIMER1_COMPA
+#define USART0_RX_vect sim_vect_USART0_RX
+#define USART0_UDRE_vect sim_vect_USART0_UDRE
+
+#endif
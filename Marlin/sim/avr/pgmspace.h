@@ -0,0 +1,32 @@
+#ifndef sim_avr_pgmspace_h
+#define sim_avr_pgmspace_h
+
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+
+// program memory is ordinary memory on the host
+#define PROGMEM
+#define PGM_P const char *
+#define PSTR(s) (s)
+#define pgm_read_byte(addr) (*(const uint8_t *)(addr))
+#define pgm_read_byte_near(addr) pgm_read_byte(addr)
+#define pgm_read_word(addr) (*(const uint16_t *)(addr))
+#define pgm_read_word_near(addr) pgm_read_word(addr)
+#define pgm_read_dword(addr) (*(const uint32_t *)(addr))
+#define pgm_read_dword_near(addr) pgm_read_dword(addr)
+#define pgm_read_float(addr) (*(const float *)(addr))
+#define pgm_read_float_near(addr) pgm_read_float(addr)
+#define pgm_read_ptr(addr) (*(const void * const *)(addr))
+#define strcpy_P strcpy
+#define strncpy_P strncpy
+#define strcmp_P strcmp
+#define strncmp_P strncmp
+#define strcasecmp_P strcasecmp
+#define strlen_P strlen
+#define strstr_P strstr
+#define strchr_P strchr
+#define memcpy_P memcpy
+#define sprintf_P sprintf
+
+#endif
@@ -0,0 +1,9 @@
+#ifndef sim_avr_wdt_h
+#define sim_avr_wdt_h
+
+#define WDTO_4S 8
+#define wdt_reset() do {} while (0)
+#define wdt_enable(t) do {} while (0)
+#define wdt_disable() do {} while (0)
+
+#endif
@@ -0,0 +1,99 @@
+/*
+  parse_test.cpp - parse_float() and parse_long() against the C library
+  Part of Marlin
+
+  The command path parses numbers with parse_float() and parse_long() instead
+  of strtod() and strtol(). They are meant to give the same value bit for bit,
+  which is checked here on edge cases and on random numbers in the forms
+  slicers write. The reference for floats is strtof(), correctly rounded to
+  single precision as the AVR strtod() is. The first differences are printed
+  and the exit status is 1 if there is any.
+
+  usage: marlin_sim -T
+         make test HARDWARE_MOTHERBOARD=80
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "Marlin.h"
+
+// Marlin_main.cpp, not part of Marlin.h
+float parse_float(const char *p);
+long parse_long(const char *p);
+
+static const char *const edge_cases[] = {
+  // signs and blanks
+  "0", "-0", "+0", "1", "-1", "+1", " 12.5", "\t-7", "  +3.25",
+  // points
+  ".5", "-.5", "+.5", "5.", "-5.", ".", "-.", "+.", "0.", ".0", "1.2.3",
+  // digits: up to 9 are parsed here, more go to strtod()
+  "0.1", "0.2", "0.3", "99.999", "3.14159", "123456789", "12345678.9",
+  "0.123456789", "1234567890", "0.0000000001", "000000001", "0000000001",
+  // the 2^24 mantissa cap
+  "16777215", "16777216", "16777217", "-16777216", "1677721.6", "1677721.7",
+  "16.777216", "16.777217", "0.16777216", "0.16777217",
+  // exponents, hex, inf/nan and no number at all go to strtod()
+  "1e3", "1E3", "1.5e-2", "-2e+1", ".5e1", "1e", "0x1A", "0X1a", "inf",
+  "-nan", "", "-", "+", "X10", "*12",
+  // what follows the number in a command
+  "10*73", "-1.5 Y2", "7;comment", "2\n",
+  // integers for parse_long(), N and checksum values
+  "2147483647", "-2147483648", "123.9", "-123.9", "0012", "65535",
+};
+
+static long failures = 0;
+
+static void check(const char *s)
+{
+  float got = parse_float(s), want = strtof(s, NULL);
+  if(memcmp(&got, &want, sizeof(float)) != 0 && !(got != got && want != want)) {
+    if(failures < 20)
+      fprintf(stderr, "parse_float(\"%s\") = %.9g, strtof() = %.9g\n", s, (double)got, (double)want);
+    failures++;
+  }
+  long got_long = parse_long(s), want_long = strtol(s, NULL, 10);
+  if(got_long != want_long) {
+    if(failures < 20)
+      fprintf(stderr, "parse_long(\"%s\") = %ld, strtol() = %ld\n", s, got_long, want_long);
+    failures++;
+  }
+}
+
+// A sign, 1 to 10 digits and maybe a point somewhere, like "-12.345"
+static void random_number(char *s)
+{
+  int digits = 1 + rand() % 10;
+  int point = rand() % (digits + 2) - 1; // digits before the point, -1 for none
+  char *p = s;
+  switch(rand() % 4) {
+    case 0: *p++ = '-'; break;
+    case 1: *p++ = '+'; break;
+  }
+  for(int i = 0; i < digits; i++) {
+    if(i == point)
+      *p++ = '.';
+    *p++ = '0' + rand() % 10;
+  }
+  if(point == digits)
+    *p++ = '.';
+  *p = 0;
+}
+
+int parse_test()
+{
+  long cases = 0;
+  for(unsigned i = 0; i < sizeof(edge_cases) / sizeof(edge_cases[0]); i++, cases++)
+    check(edge_cases[i]);
+
+  srand(1);
+  char s[16];
+  for(long i = 0; i < 1000000; i++, cases++) {
+    random_number(s);
+    check(s);
+  }
+
+  fprintf(stderr, "parse_float/parse_long: %ld cases, %ld failed\n", cases, failures);
+  return failures ? 1 : 0;
+}
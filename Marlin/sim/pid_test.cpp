@@ -0,0 +1,200 @@
+/*
+  pid_test.cpp - the fixed point heater PID against the float one
+  Part of Marlin
+
+  manage_heater() runs the PID of the hotends and the bed in fixed point, with
+  the arithmetic of pid_fixed.h. temperature.cpp needs the AVR ADC and does not
+  build on the host, so the two steps below follow manage_heater() line for
+  line: fixed_step() as it is now without the HEATER_MODEL feed-forward,
+  float_step() as it was before the fixed point PID. The gains are those of
+  Configuration.h and the example configurations, scaled with PID_dT as
+  scalePID_i() and scalePID_d() do.
+
+  - Fed the same noisy readings, the soft PWM values may differ by one step at
+    most. The readings are on the Q8 grid the fixed point PID works on, so
+    both take the same bang-bang/PID decisions.
+  - Closed over a heater model, the two PIDs settle within 0.05 degree of
+    each other.
+
+  usage: marlin_sim -T
+         make test HARDWARE_MOTHERBOARD=80
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "Marlin.h"
+#include "pid_fixed.h"
+
+#if defined(PIDTEMP) || defined(PIDTEMPBED)
+
+struct pid_gains {
+  const char *source;
+  float Kp, Ki, Kd;             // as in the configuration, I and D not yet scaled
+  bool bed;
+};
+
+static const pid_gains gain_sets[] = {
+  { "Configuration.h",           12.56,  0.57,   68.76, false },
+  { "Configuration.h Ultimaker", 22.2,   1.08,  114,    false },
+  { "Configuration.h MakerGear",  7.0,   0.1,    12,    false },
+  { "cfg_Q.h",                   12.15,  1.0,    37.02, false },
+  { "42/Configuration.h",        16.54,  0.81,   84.53, false },
+  { "Configuration.h bed",      124.55, 23.46,  165.29, true },
+  { "Configuration.h bed alt",   97.1,   1.41, 1675.16, true },
+  { "42/Configuration.h bed",   246.43, 14.35, 1057.96, true },
+};
+
+struct float_pid { float Kp, Ki, Kd, iState_max, iState, dState, dTerm; bool reset; };
+struct fixed_pid { int32_t Kp, Ki, Kd, iState_max, iState, dState, dTerm; bool reset; };
+
+static void float_init(float_pid &s, const pid_gains &g)
+{
+  s.Kp = g.Kp;
+  s.Ki = g.Ki * PID_dT;
+  s.Kd = g.Kd / PID_dT;
+  s.iState_max = PID_INTEGRAL_DRIVE_MAX / s.Ki;
+  s.iState = s.dState = s.dTerm = 0;
+  s.reset = false;
+}
+
+// as updatePID() sets the gains up
+static void fixed_init(fixed_pid &s, const pid_gains &g)
+{
+  s.Kp = to_q16(g.Kp);
+  s.Ki = to_q16(g.Ki * PID_dT);
+  s.Kd = to_q16(g.Kd / PID_dT);
+  s.iState_max = iState_max_q8(g.Ki * PID_dT);
+  s.iState = s.dState = s.dTerm = 0;
+  s.reset = false;
+}
+
+// The soft PWM value of a step of the float PID, only the hotend switches to
+// bang-bang outside PID_FUNCTIONAL_RANGE
+static int float_step(float_pid &s, float input, int target, bool bed)
+{
+  float error = target - input;
+  float output;
+  if(!bed && error > PID_FUNCTIONAL_RANGE) {
+    output = BANG_MAX;
+    s.reset = true;
+  }
+  else if(!bed && (error < -PID_FUNCTIONAL_RANGE || target == 0)) {
+    output = 0;
+    s.reset = true;
+  }
+  else {
+    if(s.reset) {
+      s.iState = 0;
+      s.reset = false;
+    }
+    float pTerm = s.Kp * error;
+    s.iState += error;
+    s.iState = constrain(s.iState, 0, s.iState_max);
+    float iTerm = s.Ki * s.iState;
+    s.dTerm = (s.Kd * (input - s.dState)) * (1.0 - K1) + (K1 * s.dTerm);
+    output = constrain(pTerm + iTerm - s.dTerm, 0, bed ? MAX_BED_POWER : PID_MAX);
+  }
+  s.dState = input;
+  return (int)output >> 1;
+}
+
+// The same step in fixed point
+static int fixed_step(fixed_pid &s, float input, int target, bool bed)
+{
+  int32_t input_q8 = (int32_t)(input * 256.0 + 0.5);
+  int32_t error = ((int32_t)target << 8) - input_q8;
+  int output;
+  if(!bed && error > PID_FUNCTIONAL_RANGE * 256L) {
+    output = BANG_MAX;
+    s.reset = true;
+  }
+  else if(!bed && (error < -PID_FUNCTIONAL_RANGE * 256L || target == 0)) {
+    output = 0;
+    s.reset = true;
+  }
+  else {
+    if(s.reset) {
+      s.iState = 0;
+      s.reset = false;
+    }
+    int32_t pTerm = mul_q16(s.Kp, error);
+    s.iState += error;
+    s.iState = constrain(s.iState, 0, s.iState_max);
+    int32_t iTerm = mul_q16(s.Ki, s.iState);
+    s.dTerm = mul_q16(K2_Q16, mul_q16(s.Kd, constrain(input_q8 - s.dState, -32767L, 32767L))) + mul_q16(K1_Q16, s.dTerm);
+    output = constrain(pTerm + iTerm - s.dTerm, 0, (bed ? MAX_BED_POWER : PID_MAX) * 256L) >> 8;
+  }
+  s.dState = input_q8;
+  return output >> 1;
+}
+
+// A heater at 25 degrees ambient, the bed slower than a hotend
+static float heater(float temp, int pwm, bool bed)
+{
+  float rise = bed ? 0.004 : 0.04, loss = bed ? 0.0005 : 0.004;
+  return temp + (pwm * rise - (temp - 25) * loss) * PID_dT * 3;
+}
+
+static int target_at(long k, bool bed)
+{
+  if(bed)
+    return k < 8000 ? 60 : (k < 14000 ? 90 : 50);
+  return k < 8000 ? 210 : (k < 14000 ? 240 : 200);
+}
+
+int pid_test()
+{
+  int failed = 0;
+  for(unsigned n = 0; n < sizeof(gain_sets) / sizeof(gain_sets[0]); n++) {
+    const pid_gains &g = gain_sets[n];
+    float_pid open_f, closed_f;
+    fixed_pid open_q, closed_q;
+    float_init(open_f, g);
+    float_init(closed_f, g);
+    fixed_init(open_q, g);
+    fixed_init(closed_q, g);
+
+    srand(1);
+    float temp_f = 25, temp_q = 25;
+    long differ = 0;
+    int worst_pwm = 0;
+    float worst_temp = 0;
+    for(long k = 0; k < 20000; k++) {
+      int target = target_at(k, g.bed);
+
+      // the readings of the float loop with some noise, rounded to Q8
+      float reading = floor((temp_f + ((rand() % 100) - 50) * 0.002) * 256.0 + 0.5) / 256.0;
+      int d = abs(float_step(open_f, reading, target, g.bed) - fixed_step(open_q, reading, target, g.bed));
+      if(d) {
+        differ++;
+        if(d > worst_pwm)
+          worst_pwm = d;
+      }
+
+      temp_f = heater(temp_f, float_step(closed_f, temp_f, target, g.bed), g.bed);
+      temp_q = heater(temp_q, fixed_step(closed_q, temp_q, target, g.bed), g.bed);
+      // give both time to get there after each change of target
+      if(k % 6000 > 2000 && fabs(temp_f - temp_q) > worst_temp)
+        worst_temp = fabs(temp_f - temp_q);
+    }
+
+    bool ok = worst_pwm <= 1 && worst_temp <= 0.05;
+    fprintf(stderr, "pid %s: P %.2f I %.2f D %.2f: %ld of 20000 outputs differ, by %d at most; "
+      "closed loops %.3f degrees apart at most%s\n", g.source, g.Kp, g.Ki, g.Kd, differ, worst_pwm,
+      worst_temp, ok ? "" : " FAILED");
+    if(!ok)
+      failed = 1;
+  }
+  return failed;
+}
+
+#else
+
+int pid_test()
+{
+  return 0;
+}
+
+#endif
@@ -0,0 +1 @@
+// pin to timer mapping is not needed by the simulation build
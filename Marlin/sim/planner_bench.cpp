@@ -0,0 +1,176 @@
+/*
+  planner_bench.cpp - planner throughput over a recorded move stream
+  Part of Marlin
+
+  Loads the G0/G1 moves of a G-code file and pushes them through
+  plan_buffer_line() as fast as the planner accepts them. The ring is kept one
+  block short of full by discarding the tail, as if the steppers were
+  infinitely fast. Each call pays for the setup of its block and for
+  planner_recalculate(), which only replans the blocks after
+  block_buffer_planned, those whose entry speeds can still change: the full
+  ring bounds that walk, the move stream decides how far it goes.
+  planner_recalculate() is also timed alone when the ring is full, right
+  after a block went in, over the same blocks with no speed left to change:
+  the cost of the walk without the trapezoids. The time is host time:
+  compare numbers between builds on the same machine, not against the AVR
+  cycle budget.
+
+  usage: marlin_sim -p passes file.gcode
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "Marlin.h"
+#include "planner.h"
+#include "temperature.h"
+
+struct bench_move {
+  float pos[NUM_AXIS];
+  float feedrate; // mm/s
+  bool set_position;
+};
+
+// planner.cpp, not part of planner.h
+void planner_recalculate();
+
+static const char bench_axis_codes[NUM_AXIS] = {'X', 'Y', 'Z', 'E'};
+static bench_move *moves = NULL;
+static long move_count = 0;
+
+static uint64_t now_ns()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void add_move(const float *pos, float feedrate, bool set_position)
+{
+  if((move_count & 1023) == 0)
+    moves = (bench_move *)realloc(moves, (move_count + 1024) * sizeof(bench_move));
+  bench_move *m = &moves[move_count++];
+  for(int i = 0; i < NUM_AXIS; i++)
+    m->pos[i] = pos[i];
+  m->feedrate = feedrate;
+  m->set_position = set_position;
+}
+
+// Absolute/relative positioning, M82/M83 and G92 are honoured, everything
+// else that is not a move is ignored.
+static void load_moves(FILE *f)
+{
+  char line[256];
+  float pos[NUM_AXIS] = { 0.0 };
+  float feedrate = 1500.0 / 60.0;
+  bool relative = false, relative_e = false;
+
+  while(fgets(line, sizeof(line), f)) {
+    char *comment = strchr(line, ';');
+    if(comment)
+      *comment = 0;
+    char *p = line;
+    while(*p == ' ' || *p == '\t')
+      p++;
+    if(*p == 'N') {
+      while(*p && *p != ' ')
+        p++;
+      while(*p == ' ')
+        p++;
+    }
+    int code = atoi(p + 1);
+    if(*p == 'M') {
+      if(code == 82) relative_e = false;
+      if(code == 83) relative_e = true;
+      continue;
+    }
+    if(*p != 'G')
+      continue;
+    if(code == 90) { relative = relative_e = false; continue; }
+    if(code == 91) { relative = relative_e = true; continue; }
+    if(code != 0 && code != 1 && code != 92)
+      continue;
+
+    bool moved = false;
+    for(int i = 0; i < NUM_AXIS; i++) {
+      char *v = strchr(p, bench_axis_codes[i]);
+      if(v == NULL)
+        continue;
+      float value = strtod(v + 1, NULL);
+      if(code == 92)
+        pos[i] = value;
+      else if(i == E_AXIS ? relative_e : relative)
+        pos[i] += value;
+      else
+        pos[i] = value;
+      moved = true;
+    }
+    char *fr = strchr(p, 'F');
+    if(fr && code != 92)
+      feedrate = strtod(fr + 1, NULL) / 60.0;
+    if(code == 92 || moved)
+      add_move(pos, feedrate, code == 92);
+  }
+}
+
+int planner_bench(FILE *f, int passes)
+{
+  load_moves(f);
+  if(move_count == 0) {
+    fprintf(stderr, "no moves\n");
+    return 1;
+  }
+
+  // keep the cold extrusion check from dropping E
+  for(int e = 0; e < EXTRUDERS; e++)
+    current_temperature[e] = target_temperature[e] = 210;
+
+  uint64_t total_ns = 0, worst_ns = 0, recalc_ns = 0;
+  long blocks = 0, recalcs = 0;
+  for(int pass = 0; pass < passes; pass++) {
+    plan_set_position(moves[0].pos[X_AXIS], moves[0].pos[Y_AXIS], moves[0].pos[Z_AXIS], moves[0].pos[E_AXIS]);
+    for(long i = 0; i < move_count; i++) {
+      bench_move *m = &moves[i];
+      if(m->set_position) {
+        plan_set_position(m->pos[X_AXIS], m->pos[Y_AXIS], m->pos[Z_AXIS], m->pos[E_AXIS]);
+        continue;
+      }
+      if(((block_buffer_head + 1) & (BLOCK_BUFFER_SIZE - 1)) == block_buffer_tail)
+        plan_discard_current_block();
+
+      uint64_t start = now_ns();
+      plan_buffer_line(m->pos[X_AXIS], m->pos[Y_AXIS], m->pos[Z_AXIS], m->pos[E_AXIS], m->feedrate, 0);
+      uint64_t t = now_ns() - start;
+      total_ns += t;
+      if(t > worst_ns)
+        worst_ns = t;
+      blocks++;
+
+      // the recalculation alone, over the blocks it just replanned
+      if(movesplanned() == BLOCK_BUFFER_SIZE - 1) {
+        start = now_ns();
+        planner_recalculate();
+        recalc_ns += now_ns() - start;
+        recalcs++;
+      }
+    }
+    while(blocks_queued())
+      plan_discard_current_block();
+  }
+
+  fprintf(stderr, "BLOCK_BUFFER_SIZE %d", BLOCK_BUFFER_SIZE);
+  #ifdef ENABLE_AUTO_BED_LEVELING
+    fprintf(stderr, ", ENABLE_AUTO_BED_LEVELING");
+  #endif
+  #ifdef COREXY
+    fprintf(stderr, ", COREXY");
+  #endif
+  fprintf(stderr, ": %ld moves x %d passes, %ld blocks\n", move_count, passes, blocks);
+  fprintf(stderr, "  plan_buffer_line: %.3f us/block, worst %.3f us\n",
+    blocks ? total_ns / 1000.0 / blocks : 0.0, worst_ns / 1000.0);
+  fprintf(stderr, "  planner_recalculate (full ring, replanned again): %.3f us\n",
+    recalcs ? recalc_ns / 1000.0 / recalcs : 0.0);
+  free(moves);
+  return 0;
+}
@@ -0,0 +1,46 @@
+/*
+  sim.h - host simulation hooks
+  Part of Marlin
+
+  The simulation build ("make sim") compiles the command path, the planner and
+  the step ISR for the build machine. These hooks replace the hardware the
+  firmware would otherwise talk to: pin writes are traced, the timer1 compare
+  ISR is driven from a simulated clock, serial input is fed from a file and
+  the SPI bus ends at a simulated SD card.
+*/
+
+#ifndef sim_h
+#define sim_h
+
+#include <stdint.h>
+#include <stdio.h>
+
+// simulated clock in timer1 ticks (F_CPU/8)
+extern uint64_t sim_ticks;
+
+void sim_write_pin(uint8_t pin, bool v);
+bool sim_read_pin(uint8_t pin);
+void sim_serial_write(uint8_t c);
+// state of the UDRE flag, polling it while it is clear costs simulated time
+bool sim_serial_ready();
+
+// runs the step ISR and the serial line until the clock has advanced by us
+void sim_advance(unsigned long us);
+
+// SD card, see sim_sd.cpp
+uint8_t sim_spi_transfer(uint8_t b);
+void sim_sd_select(bool select);
+void sim_sd_add_file(const char *path);
+void sim_sd_fragment();
+void sim_sd_insert();
+void sim_sd_dump(const char *path);
+void sim_sd_report(FILE *f);
+
+// planner throughput benchmark, see planner_bench.cpp
+int planner_bench(FILE *f, int passes);
+
+// host checks of firmware functions, see parse_test.cpp and pid_test.cpp
+int parse_test();
+int pid_test();
+
+#endif
@@ -0,0 +1,862 @@
+/*
+  sim_main.cpp - host simulation of the command path, planner and step ISR
+  Part of Marlin
+
+  Replays a G-code file through the serial command path the way a host would
+  (one line in flight, next line sent on "ok", bytes paced at BAUDRATE) and
+  runs the timer1 compare ISR from a simulated clock. Every step and direction
+  edge can be written to a trace file and every executed block to a block
+  summary, so motion changes can be compared without printing parts.
+
+  usage: marlin_sim [-t trace.txt] [-b blocks.txt] [-l loop_us] [-w window] [-B]
+                    [-s sdfile.gco]... [-F] [-d card.img] [-e eeprom.bin]
+                    [-P seconds] file.gcode
+         marlin_sim -p passes file.gcode
+         marlin_sim -T
+
+  -l  cost of one pass through loop() in microseconds (default 1000)
+  -w  number of unacknowledged lines the host keeps in flight (default 1)
+  -B  send M620 S1 and then every line as a binary frame (BINARY_TRANSPORT),
+      the lines between M28 and M29 as file frames
+  -s  put a file on the SD card, file.gcode can then print it with M23/M24,
+      a name that is not 8.3 gets a long name as well
+  -F  fragment the files on the SD card, see sim_sd.cpp
+  -d  write the SD card image to card.img at the end, e.g. to check files
+      saved with M28
+  -e  keep the EEPROM in eeprom.bin: read at the start, written through
+  -P  cut the power after that many simulated seconds, e.g. to resume the
+      SD print with M1000 in a second run with the same -e and -s
+  -p  time plan_buffer_line() over the moves of the file instead, see
+      planner_bench.cpp and "make bench"
+  -T  run the host checks instead: the number parser against the C library
+      and the fixed point heater PID against the float one, see
+      parse_test.cpp, pid_test.cpp and "make test"
+
+  Replies leave at BAUDRATE too; time the firmware spends polling a busy
+  transmitter is reported.
+
+  Heaters reach their target instantly and there is no LCD. The SD card is
+  there in builds with SIM_SDSUPPORT only (make sim DEFINES=SIM_SDSUPPORT);
+  the run then lasts until the SD print is done as well.
+*/
+
+#include <stdio.h>
+#include <unistd.h>
+
+#include "Marlin.h"
+#include "planner.h"
+#include "stepper.h"
+#include "temperature.h"
+#include "cardreader.h"
+
+// F_CPU/8 timer1 ticks per microsecond
+#define TICKS_PER_US (F_CPU/8000000UL)
+// one byte on the serial line, start and stop bit included
+#define BYTE_TICKS ((10UL * F_CPU / 8) / BAUDRATE)
+
+//===========================================================================
+//=============================public variables=============================
+//===========================================================================
+
+uint64_t sim_ticks = 0;
+
+// register stand-ins, see sim/avr/io.h
+volatile uint8_t SREG, MCUSR;
+volatile uint8_t TCCR0A, TCCR0B, TIMSK0, OCR0A, OCR0B;
+volatile uint8_t TCCR1A, TCCR1B, TCCR1C, TIMSK1, TIFR1;
+volatile uint16_t OCR1A, OCR1B, TCNT1;
+volatile uint8_t TCCR2A, TCCR2B, TCCR3A, TCCR3B, TCCR4A, TCCR4B, TCCR5A, TCCR5B;
+sim_udr_t UDR0;
+sim_ucsra_t UCSR0A;
+volatile uint8_t UCSR0B, UBRR0H, UBRR0L;
+
+// avr-libc heap symbols read by freeMemory()
+extern "C" {
+  unsigned int __bss_end;
+  void *__brkval;
+}
+
+// temperature.h, the heaters are ideal
+int target_temperature[EXTRUDERS] = { 0 };
+float current_temperature[EXTRUDERS] = { 0.0 };
+int target_temperature_bed = 0;
+float current_temperature_bed = 0.0;
+#if defined(CONTROLLERFAN_PIN) && CONTROLLERFAN_PIN > -1
+  unsigned char soft_pwm_bed;
+#endif
+#ifdef PIDTEMP
+  float Kp[EXTRUDERS]={DEFAULT_Kp};
+  float Ki[EXTRUDERS]={DEFAULT_Ki*PID_dT};
+  float Kd[EXTRUDERS]={DEFAULT_Kd/PID_dT};
+  #ifdef PID_ADD_EXTRUSION_RATE
+    float Kc[EXTRUDERS]={DEFAULT_Kc};
+  #endif
+#endif
+#ifdef PIDTEMPBED
+  float bedKp=DEFAULT_bedKp;
+  float bedKi=(DEFAULT_bedKi*PID_dT);
+  float bedKd=(DEFAULT_bedKd/PID_dT);
+#endif
+#ifdef HEATER_MODEL
+  heater_model hotend_model[EXTRUDERS];
+  #ifdef PIDTEMPBED
+    heater_model bed_model;
+  #endif
+#endif
+
+//===========================================================================
+//=============================private variables=============================
+//===========================================================================
+
+void setup();
+void loop();
+extern ring_buffer rx_buffer;
+extern "C" void TIMER1_COMPA_vect(void);
+#if TX_BUFFER_SIZE > 0
+extern "C" void USART0_UDRE_vect(void);
+#endif
+
+static unsigned long loop_us = 1000;
+static int host_window = 1;
+static bool host_binary = false;
+static int bench_passes = 0;
+
+static FILE *gcode_file = NULL;
+static FILE *trace_file = NULL;
+static FILE *block_file = NULL;
+#ifdef SDSUPPORT
+static const char *card_dump = NULL; // -d
+#endif
+static FILE *eeprom_file = NULL;
+static uint64_t power_off_tick = 0; // -P, 0 if the power stays on
+
+// host side of the serial line, a text line or a frame
+static char host_line[MAX_CMD_SIZE + 8];
+static int host_line_len = 0;
+static int host_line_pos = 0;
+static bool host_eof = false;
+static bool host_sync = false; // the last line sent has to be answered before the next one goes
+static long lines_sent = 0;
+static long lines_acked = 0;
+static uint64_t last_ack_tick = 0;
+static long host_bytes = 0;
+static long rx_overruns = 0;
+static uint64_t next_rx_tick = 0;
+static char reply[8];
+static int reply_len = 0;
+
+// transmitter: the byte in the shift register is done at tx_shift_end, UDR
+// is free again once at most one byte is left to shift out
+static uint64_t tx_shift_end = 0;
+static uint64_t tx_wait_ticks = 0;
+
+// step ISR
+static bool isr_enabled = false;
+static uint64_t next_isr_tick = 0;
+static uint8_t pin_state[256];
+
+// carriage position in steps, unaffected by G92 and homing
+static long machine_position[NUM_AXIS] = { 0 };
+
+// statistics
+static long steps[NUM_AXIS] = { 0 };
+static uint64_t last_step_tick[NUM_AXIS] = { 0 };
+static uint64_t min_step_interval[NUM_AXIS] = { 0 };
+static uint64_t last_isr_tick = 0;
+static uint64_t min_isr_interval = 0;
+static bool was_moving = false;
+static long blocks_done = 0;
+static long underruns = 0;
+static uint64_t starved_ticks = 0;
+static int8_t logged_block = -1;
+static uint64_t block_start_tick = 0;
+static uint64_t last_block_end_tick = 0;
+static uint64_t eeprom_ready_tick = 0;
+static uint64_t eeprom_wait_ticks = 0;
+static long eeprom_writes = 0;
+
+static const char axis_codes[NUM_AXIS] = {'X', 'Y', 'Z', 'E'};
+
+static void power_off();
+
+//===========================================================================
+//=============================functions         ============================
+//===========================================================================
+
+static void print_time(FILE *f, uint64_t ticks)
+{
+  fprintf(f, "%llu.%01llu", (unsigned long long)(ticks / TICKS_PER_US),
+    (unsigned long long)((ticks % TICKS_PER_US) * 10 / TICKS_PER_US));
+}
+
+static int step_axis(uint8_t pin)
+{
+  if(pin == X_STEP_PIN) return X_AXIS;
+  if(pin == Y_STEP_PIN) return Y_AXIS;
+  if(pin == Z_STEP_PIN) return Z_AXIS;
+  if(pin == E0_STEP_PIN) return E_AXIS;
+  #if EXTRUDERS > 1
+  if(pin == E1_STEP_PIN) return E_AXIS;
+  #endif
+  #if EXTRUDERS > 2
+  if(pin == E2_STEP_PIN) return E_AXIS;
+  #endif
+  return -1;
+}
+
+static int dir_axis(uint8_t pin)
+{
+  if(pin == X_DIR_PIN) return X_AXIS;
+  if(pin == Y_DIR_PIN) return Y_AXIS;
+  if(pin == Z_DIR_PIN) return Z_AXIS;
+  if(pin == E0_DIR_PIN) return E_AXIS;
+  #if EXTRUDERS > 1
+  if(pin == E1_DIR_PIN) return E_AXIS;
+  #endif
+  #if EXTRUDERS > 2
+  if(pin == E2_DIR_PIN) return E_AXIS;
+  #endif
+  return -1;
+}
+
+static bool step_level(int axis)
+{
+  switch(axis) {
+    case X_AXIS: return !INVERT_X_STEP_PIN;
+    case Y_AXIS: return !INVERT_Y_STEP_PIN;
+    case Z_AXIS: return !INVERT_Z_STEP_PIN;
+    default: return !INVERT_E_STEP_PIN;
+  }
+}
+
+static bool dir_positive(int axis)
+{
+  switch(axis) {
+    case X_AXIS: return pin_state[X_DIR_PIN] != INVERT_X_DIR;
+    case Y_AXIS: return pin_state[Y_DIR_PIN] != INVERT_Y_DIR;
+    case Z_AXIS: return pin_state[Z_DIR_PIN] != INVERT_Z_DIR;
+    default: return pin_state[E0_DIR_PIN] != INVERT_E0_DIR;
+  }
+}
+
+void sim_write_pin(uint8_t pin, bool v)
+{
+  #ifdef SDSUPPORT
+  if(pin == SDSS)
+    sim_sd_select(!v);
+  #endif
+  bool changed = pin_state[pin] != v;
+  pin_state[pin] = v;
+  if(!changed)
+    return;
+
+  int axis = step_axis(pin);
+  if(axis >= 0 && v == step_level(axis)) {
+    steps[axis]++;
+    machine_position[axis] += dir_positive(axis) ? 1 : -1;
+    uint64_t interval = sim_ticks - last_step_tick[axis];
+    if(steps[axis] > 1 && interval > 0 && (min_step_interval[axis] == 0 || interval < min_step_interval[axis]))
+      min_step_interval[axis] = interval;
+    last_step_tick[axis] = sim_ticks;
+    if(trace_file) {
+      print_time(trace_file, sim_ticks);
+      fprintf(trace_file, " %c S\n", axis_codes[axis]);
+    }
+    return;
+  }
+
+  axis = dir_axis(pin);
+  if(axis >= 0 && trace_file) {
+    print_time(trace_file, sim_ticks);
+    fprintf(trace_file, " %c D %d\n", axis_codes[axis], v ? 1 : 0);
+  }
+}
+
+// Endstops close when the carriage reaches the configured travel limits, so
+// homing and probing behave like on a machine with a flat bed.
+#define SIM_MIN_ENDSTOP(PIN, AXIS, POS, INVERTING) \
+  if(pin == PIN) return (machine_position[AXIS] <= lround(POS * axis_steps_per_unit[AXIS])) != INVERTING;
+#define SIM_MAX_ENDSTOP(PIN, AXIS, POS, INVERTING) \
+  if(pin == PIN) return (machine_position[AXIS] >= lround(POS * axis_steps_per_unit[AXIS])) != INVERTING;
+
+bool sim_read_pin(uint8_t pin)
+{
+  #if defined(X_MIN_PIN) && X_MIN_PIN > -1
+  SIM_MIN_ENDSTOP(X_MIN_PIN, X_AXIS, X_MIN_POS, X_MIN_ENDSTOP_INVERTING)
+  #endif
+  #if defined(X_MAX_PIN) && X_MAX_PIN > -1
+  SIM_MAX_ENDSTOP(X_MAX_PIN, X_AXIS, X_MAX_POS, X_MAX_ENDSTOP_INVERTING)
+  #endif
+  #if defined(Y_MIN_PIN) && Y_MIN_PIN > -1
+  SIM_MIN_ENDSTOP(Y_MIN_PIN, Y_AXIS, Y_MIN_POS, Y_MIN_ENDSTOP_INVERTING)
+  #endif
+  #if defined(Y_MAX_PIN) && Y_MAX_PIN > -1
+  SIM_MAX_ENDSTOP(Y_MAX_PIN, Y_AXIS, Y_MAX_POS, Y_MAX_ENDSTOP_INVERTING)
+  #endif
+  #if defined(Y2_MIN_PIN) && Y2_MIN_PIN > -1
+  SIM_MIN_ENDSTOP(Y2_MIN_PIN, Y_AXIS, Y_MIN_POS, Y_MIN_ENDSTOP_INVERTING)
+  #endif
+  #if defined(Y2_MAX_PIN) && Y2_MAX_PIN > -1
+  SIM_MAX_ENDSTOP(Y2_MAX_PIN, Y_AXIS, Y_MAX_POS, Y_MAX_ENDSTOP_INVERTING)
+  #endif
+  #if defined(Z_MIN_PIN) && Z_MIN_PIN > -1
+  SIM_MIN_ENDSTOP(Z_MIN_PIN, Z_AXIS, Z_MIN_POS, Z_MIN_ENDSTOP_INVERTING)
+  #endif
+  #if defined(Z_MAX_PIN) && Z_MAX_PIN > -1
+  SIM_MAX_ENDSTOP(Z_MAX_PIN, Z_AXIS, Z_MAX_POS, Z_MAX_ENDSTOP_INVERTING)
+  #endif
+  return pin_state[pin];
+}
+
+// Firmware output goes to stdout, the host watches it for "ok".
+void sim_serial_write(uint8_t c)
+{
+  tx_shift_end = (tx_shift_end > sim_ticks ? tx_shift_end : sim_ticks) + BYTE_TICKS;
+  putchar(c);
+  if(c == '\n') {
+    // M29 answers with "Done saving file." instead of "ok"
+    if((reply_len >= 2 && reply[0] == 'o' && reply[1] == 'k') || (reply_len == sizeof(reply) && memcmp(reply, "Done sav", 8) == 0)) {
+      lines_acked++;
+      last_ack_tick = sim_ticks;
+    }
+    reply_len = 0;
+  }
+  else if(reply_len < (int)sizeof(reply))
+    reply[reply_len++] = c;
+}
+
+bool sim_serial_ready()
+{
+  if(tx_shift_end <= sim_ticks + BYTE_TICKS)
+    return true;
+  // the firmware is busy waiting on the line, let time and interrupts pass
+  uint64_t start = sim_ticks;
+  sim_advance(1);
+  tx_wait_ticks += sim_ticks - start;
+  return tx_shift_end <= sim_ticks + BYTE_TICKS;
+}
+
+#ifdef BINARY_TRANSPORT
+static unsigned short host_crc16(const char *p, int len)
+{
+  unsigned short crc = 0xffff;
+  while(len--) {
+    crc ^= (unsigned char)*p++ << 8;
+    for(int i = 0; i < 8; i++)
+      crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+  }
+  return crc;
+}
+
+// Puts the frame with op and payload into host_line.
+static void host_frame(char op, const char *payload, int len)
+{
+  static unsigned char seq = 0;
+  char *frame = host_line;
+  frame[0] = (char)0xa5;
+  frame[1] = ++seq;
+  frame[2] = op;
+  frame[3] = len;
+  memmove(frame + 4, payload, len);
+  unsigned short crc = host_crc16(frame + 1, 3 + len);
+  frame[4 + len] = crc >> 8;
+  frame[5 + len] = crc & 0xff;
+  host_line_len = 6 + len;
+}
+
+// Replaces the text line in host_line by its frame, see get_command(). Plain
+// G0/G1/G92 go as moves, anything else as text.
+static void host_frame_line()
+{
+  char text[MAX_CMD_SIZE + 2];
+  char *p = host_line, *q = text;
+  while(*p == ' ' || *p == '\t')
+    p++;
+  if(*p == 'N') {
+    while(*p && *p != ' ')
+      p++;
+    while(*p == ' ')
+      p++;
+  }
+  while(*p && *p != '\n' && *p != '\r' && *p != ';' && *p != '*')
+    *q++ = *p++;
+  while(q > text && q[-1] == ' ')
+    q--;
+  *q = 0;
+
+  int len = 0;
+  int code = text[0] == 'G' ? strtol(text + 1, &p, 10) : -1;
+  bool move = code == 0 || code == 1 || code == 92;
+  static const char frame_axes[] = "XYZEF";
+  unsigned char mask = 0;
+  char payload[MAX_CMD_SIZE];
+  while(move && *p) {
+    if(*p == ' ') {
+      p++;
+      continue;
+    }
+    const char *axis = strchr(frame_axes, *p);
+    if(axis == NULL || *axis == 0 || (mask & (1 << (axis - frame_axes)))) {
+      move = false;
+      break;
+    }
+    mask |= 1 << (axis - frame_axes);
+    strtod(p + 1, &p);
+  }
+  if(move) {
+    payload[len++] = mask;
+    for(int i = 0; i < 5; i++) {
+      if(!(mask & (1 << i)))
+        continue;
+      double v = strtod(strchr(text, frame_axes[i]) + 1, NULL);
+      long fixed = lround(v * 1000.0);
+      for(int b = 0; b < 4; b++)
+        payload[len++] = (char)(fixed >> (8 * b));
+    }
+  }
+  else {
+    len = strlen(text);
+    memcpy(payload, text, len);
+  }
+  host_frame(move ? (code == 92 ? 3 : code + 1) : 0, payload, len);
+}
+
+// Between M28 and M29 the lines of the file go as they are, packed into file
+// frames, as a host uploading the file would send them. False at the M29,
+// which is left in upload_line for host_read_line().
+static bool host_upload = false;
+static char upload_line[MAX_CMD_SIZE + 2];
+static int upload_len = 0;
+static int upload_pos = 0;
+
+static bool host_upload_frame()
+{
+  char payload[MAX_CMD_SIZE - 1];
+  int len = 0;
+  while(len < (int)sizeof(payload)) {
+    if(upload_pos == upload_len) {
+      upload_len = upload_pos = 0;
+      if(!fgets(upload_line, sizeof(upload_line), gcode_file))
+        break;
+      upload_len = strlen(upload_line);
+    }
+    if(upload_pos == 0 && strncmp(upload_line, "M29", 3) == 0)
+      break;
+    int n = upload_len - upload_pos;
+    if(n > (int)sizeof(payload) - len)
+      n = sizeof(payload) - len;
+    memcpy(payload + len, upload_line + upload_pos, n);
+    len += n;
+    upload_pos += n;
+  }
+  if(len == 0) {
+    host_upload = false;
+    return false;
+  }
+  host_frame(4, payload, len);
+  return true;
+}
+#endif
+
+static bool host_read_line()
+{
+  #ifdef BINARY_TRANSPORT
+  if(upload_len) {
+    strcpy(host_line, upload_line);
+    upload_len = upload_pos = 0;
+    return true;
+  }
+  #endif
+  return fgets(host_line, MAX_CMD_SIZE + 1, gcode_file) != NULL;
+}
+
+static bool host_next_line()
+{
+  #ifdef BINARY_TRANSPORT
+  static bool m620_sent = false;
+  if(host_binary && !m620_sent) {
+    strcpy(host_line, "M620 S1\n");
+    host_line_len = strlen(host_line);
+    host_line_pos = 0;
+    m620_sent = true;
+    host_sync = true;
+    return true;
+  }
+  if(host_upload && host_upload_frame()) {
+    host_line_pos = 0;
+    return true;
+  }
+  #endif
+  while(host_read_line()) {
+    char *p = host_line;
+    while(*p == ' ' || *p == '\t')
+      p++;
+    if(*p == ';' || *p == '\n' || *p == '\r' || *p == 0)
+      continue;
+    host_line_len = strlen(host_line);
+    if(host_line[host_line_len - 1] != '\n') {
+      host_line[host_line_len++] = '\n';
+      host_line[host_line_len] = 0;
+    }
+    // the lines after M28 only go to the file once it is open
+    host_sync = strncmp(p, "M28 ", 4) == 0;
+    #ifdef BINARY_TRANSPORT
+    if(host_binary) {
+      host_upload = host_sync;
+      host_frame_line();
+    }
+    #endif
+    host_line_pos = 0;
+    return true;
+  }
+  host_eof = true;
+  return false;
+}
+
+static bool host_pending()
+{
+  if(host_line_pos < host_line_len)
+    return true;
+  if(host_eof || lines_sent - lines_acked >= host_window)
+    return false;
+  // frames only after the "ok" of M620 S1
+  if(host_sync && lines_acked < lines_sent)
+    return false;
+  host_sync = false;
+  if(!host_next_line())
+    return false;
+  lines_sent++;
+  return true;
+}
+
+// moves still to come from the host or the card
+static bool feeding()
+{
+  return !host_eof || IS_SD_PRINTING;
+}
+
+// A byte arriving on a full ring would be lost on the real board, the host
+// model holds it back instead so a large window does not corrupt lines.
+static void host_send_byte()
+{
+  int i = (unsigned int)(rx_buffer.head + 1) % RX_BUFFER_SIZE;
+  next_rx_tick = sim_ticks + BYTE_TICKS;
+  if(i == rx_buffer.tail) {
+    rx_overruns++;
+    return;
+  }
+  rx_buffer.buffer[rx_buffer.head] = host_line[host_line_pos];
+  rx_buffer.head = i;
+  host_line_pos++;
+  host_bytes++;
+}
+
+static void log_block_end()
+{
+  block_t *block = &block_buffer[logged_block];
+  block_plan_t *plan = &block_plan[logged_block];
+  blocks_done++;
+  last_block_end_tick = sim_ticks;
+  if(block_file == NULL)
+    return;
+  print_time(block_file, block_start_tick);
+  fputc(' ', block_file);
+  print_time(block_file, sim_ticks);
+  fprintf(block_file, " %ld %ld %ld %ld %lu %.3f %.2f %.2f %.2f %lu %lu %lu %ld %ld\n",
+    (long)block->steps_x, (long)block->steps_y, (long)block->steps_z, (long)block->steps_e,
+    (unsigned long)block->step_event_count,
+    plan->millimeters, plan->entry_speed, plan->nominal_speed, plan->max_entry_speed,
+    (unsigned long)block->initial_rate, (unsigned long)block->nominal_rate, (unsigned long)block->final_rate,
+    (long)block->accelerate_until, (long)block->decelerate_after);
+}
+
+static void run_step_isr()
+{
+  if(blocks_queued()) {
+    if(last_isr_tick != 0) {
+      uint64_t interval = sim_ticks - last_isr_tick;
+      if(min_isr_interval == 0 || interval < min_isr_interval)
+        min_isr_interval = interval;
+    }
+    last_isr_tick = sim_ticks;
+  }
+  else
+    last_isr_tick = 0;
+
+  SREG &= ~(1<<SREG_I);
+  TIMER1_COMPA_vect();
+  SREG |= (1<<SREG_I);
+
+  if(logged_block >= 0 && (!blocks_queued() || logged_block != block_buffer_tail)) {
+    log_block_end();
+    logged_block = -1;
+  }
+  if(blocks_queued() && block_buffer[block_buffer_tail].busy && logged_block != block_buffer_tail) {
+    logged_block = block_buffer_tail;
+    block_start_tick = sim_ticks;
+  }
+
+  // the ring ran dry while the host or the card still had moves to send
+  bool moving = blocks_queued();
+  if(was_moving && !moving && feeding())
+    underruns++;
+  was_moving = moving;
+
+  next_isr_tick = sim_ticks + (OCR1A ? OCR1A : 1);
+}
+
+void sim_advance(unsigned long us)
+{
+  uint64_t end = sim_ticks + (uint64_t)us * TICKS_PER_US;
+  while(sim_ticks < end) {
+    if(power_off_tick && sim_ticks >= power_off_tick)
+      power_off();
+    bool enabled = (TIMSK1 & (1<<OCIE1A)) != 0;
+    if(enabled && !isr_enabled)
+      next_isr_tick = sim_ticks + OCR1A;
+    isr_enabled = enabled;
+
+    // nothing interrupts a running ISR or a cli() section
+    bool interrupts = (SREG & (1<<SREG_I)) != 0;
+    bool step_isr = interrupts && isr_enabled;
+    #if TX_BUFFER_SIZE > 0
+      bool udre_isr = interrupts && (UCSR0B & (1<<UDRIE0)) != 0;
+      uint64_t tx_free_tick = tx_shift_end > BYTE_TICKS ? tx_shift_end - BYTE_TICKS : 0;
+    #endif
+
+    bool rx = host_pending();
+    uint64_t next = end;
+    if(step_isr && next_isr_tick < next)
+      next = next_isr_tick;
+    #if TX_BUFFER_SIZE > 0
+      if(udre_isr && tx_free_tick < next)
+        next = tx_free_tick;
+    #endif
+    if(rx && next_rx_tick < next)
+      next = next_rx_tick;
+    if(next < sim_ticks)
+      next = sim_ticks;
+    if(!blocks_queued() && feeding())
+      starved_ticks += next - sim_ticks;
+    sim_ticks = next;
+
+    if(rx && next_rx_tick <= sim_ticks)
+      host_send_byte();
+    if(step_isr && next_isr_tick <= sim_ticks)
+      run_step_isr();
+    #if TX_BUFFER_SIZE > 0
+      if(udre_isr && tx_free_tick <= sim_ticks) {
+        SREG &= ~(1<<SREG_I);
+        USART0_UDRE_vect();
+        SREG |= (1<<SREG_I);
+      }
+    #endif
+  }
+}
+
+//===========================================================================
+//=============================Arduino core======================================
+//===========================================================================
+
+void pinMode(uint8_t pin, uint8_t mode) {}
+void digitalWrite(uint8_t pin, uint8_t val) { sim_write_pin(pin, val); }
+int digitalRead(uint8_t pin) { return sim_read_pin(pin); }
+int analogRead(uint8_t pin) { return 0; }
+void analogWrite(uint8_t pin, int val) {}
+unsigned long millis(void) { return sim_ticks / (TICKS_PER_US * 1000UL); }
+unsigned long micros(void) { return sim_ticks / TICKS_PER_US; }
+void delay(unsigned long ms) { sim_advance(ms * 1000UL); }
+void delayMicroseconds(unsigned int us) { sim_advance(us); }
+void tone(uint8_t pin, unsigned int frequency, unsigned long duration) {}
+void noTone(uint8_t pin) {}
+
+static uint8_t eeprom[4096];
+
+// a byte takes 3.4 ms to program, eeprom_write_byte() waits for the one before
+#define EEPROM_WRITE_US 3400
+
+bool eeprom_is_ready() { return sim_ticks >= eeprom_ready_tick; }
+uint8_t eeprom_read_byte(const uint8_t *addr) { return eeprom[(uintptr_t)addr % sizeof(eeprom)]; }
+void eeprom_write_byte(uint8_t *addr, uint8_t value)
+{
+  if(!eeprom_is_ready()) {
+    uint64_t start = sim_ticks;
+    sim_advance((eeprom_ready_tick - sim_ticks + TICKS_PER_US - 1) / TICKS_PER_US);
+    eeprom_wait_ticks += sim_ticks - start;
+  }
+  uintptr_t i = (uintptr_t)addr % sizeof(eeprom);
+  eeprom[i] = value;
+  eeprom_writes++;
+  eeprom_ready_tick = sim_ticks + EEPROM_WRITE_US * TICKS_PER_US;
+  if(eeprom_file) {
+    fseek(eeprom_file, i, SEEK_SET);
+    fputc(value, eeprom_file);
+    fflush(eeprom_file);
+  }
+}
+uint32_t eeprom_read_dword(const uint32_t *addr)
+{
+  uint32_t v;
+  for(uint8_t i = 0; i < 4; i++)
+    ((uint8_t *)&v)[i] = eeprom_read_byte((const uint8_t *)addr + i);
+  return v;
+}
+void eeprom_write_dword(uint32_t *addr, uint32_t value)
+{
+  for(uint8_t i = 0; i < 4; i++)
+    eeprom_write_byte((uint8_t *)addr + i, ((uint8_t *)&value)[i]);
+}
+
+//===========================================================================
+//=============================temperature======================================
+//===========================================================================
+
+void tp_init() {}
+
+// Every caller that waits (planner full, st_synchronize, M109, G4) spins on
+// manage_heater(), so this is where simulated time passes.
+void manage_heater()
+{
+  for(int e = 0; e < EXTRUDERS; e++)
+    current_temperature[e] = target_temperature[e];
+  current_temperature_bed = target_temperature_bed;
+  sim_advance(loop_us);
+}
+
+int getHeaterPower(int heater) { return 0; }
+void disable_heater()
+{
+  for(int e = 0; e < EXTRUDERS; e++)
+    target_temperature[e] = 0;
+  target_temperature_bed = 0;
+}
+void setWatch() {}
+void updatePID() {}
+void PID_autotune(float temp, int extruder, int ncycles, bool apply) {}
+#ifdef HEATER_MODEL
+void model_autotune(float temp, int extruder, bool apply) {}
+#endif
+#ifdef PIDTEMP
+float scalePID_i(float i) { return i*PID_dT; }
+float unscalePID_i(float i) { return i/PID_dT; }
+float scalePID_d(float d) { return d/PID_dT; }
+float unscalePID_d(float d) { return d*PID_dT; }
+#endif
+
+//===========================================================================
+//=============================main=============================
+//===========================================================================
+
+static void report()
+{
+  fprintf(stderr, "lines: %ld (%ld bytes), the last acknowledged at %.3f s\n", lines_sent, host_bytes,
+    (double)last_ack_tick / (TICKS_PER_US * 1000000.0));
+  fprintf(stderr, "byte times held back on a full rx ring: %ld\n", rx_overruns);
+  fprintf(stderr, "waiting for the serial transmitter: %.3f s\n", (double)tx_wait_ticks / (TICKS_PER_US * 1000000.0));
+  fprintf(stderr, "blocks: %ld\n", blocks_done);
+  // until the last block is done, the drain loops above do not count
+  fprintf(stderr, "time: %.3f s\n", (double)last_block_end_tick / (TICKS_PER_US * 1000000.0));
+  fprintf(stderr, "planner underruns: %ld (%.3f s starved)\n", underruns,
+    (double)starved_ticks / (TICKS_PER_US * 1000000.0));
+  if(min_isr_interval)
+    fprintf(stderr, "peak step ISR rate: %lu Hz\n", (unsigned long)(F_CPU / 8 / min_isr_interval));
+  for(int i = 0; i < NUM_AXIS; i++) {
+    fprintf(stderr, "%c: %ld steps", axis_codes[i], steps[i]);
+    if(min_step_interval[i])
+      fprintf(stderr, ", peak %lu steps/s", (unsigned long)(F_CPU / 8 / min_step_interval[i]));
+    fputc('\n', stderr);
+  }
+  fprintf(stderr, "eeprom: %ld bytes written, %.3f s waiting for it\n", eeprom_writes,
+    (double)eeprom_wait_ticks / (TICKS_PER_US * 1000000.0));
+  #ifdef SDSUPPORT
+  sim_sd_report(stderr);
+  if(card_dump)
+    sim_sd_dump(card_dump);
+  #endif
+}
+
+// -P: the firmware stops where it is, only the EEPROM and the card keep what
+// they were written
+static void power_off()
+{
+  fprintf(stderr, "power lost at %.3f s\n", (double)sim_ticks / (TICKS_PER_US * 1000000.0));
+  report();
+  if(trace_file)
+    fclose(trace_file);
+  if(block_file)
+    fclose(block_file);
+  exit(0);
+}
+
+int main(int argc, char **argv)
+{
+  int opt;
+  while((opt = getopt(argc, argv, "t:b:l:w:p:TBs:Fd:e:P:")) != -1) {
+    switch(opt) {
+      case 't': trace_file = fopen(optarg, "w"); break;
+      case 'b': block_file = fopen(optarg, "w"); break;
+      case 'l': loop_us = strtoul(optarg, NULL, 10); break;
+      case 'w': host_window = atoi(optarg); break;
+      case 'p': bench_passes = atoi(optarg); break;
+      case 'T': return parse_test() | pid_test();
+      case 'e':
+        // as the last run left it, erased if there is none
+        if((eeprom_file = fopen(optarg, "r+b")) != NULL)
+          fread(eeprom, 1, sizeof(eeprom), eeprom_file);
+        else
+          eeprom_file = fopen(optarg, "w+b");
+        break;
+      case 'P': power_off_tick = (uint64_t)(atof(optarg) * 1000000.0) * TICKS_PER_US; break;
+      #ifdef BINARY_TRANSPORT
+      case 'B': host_binary = true; break;
+      #endif
+      #ifdef SDSUPPORT
+      case 's': sim_sd_add_file(optarg); break;
+      case 'F': sim_sd_fragment(); break;
+      case 'd': card_dump = optarg; break;
+      #endif
+      default:
+        fprintf(stderr, "usage: %s [-t trace.txt] [-b blocks.txt] [-l loop_us] [-w window] [-B] [-s sdfile.gco]... [-F] [-d card.img] [-e eeprom.bin] [-P seconds] file.gcode\n", argv[0]);
+        fprintf(stderr, "       %s -p passes file.gcode\n", argv[0]);
+        fprintf(stderr, "       %s -T\n", argv[0]);
+        return 2;
+    }
+  }
+  if(optind >= argc || (gcode_file = fopen(argv[optind], "r")) == NULL) {
+    fprintf(stderr, "%s: no G-code file\n", argv[0]);
+    return 2;
+  }
+  if(bench_passes > 0) {
+    setup();
+    return planner_bench(gcode_file, bench_passes);
+  }
+  if(trace_file)
+    fprintf(trace_file, "# time_us axis S | time_us axis D dir\n");
+  if(block_file)
+    fprintf(block_file, "# start_us end_us steps_x steps_y steps_z steps_e step_event_count mm entry_speed nominal_speed max_entry_speed initial_rate nominal_rate final_rate accelerate_until decelerate_after\n");
+
+  #ifdef SDSUPPORT
+  sim_sd_insert();
+  #endif
+  sei(); // as the Arduino core does before setup()
+  setup();
+  do {
+    while(feeding() || lines_acked < lines_sent)
+      loop();
+    // drain the command queue (every command takes at least 2 bytes), a
+    // queued command may start an SD print (M1000) that has to be fed again
+    for(int i = 0; i <= CMDBUFFER_SIZE / 2; i++)
+      loop();
+  } while(feeding());
+  st_synchronize();
+  sim_advance(loop_us);
+
+  report();
+
+  if(trace_file)
+    fclose(trace_file);
+  if(block_file)
+    fclose(block_file);
+  fclose(gcode_file);
+  return 0;
+}
@@ -0,0 +1,608 @@
+/*
+  sim_sd.cpp - SD card on the SPI bus of the host simulation build
+  Part of Marlin
+
+  Answers the bytes Sd2Card exchanges through SPDR the way an SDHC card in
+  SPI mode does: R1/R3/R7 responses, CSD and CID, single and multiple block
+  reads and writes. The card holds a FAT16 volume that is built in memory
+  from the files given with -s, so M23/M24 print them as from a real card.
+
+  Every byte costs the simulated time it takes on the bus at the rate set in
+  SPCR/SPSR. A block the card has to fetch costs an access time first, the
+  blocks that follow it in a multiple block read come out of the card's own
+  read-ahead after a much shorter gap. Time the firmware spends elsewhere
+  overlaps with that gap, as on a real card. CPU time of the firmware is not
+  modelled, only the bus and the card.
+
+  Built with SDSUPPORT only, see "make sim DEFINES=SIM_SDSUPPORT".
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "Marlin.h"
+
+#ifdef SDSUPPORT
+
+// card access time for CMD17 and the first block of a CMD18, and the gap
+// between the blocks of a CMD18 (microseconds)
+#define SD_ACCESS_US 800
+#define SD_STREAM_GAP_US 40
+// busy time after a block of a CMD24 and, as the card programs a block while
+// it receives the next one, after a block of a CMD25
+#define SD_PROGRAM_US 1000
+#define SD_STREAM_PROGRAM_US 100
+// image layout: partition start, cluster size and root directory entries
+#define SD_PART_START 2048
+#define SD_BLOCKS_PER_CLUSTER 4
+#define SD_ROOT_ENTRIES 512
+// FAT16 needs at least 4085 clusters
+#define SD_MIN_CLUSTERS 4200
+
+#define SD_FILES_MAX 128
+
+// SPI register stand-ins, see sim/avr/io.h
+sim_spdr_t SPDR;
+sim_spsr_t SPSR;
+volatile uint8_t SPCR;
+volatile uint8_t DDRA, PINA, PORTA, DDRB, PINB, PORTB, DDRC, PINC, PORTC;
+volatile uint8_t DDRD, PIND, PORTD, DDRE, PINE, PORTE, DDRF, PINF, PORTF;
+volatile uint8_t DDRG, PING, PORTG, DDRH, PINH, PORTH, DDRJ, PINJ, PORTJ;
+volatile uint8_t DDRK, PINK, PORTK, DDRL, PINL, PORTL;
+
+static uint8_t *image = NULL;
+static uint32_t image_blocks = 0;
+static const char *file_paths[SD_FILES_MAX];
+static int file_count = 0;
+static bool fragment = false;
+
+// bus
+static bool selected = false;
+static unsigned long spi_ns = 0;
+static uint64_t bus_ticks = 0;
+
+// output waiting to be shifted out, responses and data blocks
+static uint8_t out_buf[4 + 512 + 2 + 64];
+static int out_len = 0;
+static int out_pos = 0;
+// out_buf holds a data block of the image, counted once it is shifted out
+static bool out_block = false;
+
+// command frame being received
+static uint8_t cmd_frame[6];
+static int cmd_len = 0;
+static bool app_cmd = false;
+static bool idle = true;
+static int acmd41_count = 0;
+
+enum sd_state { SD_IDLE, SD_READ_SINGLE, SD_READ_MULTI, SD_WRITE_SINGLE, SD_WRITE_MULTI };
+static sd_state state = SD_IDLE;
+static uint32_t data_block = 0;
+static uint64_t data_ready_tick = 0;
+static uint64_t busy_until_tick = 0;
+static bool erase_pending = false;
+static uint32_t erase_first = 0, erase_last = 0;
+
+// block being written: token seen, bytes received
+static bool write_receiving = false;
+static int write_pos = 0;
+static uint8_t write_buf[512 + 2];
+
+// statistics
+static long read_commands = 0;
+static long blocks_read = 0;
+static long write_commands = 0;
+static long blocks_written = 0;
+
+//===========================================================================
+//=============================image=============================
+//===========================================================================
+
+static void put16(uint8_t *p, uint16_t v)
+{
+  p[0] = v;
+  p[1] = v >> 8;
+}
+
+static void put32(uint8_t *p, uint32_t v)
+{
+  put16(p, v);
+  put16(p + 2, v >> 16);
+}
+
+// "print.gcode" -> "PRINT   GCO"
+static void short_name(const char *path, uint8_t *name)
+{
+  const char *base = strrchr(path, '/');
+  base = base ? base + 1 : path;
+  const char *dot = strrchr(base, '.');
+  memset(name, ' ', 11);
+  int n = 0;
+  for(const char *p = base; *p && p != dot && n < 8; p++)
+    if(isalnum((unsigned char)*p) || *p == '_' || *p == '-')
+      name[n++] = toupper((unsigned char)*p);
+  n = 8;
+  for(const char *p = dot ? dot + 1 : ""; *p && n < 11; p++)
+    if(isalnum((unsigned char)*p))
+      name[n++] = toupper((unsigned char)*p);
+}
+
+// a name that does not fit 8.3 gets long name entries and "PRINTS~2.GCO"
+static bool needs_long_name(const char *base)
+{
+  const char *dot = strrchr(base, '.');
+  int len = strlen(base);
+  if((dot ? dot - base : len) > 8 || (dot && len - (dot - base) - 1 > 3))
+    return true;
+  for(const char *p = base; *p; p++)
+    if(!isalnum((unsigned char)*p) && *p != '_' && *p != '-' && p != dot)
+      return true;
+  return false;
+}
+
+static void numbered_name(uint8_t *name, int nr)
+{
+  char tail[8];
+  int len = snprintf(tail, sizeof(tail), "~%d", nr);
+  int n = 0;
+  while(n < 8 - len && name[n] != ' ')
+    n++;
+  memcpy(name + n, tail, len);
+}
+
+static uint8_t lfn_checksum(const uint8_t *name)
+{
+  uint8_t sum = 0;
+  for(int i = 0; i < 11; i++)
+    sum = ((sum & 1) << 7) + (sum >> 1) + name[i];
+  return sum;
+}
+
+// writes the long name entries of base in front of a short entry, returns
+// how many (0 without a long name)
+static int long_name_entries(const char *base, const uint8_t *name, uint8_t *dir)
+{
+  static const uint8_t at[13] = {1, 3, 5, 7, 9, 14, 16, 18, 20, 22, 24, 28, 30};
+  int len = strlen(base);
+  int count = (len + 12) / 13;
+  uint8_t sum = lfn_checksum(name);
+  for(int k = 0; k < count; k++) {
+    // the last part of the name comes first
+    uint8_t *entry = dir + 32 * (count - 1 - k);
+    entry[0] = (k + 1) | (k + 1 == count ? 0x40 : 0);
+    entry[11] = 0x0f;
+    entry[13] = sum;
+    for(int c = 0; c < 13; c++) {
+      int i = 13 * k + c;
+      uint16_t ch = i < len ? (uint8_t)base[i] : i == len ? 0 : 0xffff;
+      put16(entry + at[c], ch);
+    }
+  }
+  return count;
+}
+
+static uint8_t *read_file(const char *path, long *size)
+{
+  FILE *f = fopen(path, "rb");
+  if(f == NULL) {
+    fprintf(stderr, "sd: cannot open %s\n", path);
+    exit(2);
+  }
+  fseek(f, 0, SEEK_END);
+  *size = ftell(f);
+  fseek(f, 0, SEEK_SET);
+  uint8_t *data = (uint8_t *)malloc(*size + 1);
+  if(fread(data, 1, *size, f) != (size_t)*size) {
+    fprintf(stderr, "sd: cannot read %s\n", path);
+    exit(2);
+  }
+  fclose(f);
+  return data;
+}
+
+// MBR with one FAT16 partition holding the files in its root directory. With
+// -F every file takes every other cluster, so reads follow the FAT and cannot
+// stream across cluster boundaries.
+static void build_image()
+{
+  long sizes[SD_FILES_MAX];
+  uint8_t *data[SD_FILES_MAX];
+  uint32_t stride = fragment ? 2 : 1;
+  uint32_t cluster_bytes = SD_BLOCKS_PER_CLUSTER * 512;
+  uint32_t clusters = 0;
+  for(int i = 0; i < file_count; i++) {
+    data[i] = read_file(file_paths[i], &sizes[i]);
+    clusters += stride * ((sizes[i] + cluster_bytes - 1) / cluster_bytes);
+  }
+  clusters += 256;
+  if(clusters < SD_MIN_CLUSTERS)
+    clusters = SD_MIN_CLUSTERS;
+  if(clusters > 65000) {
+    fprintf(stderr, "sd: files do not fit a FAT16 volume\n");
+    exit(2);
+  }
+
+  uint32_t fat_blocks = ((clusters + 2) * 2 + 511) / 512;
+  uint32_t root_blocks = SD_ROOT_ENTRIES * 32 / 512;
+  uint32_t volume_blocks = 1 + 2 * fat_blocks + root_blocks + clusters * SD_BLOCKS_PER_CLUSTER;
+  image_blocks = SD_PART_START + volume_blocks;
+  image = (uint8_t *)calloc(image_blocks, 512);
+
+  uint8_t *mbr = image;
+  uint8_t *part = mbr + 446;
+  part[4] = 0x06;
+  put32(part + 8, SD_PART_START);
+  put32(part + 12, volume_blocks);
+  mbr[510] = 0x55;
+  mbr[511] = 0xaa;
+
+  uint8_t *boot = image + SD_PART_START * 512;
+  boot[0] = 0xeb;
+  boot[1] = 0x3c;
+  boot[2] = 0x90;
+  memcpy(boot + 3, "MARLINSM", 8);
+  put16(boot + 11, 512);
+  boot[13] = SD_BLOCKS_PER_CLUSTER;
+  put16(boot + 14, 1);
+  boot[16] = 2;
+  put16(boot + 17, SD_ROOT_ENTRIES);
+  if(volume_blocks < 65536)
+    put16(boot + 19, volume_blocks);
+  else
+    put32(boot + 32, volume_blocks);
+  boot[21] = 0xf8;
+  put16(boot + 22, fat_blocks);
+  boot[38] = 0x29;
+  memcpy(boot + 43, "SIMULATION ", 11);
+  memcpy(boot + 54, "FAT16   ", 8);
+  boot[510] = 0x55;
+  boot[511] = 0xaa;
+
+  uint32_t fat_start = SD_PART_START + 1;
+  uint32_t root_start = fat_start + 2 * fat_blocks;
+  uint32_t data_start = root_start + root_blocks;
+  uint8_t *fat = image + fat_start * 512;
+  put16(fat, 0xfff8);
+  put16(fat + 2, 0xffff);
+
+  uint8_t *dir = image + root_start * 512;
+  int slot = 0;
+  uint32_t next_cluster = 2;
+  for(int i = 0; i < file_count; i++) {
+    const char *base = strrchr(file_paths[i], '/');
+    base = base ? base + 1 : file_paths[i];
+    uint8_t name[11];
+    short_name(base, name);
+    if(needs_long_name(base)) {
+      numbered_name(name, i + 1);
+      if(slot + (strlen(base) + 12) / 13 + 1 > SD_ROOT_ENTRIES) {
+        fprintf(stderr, "sd: root directory full\n");
+        exit(2);
+      }
+      slot += long_name_entries(base, name, dir + 32 * slot);
+    }
+    uint8_t *entry = dir + 32 * slot++;
+    memcpy(entry, name, 11);
+    entry[11] = 0x20;
+    put16(entry + 24, (34 << 9) | (1 << 5) | 1); // 2014-01-01
+    put32(entry + 28, sizes[i]);
+    uint32_t count = (sizes[i] + cluster_bytes - 1) / cluster_bytes;
+    if(count)
+      put16(entry + 26, next_cluster);
+    for(uint32_t c = 0; c < count; c++) {
+      uint32_t cluster = next_cluster;
+      next_cluster += stride;
+      put16(fat + 2 * cluster, c + 1 < count ? next_cluster : 0xffff);
+      uint32_t offset = c * cluster_bytes;
+      uint32_t n = sizes[i] - offset < cluster_bytes ? sizes[i] - offset : cluster_bytes;
+      memcpy(image + (data_start + (cluster - 2) * SD_BLOCKS_PER_CLUSTER) * 512, data[i] + offset, n);
+    }
+    free(data[i]);
+  }
+  memcpy(fat + fat_blocks * 512, fat, fat_blocks * 512);
+}
+
+//===========================================================================
+//=============================card=============================
+//===========================================================================
+
+static uint16_t crc16(const uint8_t *p, int len)
+{
+  uint16_t crc = 0;
+  while(len--) {
+    crc ^= *p++ << 8;
+    for(int i = 0; i < 8; i++)
+      crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+  }
+  return crc;
+}
+
+static void out_clear()
+{
+  out_pos = out_len = 0;
+  out_block = false;
+}
+
+static void out_byte(uint8_t b)
+{
+  if(out_pos == out_len)
+    out_clear();
+  out_buf[out_len++] = b;
+}
+
+// start token, data and CRC
+static void out_data(const uint8_t *p, int len)
+{
+  out_byte(0xfe);
+  for(int i = 0; i < len; i++)
+    out_byte(p[i]);
+  uint16_t crc = crc16(p, len);
+  out_byte(crc >> 8);
+  out_byte(crc & 0xff);
+}
+
+static void r1(uint8_t status)
+{
+  out_clear();
+  out_byte(0xff);
+  out_byte(status | (idle ? 0x01 : 0));
+}
+
+static void command()
+{
+  uint8_t cmd = cmd_frame[0] & 0x3f;
+  uint32_t arg = (uint32_t)cmd_frame[1] << 24 | (uint32_t)cmd_frame[2] << 16 | cmd_frame[3] << 8 | cmd_frame[4];
+  bool app = app_cmd;
+  app_cmd = false;
+
+  // a command ends a multiple block read, CMD12 after its stuff byte
+  if(state == SD_READ_MULTI || state == SD_READ_SINGLE)
+    state = SD_IDLE;
+
+  if(app) {
+    switch(cmd) {
+      case 41:
+        if(++acmd41_count >= 2)
+          idle = false;
+        r1(0);
+        return;
+      case 23:
+        r1(0);
+        return;
+    }
+  }
+  switch(cmd) {
+    case 0:
+      idle = true;
+      acmd41_count = 0;
+      state = SD_IDLE;
+      r1(0);
+      return;
+    case 8:
+      r1(0);
+      out_byte(0x00);
+      out_byte(0x00);
+      out_byte(0x01);
+      out_byte(arg & 0xff);
+      return;
+    case 55:
+      app_cmd = true;
+      r1(0);
+      return;
+    case 58:
+      r1(0);
+      out_byte(0xc0);
+      out_byte(0xff);
+      out_byte(0x80);
+      out_byte(0x00);
+      return;
+    case 9: {
+      // CSD version 2.0, C_SIZE in units of 512 KiB
+      uint8_t csd[16] = { 0x40, 0x0e, 0x00, 0x32, 0x5b, 0x59, 0x00, 0, 0, 0, 0x7f, 0x80, 0x0a, 0x40, 0x00, 0x01 };
+      uint32_t c_size = image_blocks / 1024 - 1;
+      csd[7] = (c_size >> 16) & 0x3f;
+      csd[8] = c_size >> 8;
+      csd[9] = c_size;
+      r1(0);
+      out_data(csd, 16);
+      return;
+    }
+    case 10: {
+      uint8_t cid[16] = { 0x00, 'S', 'M', 'M', 'A', 'R', 'L', 'N', 0x10, 0, 0, 0, 1, 0x00, 0xe1, 0x01 };
+      r1(0);
+      out_data(cid, 16);
+      return;
+    }
+    case 12:
+      out_clear();
+      out_byte(0xff); // stuff byte
+      out_byte(0x00);
+      return;
+    case 13:
+      r1(0);
+      out_byte(0x00);
+      return;
+    case 17:
+    case 18:
+      if(arg >= image_blocks) {
+        r1(0x40); // address error
+        return;
+      }
+      r1(0);
+      read_commands++;
+      state = cmd == 17 ? SD_READ_SINGLE : SD_READ_MULTI;
+      data_block = arg;
+      data_ready_tick = sim_ticks + SD_ACCESS_US * (F_CPU / 8000000UL);
+      return;
+    case 24:
+    case 25:
+      if(arg >= image_blocks) {
+        r1(0x40);
+        return;
+      }
+      r1(0);
+      write_commands++;
+      state = cmd == 24 ? SD_WRITE_SINGLE : SD_WRITE_MULTI;
+      data_block = arg;
+      write_receiving = false;
+      return;
+    case 32:
+      erase_first = arg;
+      r1(0);
+      return;
+    case 33:
+      erase_last = arg;
+      erase_pending = true;
+      r1(0);
+      return;
+    case 38:
+      if(erase_pending && erase_first <= erase_last && erase_last < image_blocks)
+        memset(image + erase_first * 512, 0, (erase_last - erase_first + 1) * 512);
+      erase_pending = false;
+      r1(0);
+      return;
+  }
+  r1(0x04); // illegal command
+}
+
+// next byte on MISO while the card is selected
+static uint8_t card_out()
+{
+  if(out_pos < out_len) {
+    uint8_t b = out_buf[out_pos++];
+    if(out_block && out_pos == out_len) {
+      blocks_read++;
+      out_block = false;
+    }
+    return b;
+  }
+  if(sim_ticks < busy_until_tick)
+    return 0x00;
+  if((state == SD_READ_SINGLE || state == SD_READ_MULTI) && sim_ticks >= data_ready_tick) {
+    out_data(image + data_block * 512, 512);
+    out_block = true;
+    if(state == SD_READ_SINGLE)
+      state = SD_IDLE;
+    else {
+      data_block++;
+      if(data_block >= image_blocks)
+        state = SD_IDLE;
+      // the card fetches the next block while this one is shifted out
+      data_ready_tick = sim_ticks + (SD_STREAM_GAP_US + 518) * (F_CPU / 8000000UL);
+    }
+    return out_buf[out_pos++];
+  }
+  return 0xff;
+}
+
+// byte on MOSI while the card is selected
+static void card_in(uint8_t b)
+{
+  if(write_receiving) {
+    write_buf[write_pos++] = b;
+    if(write_pos < 512 + 2)
+      return;
+    // the CRC is not checked in SPI mode
+    write_receiving = false;
+    memcpy(image + data_block * 512, write_buf, 512);
+    blocks_written++;
+    out_byte(0x05); // data accepted
+    busy_until_tick = sim_ticks + (state == SD_WRITE_SINGLE ? SD_PROGRAM_US : SD_STREAM_PROGRAM_US) * (F_CPU / 8000000UL);
+    if(state == SD_WRITE_SINGLE)
+      state = SD_IDLE;
+    else if(++data_block >= image_blocks)
+      state = SD_IDLE;
+    return;
+  }
+  if(cmd_len > 0) {
+    cmd_frame[cmd_len++] = b;
+    if(cmd_len == 6) {
+      cmd_len = 0;
+      command();
+    }
+    return;
+  }
+  if((b & 0xc0) == 0x40) {
+    cmd_frame[cmd_len++] = b;
+    return;
+  }
+  if((state == SD_WRITE_SINGLE && b == 0xfe) || (state == SD_WRITE_MULTI && b == 0xfc)) {
+    write_receiving = true;
+    write_pos = 0;
+    return;
+  }
+  if(state == SD_WRITE_MULTI && b == 0xfd) {
+    // stop tran token
+    state = SD_IDLE;
+    out_clear();
+    out_byte(0xff);
+    busy_until_tick = sim_ticks + SD_PROGRAM_US * (F_CPU / 8000000UL);
+  }
+}
+
+//===========================================================================
+//=============================bus=============================
+//===========================================================================
+
+void sim_sd_select(bool select)
+{
+  selected = select;
+}
+
+uint8_t sim_spi_transfer(uint8_t b)
+{
+  // 8 SCK periods at F_CPU/2^(1 + rate), see spiInit() in Sd2Card.cpp
+  uint8_t rate = (SPCR & 3) << 1 | ((SPSR & (1 << SPI2X)) ? 0 : 1);
+  spi_ns += (8000000000UL / F_CPU) << (rate + 1);
+  if(spi_ns >= 1000) {
+    uint64_t start = sim_ticks;
+    sim_advance(spi_ns / 1000);
+    bus_ticks += sim_ticks - start;
+    spi_ns %= 1000;
+  }
+  if(!selected || image == NULL)
+    return 0xff;
+  uint8_t out = card_out();
+  card_in(b);
+  return out;
+}
+
+void sim_sd_add_file(const char *path)
+{
+  if(file_count == SD_FILES_MAX) {
+    fprintf(stderr, "sd: at most %d files\n", SD_FILES_MAX);
+    exit(2);
+  }
+  file_paths[file_count++] = path;
+}
+
+void sim_sd_fragment()
+{
+  fragment = true;
+}
+
+// A card without files is an empty volume.
+void sim_sd_insert()
+{
+  build_image();
+}
+
+void sim_sd_dump(const char *path)
+{
+  FILE *f = fopen(path, "wb");
+  if(f == NULL || fwrite(image, 512, image_blocks, f) != image_blocks)
+    fprintf(stderr, "sd: cannot write %s\n", path);
+  if(f)
+    fclose(f);
+}
+
+void sim_sd_report(FILE *f)
+{
+  fprintf(f, "sd: %ld blocks read with %ld commands, %ld blocks written with %ld commands\n",
+    blocks_read, read_commands, blocks_written, write_commands);
+  fprintf(f, "sd: %.3f s on the SPI bus\n", (double)bus_ticks / (F_CPU / 8 * 1.0));
+}
+
+#endif // SDSUPPORT
@@ -0,0 +1,9 @@
+#ifndef sim_util_delay_h
+#define sim_util_delay_h
+
+#include "../sim.h"
+
+#define _delay_ms(ms) sim_advance((unsigned long)(ms) * 1000UL)
+#define _delay_us(us) sim_advance((unsigned long)(us))
+
+#endif
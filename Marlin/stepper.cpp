@@ -51,6 +51,10 @@ static long counter_x,       // Counter variables for the bresenham line tracer
             counter_y,
             counter_z,
             counter_e;
+static long steps_x,         // Step counts of the current block, the block keeps them in 24 bit fields
+            steps_y,
+            steps_z,
+            steps_e;
 volatile static unsigned long step_events_completed; // The number of step events executed in the current block
 #ifdef ADVANCE
   static long advance_rate, advance, final_advance = 0;
@@ -59,6 +63,15 @@ volatile static unsigned long step_events_completed; // The number of step event
 #endif
 static long acceleration_time, deceleration_time;
 //static unsigned long accelerate_until, decelerate_after, acceleration_rate, initial_rate, final_rate, nominal_rate;
+// Step event count and ramp ends of the current block in bresenham ticks, which are step
+// events shifted left by the oversampling level.
+static unsigned long step_events_total, accelerate_until, decelerate_after;
+#ifdef ADAPTIVE_STEP_SMOOTHING
+  static unsigned char oversampling;   // bresenham ticks per step event are 1<<oversampling
+  #define OVERSAMPLED(rate) ((rate) << oversampling)
+#else
+  #define OVERSAMPLED(rate) (rate)
+#endif
 static unsigned short acc_step_rate; // needed for deccelaration start point
 static char step_loops;
 static unsigned short OCR1A_nominal;
@@ -101,6 +114,13 @@ extern volatile float detect_filament_factor;
 
 #define CHECK_ENDSTOPS  if(check_endstops)
 
+#ifdef SIMULATION
+// Portable versions of the multiplies below for the host simulation build
+#define MultiU16X8toH16(intRes, charIn1, intIn2) \
+  intRes = ((uint32_t)(uint8_t)(charIn1) * (uint16_t)(intIn2) + 0x80) >> 8
+#define MultiU24X24toH16(intRes, longIn1, longIn2) \
+  intRes = ((uint64_t)((longIn1) & 0xFFFFFF) * ((longIn2) & 0xFFFFFF) + 0x800000) >> 24
+#else
 // intRes = intIn1 * intIn2 >> 16
 // uses:
 // r26 to store 0
@@ -170,6 +190,7 @@ asm volatile ( \
 : \
 "r26" , "r27" \
 )
+#endif // SIMULATION
 
 // Some useful constants
 
@@ -286,6 +307,29 @@ FORCE_INLINE unsigned short calc_timer(unsigned short step_rate) {
   return timer;
 }
 
+#ifdef S_CURVE_ACCELERATION
+// Step rate at time t (timer ticks) into a ramp from rate v0 to v1, following
+// s(x) = 10x^3 - 15x^4 + 6x^5 = x^3 (10 - 15x + 6x^2) with x = t / ramp time.
+// The ramp time comes as a shift and an inverse from the planner, x is computed
+// in 16 bit fixed point and the polynomial in Q12, so five 16x16->32
+// multiplies (t by the inverse, x^2, x^3, x^3 by the polynomial, the rate
+// change by s) and two by constants are needed, and no division.
+FORCE_INLINE unsigned short s_curve_rate(unsigned short v0, unsigned short v1, unsigned long t, signed char shift, unsigned short inverse) {
+  unsigned long ts = shift >= 0 ? t >> shift : t << -shift;
+  if(ts > 65535) return v1;
+  unsigned long x = ((unsigned long)(unsigned short)ts * inverse) >> 15;
+  if(x > 65535) return v1;
+  unsigned short x2 = ((unsigned long)(unsigned short)x * (unsigned short)x) >> 16;
+  unsigned short x3 = ((unsigned long)x2 * (unsigned short)x) >> 16;
+  unsigned short p = 40960UL - ((x * 15) >> 4) + (((unsigned long)x2 * 6) >> 4);
+  unsigned long s = ((unsigned long)x3 * p) >> 12;
+  if(s > 65535) s = 65535;
+  if(v1 >= v0)
+    return v0 + (((unsigned long)(unsigned short)(v1 - v0) * (unsigned short)s) >> 16);
+  return v0 - (((unsigned long)(unsigned short)(v0 - v1) * (unsigned short)s) >> 16);
+}
+#endif
+
 // Initializes the trapezoid generator from the current block. Called whenever a new
 // block begins.
 FORCE_INLINE void trapezoid_generator_reset() {
@@ -297,12 +341,21 @@ FORCE_INLINE void trapezoid_generator_reset() {
     old_advance = advance >>8;
   #endif
   deceleration_time = 0;
+  #ifdef ADAPTIVE_STEP_SMOOTHING
+    // Oversample as far as the nominal rate allows without leaving single stepping.
+    oversampling = 0;
+    while(oversampling < ADAPTIVE_STEP_SMOOTHING && ((unsigned long)current_block->nominal_rate << (oversampling + 1)) <= 10000)
+      oversampling++;
+  #endif
+  step_events_total = OVERSAMPLED(current_block->step_event_count);
+  accelerate_until = OVERSAMPLED((unsigned long)current_block->accelerate_until);
+  decelerate_after = OVERSAMPLED((unsigned long)current_block->decelerate_after);
   // step_rate to timer interval
-  OCR1A_nominal = calc_timer(current_block->nominal_rate);
+  OCR1A_nominal = calc_timer(OVERSAMPLED(current_block->nominal_rate));
   // make a note of the number of step loops required at nominal speed
   step_loops_nominal = step_loops;
   acc_step_rate = current_block->initial_rate;
-  acceleration_time = calc_timer(acc_step_rate);
+  acceleration_time = calc_timer(OVERSAMPLED(acc_step_rate));
   OCR1A = acceleration_time;
 
 //    SERIAL_ECHO_START;
@@ -328,10 +381,14 @@ ISR(TIMER1_COMPA_vect)
     if (current_block != NULL) {
       current_block->busy = true;
       trapezoid_generator_reset();
-      counter_x = -(current_block->step_event_count >> 1);
+      counter_x = -(step_events_total >> 1);
       counter_y = counter_x;
       counter_z = counter_x;
       counter_e = counter_x;
+      steps_x = current_block->steps_x;
+      steps_y = current_block->steps_y;
+      steps_z = current_block->steps_z;
+      steps_e = current_block->steps_e;
       step_events_completed = 0;
 
       #ifdef Z_LATE_ENABLE
@@ -429,7 +486,7 @@ ISR(TIMER1_COMPA_vect)
             if(x_min_endstop && old_x_min_endstop && (current_block->steps_x > 0)) {
               endstops_trigsteps[X_AXIS] = count_position[X_AXIS];
               endstop_x_hit=true;
-              step_events_completed = current_block->step_event_count;
+              step_events_completed = step_events_total;
             }
             old_x_min_endstop = x_min_endstop;
           #endif
@@ -450,7 +507,7 @@ ISR(TIMER1_COMPA_vect)
             if(x_max_endstop && old_x_max_endstop && (current_block->steps_x > 0)){
               endstops_trigsteps[X_AXIS] = count_position[X_AXIS];
               endstop_x_hit=true;
-              step_events_completed = current_block->step_event_count;
+              step_events_completed = step_events_total;
             }
             old_x_max_endstop = x_max_endstop;
           #endif
@@ -473,7 +530,7 @@ ISR(TIMER1_COMPA_vect)
           if(y_min_endstop && old_y_min_endstop && (current_block->steps_y > 0)) {
             endstops_trigsteps[Y_AXIS] = count_position[Y_AXIS];
             endstop_y_hit=true;
-            step_events_completed = current_block->step_event_count;
+            step_events_completed = step_events_total;
           }
           old_y_min_endstop = y_min_endstop;
         #endif
@@ -490,7 +547,7 @@ ISR(TIMER1_COMPA_vect)
           if(y_max_endstop && old_y_max_endstop && (current_block->steps_y > 0)){
             endstops_trigsteps[Y_AXIS] = count_position[Y_AXIS];
             endstop_y_hit=true;
-            step_events_completed = current_block->step_event_count;
+            step_events_completed = step_events_total;
           }
           old_y_max_endstop = y_max_endstop;
         #endif
@@ -515,7 +572,7 @@ ISR(TIMER1_COMPA_vect)
           if(z_min_endstop && old_z_min_endstop && (current_block->steps_z > 0)) {
             endstops_trigsteps[Z_AXIS] = count_position[Z_AXIS];
             endstop_z_hit=true;
-            step_events_completed = current_block->step_event_count;
+            step_events_completed = step_events_total;
           }
           old_z_min_endstop = z_min_endstop;
         #endif
@@ -539,7 +596,7 @@ ISR(TIMER1_COMPA_vect)
           if(z_max_endstop && old_z_max_endstop && (current_block->steps_z > 0)) {
             endstops_trigsteps[Z_AXIS] = count_position[Z_AXIS];
             endstop_z_hit=true;
-            step_events_completed = current_block->step_event_count;
+            step_events_completed = step_events_total;
           }
           old_z_max_endstop = z_max_endstop;
         #endif
@@ -565,9 +622,9 @@ ISR(TIMER1_COMPA_vect)
       #endif
 
       #ifdef ADVANCE
-      counter_e += current_block->steps_e;
+      counter_e += steps_e;
       if (counter_e > 0) {
-        counter_e -= current_block->step_event_count;
+        counter_e -= step_events_total;
         if ((out_bits & (1<<E_AXIS)) != 0) { // - direction
           e_steps[current_block->active_extruder]--;
         }
@@ -577,7 +634,7 @@ ISR(TIMER1_COMPA_vect)
       }
       #endif //ADVANCE
 
-        counter_x += current_block->steps_x;
+        counter_x += steps_x;
         if (counter_x > 0) {
         #ifdef DUAL_X_CARRIAGE
           if (extruder_duplication_enabled){
@@ -593,7 +650,7 @@ ISR(TIMER1_COMPA_vect)
         #else
           WRITE(X_STEP_PIN, !INVERT_X_STEP_PIN);
         #endif        
-          counter_x -= current_block->step_event_count;
+          counter_x -= step_events_total;
           count_position[X_AXIS]+=count_direction[X_AXIS];   
         #ifdef DUAL_X_CARRIAGE
           if (extruder_duplication_enabled){
@@ -611,7 +668,7 @@ ISR(TIMER1_COMPA_vect)
         #endif
         }
 
-        counter_y += current_block->steps_y;
+        counter_y += steps_y;
         if (counter_y > 0) {
           WRITE(Y_STEP_PIN, !INVERT_Y_STEP_PIN);
 		  
@@ -619,7 +676,7 @@ ISR(TIMER1_COMPA_vect)
 			WRITE(Y2_STEP_PIN, !INVERT_Y_STEP_PIN);
 		  #endif
 		  
-          counter_y -= current_block->step_event_count;
+          counter_y -= step_events_total;
           count_position[Y_AXIS]+=count_direction[Y_AXIS];
           WRITE(Y_STEP_PIN, INVERT_Y_STEP_PIN);
 		  
@@ -628,7 +685,7 @@ ISR(TIMER1_COMPA_vect)
 		  #endif
         }
 
-      counter_z += current_block->steps_z;
+      counter_z += steps_z;
       if (counter_z > 0) {
         WRITE(Z_STEP_PIN, !INVERT_Z_STEP_PIN);
         
@@ -636,7 +693,7 @@ ISR(TIMER1_COMPA_vect)
           WRITE(Z2_STEP_PIN, !INVERT_Z_STEP_PIN);
         #endif
 
-        counter_z -= current_block->step_event_count;
+        counter_z -= step_events_total;
         count_position[Z_AXIS]+=count_direction[Z_AXIS];
         WRITE(Z_STEP_PIN, INVERT_Z_STEP_PIN);
         
@@ -646,31 +703,36 @@ ISR(TIMER1_COMPA_vect)
       }
 
       #ifndef ADVANCE
-        counter_e += current_block->steps_e;
+        counter_e += steps_e;
         if (counter_e > 0) {
           WRITE_E_STEP(!INVERT_E_STEP_PIN);
-          counter_e -= current_block->step_event_count;
+          counter_e -= step_events_total;
           count_position[E_AXIS]+=count_direction[E_AXIS];
           WRITE_E_STEP(INVERT_E_STEP_PIN);
         }
       #endif //!ADVANCE
       step_events_completed += 1;
-      if(step_events_completed >= current_block->step_event_count) break;
+      if(step_events_completed >= step_events_total) break;
     }
     // Calculare new timer value
     unsigned short timer;
     unsigned short step_rate;
-    if (step_events_completed <= (unsigned long int)current_block->accelerate_until) {
+    if (step_events_completed <= accelerate_until) {
 
-      MultiU24X24toH16(acc_step_rate, acceleration_time, current_block->acceleration_rate);
-      acc_step_rate += current_block->initial_rate;
+      #ifdef S_CURVE_ACCELERATION
+        acc_step_rate = s_curve_rate(current_block->initial_rate, current_block->cruise_rate, acceleration_time,
+          current_block->accel_time_shift, current_block->accel_time_inverse);
+      #else
+        MultiU24X24toH16(acc_step_rate, acceleration_time, current_block->acceleration_rate);
+        acc_step_rate += current_block->initial_rate;
+      #endif
 
       // upper limit
       if(acc_step_rate > current_block->nominal_rate)
         acc_step_rate = current_block->nominal_rate;
 
       // step_rate to timer interval
-      timer = calc_timer(acc_step_rate);
+      timer = calc_timer(OVERSAMPLED(acc_step_rate));
       OCR1A = timer;
       acceleration_time += timer;
       #ifdef ADVANCE
@@ -684,22 +746,28 @@ ISR(TIMER1_COMPA_vect)
 
       #endif
     }
-    else if (step_events_completed > (unsigned long int)current_block->decelerate_after) {
-      MultiU24X24toH16(step_rate, deceleration_time, current_block->acceleration_rate);
+    else if (step_events_completed > decelerate_after) {
+      #ifdef S_CURVE_ACCELERATION
+        // Decelerate from aceleration end point.
+        step_rate = s_curve_rate(acc_step_rate, current_block->final_rate, deceleration_time,
+          current_block->decel_time_shift, current_block->decel_time_inverse);
+      #else
+        MultiU24X24toH16(step_rate, deceleration_time, current_block->acceleration_rate);
 
-      if(step_rate > acc_step_rate) { // Check step_rate stays positive
-        step_rate = current_block->final_rate;
-      }
-      else {
-        step_rate = acc_step_rate - step_rate; // Decelerate from aceleration end point.
-      }
+        if(step_rate > acc_step_rate) { // Check step_rate stays positive
+          step_rate = current_block->final_rate;
+        }
+        else {
+          step_rate = acc_step_rate - step_rate; // Decelerate from aceleration end point.
+        }
+      #endif
 
       // lower limit
       if(step_rate < current_block->final_rate)
         step_rate = current_block->final_rate;
 
       // step_rate to timer interval
-      timer = calc_timer(step_rate);
+      timer = calc_timer(OVERSAMPLED(step_rate));
       OCR1A = timer;
       deceleration_time += timer;
       #ifdef ADVANCE
@@ -725,7 +793,7 @@ ISR(TIMER1_COMPA_vect)
     }
 #endif
     // If current block is finished, reset pointer
-    if (step_events_completed >= current_block->step_event_count) {
+    if (step_events_completed >= step_events_total) {
 
 #ifdef USE_FILAMENT_DETECTION
       if (detect_filament && (forced_M600 == false)){
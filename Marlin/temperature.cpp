@@ -32,6 +32,7 @@
 #include "Marlin.h"
 #include "ultralcd.h"
 #include "temperature.h"
+#include "pid_fixed.h"
 #include "watchdog.h"
 
 //===========================================================================
@@ -47,12 +48,22 @@ float current_temperature_bed = 0.0;
   int redundant_temperature_raw = 0;
   float redundant_temperature = 0.0;
 #endif
+#if EXTRUDERS > 3
+  # error Unsupported number of extruders
+#elif EXTRUDERS > 2
+  # define ARRAY_BY_EXTRUDERS(v1, v2, v3) { v1, v2, v3 }
+#elif EXTRUDERS > 1
+  # define ARRAY_BY_EXTRUDERS(v1, v2, v3) { v1, v2 }
+#else
+  # define ARRAY_BY_EXTRUDERS(v1, v2, v3) { v1 }
+#endif
+
 #ifdef PIDTEMP
-  float Kp=DEFAULT_Kp;
-  float Ki=(DEFAULT_Ki*PID_dT);
-  float Kd=(DEFAULT_Kd/PID_dT);
+  float Kp[EXTRUDERS] = ARRAY_BY_EXTRUDERS(DEFAULT_Kp, DEFAULT_Kp, DEFAULT_Kp);
+  float Ki[EXTRUDERS] = ARRAY_BY_EXTRUDERS(DEFAULT_Ki*PID_dT, DEFAULT_Ki*PID_dT, DEFAULT_Ki*PID_dT);
+  float Kd[EXTRUDERS] = ARRAY_BY_EXTRUDERS(DEFAULT_Kd/PID_dT, DEFAULT_Kd/PID_dT, DEFAULT_Kd/PID_dT);
   #ifdef PID_ADD_EXTRUSION_RATE
-    float Kc=DEFAULT_Kc;
+    float Kc[EXTRUDERS] = ARRAY_BY_EXTRUDERS(DEFAULT_Kc, DEFAULT_Kc, DEFAULT_Kc);
   #endif
 #endif //PIDTEMP
 
@@ -61,6 +72,13 @@ float current_temperature_bed = 0.0;
   float bedKi=(DEFAULT_bedKi*PID_dT);
   float bedKd=(DEFAULT_bedKd/PID_dT);
 #endif //PIDTEMPBED
+
+#ifdef HEATER_MODEL
+  heater_model hotend_model[EXTRUDERS];
+  #ifdef PIDTEMPBED
+    heater_model bed_model;
+  #endif
+#endif //HEATER_MODEL
   
 #ifdef FAN_SOFT_PWM
   unsigned char fanSpeedSoftPwm;
@@ -77,32 +95,47 @@ unsigned char soft_pwm_bed;
 //===========================================================================
 static volatile bool temp_meas_ready = false;
 
+// The PID runs in fixed point, see pid_fixed.h
+#ifdef HEATER_MODEL
+  // a heater_model in the units of the PID, and the power on the way to the sensor
+  struct model_state { int32_t rise_q16, lag_q16, hold_q16, follow_q16, power_q8; };
+#endif
 #ifdef PIDTEMP
   //static cannot be external:
-  static float temp_iState[EXTRUDERS] = { 0 };
-  static float temp_dState[EXTRUDERS] = { 0 };
-  static float pTerm[EXTRUDERS];
-  static float iTerm[EXTRUDERS];
-  static float dTerm[EXTRUDERS];
+  static int32_t temp_iState[EXTRUDERS] = { 0 };
+  static int32_t temp_dState[EXTRUDERS] = { 0 };
+  static int32_t pTerm[EXTRUDERS];
+  static int32_t iTerm[EXTRUDERS];
+  static int32_t dTerm[EXTRUDERS];
   //int output;
-  static float pid_error[EXTRUDERS];
-  static float temp_iState_min[EXTRUDERS];
-  static float temp_iState_max[EXTRUDERS];
+  static int32_t pid_error[EXTRUDERS];
+  static int32_t temp_iState_min[EXTRUDERS];
+  static int32_t temp_iState_max[EXTRUDERS];
   // static float pid_input[EXTRUDERS];
   // static float pid_output[EXTRUDERS];
   static bool pid_reset[EXTRUDERS];
+  //Kp, Ki and Kd as set by updatePID()
+  static int32_t Kp_q16[EXTRUDERS], Ki_q16[EXTRUDERS], Kd_q16[EXTRUDERS];
+  #ifdef HEATER_MODEL
+  //hotend_model as set by updatePID(), see model_coefficients()
+  static model_state hotend_model_q[EXTRUDERS];
+  #endif
 #endif //PIDTEMP
 #ifdef PIDTEMPBED
   //static cannot be external:
-  static float temp_iState_bed = { 0 };
-  static float temp_dState_bed = { 0 };
-  static float pTerm_bed;
-  static float iTerm_bed;
-  static float dTerm_bed;
+  static int32_t temp_iState_bed = { 0 };
+  static int32_t temp_dState_bed = { 0 };
+  static int32_t pTerm_bed;
+  static int32_t iTerm_bed;
+  static int32_t dTerm_bed;
   //int output;
-  static float pid_error_bed;
-  static float temp_iState_min_bed;
-  static float temp_iState_max_bed;
+  static int32_t pid_error_bed;
+  static int32_t temp_iState_min_bed;
+  static int32_t temp_iState_max_bed;
+  static int32_t bedKp_q16, bedKi_q16, bedKd_q16;
+  #ifdef HEATER_MODEL
+  static model_state bed_model_q;
+  #endif
 #else //PIDTEMPBED
 	static unsigned long  previous_millis_bed_heater;
 #endif //PIDTEMPBED
@@ -117,16 +150,6 @@ static volatile bool temp_meas_ready = false;
   static unsigned long extruder_autofan_last_check;
 #endif  
 
-#if EXTRUDERS > 3
-  # error Unsupported number of extruders
-#elif EXTRUDERS > 2
-  # define ARRAY_BY_EXTRUDERS(v1, v2, v3) { v1, v2, v3 }
-#elif EXTRUDERS > 1
-  # define ARRAY_BY_EXTRUDERS(v1, v2, v3) { v1, v2 }
-#else
-  # define ARRAY_BY_EXTRUDERS(v1, v2, v3) { v1 }
-#endif
-
 // Init min and max temp with extreme values to prevent false errors during startup
 static int minttemp_raw[EXTRUDERS] = ARRAY_BY_EXTRUDERS( HEATER_0_RAW_LO_TEMP , HEATER_1_RAW_LO_TEMP , HEATER_2_RAW_LO_TEMP );
 static int maxttemp_raw[EXTRUDERS] = ARRAY_BY_EXTRUDERS( HEATER_0_RAW_HI_TEMP , HEATER_1_RAW_HI_TEMP , HEATER_2_RAW_HI_TEMP );
@@ -154,6 +177,22 @@ int watch_start_temp[EXTRUDERS] = ARRAY_BY_EXTRUDERS(0,0,0);
 unsigned long watchmillis[EXTRUDERS] = ARRAY_BY_EXTRUDERS(0,0,0);
 #endif //WATCH_TEMP_PERIOD
 
+#ifdef THERMAL_RUNAWAY_PROTECTION_PERIOD
+enum runaway_phase { RUNAWAY_IDLE, RUNAWAY_HEATING, RUNAWAY_STABLE, RUNAWAY_TRIPPED };
+// where a heater is in thermal_runaway_check()
+struct runaway_state
+{
+  unsigned char phase;
+  int target;               // the target the phase is for
+  float mark;               // heating: the temperature to get HYSTERESIS warmer than
+  unsigned long since;      // the last time the heater did what the phase asks for
+};
+static runaway_state hotend_runaway[EXTRUDERS];
+#ifdef THERMAL_RUNAWAY_PROTECTION_BED_PERIOD
+static runaway_state bed_runaway;
+#endif
+#endif //THERMAL_RUNAWAY_PROTECTION_PERIOD
+
 #ifdef HEATER_0_USES_MLX90614
 static float mlx_temp=20.0;
 #include "mlx90614.h"
@@ -167,7 +206,7 @@ static float mlx_temp=20.0;
 //=============================   functions      ============================
 //===========================================================================
 
-void PID_autotune(float temp, int extruder, int ncycles)
+void PID_autotune(float temp, int extruder, int ncycles, bool apply)
 {
   float input = 0.0;
   int cycles=0;
@@ -181,7 +220,7 @@ void PID_autotune(float temp, int extruder, int ncycles)
 
   long bias, d;
   float Ku, Tu;
-  float Kp, Ki, Kd;
+  float Kp = 0, Ki, Kd; // the gains found, ::Kp and the others are only set with apply
   float max = 0, min = 10000;
 
   if ((extruder >= EXTRUDERS)
@@ -312,21 +351,225 @@ void PID_autotune(float temp, int extruder, int ncycles)
     }
     if(cycles > ncycles) {
       SERIAL_PROTOCOLLNPGM("PID Autotune finished! Put the last Kp, Ki and Kd constants from above into Configuration.h");
+      if(apply && Kp > 0) {
+        if(extruder < 0) {
+          #ifdef PIDTEMPBED
+            bedKp = Kp;
+            bedKi = scalePID_i(Ki);
+            bedKd = scalePID_d(Kd);
+          #endif
+        }
+        else {
+          #ifdef PIDTEMP
+            ::Kp[extruder] = Kp;
+            ::Ki[extruder] = scalePID_i(Ki);
+            ::Kd[extruder] = scalePID_d(Kd);
+          #endif
+        }
+        updatePID();
+        SERIAL_PROTOCOLLNPGM("PID settings applied, M500 stores them");
+      }
       return;
     }
     lcd_update();
   }
 }
 
+#ifdef HEATER_MODEL
+//The heating rate is taken over this many seconds, once a second
+#define MODEL_RATE_SPAN 8
+
+//Heats from cold at full power up to temp and fits the heater model to the way it warms up:
+//the rate at full power falls in a straight line with the temperature above ambient,
+//rate = (rise - above) / tau. The dead time is how much later than the line says it got 1C warmer.
+void model_autotune(float temp, int extruder, bool apply)
+{
+  float input = 0.0;
+  float start;
+  float history[MODEL_RATE_SPAN];
+  uint8_t samples = 0, oldest = 0;
+  float n = 0, sx = 0, sy = 0, sxx = 0, sxy = 0;
+  unsigned long t0 = millis();
+  unsigned long sample_millis = t0;
+  unsigned long temp_millis = t0;
+  unsigned long dead_millis = 0;
+
+  if ((extruder >= EXTRUDERS)
+  #ifndef PIDTEMPBED
+       ||(extruder < 0)
+  #endif
+       ){
+          SERIAL_ECHOLN("Model Autotune failed. Bad extruder number.");
+          return;
+        }
+
+  input = start = (extruder<0)?current_temperature_bed:current_temperature[extruder];
+  if(start > HEATER_MODEL_AMBIENT + 10 || temp < start + 40) {
+    SERIAL_ECHOLN("Model Autotune failed. Let the heater cool down, or heat it further.");
+    return;
+  }
+
+  SERIAL_ECHOLN("Model Autotune start");
+
+  disable_heater(); // switch off all heaters.
+
+  if (extruder<0)
+    soft_pwm_bed = (MAX_BED_POWER)>>1;
+  else
+    soft_pwm[extruder] = (PID_MAX)>>1;
+
+  for(;;) {
+    if(temp_meas_ready == true) { // temp sample ready
+      updateTemperaturesFromRawValues();
+      input = (extruder<0)?current_temperature_bed:current_temperature[extruder];
+      if(!dead_millis && input > start + 1)
+        dead_millis = millis();
+    }
+    if(millis() - sample_millis >= 1000) {
+      sample_millis += 1000;
+      if(samples == MODEL_RATE_SPAN) {
+        float then = history[oldest];
+        float x = (input + then) / 2 - HEATER_MODEL_AMBIENT;
+        float y = (input - then) / MODEL_RATE_SPAN;
+        //below that the heat has not got through to the sensor yet
+        if(then > start + (temp - start) / 5) {
+          n++;
+          sx += x; sy += y;
+          sxx += x * x; sxy += x * y;
+        }
+      }
+      else
+        samples++;
+      history[oldest] = input;
+      oldest = (oldest + 1) % MODEL_RATE_SPAN;
+    }
+    if(input >= temp) {
+      disable_heater();
+      break;
+    }
+    if(millis() - temp_millis > 2000) {
+      int p;
+      if (extruder<0){
+        p=soft_pwm_bed;
+        SERIAL_PROTOCOLPGM("ok B:");
+      }else{
+        p=soft_pwm[extruder];
+        SERIAL_PROTOCOLPGM("ok T:");
+      }
+      SERIAL_PROTOCOL(input);
+      SERIAL_PROTOCOLPGM(" @:");
+      SERIAL_PROTOCOLLN(p);
+      temp_millis = millis();
+    }
+    if(millis() - t0 > 20L*60L*1000L) {
+      disable_heater();
+      SERIAL_PROTOCOLLNPGM("Model Autotune failed! timeout");
+      return;
+    }
+    lcd_update();
+  }
+
+  heater_model m;
+  float det = n * sxx - sx * sx;
+  float slope = det > 0 ? (n * sxy - sx * sy) / det : 0;
+  if(n < 10 || slope >= 0) {
+    SERIAL_PROTOCOLLNPGM("Model Autotune failed! Heated up too fast to be measured");
+    return;
+  }
+  m.tau = -1 / slope;
+  m.rise = (sy - slope * sx) / n * m.tau;
+  m.dead_time = (dead_millis - t0) / 1000.0 - m.tau / m.rise;
+  if(m.dead_time < 0) m.dead_time = 0;
+  if(m.rise < temp - HEATER_MODEL_AMBIENT) {
+    SERIAL_PROTOCOLLNPGM("Model Autotune failed! The heater cannot hold that temperature");
+    return;
+  }
+
+  SERIAL_PROTOCOLLNPGM("Model Autotune finished! Put the constants into Configuration.h, or send:");
+  if(extruder < 0)
+    SERIAL_PROTOCOLPGM(" M304");
+  else {
+    SERIAL_PROTOCOLPGM(" M301 E");
+    SERIAL_PROTOCOL(extruder);
+  }
+  SERIAL_PROTOCOLPGM(" K");
+  SERIAL_PROTOCOL(m.rise);
+  SERIAL_PROTOCOLPGM(" T");
+  SERIAL_PROTOCOL(m.tau);
+  SERIAL_PROTOCOLPGM(" L");
+  SERIAL_PROTOCOLLN(m.dead_time);
+  if(apply) {
+    if(extruder < 0) {
+      #ifdef PIDTEMPBED
+        bed_model = m;
+      #endif
+    }
+    else
+      hotend_model[extruder] = m;
+    updatePID();
+    SERIAL_PROTOCOLLNPGM("Model applied, M500 stores it");
+  }
+}
+#endif //HEATER_MODEL
+
+#ifdef HEATER_MODEL
+// The model of a heater with full power max_power as manage_heater() uses it: the rise per unit
+// of power, the dead time in time constants, the power per degree above ambient, and how much of
+// the way to the last power the power in the heater gets per PID_dT. rise_q16 is 0 without a model.
+static void model_coefficients(const heater_model &m, float max_power, model_state &q)
+{
+  bool valid = m.rise > 0 && m.tau > 0;
+  q.rise_q16 = valid ? to_q16(m.rise / max_power) : 0;
+  q.lag_q16 = valid ? to_q16(m.dead_time / m.tau) : 0;
+  q.hold_q16 = valid ? to_q16(max_power / m.rise) : 0;
+  q.follow_q16 = m.dead_time > PID_dT ? to_q16(PID_dT / m.dead_time) : 65536L;
+}
+
+// Where the temperature (Q8) is heading to within the dead time: rate = (rise * power - above ambient) / tau.
+// The power is that of the PID outputs (twice the soft PWM) over the dead time, the heat that
+// is on the way to the sensor, and not the last output alone so that it cannot chase itself.
+static int32_t model_predict(model_state &q, int32_t input_q8, unsigned char pwm)
+{
+  q.power_q8 += mul_q16(q.follow_q16, ((int32_t)pwm << 9) - q.power_q8);
+  int32_t above_q8 = input_q8 - ((int32_t)HEATER_MODEL_AMBIENT << 8);
+  return input_q8 + mul_q16(q.lag_q16, mul_q16(q.rise_q16, q.power_q8) - above_q8);
+}
+
+// The power (Q8) that holds target, the PID only trims it
+static int32_t model_hold(const model_state &q, int target)
+{
+  return target > HEATER_MODEL_AMBIENT ? mul_q16(q.hold_q16, (int32_t)(target - HEATER_MODEL_AMBIENT) << 8) : 0;
+}
+#endif //HEATER_MODEL
+
 void updatePID()
 {
 #ifdef PIDTEMP
   for(int e = 0; e < EXTRUDERS; e++) { 
-     temp_iState_max[e] = PID_INTEGRAL_DRIVE_MAX / Ki;  
+     Kp_q16[e] = to_q16(Kp[e]);
+     Ki_q16[e] = to_q16(Ki[e]);
+     Kd_q16[e] = to_q16(Kd[e]);
+     temp_iState_max[e] = iState_max_q8(Ki[e]);
+     temp_iState_min[e] = 0;
+     #ifdef HEATER_MODEL
+     model_coefficients(hotend_model[e], PID_MAX, hotend_model_q[e]);
+     //the integral corrects the holding power both ways
+     if(hotend_model_q[e].rise_q16)
+       temp_iState_min[e] = -temp_iState_max[e];
+     #endif
   }
 #endif
 #ifdef PIDTEMPBED
-  temp_iState_max_bed = PID_INTEGRAL_DRIVE_MAX / bedKi;  
+  bedKp_q16 = to_q16(bedKp);
+  bedKi_q16 = to_q16(bedKi);
+  bedKd_q16 = to_q16(bedKd);
+  temp_iState_max_bed = iState_max_q8(bedKi);
+  temp_iState_min_bed = 0;
+  #ifdef HEATER_MODEL
+  model_coefficients(bed_model, MAX_BED_POWER, bed_model_q);
+  if(bed_model_q.rise_q16)
+    temp_iState_min_bed = -temp_iState_max_bed;
+  #endif
 #endif
 }
   
@@ -408,10 +651,70 @@ void checkExtruderAutoFans()
 
 #endif // any extruder auto fan pins set
 
+#ifdef THERMAL_RUNAWAY_PROTECTION_PERIOD
+// heater is the extruder, -1 for the bed
+static void thermal_runaway_error(int heater)
+{
+  disable_heater();
+  SERIAL_ERROR_START;
+  SERIAL_ERRORPGM("Thermal runaway on ");
+  if(heater < 0)
+    SERIAL_ERRORPGM("the bed");
+  else {
+    SERIAL_ERRORPGM("extruder ");
+    SERIAL_ERROR(heater);
+  }
+  SERIAL_ERRORLNPGM(", heaters switched off. Printer halted");
+  LCD_ALERTMESSAGEPGM("Err: THERMAL RUNAWAY");
+  #ifndef BOGUS_TEMPERATURE_FAILSAFE_OVERRIDE
+  kill();
+  #endif
+}
+
+// Idle without a target. A new target starts heating, which goes on as long as the
+// heater gets hysteresis warmer every period, and is stable once it is within hysteresis
+// below the target. Stable lasts as long as it does not stay further below for a period.
+static void thermal_runaway_check(runaway_state &r, float temp, int target, unsigned long period, float hysteresis, int heater)
+{
+  unsigned long now = millis();
+  if(target != r.target) {
+    r.target = target;
+    r.phase = target > 0 ? RUNAWAY_HEATING : RUNAWAY_IDLE;
+    r.mark = temp;
+    r.since = now;
+  }
+  switch(r.phase) {
+    case RUNAWAY_HEATING:
+      if(temp >= target - hysteresis) {
+        r.phase = RUNAWAY_STABLE;
+        r.since = now;
+      }
+      else if(temp >= r.mark + hysteresis) {
+        r.mark = temp;
+        r.since = now;
+      }
+      break;
+    case RUNAWAY_STABLE:
+      if(temp >= target - hysteresis)
+        r.since = now;
+      break;
+    default:
+      return;
+  }
+  if(now - r.since > period) {
+    r.phase = RUNAWAY_TRIPPED;
+    thermal_runaway_error(heater);
+  }
+}
+#endif //THERMAL_RUNAWAY_PROTECTION_PERIOD
+
 void manage_heater()
 {
   float pid_input;
-  float pid_output;
+  int pid_output;
+  #if defined(PIDTEMP) || defined(PIDTEMPBED)
+  int32_t pid_input_q8;
+  #endif
 
   if(temp_meas_ready != true)   //better readability
     return; 
@@ -425,31 +728,38 @@ void manage_heater()
     pid_input = current_temperature[e];
 
     #ifndef PID_OPENLOOP
-        pid_error[e] = target_temperature[e] - pid_input;
-        if(pid_error[e] > PID_FUNCTIONAL_RANGE) {
+        pid_input_q8 = (int32_t)(pid_input * 256.0 + 0.5);
+        #ifdef HEATER_MODEL
+        if(hotend_model_q[e].rise_q16)
+          pid_input_q8 = model_predict(hotend_model_q[e], pid_input_q8, soft_pwm[e]);
+        #endif
+        pid_error[e] = ((int32_t)target_temperature[e] << 8) - pid_input_q8;
+        if(pid_error[e] > PID_FUNCTIONAL_RANGE * 256L) {
           pid_output = BANG_MAX;
           pid_reset[e] = true;
         }
-        else if(pid_error[e] < -PID_FUNCTIONAL_RANGE || target_temperature[e] == 0) {
+        else if(pid_error[e] < -PID_FUNCTIONAL_RANGE * 256L || target_temperature[e] == 0) {
           pid_output = 0;
           pid_reset[e] = true;
         }
         else {
           if(pid_reset[e] == true) {
-            temp_iState[e] = 0.0;
+            temp_iState[e] = 0;
             pid_reset[e] = false;
           }
-          pTerm[e] = Kp * pid_error[e];
+          pTerm[e] = mul_q16(Kp_q16[e], pid_error[e]);
           temp_iState[e] += pid_error[e];
           temp_iState[e] = constrain(temp_iState[e], temp_iState_min[e], temp_iState_max[e]);
-          iTerm[e] = Ki * temp_iState[e];
-
-          //K1 defined in Configuration.h in the PID settings
-          #define K2 (1.0-K1)
-          dTerm[e] = (Kd * (pid_input - temp_dState[e]))*K2 + (K1 * dTerm[e]);
-          pid_output = constrain(pTerm[e] + iTerm[e] - dTerm[e], 0, PID_MAX);
+          iTerm[e] = mul_q16(Ki_q16[e], temp_iState[e]);
+
+          //a jump of more than 128 degrees is a sensor glitch, not to overflow on it
+          dTerm[e] = mul_q16(K2_Q16, mul_q16(Kd_q16[e], constrain(pid_input_q8 - temp_dState[e], -32767L, 32767L))) + mul_q16(K1_Q16, dTerm[e]);
+          #ifdef HEATER_MODEL
+          pTerm[e] += model_hold(hotend_model_q[e], target_temperature[e]);
+          #endif
+          pid_output = constrain(pTerm[e] + iTerm[e] - dTerm[e], 0, PID_MAX * 256L) >> 8;
         }
-        temp_dState[e] = pid_input;
+        temp_dState[e] = pid_input_q8;
     #else 
           pid_output = constrain(target_temperature[e], 0, PID_MAX);
     #endif //PID_OPENLOOP
@@ -462,11 +772,11 @@ void manage_heater()
     SERIAL_ECHO(" Output ");
     SERIAL_ECHO(pid_output);
     SERIAL_ECHO(" pTerm ");
-    SERIAL_ECHO(pTerm[e]);
+    SERIAL_ECHO(pTerm[e] / 256.0);
     SERIAL_ECHO(" iTerm ");
-    SERIAL_ECHO(iTerm[e]);
+    SERIAL_ECHO(iTerm[e] / 256.0);
     SERIAL_ECHO(" dTerm ");
-    SERIAL_ECHOLN(dTerm[e]);  
+    SERIAL_ECHOLN(dTerm[e] / 256.0);  
     #endif //PID_DEBUG
   #else /* PID off */
     pid_output = 0;
@@ -478,12 +788,17 @@ void manage_heater()
     // Check if temperature is within the correct range
     if((current_temperature[e] > minttemp[e]) && (current_temperature[e] < maxttemp[e])) 
     {
-      soft_pwm[e] = (int)pid_output >> 1;
+      soft_pwm[e] = pid_output >> 1;
     }
     else {
       soft_pwm[e] = 0;
     }
 
+    #ifdef THERMAL_RUNAWAY_PROTECTION_PERIOD
+    thermal_runaway_check(hotend_runaway[e], current_temperature[e], target_temperature[e],
+                          THERMAL_RUNAWAY_PROTECTION_PERIOD * 1000UL, THERMAL_RUNAWAY_PROTECTION_HYSTERESIS, e);
+    #endif
+
     #ifdef WATCH_TEMP_PERIOD
     if(watchmillis[e] && millis() - watchmillis[e] > WATCH_TEMP_PERIOD)
     {
@@ -534,23 +849,34 @@ void manage_heater()
   #endif
 
   #if TEMP_SENSOR_BED != 0
+
+  #if defined(THERMAL_RUNAWAY_PROTECTION_PERIOD) && defined(THERMAL_RUNAWAY_PROTECTION_BED_PERIOD)
+  thermal_runaway_check(bed_runaway, current_temperature_bed, target_temperature_bed,
+                        THERMAL_RUNAWAY_PROTECTION_BED_PERIOD * 1000UL, THERMAL_RUNAWAY_PROTECTION_BED_HYSTERESIS, -1);
+  #endif
   
   #ifdef PIDTEMPBED
     pid_input = current_temperature_bed;
 
     #ifndef PID_OPENLOOP
-		  pid_error_bed = target_temperature_bed - pid_input;
-		  pTerm_bed = bedKp * pid_error_bed;
+		  pid_input_q8 = (int32_t)(pid_input * 256.0 + 0.5);
+		  #ifdef HEATER_MODEL
+		  if(bed_model_q.rise_q16)
+		    pid_input_q8 = model_predict(bed_model_q, pid_input_q8, soft_pwm_bed);
+		  #endif
+		  pid_error_bed = ((int32_t)target_temperature_bed << 8) - pid_input_q8;
+		  pTerm_bed = mul_q16(bedKp_q16, pid_error_bed);
 		  temp_iState_bed += pid_error_bed;
 		  temp_iState_bed = constrain(temp_iState_bed, temp_iState_min_bed, temp_iState_max_bed);
-		  iTerm_bed = bedKi * temp_iState_bed;
+		  iTerm_bed = mul_q16(bedKi_q16, temp_iState_bed);
 
-		  //K1 defined in Configuration.h in the PID settings
-		  #define K2 (1.0-K1)
-		  dTerm_bed= (bedKd * (pid_input - temp_dState_bed))*K2 + (K1 * dTerm_bed);
-		  temp_dState_bed = pid_input;
+		  dTerm_bed= mul_q16(K2_Q16, mul_q16(bedKd_q16, constrain(pid_input_q8 - temp_dState_bed, -32767L, 32767L))) + mul_q16(K1_Q16, dTerm_bed);
+		  temp_dState_bed = pid_input_q8;
 
-		  pid_output = constrain(pTerm_bed + iTerm_bed - dTerm_bed, 0, MAX_BED_POWER);
+		  #ifdef HEATER_MODEL
+		  pTerm_bed += model_hold(bed_model_q, target_temperature_bed);
+		  #endif
+		  pid_output = constrain(pTerm_bed + iTerm_bed - dTerm_bed, 0, MAX_BED_POWER * 256L) >> 8;
 
     #else 
       pid_output = constrain(target_temperature_bed, 0, MAX_BED_POWER);
@@ -558,7 +884,7 @@ void manage_heater()
 
 	  if((current_temperature_bed > BED_MINTEMP) && (current_temperature_bed < BED_MAXTEMP)) 
 	  {
-	    soft_pwm_bed = (int)pid_output >> 1;
+	    soft_pwm_bed = pid_output >> 1;
 	  }
 	  else {
 	    soft_pwm_bed = 0;
@@ -606,6 +932,27 @@ void manage_heater()
 }
 
 #define PGM_RD_W(x)   (short)pgm_read_word(&x)
+// Interpolates raw in a thermistor table, its raw values rise from entry to entry.
+// A binary search finds the first entry above raw, below the first entry the
+// first two are extrapolated, above the last entry its temperature is returned.
+static float temp_from_table(const short (*tt)[2], uint8_t len, int raw)
+{
+  uint8_t lo = 1, hi = len;
+  while (lo < hi)
+  {
+    uint8_t mid = (lo + hi) >> 1;
+    if (PGM_RD_W(tt[mid][0]) > raw)
+      hi = mid;
+    else
+      lo = mid + 1;
+  }
+  // Overflow: Set to last value in the table
+  if (lo == len)
+    return PGM_RD_W(tt[len-1][1]);
+  short raw0 = PGM_RD_W(tt[lo-1][0]), temp0 = PGM_RD_W(tt[lo-1][1]);
+  return temp0 + (raw - raw0) * (float)(PGM_RD_W(tt[lo][1]) - temp0) / (float)(PGM_RD_W(tt[lo][0]) - raw0);
+}
+
 // Derived from RepRap FiveD extruder::getTemperature()
 // For hot end temperature measurement.
 static float analog2temp(int raw, uint8_t e) {
@@ -634,28 +981,7 @@ static float analog2temp(int raw, uint8_t e) {
   #endif
 
   if(heater_ttbl_map[e] != NULL)
-  {
-    float celsius = 0;
-    uint8_t i;
-    short (*tt)[][2] = (short (*)[][2])(heater_ttbl_map[e]);
-
-    for (i=1; i<heater_ttbllen_map[e]; i++)
-    {
-      if (PGM_RD_W((*tt)[i][0]) > raw)
-      {
-        celsius = PGM_RD_W((*tt)[i-1][1]) + 
-          (raw - PGM_RD_W((*tt)[i-1][0])) * 
-          (float)(PGM_RD_W((*tt)[i][1]) - PGM_RD_W((*tt)[i-1][1])) /
-          (float)(PGM_RD_W((*tt)[i][0]) - PGM_RD_W((*tt)[i-1][0]));
-        break;
-      }
-    }
-
-    // Overflow: Set to last value in the table
-    if (i == heater_ttbllen_map[e]) celsius = PGM_RD_W((*tt)[i-1][1]);
-
-    return celsius;
-  }
+    return temp_from_table((const short (*)[2])heater_ttbl_map[e], heater_ttbllen_map[e], raw);
   return ((raw * ((5.0 * 100.0) / 1024.0) / OVERSAMPLENR) * TEMP_SENSOR_AD595_GAIN) + TEMP_SENSOR_AD595_OFFSET;
 }
 
@@ -663,25 +989,7 @@ static float analog2temp(int raw, uint8_t e) {
 // For bed temperature measurement.
 static float analog2tempBed(int raw) {
   #ifdef BED_USES_THERMISTOR
-    float celsius = 0;
-    byte i;
-
-    for (i=1; i<BEDTEMPTABLE_LEN; i++)
-    {
-      if (PGM_RD_W(BEDTEMPTABLE[i][0]) > raw)
-      {
-        celsius  = PGM_RD_W(BEDTEMPTABLE[i-1][1]) + 
-          (raw - PGM_RD_W(BEDTEMPTABLE[i-1][0])) * 
-          (float)(PGM_RD_W(BEDTEMPTABLE[i][1]) - PGM_RD_W(BEDTEMPTABLE[i-1][1])) /
-          (float)(PGM_RD_W(BEDTEMPTABLE[i][0]) - PGM_RD_W(BEDTEMPTABLE[i-1][0]));
-        break;
-      }
-    }
-
-    // Overflow: Set to last value in the table
-    if (i == BEDTEMPTABLE_LEN) celsius = PGM_RD_W(BEDTEMPTABLE[i-1][1]);
-
-    return celsius;
+    return temp_from_table(BEDTEMPTABLE, BEDTEMPTABLE_LEN, raw);
   #elif defined BED_USES_AD595
     return ((raw * ((5.0 * 100.0) / 1024.0) / OVERSAMPLENR) * TEMP_SENSOR_AD595_GAIN) + TEMP_SENSOR_AD595_OFFSET;
   #else
@@ -721,15 +1029,8 @@ void tp_init()
   for(int e = 0; e < EXTRUDERS; e++) {
     // populate with the first value 
     maxttemp[e] = maxttemp[0];
-#ifdef PIDTEMP
-    temp_iState_min[e] = 0.0;
-    temp_iState_max[e] = PID_INTEGRAL_DRIVE_MAX / Ki;
-#endif //PIDTEMP
-#ifdef PIDTEMPBED
-    temp_iState_min_bed = 0.0;
-    temp_iState_max_bed = PID_INTEGRAL_DRIVE_MAX / bedKi;
-#endif //PIDTEMPBED
   }
+  updatePID();
 
   #if defined(HEATER_0_PIN) && (HEATER_0_PIN > -1) 
     SET_OUTPUT(HEATER_0_PIN);
@@ -50,7 +50,7 @@ extern float current_temperature_bed;
 #endif
 
 #ifdef PIDTEMP
-  extern float Kp,Ki,Kd,Kc;
+  extern float Kp[EXTRUDERS],Ki[EXTRUDERS],Kd[EXTRUDERS],Kc[EXTRUDERS];
   float scalePID_i(float i);
   float scalePID_d(float d);
   float unscalePID_i(float i);
@@ -60,6 +60,20 @@ extern float current_temperature_bed;
 #ifdef PIDTEMPBED
   extern float bedKp,bedKi,bedKd;
 #endif
+
+// First-order thermal model of a heater, see HEATER_MODEL. rise 0 for none.
+struct heater_model
+{
+  float rise;       // degrees above ambient at full power
+  float tau;        // time constant, s
+  float dead_time;  // s
+};
+#ifdef HEATER_MODEL
+  extern heater_model hotend_model[EXTRUDERS];
+  #ifdef PIDTEMPBED
+    extern heater_model bed_model;
+  #endif
+#endif
   
   
 #ifdef BABYSTEPPING
@@ -165,7 +179,10 @@ FORCE_INLINE void autotempShutdown(){
  #endif
 }
 
-void PID_autotune(float temp, int extruder, int ncycles);
+void PID_autotune(float temp, int extruder, int ncycles, bool apply);
+#ifdef HEATER_MODEL
+void model_autotune(float temp, int extruder, bool apply);
+#endif
 
 #endif
 
@@ -45,6 +45,14 @@ char lcd_status_message[LCD_WIDTH+1] = WELCOME_MSG;
 
 void copy_and_scalePID_i();
 void copy_and_scalePID_d();
+#if EXTRUDERS > 1
+void copy_and_scalePID_i_E2();
+void copy_and_scalePID_d_E2();
+#endif
+#if EXTRUDERS > 2
+void copy_and_scalePID_i_E3();
+void copy_and_scalePID_d_E3();
+#endif
 static void lcd_ut_level_plate_a();
 static void lcd_ut_level_plate_m();
 static void lcd_ut_change_right();
@@ -188,7 +196,7 @@ int32_t minEditValue, maxEditValue;
 menuFunc_t callbackFunc;
 
 // place-holders for Ki and Kd edits
-float raw_Ki, raw_Kd;
+float raw_Ki[EXTRUDERS], raw_Kd[EXTRUDERS];
 
 /* Main status screen. It's up to the implementation specific part to show what is needed. As this is very display dependend */
 bool lcd_LockStatusScreen=false;
@@ -959,8 +967,10 @@ static void lcd_control_temperature_menu()
 {
 #ifdef PIDTEMP
     // set up temp variables - undo the default scaling
-    raw_Ki = unscalePID_i(Ki);
-    raw_Kd = unscalePID_d(Kd);
+    for(int e = 0; e < EXTRUDERS; e++) {
+      raw_Ki[e] = unscalePID_i(Ki[e]);
+      raw_Kd[e] = unscalePID_d(Kd[e]);
+    }
 #endif
 
     START_MENU();
@@ -983,13 +993,29 @@ static void lcd_control_temperature_menu()
     MENU_ITEM_EDIT(float32, MSG_FACTOR, &autotemp_factor, 0.0, 1.0);
 #endif
 #ifdef PIDTEMP
-    MENU_ITEM_EDIT(float52, MSG_PID_P, &Kp, 1, 9990);
+    MENU_ITEM_EDIT_CALLBACK(float52, MSG_PID_P, &Kp[0], 1, 9990, updatePID);
     // i is typically a small value so allows values below 1
-    MENU_ITEM_EDIT_CALLBACK(float52, MSG_PID_I, &raw_Ki, 0.01, 9990, copy_and_scalePID_i);
-    MENU_ITEM_EDIT_CALLBACK(float52, MSG_PID_D, &raw_Kd, 1, 9990, copy_and_scalePID_d);
+    MENU_ITEM_EDIT_CALLBACK(float52, MSG_PID_I, &raw_Ki[0], 0.01, 9990, copy_and_scalePID_i);
+    MENU_ITEM_EDIT_CALLBACK(float52, MSG_PID_D, &raw_Kd[0], 1, 9990, copy_and_scalePID_d);
 # ifdef PID_ADD_EXTRUSION_RATE
-    MENU_ITEM_EDIT(float3, MSG_PID_C, &Kc, 1, 9990);
+    MENU_ITEM_EDIT(float3, MSG_PID_C, &Kc[0], 1, 9990);
 # endif//PID_ADD_EXTRUSION_RATE
+# if EXTRUDERS > 1
+    MENU_ITEM_EDIT_CALLBACK(float52, MSG_PID_P " E2", &Kp[1], 1, 9990, updatePID);
+    MENU_ITEM_EDIT_CALLBACK(float52, MSG_PID_I " E2", &raw_Ki[1], 0.01, 9990, copy_and_scalePID_i_E2);
+    MENU_ITEM_EDIT_CALLBACK(float52, MSG_PID_D " E2", &raw_Kd[1], 1, 9990, copy_and_scalePID_d_E2);
+#  ifdef PID_ADD_EXTRUSION_RATE
+    MENU_ITEM_EDIT(float3, MSG_PID_C " E2", &Kc[1], 1, 9990);
+#  endif//PID_ADD_EXTRUSION_RATE
+# endif//EXTRUDERS > 1
+# if EXTRUDERS > 2
+    MENU_ITEM_EDIT_CALLBACK(float52, MSG_PID_P " E3", &Kp[2], 1, 9990, updatePID);
+    MENU_ITEM_EDIT_CALLBACK(float52, MSG_PID_I " E3", &raw_Ki[2], 0.01, 9990, copy_and_scalePID_i_E3);
+    MENU_ITEM_EDIT_CALLBACK(float52, MSG_PID_D " E3", &raw_Kd[2], 1, 9990, copy_and_scalePID_d_E3);
+#  ifdef PID_ADD_EXTRUSION_RATE
+    MENU_ITEM_EDIT(float3, MSG_PID_C " E3", &Kc[2], 1, 9990);
+#  endif//PID_ADD_EXTRUSION_RATE
+# endif//EXTRUDERS > 2
 #endif//PIDTEMP
     MENU_ITEM(submenu, MSG_PREHEAT_PLA_SETTINGS, lcd_control_temperature_preheat_pla_settings_menu);
     //MENU_ITEM(submenu, MSG_PREHEAT_ABS_SETTINGS, lcd_control_temperature_preheat_abs_settings_menu);
@@ -1037,6 +1063,7 @@ static void lcd_control_motion_menu()
     MENU_ITEM_EDIT(float3, MSG_VXY_JERK, &max_xy_jerk, 1, 990);
     MENU_ITEM_EDIT(float52, MSG_VZ_JERK, &max_z_jerk, 0.1, 990);
     MENU_ITEM_EDIT(float3, MSG_VE_JERK, &max_e_jerk, 1, 990);
+    MENU_ITEM_EDIT(float52, MSG_JUNCTION_DEVIATION, &junction_deviation, 0, 2);
     MENU_ITEM_EDIT(float3, MSG_VMAX MSG_X, &max_feedrate[X_AXIS], 1, 250);
     MENU_ITEM_EDIT(float3, MSG_VMAX MSG_Y, &max_feedrate[Y_AXIS], 1, 250);
     MENU_ITEM_EDIT(float3, MSG_VMAX MSG_Z, &max_feedrate[Z_AXIS], 1, 250);
@@ -1707,6 +1734,7 @@ void lcd_ForceStatusScreen( bool s )
   lcd_LockStatusScreen=s;
 }
 #endif//ULTIPANEL
+#endif //ULTRA_LCD
 
 /********************************/
 /** Float conversion utilities **/
@@ -1901,24 +1929,39 @@ char *ftostr52(const float &x)
   return conv;
 }
 
+#ifdef ULTRA_LCD
 // Callback for after editing PID i value
 // grab the PID i value out of the temp variable; scale it; then update the PID driver
-void copy_and_scalePID_i()
+static void copy_and_scalePID_i(int e)
 {
 #ifdef PIDTEMP
-  Ki = scalePID_i(raw_Ki);
+  Ki[e] = scalePID_i(raw_Ki[e]);
   updatePID();
 #endif
 }
+void copy_and_scalePID_i() { copy_and_scalePID_i(0); }
+#if EXTRUDERS > 1
+void copy_and_scalePID_i_E2() { copy_and_scalePID_i(1); }
+#endif
+#if EXTRUDERS > 2
+void copy_and_scalePID_i_E3() { copy_and_scalePID_i(2); }
+#endif
 
 // Callback for after editing PID d value
 // grab the PID d value out of the temp variable; scale it; then update the PID driver
-void copy_and_scalePID_d()
+static void copy_and_scalePID_d(int e)
 {
 #ifdef PIDTEMP
-  Kd = scalePID_d(raw_Kd);
+  Kd[e] = scalePID_d(raw_Kd[e]);
   updatePID();
 #endif
 }
+void copy_and_scalePID_d() { copy_and_scalePID_d(0); }
+#if EXTRUDERS > 1
+void copy_and_scalePID_d_E2() { copy_and_scalePID_d(1); }
+#endif
+#if EXTRUDERS > 2
+void copy_and_scalePID_d_E3() { copy_and_scalePID_d(2); }
+#endif
 
 #endif //ULTRA_LCD
@@ -92,11 +92,13 @@
 #else //no LCD
   FORCE_INLINE void lcd_update() {}
   FORCE_INLINE void lcd_init() {}
-  FORCE_INLINE const char *lcd_getstatus( int *level ) {}
+  FORCE_INLINE const char *lcd_getstatus( int *level ) { *level = 0; return ""; }
   FORCE_INLINE void lcd_setstatus(const char* message) {}
   FORCE_INLINE void lcd_buttons_update() {}
   FORCE_INLINE void lcd_reset_alert_level() {}
   FORCE_INLINE void lcd_buzz(long duration,uint16_t freq) {}
+  FORCE_INLINE bool lcd_clicked() { return false; }
+  FORCE_INLINE void lcd_ForceStatusScreen( bool s ) {}
 
   #define LCD_MESSAGEPGM(x) 
   #define LCD_ALERTMESSAGEPGM(x) 